@@ -0,0 +1,66 @@
+#!/usr/bin/env python
+# Pick the GEMM shapes that get fully unrolled small-GEMM kernels.
+#
+# Reads the gemm_stat<rank> files written when PEXSI is built with
+# GEMM_PROFILE (one "m n z" line per GEMM, z being the inner dimension),
+# counts how often each small shape occurs, and prints
+# small_gemm_shapes.hpp for the most frequent ones.
+#
+# Usage:
+#   python my_tuneSmallGemm.py [-cutoff 32] [-max 16] [-min 100] gemm_stat0 gemm_stat1 ... \
+#       > ../include/pexsi/small_gemm_shapes.hpp
+import sys
+
+def parseArgs(argv):
+    opts = {"-cutoff": 32, "-max": 16, "-min": 100}
+    files = []
+    i = 1
+    while i < len(argv):
+        if argv[i] in opts:
+            opts[argv[i]] = int(argv[i + 1])
+            i += 2
+        else:
+            files.append(argv[i])
+            i += 1
+    return opts, files
+
+def readStat(fileName, cutoff, count):
+    with open(fileName) as f:
+        for line in f:
+            fields = line.split()
+            if len(fields) != 3 or not fields[0].isdigit():
+                continue  # header line
+            m, n, k = [int(x) for x in fields]
+            if m == 0 or n == 0 or k == 0:
+                continue
+            if m > cutoff or n > cutoff or k > cutoff:
+                continue  # handled by the vendor BLAS anyway
+            count[(m, n, k)] = count.get((m, n, k), 0) + 1
+
+def main():
+    opts, files = parseArgs(sys.argv)
+    if len(files) == 0:
+        sys.stderr.write("Usage: python my_tuneSmallGemm.py [-cutoff 32] [-max 16] [-min 100] gemm_stat0 ...\n")
+        sys.exit(1)
+
+    count = {}
+    for fileName in files:
+        readStat(fileName, opts["-cutoff"], count)
+
+    # The small kernels save call overhead, so the number of calls is
+    # what matters, not the flops.
+    shapes = sorted(count.items(), key=lambda x: -x[1])
+    shapes = [s for s in shapes if s[1] >= opts["-min"]][:opts["-max"]]
+
+    total = sum(count.values())
+    print("/// @file small_gemm_shapes.hpp")
+    print("/// @brief (m,n,k) shapes with fully unrolled small-GEMM kernels.")
+    print("///")
+    print("/// Included by smallgemm::Gemm with PEXSI_SMALL_GEMM_SHAPE defined; no")
+    print("/// include guard on purpose.  Generated by examples/my_tuneSmallGemm.py")
+    print("/// from %d files, %d GEMMs below the cutoff %d." % (len(files), total, opts["-cutoff"]))
+    for (m, n, k), c in shapes:
+        print("PEXSI_SMALL_GEMM_SHAPE(%d,%d,%d) // %d calls" % (m, n, k, c))
+
+if __name__ == "__main__":
+    main()
@@ -66,7 +66,7 @@ void destoryHandle(cublasHandle_t& handle);
 void initializeHandle(cublasHandle_t& handle);
 
 void Usage(){
-  std::cout << "Usage" << std::endl << "run_pselinv -T [isText] -F [doFacto -E [doTriSolve] -Sinv [doSelInv]]  -H <Hfile> -S [Sfile] -colperm [colperm] -r [nprow] -c [npcol] -npsymbfact [npsymbfact] -P [maxpipelinedepth] -SinvBcast [doSelInvBcast] -SinvPipeline [doSelInvPipeline] -SinvHybrid [doSelInvHybrid] -rshift [real shift] -ishift [imaginary shift] -ToDist [doToDist] -Diag [doDiag] -SS [symmetricStorage]" << std::endl;
+  std::cout << "Usage" << std::endl << "run_pselinv -T [isText] -F [doFacto -E [doTriSolve] -Sinv [doSelInv]]  -H <Hfile> -S [Sfile] -colperm [colperm] -r [nprow] -c [npcol] -npsymbfact [npsymbfact] -P [maxpipelinedepth] -SinvBcast [doSelInvBcast] -SinvPipeline [doSelInvPipeline] -SinvHybrid [doSelInvHybrid] -rshift [real shift] -ishift [imaginary shift] -ToDist [doToDist] -Diag [doDiag] -SS [symmetricStorage] -GB [gemmBackend] -CG [complexGemmMode] -DI [diagInverseGemm] -LA [diagBcastLookAhead] -NT [numThreads] -TP [taskParallelSelInv] -BP [bcastPrefetchSteps] -CP [criticalPathOrder] -MB [pipelineMemoryBudget] -EC [numEpochComm] -AP [asyncProgress] -UC [uChunkSize] -LB [loadBalancedMapping] -RC [numReplica] -NA [nodeAwareTree] -GP [gridPlacement] -GW [placementColWeight] -FV [freeLUValues]" << std::endl;
 }
 
 static void _split(const std::string &s, char delim, 
@@ -95,7 +95,13 @@ int main(int argc, char **argv)
   TAU_PROFILE_INIT(argc, argv);
 #endif
 
+#ifdef _OMP_ENABLED_
+  // Only the master thread calls MPI.
+  int provided;
+  MPI_Init_thread( &argc, &argv, MPI_THREAD_FUNNELED, &provided );
+#else
   MPI_Init( &argc, &argv );
+#endif
   
 
   int mpirank, mpisize;
@@ -147,15 +153,31 @@ int main(int argc, char **argv)
       fileName = "quant_report";
     }
     
-    // Default processor number
+    // Number of copies of the grid for the 2.5D selected inversion.
+    Int numReplica = 1;
+    if( options.find("-RC") != options.end() ){ 
+      numReplica = atoi(options["-RC"].c_str());
+      if( numReplica < 1 || mpisize % numReplica != 0 ){
+        ErrorHandling( "The number of processors must be divisible by -RC." );
+      }
+    }
+
+    // Default processor number: the most square nprow x npcol grid with
+    // all the processors of a copy, nprow <= npcol.
     Int nprow = 1;
-    Int npcol = mpisize;
+    Int npcol = mpisize / numReplica;
+    for( Int r = 1; r * r <= mpisize / numReplica; r++ ){
+      if( ( mpisize / numReplica ) % r == 0 ){
+        nprow = r;
+        npcol = mpisize / numReplica / r;
+      }
+    }
     //选择processor的row和col
     if( options.find("-r") != options.end() ){
       if( options.find("-c") != options.end() ){
         nprow= atoi(options["-r"].c_str());
         npcol= atoi(options["-c"].c_str());
-        if(nprow*npcol > mpisize){
+        if(nprow*npcol*numReplica > mpisize){
           ErrorHandling("The number of used processors cannot be higher than the total number of available processors." );
         } 
       }
@@ -167,7 +189,7 @@ int main(int argc, char **argv)
       if( options.find("-r") != options.end() ){
         nprow= atoi(options["-r"].c_str());
         npcol= atoi(options["-c"].c_str());
-        if(nprow*npcol > mpisize){
+        if(nprow*npcol*numReplica > mpisize){
           ErrorHandling("The number of used processors cannot be higher than the total number of available processors." );
         } 
       }
@@ -178,9 +200,9 @@ int main(int argc, char **argv)
     //将原来的processor分为两部分——在范围内的和在范围外的
     //用world_comm代替原来的communicator
     //Create a communicator with npcol*nprow processors
-    MPI_Comm_split(MPI_COMM_WORLD, mpirank<nprow*npcol, mpirank, &world_comm);
+    MPI_Comm_split(MPI_COMM_WORLD, mpirank<nprow*npcol*numReplica, mpirank, &world_comm);
 
-    if (mpirank<nprow*npcol){
+    if (mpirank<nprow*npcol*numReplica){
 
       MPI_Comm_rank(world_comm, &mpirank );
       MPI_Comm_size(world_comm, &mpisize );
@@ -192,6 +214,13 @@ int main(int argc, char **argv)
       ss << "logTest" << mpirank;
       statusOFS.open( ss.str().c_str() );
 
+#ifdef GEMM_PROFILE
+      //GEMM的形状记录，用examples/my_tuneSmallGemm.py生成small_gemm_shapes.hpp
+      stringstream  ss2;
+      ss2 << "gemm_stat" << mpirank;
+      statOFS.open( ss2.str().c_str());
+#endif
+
       ///#if defined(COMM_PROFILE) || defined(COMM_PROFILE_BCAST)
       ///      stringstream  ss3;
       ///      ss3 << "comm_stat" << mpirank;
@@ -204,7 +233,46 @@ int main(int argc, char **argv)
       //}
 
       if( mpirank == 0 )
-        cout << "nprow = " << nprow << ", npcol = " << npcol << endl;
+        cout << "nprow = " << nprow << ", npcol = " << npcol << ", numReplica = " << numReplica << endl;
+
+      Int gridPlacement = 0;
+      if( options.find("-GP") != options.end() ){ 
+        gridPlacement = atoi(options["-GP"].c_str());
+      }
+      else{
+        statusOFS << "-GP option is not given. " 
+          << "Place the processors row major on the grid." 
+          << std::endl << std::endl;
+      }
+
+      // Ratio of the column to the row traffic for the tiles of -GP 2,
+      // printed after ConstructCommunicationPattern.
+      Real placementColWeight = 1.0;
+      if( options.find("-GW") != options.end() ){ 
+        placementColWeight = atof(options["-GW"].c_str());
+      }
+
+      // 2.5D: each copy of the grid reads and factorizes the matrix on
+      // its own communicator, replica_comm links the processors at the
+      // same grid position in the copies.  The copy communicator is
+      // renumbered in the order of -GP, so that the SuperLU grid and
+      // the GridType built on it agree.
+      MPI_Comm replica_comm = MPI_COMM_NULL;
+      if( numReplica > 1 || gridPlacement != 0 ){
+        MPI_Comm copy_comm, placed_comm;
+        MPI_Comm_split( world_comm, mpirank / (nprow*npcol), mpirank, &copy_comm );
+        Int gridRank = GridPlacementRank( copy_comm, nprow, npcol, gridPlacement,
+            placementColWeight );
+        if( numReplica > 1 ){
+          MPI_Comm_split( world_comm, gridRank, mpirank, &replica_comm );
+        }
+        MPI_Comm_split( copy_comm, 0, gridRank, &placed_comm );
+        MPI_Comm_free( &copy_comm );
+        MPI_Comm_free( &world_comm );
+        world_comm = placed_comm;
+        MPI_Comm_rank(world_comm, &mpirank );
+        MPI_Comm_size(world_comm, &mpisize );
+      }
 
       std::string Hfile, Sfile;
       int isCSC = true;
@@ -346,6 +414,162 @@ int main(int argc, char **argv)
           << std::endl << std::endl;
       }
 
+      Int gemmBackend = 0;
+      if( options.find("-GB") != options.end() ){ 
+        gemmBackend = atoi(options["-GB"].c_str());
+      }
+      else{
+        statusOFS << "-GB option is not given. " 
+          << "Use cuBLAS for the SelInv GEMM." 
+          << std::endl << std::endl;
+      }
+
+      Int complexGemmMode = 0;
+      if( options.find("-CG") != options.end() ){ 
+        complexGemmMode = atoi(options["-CG"].c_str());
+      }
+      else{
+        statusOFS << "-CG option is not given. " 
+          << "Use the standard complex GEMM." 
+          << std::endl << std::endl;
+      }
+
+      Int diagInverseGemm = 0;
+      if( options.find("-DI") != options.end() ){ 
+        diagInverseGemm = atoi(options["-DI"].c_str());
+      }
+      else{
+        statusOFS << "-DI option is not given. " 
+          << "Use TRSM in PreSelInv." 
+          << std::endl << std::endl;
+      }
+
+      Int diagBcastLookAhead = 4;
+      if( options.find("-LA") != options.end() ){ 
+        diagBcastLookAhead = atoi(options["-LA"].c_str());
+      }
+      else{
+        statusOFS << "-LA option is not given. " 
+          << "Post the broadcasts of L(k,k) 4 supernodes ahead in PreSelInv." 
+          << std::endl << std::endl;
+      }
+
+      Int numThreads = 0;
+      if( options.find("-NT") != options.end() ){ 
+        numThreads = atoi(options["-NT"].c_str());
+      }
+      else{
+        statusOFS << "-NT option is not given. " 
+          << "Use OMP_NUM_THREADS threads." 
+          << std::endl << std::endl;
+      }
+
+      Int taskParallelSelInv = 0;
+      if( options.find("-TP") != options.end() ){ 
+        taskParallelSelInv = atoi(options["-TP"].c_str());
+      }
+      else{
+        statusOFS << "-TP option is not given. " 
+          << "Process one supernode at a time in SelInv." 
+          << std::endl << std::endl;
+      }
+
+      Int bcastPrefetchSteps = 1;
+      if( options.find("-BP") != options.end() ){ 
+        bcastPrefetchSteps = atoi(options["-BP"].c_str());
+      }
+      else{
+        statusOFS << "-BP option is not given. " 
+          << "Prefetch the broadcasts of the next SelInv step." 
+          << std::endl << std::endl;
+      }
+
+      Int criticalPathOrder = 1;
+      if( options.find("-CP") != options.end() ){ 
+        criticalPathOrder = atoi(options["-CP"].c_str());
+      }
+      else{
+        statusOFS << "-CP option is not given. " 
+          << "Order the supernodes by critical path priority." 
+          << std::endl << std::endl;
+      }
+
+      Int pipelineMemoryBudget = 0;
+      if( options.find("-MB") != options.end() ){ 
+        pipelineMemoryBudget = atoi(options["-MB"].c_str());
+      }
+      else{
+        statusOFS << "-MB option is not given. " 
+          << "Do not limit the memory of the SelInv steps." 
+          << std::endl << std::endl;
+      }
+
+      Int numEpochComm = 2;
+      if( options.find("-EC") != options.end() ){ 
+        numEpochComm = atoi(options["-EC"].c_str());
+      }
+      else{
+        statusOFS << "-EC option is not given. " 
+          << "Rotate 2 communicator sets over the SelInv tag epochs." 
+          << std::endl << std::endl;
+      }
+
+      Int asyncProgress = 1;
+      if( options.find("-AP") != options.end() ){ 
+        asyncProgress = atoi(options["-AP"].c_str());
+      }
+      else{
+        statusOFS << "-AP option is not given. " 
+          << "Progress the SelInv trees between the GEMM panels." 
+          << std::endl << std::endl;
+      }
+      if( symmetricStorage == 1 && asyncProgress != 0 ){
+        statusOFS << "The trees of the symmetric storage are not progressed "
+          << "between the GEMM panels, -AP is set to 0." 
+          << std::endl << std::endl;
+        asyncProgress = 0;
+      }
+
+      Int uChunkSize = 0;
+      if( options.find("-UC") != options.end() ){ 
+        uChunkSize = atoi(options["-UC"].c_str());
+      }
+      else{
+        statusOFS << "-UC option is not given. " 
+          << "Broadcast the U rows in a single message." 
+          << std::endl << std::endl;
+      }
+
+      Int loadBalancedMapping = 0;
+      if( options.find("-LB") != options.end() ){ 
+        loadBalancedMapping = atoi(options["-LB"].c_str());
+      }
+      else{
+        statusOFS << "-LB option is not given. " 
+          << "Map the supernodes 2D block cyclic." 
+          << std::endl << std::endl;
+      }
+
+      Int nodeAwareTree = 0;
+      if( options.find("-NA") != options.end() ){ 
+        nodeAwareTree = atoi(options["-NA"].c_str());
+      }
+      else{
+        statusOFS << "-NA option is not given. " 
+          << "Build the trees over the processors." 
+          << std::endl << std::endl;
+      }
+
+      Int freeLUValues = 0;
+      if( options.find("-FV") != options.end() ){ 
+        freeLUValues = atoi(options["-FV"].c_str());
+      }
+      else{
+        statusOFS << "-FV option is not given. " 
+          << "Keep the values of the factors in SuperLU after the conversion." 
+          << std::endl << std::endl;
+      }
+
 
 
 
@@ -511,6 +735,7 @@ int main(int argc, char **argv)
       SuperLUOptions luOpt;//保存了SuperLU的一些选项
       luOpt.ColPerm = ColPerm;
       luOpt.numProcSymbFact = numProcSymbFact;
+      luOpt.freeLUValues = freeLUValues;
 
 
       SuperLUMatrix<MYSCALAR> luMat(g, luOpt );//保存了这个SuperLU的信息和processor分布的信息，放在ptrData中
@@ -613,8 +838,9 @@ int main(int argc, char **argv)
 
           GetTime( timeTotalSelInvSta );
 
-          g1Ptr = new GridType( world_comm, nprow, npcol );
+          g1Ptr = new GridType( world_comm, nprow, npcol, replica_comm );
           GridType &g1 = *g1Ptr;
+          statusOFS << "The grid spans " << g1.numNode << " nodes." << std::endl;
 
           superPtr = new SuperNodeType();
           SuperNodeType & super = *superPtr;//保存supernode信息
@@ -625,6 +851,21 @@ int main(int argc, char **argv)
           PSelInvOptions selInvOpt;//一些PSelInv的选项
           selInvOpt.maxPipelineDepth = maxPipelineDepth;
           selInvOpt.symmetricStorage = symmetricStorage;
+          selInvOpt.gemmBackend = gemmBackend;
+          selInvOpt.complexGemmMode = complexGemmMode;
+          selInvOpt.diagInverseGemm = diagInverseGemm;
+          selInvOpt.diagBcastLookAhead = diagBcastLookAhead;
+          selInvOpt.numThreads = numThreads;
+          selInvOpt.taskParallelSelInv = taskParallelSelInv;
+          selInvOpt.bcastPrefetchSteps = bcastPrefetchSteps;
+          selInvOpt.criticalPathOrder = criticalPathOrder;
+          selInvOpt.pipelineMemoryBudget = pipelineMemoryBudget;
+          selInvOpt.numEpochComm = numEpochComm;
+          selInvOpt.asyncProgress = asyncProgress;
+          selInvOpt.uChunkSize = uChunkSize;
+          selInvOpt.loadBalancedMapping = loadBalancedMapping;
+          selInvOpt.numReplica = numReplica;
+          selInvOpt.nodeAwareTree = nodeAwareTree;
 
           FactorizationOptions factOpt;//一些进行分解的选项
           factOpt.ColPerm = ColPerm;
@@ -634,6 +875,14 @@ int main(int argc, char **argv)
 
           if(doConvert){
             luMat.LUstructToPMatrix( PMloc );//将LU分解的结果转到PMloc中
+            // g1 is owned here: the load balanced map is set on it once,
+            // then the blocks are moved to it.
+            if( loadBalancedMapping == 1 && g1.snodeSlot.empty() ){
+              std::vector<Int> slot;
+              PMloc.ComputeSuperNodeMap( slot );
+              g1.SetSuperNodeMap( slot );
+              PMloc.RedistributeSuperNodes();
+            }
             GetTime( timeEnd );
           }
           LongInt nnzLU = PMloc.Nnz();
@@ -664,6 +913,15 @@ int main(int argc, char **argv)
             if( mpirank == 0 )
               cout << "Time for constructing the communication pattern is " << timeEnd  - timeSta << endl;
 
+            {
+              // 预测的行/列通信量, 其比值可以作为下次运行的-GW.
+              Real rowVolume, colVolume;
+              PMloc.CommunicationVolume( rowVolume, colVolume );
+              if( mpirank == 0 )
+                cout << "Predicted row / column volume is " << rowVolume << " / " << colVolume 
+                  << " (-GW " << ( rowVolume > 0 ? colVolume / rowVolume : 1.0 ) << ")" << endl;
+            }
+
             double timeTotalOffsetSta = 0;
             GetTime( timeTotalOffsetSta );
 
@@ -792,6 +1050,15 @@ int main(int argc, char **argv)
 
             if( mpirank == 0 )
               cout << "Time for constructing the communication pattern is " << timeEnd  - timeSta << endl;
+
+            {
+              // 预测的行/列通信量, 其比值可以作为下次运行的-GW.
+              Real rowVolume, colVolume;
+              PMloc.CommunicationVolume( rowVolume, colVolume );
+              if( mpirank == 0 )
+                cout << "Predicted row / column volume is " << rowVolume << " / " << colVolume 
+                  << " (-GW " << ( rowVolume > 0 ? colVolume / rowVolume : 1.0 ) << ")" << endl;
+            }
             MPI_Barrier(world_comm);
             GetTime( timeSta );
          //  if(mpirank == 0)
@@ -933,6 +1200,9 @@ int main(int argc, char **argv)
           delete PMlocPtr;
           delete superPtr;
           delete g1Ptr;
+          if( replica_comm != MPI_COMM_NULL ){
+            MPI_Comm_free( &replica_comm );
+          }
 
         }
 
@@ -944,6 +1214,10 @@ int main(int argc, char **argv)
       //#endif
 
 
+#ifdef GEMM_PROFILE
+      statOFS.close();
+#endif
+
       statusOFS.close();
     }
   }
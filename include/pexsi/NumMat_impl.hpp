@@ -248,6 +248,59 @@ Symmetrize( NumMat<F>& A )
 }		// -----  end of function Symmetrize ----- 
 
 
+/// @brief Packs the lower triangle of the square matrix A, column by
+/// column, into the first m(m+1)/2 entries of its own storage.
+///
+/// The layout is the LAPACK packed storage with uplo = 'L'.  A keeps its
+/// dimensions; only the layout of the data changes.
+template <class F> inline void
+PackLower( NumMat<F>& A )
+{
+  if( A.m() != A.n() ){
+    ErrorHandling( "The matrix to be packed should be a square matrix." );
+  }
+
+  // The packed position of (i,j) never exceeds its full position, so
+  // the forward sweep does not overwrite entries still to be read.
+  F* Adata = A.Data();
+  Int m = A.m();
+  Int pos = 0;
+  for( Int j = 0; j < m; j++ ){
+    for( Int i = j; i < m; i++ ){
+      Adata[pos++] = Adata[i + j*m];
+    }
+  }
+
+  return ;
+}		// -----  end of function PackLower ----- 
+
+/// @brief Inverse of PackLower.  The upper triangle is filled by
+/// symmetry.
+template <class F> inline void
+UnpackLower( NumMat<F>& A )
+{
+  if( A.m() != A.n() ){
+    ErrorHandling( "The matrix to be unpacked should be a square matrix." );
+  }
+
+  F* Adata = A.Data();
+  Int m = A.m();
+  Int pos = m * (m+1) / 2;
+  for( Int j = m-1; j >= 0; j-- ){
+    for( Int i = m-1; i >= j; i-- ){
+      Adata[i + j*m] = Adata[--pos];
+    }
+  }
+  for( Int j = 0; j < m; j++ ){
+    for( Int i = 0; i < j; i++ ){
+      Adata[i + j*m] = Adata[j + i*m];
+    }
+  }
+
+  return ;
+}		// -----  end of function UnpackLower ----- 
+
+
 } // namespace PEXSI
 
 #endif // _PEXSI_NUMMAT_IMPL_HPP_
@@ -193,6 +193,10 @@ public:
   } 
   /// @brief LUstructToPMatrix converts the data in LUstruct to PMatrix.
   ///
+  /// The first call builds the blocks of PMloc.  Later calls with the
+  /// same PMloc, e.g. for the next pole, only copy the new numerical
+  /// values into the existing blocks.
+  ///
   /// @paramp[out] PMloc
   void LUstructToPMatrix( PMatrix<T>& PMloc ){ }
 
@@ -324,6 +328,10 @@ public:
 
   /// @brief LUstructToPMatrix converts the data in LUstruct to PMatrix.
   ///
+  /// The first call builds the blocks of PMloc.  Later calls with the
+  /// same PMloc, e.g. for the next pole, only copy the new numerical
+  /// values into the existing blocks.
+  ///
   /// @paramp[out] PMloc
   void LUstructToPMatrix( PMatrix<Real>& PMloc );
 
@@ -457,6 +465,10 @@ public:
 
   /// @brief LUstructToPMatrix converts the data in LUstruct to PMatrix.
   ///
+  /// The first call builds the blocks of PMloc.  Later calls with the
+  /// same PMloc, e.g. for the next pole, only copy the new numerical
+  /// values into the existing blocks.
+  ///
   /// @paramp[out] PMloc
   void LUstructToPMatrix( PMatrix<Complex>& PMloc );
 
@@ -23,6 +23,91 @@ namespace PEXSI{
 
 extern std::map< MPI_Comm , std::vector<int> > commGlobRanks;
 
+// 二叉树的划分方式和BTreeBcast2相同, me必须在list中.
+inline void BinaryTreeLinks(const std::vector<Int> & list, Int me, Int & parent, std::vector<Int> & children){
+  Int idxStart = 0;
+  Int idxEnd = list.size();
+  Int prevRoot = list[0];
+  while(idxStart<idxEnd){
+    Int curRoot = list[idxStart];
+    Int listSize = idxEnd - idxStart;
+    Int halfList = (listSize + 1) / 2;
+    Int idxStartL = idxStart+1;
+    Int idxStartH = idxStart+halfList;
+    if(curRoot == me){
+      parent = prevRoot;
+      if(listSize>1){
+        if(idxStartH > idxStartL){ children.push_back(list[idxStartL]); }
+        if(idxEnd > idxStartH){ children.push_back(list[idxStartH]); }
+      }
+      return;
+    }
+    if(std::find(&list[idxStartL], &list[0]+idxStartH, me) != &list[0]+idxStartH){
+      idxStart = idxStartL;
+      idxEnd = idxStartH;
+    }
+    else{
+      idxStart = idxStartH;
+    }
+    prevRoot = curRoot;
+  }
+}
+
+/// @brief BuildNodeTree computes the parent (myRoot) and the children
+/// (myDests) of myRank in a two-level tree over ranks, rooted at
+/// ranks[0].
+///
+/// The ranks are grouped by rankNode.  One leader per node (the root
+/// on its own node, a member picked with seed elsewhere) takes part
+/// in a binary tree over the nodes, and forwards inside its node
+/// along a binary tree over the node members.  A message thus
+/// crosses the network once per node, the rest goes through the
+/// shared memory transport of MPI.  seed is a nonnegative integer,
+/// e.g. the supernode index.
+inline void BuildNodeTree(const Int * ranks, Int rank_cnt, const std::vector<Int> & rankNode,
+    Int seed, Int myRank, Int & myRoot, std::vector<Int> & myDests){
+  // Group the ranks by node, in the order the nodes first appear.
+  std::vector<Int> nodes;
+  std::map<Int, std::vector<Int> > members;
+  for(Int i = 0; i<rank_cnt; i++){
+    Int node = rankNode[ranks[i]];
+    std::vector<Int> & mem = members[node];
+    if(mem.empty()){ nodes.push_back(node); }
+    mem.push_back(ranks[i]);
+  }
+
+  // The leader is the first member.  It is the root on the root
+  // node, and is rotated with seed elsewhere so that different
+  // trees forward through different processors.
+  std::vector<Int> leaders(nodes.size());
+  for(Int k = 0; k<(Int)nodes.size(); k++){
+    std::vector<Int> & mem = members[nodes[k]];
+    if(k>0){
+      std::swap(mem[0], mem[seed % (Int)mem.size()]);
+    }
+    leaders[k] = mem[0];
+  }
+
+  myDests.clear();
+  std::map<Int, std::vector<Int> >::iterator it = members.find(rankNode[myRank]);
+  if(it == members.end() ||
+      std::find(it->second.begin(), it->second.end(), myRank) == it->second.end()){
+    return;
+  }
+  const std::vector<Int> & mem = it->second;
+
+  // Inter-node children first: they are on the critical path.
+  Int intraRoot = myRank;
+  if(mem[0] == myRank){
+    BinaryTreeLinks(leaders, myRank, myRoot, myDests);
+  }
+  BinaryTreeLinks(mem, myRank, intraRoot, myDests);
+  if(mem[0] != myRank){
+    myRoot = intraRoot;
+  }
+}
+
+
 #ifdef NEW_BCAST
 
 template< typename T>
@@ -809,7 +894,11 @@ public:
 
 
 
-  static TreeBcast * Create(const MPI_Comm & pComm, Int * ranks, Int rank_cnt, Int msgSize,double rseed);
+  /// @brief With rankNode (node of each rank of pComm, see
+  /// GridType::rowRankNode) a node-aware tree is returned when the
+  /// ranks span more than one node.
+  static TreeBcast * Create(const MPI_Comm & pComm, Int * ranks, Int rank_cnt, Int msgSize,double rseed,
+      const std::vector<Int> * rankNode = NULL);
 
   virtual inline Int GetNumRecvMsg(){return numRecv_;}
   virtual inline Int GetNumMsgToRecv(){return 1;}
@@ -824,6 +913,17 @@ public:
   Int GetRoot(){ return myRoot_;}
   Int GetMsgSize(){ return msgSize_;}
 
+  /// @brief Communicate on comm from now on.  comm must be a duplicate
+  /// of the communicator the tree was built on.
+  void SetComm(const MPI_Comm & comm){
+#if defined(COMM_PROFILE_BCAST) || defined(COMM_PROFILE)
+    if(commGlobRanks.count(comm_)>0 && commGlobRanks.count(comm)==0){
+      commGlobRanks[comm] = commGlobRanks[comm_];
+    }
+#endif
+    comm_ = comm;
+  }
+
   void ForwardMessage( char * data, size_t size, int tag, MPI_Request * requests ){
     tag_ = tag;
     for( Int idxRecv = 0; idxRecv < myDests_.size(); ++idxRecv ){
@@ -1271,6 +1371,38 @@ public:
 
 };
 
+/// @brief Two-level broadcast tree over the nodes, see BuildNodeTree.
+/// rankNode gives the node of each rank of pComm.
+class NodeTreeBcast: public TreeBcast{
+protected:
+  Int seed_;
+  const std::vector<Int> * rankNode_;
+
+  virtual void buildTree(Int * ranks, Int rank_cnt){
+    BuildNodeTree(ranks, rank_cnt, *rankNode_, seed_, myRank_, myRoot_, myDests_);
+
+#if (defined(BCAST_VERBOSE))
+    statusOFS<<"My root is "<<myRoot_<<std::endl;
+    statusOFS<<"My dests are ";
+    for(int i =0;i<myDests_.size();++i){statusOFS<<myDests_[i]<<" ";}
+    statusOFS<<std::endl;
+#endif
+  }
+
+public:
+  NodeTreeBcast(const MPI_Comm & pComm, Int * ranks, Int rank_cnt, Int msgSize, Int seed,
+      const std::vector<Int> * rankNode):TreeBcast(pComm,ranks,rank_cnt,msgSize){
+    seed_ = seed;
+    rankNode_ = rankNode;
+    buildTree(ranks,rank_cnt);
+  }
+
+  virtual NodeTreeBcast * clone() const{
+    NodeTreeBcast * out = new NodeTreeBcast(*this);
+    return out;
+  }
+};
+
 
 template< typename T>
 class TreeReduce: public TreeBcast{
@@ -1343,7 +1475,8 @@ public:
   }
 
 
-  static TreeReduce<T> * Create(const MPI_Comm & pComm, Int * ranks, Int rank_cnt, Int msgSize,double rseed);
+  static TreeReduce<T> * Create(const MPI_Comm & pComm, Int * ranks, Int rank_cnt, Int msgSize,double rseed,
+      const std::vector<Int> * rankNode = NULL);
 
   virtual inline Int GetNumMsgToRecv(){return GetDestCount();}
 
@@ -2101,12 +2234,57 @@ public:
 };
 
 
+/// @brief Two-level reduction tree over the nodes, see BuildNodeTree.
+template< typename T>
+class NodeTreeReduce: public TreeReduce<T>{
+protected:
+  Int seed_;
+  const std::vector<Int> * rankNode_;
+
+  virtual void buildTree(Int * ranks, Int rank_cnt){
+    BuildNodeTree(ranks, rank_cnt, *rankNode_, seed_, this->myRank_, this->myRoot_, this->myDests_);
+
+#if (defined(REDUCE_VERBOSE))
+    statusOFS<<"My root is "<<this->myRoot_<<std::endl;
+    statusOFS<<"My dests are ";
+    for(int i =0;i<this->myDests_.size();++i){statusOFS<<this->myDests_[i]<<" ";}
+    statusOFS<<std::endl;
+#endif
+  }
 
-inline TreeBcast * TreeBcast::Create(const MPI_Comm & pComm, Int * ranks, Int rank_cnt, Int msgSize, double rseed){
+public:
+  NodeTreeReduce(const MPI_Comm & pComm, Int * ranks, Int rank_cnt, Int msgSize, Int seed,
+      const std::vector<Int> * rankNode):TreeReduce<T>(pComm,ranks,rank_cnt,msgSize){
+    seed_ = seed;
+    rankNode_ = rankNode;
+    buildTree(ranks,rank_cnt);
+  }
+
+  virtual NodeTreeReduce * clone() const{
+    NodeTreeReduce * out = new NodeTreeReduce(*this);
+    return out;
+  }
+};
+
+
+
+inline TreeBcast * TreeBcast::Create(const MPI_Comm & pComm, Int * ranks, Int rank_cnt, Int msgSize, double rseed,
+    const std::vector<Int> * rankNode){
   //get communicator size
   int nprocs = 0;
   MPI_Comm_size(pComm, &nprocs);
 
+  if(rankNode!=NULL && rank_cnt>1){
+    Int rootNode = (*rankNode)[ranks[0]];
+    for(Int i = 1; i<rank_cnt; i++){
+      if((*rankNode)[ranks[i]] != rootNode){
+#if ( _DEBUGlevel_ >= 1 ) || defined(REDUCE_VERBOSE)
+        statusOFS<<"NODE TREE USED"<<std::endl;
+#endif
+        return new NodeTreeBcast(pComm,ranks,rank_cnt,msgSize,(Int)rseed,rankNode);
+      }
+    }
+  }
 
 #if defined(FTREE)
   return new FTreeBcast(pComm,ranks,rank_cnt,msgSize);
@@ -2139,11 +2317,24 @@ inline TreeBcast * TreeBcast::Create(const MPI_Comm & pComm, Int * ranks, Int ra
 
 
 template< typename T>
-inline TreeReduce<T> * TreeReduce<T>::Create(const MPI_Comm & pComm, Int * ranks, Int rank_cnt, Int msgSize, double rseed){
+inline TreeReduce<T> * TreeReduce<T>::Create(const MPI_Comm & pComm, Int * ranks, Int rank_cnt, Int msgSize, double rseed,
+    const std::vector<Int> * rankNode){
   //get communicator size
   int nprocs = 0;
   MPI_Comm_size(pComm, &nprocs);
 
+  if(rankNode!=NULL && rank_cnt>1){
+    Int rootNode = (*rankNode)[ranks[0]];
+    for(Int i = 1; i<rank_cnt; i++){
+      if((*rankNode)[ranks[i]] != rootNode){
+#if ( _DEBUGlevel_ >= 1 ) || defined(REDUCE_VERBOSE)
+        statusOFS<<"NODE TREE USED"<<std::endl;
+#endif
+        return new NodeTreeReduce<T>(pComm,ranks,rank_cnt,msgSize,(Int)rseed,rankNode);
+      }
+    }
+  }
+
 #if defined(FTREE)
   return new FTreeReduce<T>(pComm,ranks,rank_cnt,msgSize);
 #elif defined(MODBTREE)
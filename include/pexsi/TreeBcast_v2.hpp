@@ -3,6 +3,7 @@
 
 #include "pexsi/environment.hpp"
 #include "pexsi/timer.h"
+#include "pexsi/TreeBcast.hpp"
 
 #include <vector>
 #include <list>
@@ -74,7 +75,11 @@ namespace PEXSI{
 
 
       public:
-        static TreeBcast_v2<T> * Create(const MPI_Comm & pComm, Int * ranks, Int rank_cnt, Int msgSize,double rseed);
+        /// @brief With rankNode (node of each rank of pComm, see
+        /// GridType::rankNode) a node-aware tree is returned when the
+        /// ranks span more than one node.
+        static TreeBcast_v2<T> * Create(const MPI_Comm & pComm, Int * ranks, Int rank_cnt, Int msgSize,double rseed,
+            const std::vector<Int> * rankNode = NULL);
         TreeBcast_v2();
         TreeBcast_v2(const MPI_Comm & pComm, Int * ranks, Int rank_cnt,Int msgSize);
         TreeBcast_v2(const TreeBcast_v2 & Tree);
@@ -153,6 +158,20 @@ namespace PEXSI{
         virtual ModBTreeBcast2<T> * clone() const;
     };
 
+  /// @brief Two-level broadcast tree over the nodes, see BuildNodeTree.
+  template< typename T>
+    class NodeTreeBcast2: public TreeBcast_v2<T>{
+      protected:
+        double rseed_;
+        const std::vector<Int> * rankNode_;
+        virtual void buildTree(Int * ranks, Int rank_cnt);
+
+      public:
+        NodeTreeBcast2(const MPI_Comm & pComm, Int * ranks, Int rank_cnt, Int msgSize, double rseed,
+            const std::vector<Int> * rankNode);
+        virtual NodeTreeBcast2<T> * clone() const;
+    };
+
 
   template< typename T>
   void TreeBcast_Waitsome(std::vector<Int> & treeIdx, std::vector< std::shared_ptr<TreeBcast_v2<T> > > & arrTrees, std::list<int> & doneIdx, std::vector<bool> & finishedFlags);
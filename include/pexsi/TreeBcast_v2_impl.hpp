@@ -463,11 +463,24 @@ namespace PEXSI{
 
 
   template< typename T>
-    inline TreeBcast_v2<T> * TreeBcast_v2<T>::Create(const MPI_Comm & pComm, Int * ranks, Int rank_cnt, Int msgSize, double rseed){
+    inline TreeBcast_v2<T> * TreeBcast_v2<T>::Create(const MPI_Comm & pComm, Int * ranks, Int rank_cnt, Int msgSize, double rseed,
+        const std::vector<Int> * rankNode){
       //get communicator size
       Int nprocs = 0;
       MPI_Comm_size(pComm, &nprocs);
 
+      if(rankNode!=NULL && rank_cnt>1){
+        Int rootNode = (*rankNode)[ranks[0]];
+        for(Int i = 1; i<rank_cnt; i++){
+          if((*rankNode)[ranks[i]] != rootNode){
+#if ( _DEBUGlevel_ >= 1 ) || defined(REDUCE_VERBOSE)
+            statusOFS<<"NODE TREE USED"<<std::endl;
+#endif
+            return new NodeTreeBcast2<T>(pComm,ranks,rank_cnt,msgSize,rseed,rankNode);
+          }
+        }
+      }
+
 #if defined(FTREE)
       return new FTreeBcast2<T>(pComm,ranks,rank_cnt,msgSize);
 #elif defined(MODBTREE)
@@ -705,6 +718,34 @@ namespace PEXSI{
 
 
 
+  template< typename T>
+    NodeTreeBcast2<T>::NodeTreeBcast2(const MPI_Comm & pComm, Int * ranks, Int rank_cnt, Int msgSize, double rseed,
+        const std::vector<Int> * rankNode):TreeBcast_v2<T>(pComm,ranks,rank_cnt,msgSize){
+      this->rseed_ = rseed;
+      this->rankNode_ = rankNode;
+      buildTree(ranks,rank_cnt);
+    }
+
+  template< typename T>
+    inline NodeTreeBcast2<T> * NodeTreeBcast2<T>::clone() const{
+      NodeTreeBcast2 * out = new NodeTreeBcast2(*this);
+      return out;
+    }
+
+  template< typename T>
+    inline void NodeTreeBcast2<T>::buildTree(Int * ranks, Int rank_cnt){
+      BuildNodeTree(ranks, rank_cnt, *this->rankNode_, (Int)this->rseed_, this->myRank_, this->myRoot_, this->myDests_);
+
+#if (defined(BCAST_VERBOSE))
+      statusOFS<<"My root is "<<this->myRoot_<<std::endl;
+      statusOFS<<"My dests are ";
+      for(int i =0;i<this->myDests_.size();++i){statusOFS<<this->myDests_[i]<<" ";}
+      statusOFS<<std::endl;
+#endif
+    }
+
+
+
   template< typename T>
    void TreeBcast_Waitsome(std::vector<Int> & treeIdx, std::vector< std::shared_ptr<TreeBcast_v2<T> > > & arrTrees, std::list<int> & doneIdx, std::vector<bool> & finishedFlags){
       doneIdx.clear();
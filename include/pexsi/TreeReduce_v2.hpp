@@ -24,7 +24,8 @@ namespace PEXSI{
         bool isBufferSet_;
 
       public:
-        static TreeReduce_v2<T> * Create(const MPI_Comm & pComm, Int * ranks, Int rank_cnt, Int msgSize,double rseed);
+        static TreeReduce_v2<T> * Create(const MPI_Comm & pComm, Int * ranks, Int rank_cnt, Int msgSize,double rseed,
+            const std::vector<Int> * rankNode = NULL);
 
         TreeReduce_v2();
         TreeReduce_v2(const MPI_Comm & pComm, Int * ranks, Int rank_cnt, Int msgSize);
@@ -117,6 +118,21 @@ public:
 };
 
 
+/// @brief Two-level reduction tree over the nodes, see BuildNodeTree.
+template< typename T>
+class NodeTreeReduce_v2: public TreeReduce_v2<T>{
+protected:
+  double rseed_;
+  const std::vector<Int> * rankNode_;
+  virtual void buildTree(Int * ranks, Int rank_cnt);
+
+public:
+  NodeTreeReduce_v2(const MPI_Comm & pComm, Int * ranks, Int rank_cnt, Int msgSize, double rseed,
+      const std::vector<Int> * rankNode);
+  virtual NodeTreeReduce_v2<T> * clone() const;
+};
+
+
 template< typename T>
 class PalmTreeReduce_v2: public TreeReduce_v2<T>{
 protected:
@@ -492,11 +492,24 @@ namespace PEXSI{
 
 
   template< typename T>
-    inline TreeReduce_v2<T> * TreeReduce_v2<T>::Create(const MPI_Comm & pComm, Int * ranks, Int rank_cnt, Int msgSize, double rseed){
+    inline TreeReduce_v2<T> * TreeReduce_v2<T>::Create(const MPI_Comm & pComm, Int * ranks, Int rank_cnt, Int msgSize, double rseed,
+        const std::vector<Int> * rankNode){
       //get communicator size
       Int nprocs = 0;
       MPI_Comm_size(pComm, &nprocs);
 
+      if(rankNode!=NULL && rank_cnt>1){
+        Int rootNode = (*rankNode)[ranks[0]];
+        for(Int i = 1; i<rank_cnt; i++){
+          if((*rankNode)[ranks[i]] != rootNode){
+#if ( _DEBUGlevel_ >= 1 ) || defined(REDUCE_VERBOSE)
+            statusOFS<<"NODE TREE USED"<<std::endl;
+#endif
+            return new NodeTreeReduce_v2<T>(pComm,ranks,rank_cnt,msgSize,rseed,rankNode);
+          }
+        }
+      }
+
 #if defined(FTREE)
       return new FTreeReduce_v2<T>(pComm,ranks,rank_cnt,msgSize);
 #elif defined(MODBTREE)
@@ -740,6 +753,32 @@ namespace PEXSI{
       return out;
     }
 
+  template< typename T>
+    NodeTreeReduce_v2<T>::NodeTreeReduce_v2(const MPI_Comm & pComm, Int * ranks, Int rank_cnt, Int msgSize, double rseed,
+        const std::vector<Int> * rankNode):TreeReduce_v2<T>(pComm, ranks, rank_cnt, msgSize){
+      this->rseed_ = rseed;
+      this->rankNode_ = rankNode;
+      buildTree(ranks,rank_cnt);
+    }
+
+  template< typename T>
+    inline NodeTreeReduce_v2<T> * NodeTreeReduce_v2<T>::clone() const{
+      NodeTreeReduce_v2<T> * out = new NodeTreeReduce_v2<T>(*this);
+      return out;
+    }
+
+  template< typename T>
+    inline void NodeTreeReduce_v2<T>::buildTree(Int * ranks, Int rank_cnt){
+      BuildNodeTree(ranks, rank_cnt, *this->rankNode_, (Int)this->rseed_, this->myRank_, this->myRoot_, this->myDests_);
+
+#if (defined(REDUCE_VERBOSE))
+      statusOFS<<"My root is "<<this->myRoot_<<std::endl;
+      statusOFS<<"My dests are ";
+      for(int i =0;i<this->myDests_.size();++i){statusOFS<<this->myDests_[i]<<" ";}
+      statusOFS<<std::endl;
+#endif
+    }
+
   template< typename T>
     inline void ModBTreeReduce_v2<T>::buildTree(Int * ranks, Int rank_cnt){
 
@@ -390,6 +390,87 @@ template<typename T>
     T alpha, const T* A, Int lda, const T* B, Int ldb,
     T beta,        T* C, Int ldc );
 
+/// @brief Algorithm used by the complex Gemm.
+///
+/// - COMPLEX_GEMM_4M   : vendor cgemm / zgemm (default).
+/// - COMPLEX_GEMM_3M   : Gauss trick, three real GEMMs on split real /
+///   imaginary planes.  About 25% fewer flops, with a slightly larger
+///   error in the imaginary part.
+/// - COMPLEX_GEMM_SPLIT: four real GEMMs on split planes.  Same
+///   accuracy as 4M, but uses the (often better tuned) real kernels.
+///
+/// The split variants need O(mk+kn+mn) extra memory and are only used
+/// when m, n and k are all at least minDim.  The mode is given per
+/// call, so that objects with different options do not interfere.
+enum ComplexGemmMode{
+  COMPLEX_GEMM_4M    = 0,
+  COMPLEX_GEMM_3M    = 1,
+  COMPLEX_GEMM_SPLIT = 2
+};
+
+/// @class ComplexPlanes
+/// @brief Real and imaginary planes of op(X) (m x n, leading dimension
+/// m), and Re+Im for COMPLEX_GEMM_3M.
+///
+/// An operand used in several products is split once and passed to
+/// GemmPlanes each time.  The storage is kept between calls to Split.
+template<typename R>
+class ComplexPlanes{
+public:
+  ComplexPlanes(): m_(0), n_(0) {}
+
+  void Split( Int mode, char trans, Int m, Int n, 
+      const std::complex<R>* X, Int ldx );
+
+  Int m() const { return m_; }
+  Int n() const { return n_; }
+  const R* Re()  const { return re_.data(); }
+  const R* Im()  const { return im_.data(); }
+  const R* Sum() const { return sum_.data(); }
+  /// @brief Whether Re+Im was formed, i.e. Split was given COMPLEX_GEMM_3M.
+  bool HasSum()  const { return sum_.size() == re_.size(); }
+
+private:
+  Int            m_;
+  Int            n_;
+  std::vector<R> re_;
+  std::vector<R> im_;
+  std::vector<R> sum_;
+};
+
+/// @brief C = alpha * A * B + beta * C on split operands, with mode
+/// COMPLEX_GEMM_3M or COMPLEX_GEMM_SPLIT.  A is m x k and B is k x n.
+void GemmPlanes
+  ( Int mode, Int m, Int n, Int k,
+    scomplex alpha, const ComplexPlanes<float>& A, const ComplexPlanes<float>& B,
+    scomplex beta,        scomplex* C, Int ldc );
+void GemmPlanes
+  ( Int mode, Int m, Int n, Int k,
+    dcomplex alpha, const ComplexPlanes<double>& A, const ComplexPlanes<double>& B,
+    dcomplex beta,        dcomplex* C, Int ldc );
+
+/// @brief Gemm with the complex algorithm given by mode (see
+/// ComplexGemmMode) for m, n, k >= minDim.  The real versions ignore
+/// mode and minDim, so that templated callers can pass them always.
+void Gemm
+  ( Int mode, Int minDim, char transA, char transB, Int m, Int n, Int k,
+    scomplex alpha, const scomplex* A, Int lda, const scomplex* B, Int ldb,
+    scomplex beta,        scomplex* C, Int ldc );
+void Gemm
+  ( Int mode, Int minDim, char transA, char transB, Int m, Int n, Int k,
+    dcomplex alpha, const dcomplex* A, Int lda, const dcomplex* B, Int ldb,
+    dcomplex beta,        dcomplex* C, Int ldc );
+inline void Gemm
+  ( Int mode, Int minDim, char transA, char transB, Int m, Int n, Int k,
+    float alpha, const float* A, Int lda, const float* B, Int ldb,
+    float beta,        float* C, Int ldc )
+{ Gemm( transA, transB, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc ); }
+inline void Gemm
+  ( Int mode, Int minDim, char transA, char transB, Int m, Int n, Int k,
+    double alpha, const double* A, Int lda, const double* B, Int ldb,
+    double beta,        double* C, Int ldc )
+{ Gemm( transA, transB, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc ); }
+
 void Hemm
   ( char side, char uplo, Int m, Int n,
     float alpha, const float* A, Int lda, const float* B, Int ldb,
@@ -563,6 +644,19 @@ template<typename scalar>
       const scalar* b, const int ldb, const scalar beta, 
        scalar* c, const int ldc, int depth = 0) ;
 
+/// @brief One triangle of C(n,n) = alpha * op(A) * op(B) + beta * C,
+/// for products known to be symmetric (the GEMMT operation).
+///
+/// Computed by column panels of width nb, so about (1+nb/n)/2 of the
+/// flops of the full product are spent.  The default nb = 0 takes
+/// max(8, n/4), which keeps the saving on the narrow supernodes that
+/// dominate the diagonal updates.  Entries of the other triangle inside
+/// the diagonal nb x nb blocks are overwritten as well.
+template<typename T> 
+  void Gemmt( char uplo, char transA, char transB, Int n, Int k,
+      T alpha, const T* A, Int lda, const T* B, Int ldb,
+      T beta,        T* C, Int ldc, Int nb = 0 );
+
 } // namespace blas
 } // namespace PEXSI 
 
@@ -574,11 +668,10 @@ namespace PEXSI{
 
 #ifdef _OMP_ENABLED_
       int num_threads = omp_get_num_threads();
-      int task_recursion_cutoff_level = (omp_get_num_threads() == 1) ? 0 : std::log2(omp_get_num_threads()) + 3;
 #else
       int num_threads = 1;
-      int task_recursion_cutoff_level = 0;
 #endif
+      int task_recursion_cutoff_level = (num_threads == 1) ? 0 : std::log2(num_threads) + 3;
       int gemmOMPThreshold = 64*64*64;//64;
 
 
@@ -608,6 +701,32 @@ namespace PEXSI{
       }
     }
 
+    template<typename T> inline void Gemmt( char uplo, char transA, char transB, Int n, Int k,
+        T alpha, const T* A, Int lda, const T* B, Int ldb,
+        T beta,        T* C, Int ldc, Int nb ){
+      // Row i of op(A) and column j of op(B)
+      bool opA = transA=='T'||transA=='t'||transA=='C'||transA=='c';
+      bool opB = transB=='T'||transB=='t'||transB=='C'||transB=='c';
+      if( nb <= 0 ){
+        nb = std::max( 8, ( n + 3 ) / 4 );
+      }
+      for( Int j0 = 0; j0 < n; j0 += nb ){
+        Int jb = std::min( nb, n - j0 );
+        const T* Bj = opB ? B + j0 : B + j0 * ldb;
+        if( uplo == 'L' || uplo == 'l' ){
+          // Rows j0:n of the panel
+          const T* Ai = opA ? A + j0 * lda : A + j0;
+          blas::Gemm( transA, transB, n - j0, jb, k, alpha, Ai, lda, Bj, ldb,
+              beta, C + j0 + j0 * ldc, ldc );
+        }
+        else{
+          // Rows 0:j0+jb of the panel
+          blas::Gemm( transA, transB, j0 + jb, jb, k, alpha, A, lda, Bj, ldb,
+              beta, C + j0 * ldc, ldc );
+        }
+      }
+    }
+
   }
 }
 
@@ -0,0 +1,141 @@
+/// @file indirect_gemm.hpp
+/// @brief GEMM with operands gathered on the fly from block storage.
+///
+/// The update Sinv(I,K) * U(K,J)^T in PMatrix::SelInvIntra_P2p reads
+/// its operands from many small blocks (the local Sinv blocks and the
+/// received U blocks), addressed through relative row / column index
+/// maps.  Instead of assembling them into dense AinvBuf / UBuf first,
+/// the operands are described as a list of tiles and gathered panel by
+/// panel while the product is computed.
+#ifndef _PEXSI_INDIRECT_GEMM_HPP_
+#define _PEXSI_INDIRECT_GEMM_HPP_
+
+#include "pexsi/environment.hpp"
+#include "pexsi/NumMat.hpp"
+#include "pexsi/blas.hpp"
+
+#include <vector>
+#include <deque>
+#include <functional>
+
+namespace PEXSI{
+
+  /// @struct IndirectTile
+  /// @brief A numRow x numCol block of a virtual matrix, placed at
+  /// (rowOffset, colOffset).
+  ///
+  /// Entry (i,j) of the tile is src[relRows[i] + relCols[j] * ld].  A
+  /// NULL relRows (relCols) stands for the identity map.
+  template<typename T>
+    struct IndirectTile{
+      const T*          src;
+      Int               ld;
+      const Int*        relRows;
+      const Int*        relCols;
+      Int               rowOffset;
+      Int               colOffset;
+      Int               numRow;
+      Int               numCol;
+    };
+
+  /// @class IndirectMatrix
+  /// @brief A m x n matrix that is never formed, given as a set of
+  /// tiles.
+  ///
+  /// Tiles are expected to be appended in nondecreasing colOffset order
+  /// and to cover the matrix.  The index maps referenced by the tiles
+  /// may be stored in the matrix itself with NewIndexMap.
+  template<typename T>
+    class IndirectMatrix{
+      public:
+        IndirectMatrix(): m_(0), n_(0) {}
+
+        void Reset( Int m, Int n );
+
+        /// @brief Returns a map of size n owned by this matrix.  The
+        /// pointer stays valid until the next Reset.
+        Int* NewIndexMap( Int n );
+
+        void AddTile( const T* src, Int ld, const Int* relRows, const Int* relCols,
+            Int rowOffset, Int colOffset, Int numRow, Int numCol );
+
+        Int m() const { return m_; }
+        Int n() const { return n_; }
+        const std::vector<IndirectTile<T> >& Tiles() const { return tiles_; }
+
+        /// @brief Gather columns [colBeg, colEnd) into the dense panel
+        /// (m x (colEnd-colBeg)), converting to TC on the fly.
+        template<typename TC>
+          void Pack( Int colBeg, Int colEnd, TC* panel, Int ldPanel ) const;
+
+      private:
+        Int                               m_;
+        Int                               n_;
+        std::vector<IndirectTile<T> >     tiles_;
+        std::deque<std::vector<Int> >     maps_;
+    };
+
+  /// @class IndirectGemmEngine
+  /// @brief Computes C = alpha * A * B^T + beta * C with A and B given
+  /// as IndirectMatrix.
+  ///
+  /// The engine walks the inner dimension in panels of kc columns,
+  /// gathers the A and B panels into reused buffers, and hands the
+  /// dense panels to PanelGemm.  TS is the type of the source blocks,
+  /// TC the type the product is computed in.  A backend only has to
+  /// implement PanelGemm.
+  ///
+  /// A progress hook, if set, is called after every panel, e.g. to
+  /// progress pending communications during long products.
+  template<typename TS, typename TC>
+    class IndirectGemmEngine{
+      public:
+        IndirectGemmEngine( Int kc ): kc_(kc) {}
+        virtual ~IndirectGemmEngine() {}
+
+        void GemmNT( TC alpha, const IndirectMatrix<TS>& A, const IndirectMatrix<TS>& B,
+            TC beta, TC* C, Int ldc );
+
+        Int PanelWidth() const { return kc_; }
+
+        void SetProgressHook( const std::function<void()>& hook ){ progressHook_ = hook; }
+
+      protected:
+        /// @brief Dense C = alpha * A * B^T + beta * C on packed panels.
+        virtual void PanelGemm( Int m, Int n, Int k, TC alpha, const TC* A, Int lda,
+            const TC* B, Int ldb, TC beta, TC* C, Int ldc ) = 0;
+
+        Int           kc_;
+        NumMat<TC>    APanel_;
+        NumMat<TC>    BPanel_;
+        std::function<void()>   progressHook_;
+    };
+
+  /// @class IndirectGemmCPU
+  /// @brief Host backend using blas::Gemm for the panel products.
+  ///
+  /// With splitTasks the panel products are split recursively into
+  /// OpenMP tasks (blas::gemm_omp_task), for engines used inside a
+  /// parallel region.  Otherwise complex panels use the algorithm
+  /// complexMode (see blas::ComplexGemmMode) from complexMinDim on.
+  template<typename TS, typename TC>
+    class IndirectGemmCPU: public IndirectGemmEngine<TS,TC>{
+      public:
+        IndirectGemmCPU( Int kc = 256, bool splitTasks = false, 
+            Int complexMode = 0, Int complexMinDim = 64 ): 
+          IndirectGemmEngine<TS,TC>(kc), splitTasks_(splitTasks),
+          complexMode_(complexMode), complexMinDim_(complexMinDim) {}
+
+      protected:
+        virtual void PanelGemm( Int m, Int n, Int k, TC alpha, const TC* A, Int lda,
+            const TC* B, Int ldb, TC beta, TC* C, Int ldc );
+
+        bool          splitTasks_;
+        Int           complexMode_;
+        Int           complexMinDim_;
+    };
+
+}//namespace PEXSI
+
+#include "pexsi/indirect_gemm_impl.hpp"
+#endif
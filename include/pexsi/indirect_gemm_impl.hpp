@@ -0,0 +1,135 @@
+/// @file indirect_gemm_impl.hpp
+/// @brief Implementation of the indirect GEMM engine.
+#ifndef _PEXSI_INDIRECT_GEMM_IMPL_HPP_
+#define _PEXSI_INDIRECT_GEMM_IMPL_HPP_
+
+#include <algorithm>
+
+namespace PEXSI{
+
+  template<typename T>
+    inline void IndirectMatrix<T>::Reset( Int m, Int n )
+    {
+      m_ = m;
+      n_ = n;
+      tiles_.clear();
+      maps_.clear();
+    }
+
+  template<typename T>
+    inline Int* IndirectMatrix<T>::NewIndexMap( Int n )
+    {
+      // std::deque does not move its elements on push_back, so the
+      // maps handed out earlier stay valid.
+      maps_.push_back( std::vector<Int>( n ) );
+      return maps_.back().data();
+    }
+
+  template<typename T>
+    inline void IndirectMatrix<T>::AddTile( const T* src, Int ld,
+        const Int* relRows, const Int* relCols,
+        Int rowOffset, Int colOffset, Int numRow, Int numCol )
+    {
+      if( numRow == 0 || numCol == 0 ) return;
+      if( rowOffset + numRow > m_ || colOffset + numCol > n_ ){
+        ErrorHandling( "The tile does not fit in the IndirectMatrix." );
+      }
+      if( !tiles_.empty() && colOffset < tiles_.back().colOffset ){
+        ErrorHandling( "Tiles must be added in nondecreasing column order." );
+      }
+
+      IndirectTile<T> tile;
+      tile.src       = src;
+      tile.ld        = ld;
+      tile.relRows   = relRows;
+      tile.relCols   = relCols;
+      tile.rowOffset = rowOffset;
+      tile.colOffset = colOffset;
+      tile.numRow    = numRow;
+      tile.numCol    = numCol;
+      tiles_.push_back( tile );
+    }
+
+  template<typename T>
+    template<typename TC>
+    inline void IndirectMatrix<T>::Pack( Int colBeg, Int colEnd, TC* panel, Int ldPanel ) const
+    {
+      for( Int it = 0; it < (Int)tiles_.size(); it++ ){
+        const IndirectTile<T> & tile = tiles_[it];
+        if( tile.colOffset >= colEnd ) break;
+
+        Int jBeg = std::max( colBeg, tile.colOffset );
+        Int jEnd = std::min( colEnd, tile.colOffset + tile.numCol );
+        for( Int j = jBeg; j < jEnd; j++ ){
+          Int jt = j - tile.colOffset;
+          const T* srcCol = tile.src +
+            ( ( tile.relCols == NULL ) ? jt : tile.relCols[jt] ) * tile.ld;
+          TC* dstCol = panel + tile.rowOffset + ( j - colBeg ) * ldPanel;
+          if( tile.relRows == NULL ){
+            for( Int i = 0; i < tile.numRow; i++ ){
+              dstCol[i] = (TC)srcCol[i];
+            }
+          }
+          else{
+            for( Int i = 0; i < tile.numRow; i++ ){
+              dstCol[i] = (TC)srcCol[tile.relRows[i]];
+            }
+          }
+        }
+      }
+    }
+
+  template<typename TS, typename TC>
+    inline void IndirectGemmEngine<TS,TC>::GemmNT( TC alpha,
+        const IndirectMatrix<TS>& A, const IndirectMatrix<TS>& B,
+        TC beta, TC* C, Int ldc )
+    {
+      Int m = A.m();
+      Int n = B.m();
+      Int k = A.n();
+      if( B.n() != k ){
+        ErrorHandling( "The inner dimensions of A and B do not match." );
+      }
+      if( m == 0 || n == 0 ) return;
+
+      if( k == 0 ){
+        for( Int j = 0; j < n; j++ ){
+          for( Int i = 0; i < m; i++ ){
+            C[i + j * ldc] = ( beta == ZERO<TC>() ) ? ZERO<TC>() : beta * C[i + j * ldc];
+          }
+        }
+        return;
+      }
+
+      for( Int k0 = 0; k0 < k; k0 += kc_ ){
+        Int kb = std::min( kc_, k - k0 );
+        APanel_.Resize( m, kb );
+        BPanel_.Resize( n, kb );
+        A.Pack( k0, k0 + kb, APanel_.Data(), APanel_.m() );
+        B.Pack( k0, k0 + kb, BPanel_.Data(), BPanel_.m() );
+
+        this->PanelGemm( m, n, kb, alpha, APanel_.Data(), APanel_.m(),
+            BPanel_.Data(), BPanel_.m(), ( k0 == 0 ) ? beta : ONE<TC>(), C, ldc );
+
+        if( progressHook_ ){
+          progressHook_();
+        }
+      }
+    }
+
+  template<typename TS, typename TC>
+    inline void IndirectGemmCPU<TS,TC>::PanelGemm( Int m, Int n, Int k, TC alpha,
+        const TC* A, Int lda, const TC* B, Int ldb, TC beta, TC* C, Int ldc )
+    {
+      if( splitTasks_ ){
+        blas::gemm_omp_task( 'N', 'T', m, n, k, alpha, A, lda, B, ldb, beta, C, ldc );
+      }
+      else{
+        blas::Gemm( complexMode_, complexMinDim_, 'N', 'T', m, n, k, 
+            alpha, A, lda, B, ldb, beta, C, ldc );
+      }
+    }
+
+}//namespace PEXSI
+
+#endif
@@ -60,6 +60,7 @@ such enhancements or derivative works thereof, in binary and source code form.
 #include "pexsi/utility.hpp"
 #include "pexsi/blas.hpp"
 #include "pexsi/lapack.hpp"
+#include "pexsi/indirect_gemm.hpp"
 
 #include "pexsi/TreeBcast.hpp"
 
@@ -106,13 +107,168 @@ typedef std::map<bitMask , std::vector<Int> > bitMaskSet;
 ///
 struct PSelInvOptions{
   /// @brief The maximum pipeline depth. 
+  ///
+  /// - = -1  : unbounded (default), or as deep as pipelineMemoryBudget
+  ///   allows.
   Int              maxPipelineDepth; 
 
   /// @brief Use symmetric storage for the selected inversion or not. 
   Int              symmetricStorage; 
 
+  /// @brief Backend for the Sinv * U^T products (see indirect_gemm.hpp).
+  /// 
+  /// - = 0   : cuBLAS (default).
+  /// - = 1   : host BLAS.
+  Int              gemmBackend; 
+
+  /// @brief Algorithm of the complex GEMMs on the host (see
+  /// blas::ComplexGemmMode).
+  /// 
+  /// - = 0   : standard 4M complex GEMM (default).
+  /// - = 1   : 3M, faster but slightly less accurate.
+  /// - = 2   : 4M on split real / imaginary planes with real GEMMs.
+  ///
+  /// Only the host GEMMs of a complex PMatrix are affected.  The float
+  /// tiers of this tree are real, so PMatrix is instantiated for Real
+  /// only and the option has no effect there yet.
+  Int              complexGemmMode; 
+
+  /// @brief Smallest m, n and k for which complexGemmMode applies
+  /// (default 64).  Smaller products use the standard complex GEMM.
+  Int              complexGemmMinDim; 
+
+  /// @brief How PreSelInv computes L(i,k) <- L(i,k) * L(k,k)^{-1}.
+  /// 
+  /// - = 0   : one TRSM per block (default).
+  /// - = 1   : invert L(k,k) once (TRTRI) and apply it with one GEMM
+  ///   per packed panel of blocks (double / float).
+  Int              diagInverseGemm; 
+
+  /// @brief Number of broadcasts of the diagonal L blocks posted ahead
+  /// of the triangular solves in PreSelInv (at least 1).
+  Int              diagBcastLookAhead; 
+
+  /// @brief Number of OpenMP threads used by each process in PreSelInv.
+  /// 
+  /// - = 0   : OMP_NUM_THREADS, i.e. omp_get_max_threads() (default).
+  /// - > 0   : this number of threads.
+  ///
+  /// Only the master thread calls MPI.
+  Int              numThreads; 
+
+  /// @brief Process the ready supernodes of a SelInv step concurrently.
+  /// 
+  /// - = 0   : one supernode at a time (default).
+  /// - = 1   : OpenMP tasks on numThreads threads, the master thread
+  ///   progressing MPI (MPI_THREAD_FUNNELED is enough).  Only with
+  ///   _OMP_ENABLED_.
+  Int              taskParallelSelInv; 
+
+  /// @brief Broadcast prefetch: number of SelInv steps whose L / U
+  /// broadcasts are posted before they are needed.  This only
+  /// prefetches the broadcasts: the reductions, the diagonal update and
+  /// the GEMMs of a step still start once the previous step is done.
+  /// Never crosses the barriers that recycle the tags.  0 posts the
+  /// broadcasts of every step when the step starts.
+  Int              bcastPrefetchSteps; 
+
+  /// @brief Order of the supernodes within a SelInv step.
+  /// 
+  /// - = 0   : reverse postorder of the etree.
+  /// - = 1   : decreasing critical path priority (default), see
+  ///   PMatrix::GetCriticalPathPriority.
+  Int              criticalPathOrder; 
+
+  /// @brief Memory budget (MB per process) of the buffers of one SelInv
+  /// step.  Each level of the etree is split into steps whose estimated
+  /// footprint fits in it, within maxPipelineDepth.  0 (default) does
+  /// not limit the steps.  With symmetricStorage = 1 the footprints
+  /// are estimated from the block structure (see GetStepFootprint).
+  /// The prefetched steps (bcastPrefetchSteps) come on top of it.
+  Int              pipelineMemoryBudget; 
+
+  /// @brief Number of communicator sets rotated over the tag epochs of
+  /// SelInv_P2p.  A set is reused once all the processes are done
+  /// with its previous epoch (MPI_Ibarrier), so no process waits
+  /// unless it is that many epochs ahead.
+  /// 
+  /// - = 0   : one MPI_Barrier per epoch instead.
+  /// - > 0   : this number of sets (default 2).
+  ///
+  /// Only used with the non-symmetric storage.
+  Int              numEpochComm; 
+
+  /// @brief Whether the GEMMs of SelInv_P2p progress the broadcast and
+  /// reduction trees between their panels, so that the L / U blocks
+  /// are forwarded while the process computes.
+  /// 
+  /// - = 0   : only between the supernodes.
+  /// - = 1   : also between the GEMM panels (default).
+  ///
+  /// Only used with the non-symmetric storage, and without
+  /// taskParallelSelInv, where the master thread progresses the trees.
+  /// Must be 0 with symmetricStorage = 1: the progress engine drives
+  /// the TreeBcast / TreeReduce trees, not the v2 trees used there.
+  Int              asyncProgress; 
+
+  /// @brief Size in bytes of the messages the U row of a supernode is
+  /// broadcast in by SelInv_P2p.  The Sinv * U^T product then starts
+  /// with the U blocks of the first chunks, and the blocks of the
+  /// chunks still in flight are multiplied and accumulated as they
+  /// arrive.
+  /// 
+  /// - <= 0  : a single message (default).
+  /// - > 0   : chunks of this size.
+  ///
+  /// Only used with the non-symmetric storage.
+  Int              uChunkSize; 
+
+  /// @brief Mapping of the supernodes to the processors.
+  /// 
+  /// - = 0   : 2D block cyclic, as SuperLU_DIST (default).
+  /// - = 1   : load balanced.  The supernodes are assigned greedily,
+  ///           most expensive first, to the processor row and column
+  ///           with the least work, the cost of a supernode being
+  ///           estimated from its width and the number of rows of
+  ///           L(:,k).  Read by the owner of the grid, which sets the
+  ///           map computed by PMatrix::ComputeSuperNodeMap on it.
+  ///
+  /// Only used by PMatrix.  PMatrixUnsym requires the block cyclic
+  /// mapping.
+  Int              loadBalancedMapping; 
+
+  /// @brief Number of copies of the 2D processor grid the selected
+  /// inversion is replicated over (2.5D).
+  ///
+  /// Every copy holds the whole PMatrix and runs the same steps, but
+  /// contracts only a share of the U blocks in Sinv(I,J) * U(K,J)^T.
+  /// The broadcast and reduction trees of a copy only span the
+  /// processors of its share, and the partial LUpdateBuf are summed
+  /// along GridType::replicaComm.  Only with symmetricStorage = 0, the
+  /// other SelInv paths compute redundantly in every copy.
+  /// The drivers (run_pselinv -RC, PPEXSIData) build the GridType from
+  /// it, and PMatrix::Setup checks that both agree.
+  /// 
+  /// - = 1   : no replication (default).
+  Int              numReplica; 
+
+  /// @brief Whether the broadcast and reduction trees of SelInv are
+  /// built node-aware.
+  ///
+  /// - = 0   : trees over the processors (default).
+  /// - = 1   : two-level trees: a message goes once to every node
+  ///           spanned by the tree and is forwarded inside the node.
+  ///           The nodes are given by GridType::rankNode, and by
+  ///           rowRankNode/colRankNode for the trees on rowComm and
+  ///           colComm (symmetricStorage = 0).
+  Int              nodeAwareTree; 
+
   // Member functions to setup the default value
-  PSelInvOptions(): maxPipelineDepth(-1), symmetricStorage(0) {}
+  PSelInvOptions(): maxPipelineDepth(-1), symmetricStorage(0), gemmBackend(0), complexGemmMode(0),
+    complexGemmMinDim(64), diagInverseGemm(0), diagBcastLookAhead(4), numThreads(0), taskParallelSelInv(0),
+    bcastPrefetchSteps(1), criticalPathOrder(1), pipelineMemoryBudget(0), numEpochComm(2),
+    asyncProgress(1), uChunkSize(0), loadBalancedMapping(0),
+    numReplica(1), nodeAwareTree(0) {}
 };
 
 
@@ -155,11 +311,77 @@ struct GridType{
   Int         numProcRow;
   Int         numProcCol;
 
+  /// @brief Optional supernode map.  Supernode k is placed where the
+  /// supernode snodeSlot[k] is placed by the 2D block cyclic
+  /// distribution, and slotSnode is the inverse permutation.  Empty
+  /// means block cyclic.  See SLOT and SNODE.
+  std::vector<Int> snodeSlot;
+  std::vector<Int> slotSnode;
+
+  /// @brief 2.5D replication: the processors at the same position in
+  /// the numReplica copies of the grid, ranked by replicaRank.
+  /// MPI_COMM_NULL without replication.
+  MPI_Comm    replicaComm;
+  Int         replicaRank;
+  Int         numReplica;
+
+  /// @brief Node of each processor of comm, named by the rank in comm
+  /// of the first processor sharing memory with it
+  /// (MPI_COMM_TYPE_SHARED).  numNode is the number of nodes spanned
+  /// by the grid.  rowRankNode and colRankNode give the same for the
+  /// processors of rowComm and colComm.
+  std::vector<Int> rankNode;
+  std::vector<Int> rowRankNode;
+  std::vector<Int> colRankNode;
+  Int         numNode;
+
   // Member function
-  GridType( MPI_Comm Bcomm, int nprow, int npcol );
+  /// @brief Bcomm is the communicator of this copy of the grid, and
+  /// Rcomm, if given, connects it to the other copies (see
+  /// PSelInvOptions::numReplica).  The processors of Bcomm are placed
+  /// on the grid according to placement, see GridPlacementRank.
+  GridType( MPI_Comm Bcomm, int nprow, int npcol, MPI_Comm Rcomm = MPI_COMM_NULL,
+      Int placement = 0, Real colWeight = 1.0 );
   ~GridType();
+
+  /// @brief SetSuperNodeMap sets the supernode map.  slot must be a
+  /// permutation of 0..numSuper-1.  The map is shared by all the
+  /// PMatrix using this grid.
+  void SetSuperNodeMap( const std::vector<Int>& slot );
 };
 
+/// @brief GridPlacementRank returns the rank in the grid (i.e.
+/// PNUM(MYROW,MYCOL)) of the calling processor of Bcomm for a
+/// placement strategy.  Collective over Bcomm.
+///
+/// The grid column communicators carry the reductions towards the
+/// diagonal and most of the broadcasts of SelInv, and with the default
+/// order, where consecutive ranks (usually on the same node) fill a
+/// grid row, a grid column spans up to nprow nodes.
+///
+/// - = 0   : row major in Bcomm (default).
+/// - = 1   : column major in Bcomm: consecutive ranks fill a grid
+///           column.
+/// - = 2   : node aligned tiles.  The nodes are found with
+///           MPI_COMM_TYPE_SHARED, and every node gets a kr x kc tile
+///           of the grid.  Among the tiles fitting the grid, the one
+///           minimizing colWeight times the number of nodes spanned by
+///           a grid column, plus the number of nodes spanned by a grid
+///           row, is used, the taller one on ties.  colWeight is the
+///           ratio of the column to the row traffic, as predicted by
+///           PMatrix::CommunicationVolume for the matrix.  Without
+///           such a tile (e.g. nodes of different sizes) the ranks are
+///           ordered by node and fill the grid columns.
+/// - = 3   : node major rows: ordered by node, filling the grid rows.
+///           Used for the pole groups of PPEXSIData, which then hold
+///           whole nodes when possible.
+///
+/// Every object distributed on the grid (SuperLUGrid in particular)
+/// has to use the same order, e.g. by being built on GridType::comm or
+/// on Bcomm split with this rank as the key.
+Int GridPlacementRank( MPI_Comm Bcomm, int nprow, int npcol, Int placement,
+    Real colWeight = 1.0 );
+
 /// @struct SuperNodeType
 ///
 /// @brief SuperNodeType describes mapping between supernode and column, the
@@ -307,15 +529,26 @@ inline Int MYROW( const GridType* g )
 inline Int MYCOL( const GridType* g )
 { return g->mpirank % g->numProcCol; }
 
+/// @brief SLOT returns the position of the bnum-th block (supernode)
+/// in the 2D block cyclic distribution.  This is bnum itself unless a
+/// supernode map is set on the grid.
+inline Int SLOT( Int bnum, const GridType* g )
+{ return ( bnum < (Int)g->snodeSlot.size() ) ? g->snodeSlot[bnum] : bnum; }
+
+/// @brief SNODE returns the block (supernode) placed at the position
+/// slot, the inverse of SLOT.
+inline Int SNODE( Int slot, const GridType* g )
+{ return ( slot < (Int)g->slotSnode.size() ) ? g->slotSnode[slot] : slot; }
+
 /// @brief PROW returns the processor row that the bnum-th block
 /// (supernode) belongs to.
 inline Int PROW( Int bnum, const GridType* g ) 
-{ return bnum % g->numProcRow; }
+{ return SLOT( bnum, g ) % g->numProcRow; }
 
 /// @brief PCOL returns the processor column that the bnum-th block
 /// (supernode) belongs to.
 inline Int PCOL( Int bnum, const GridType* g ) 
-{ return bnum % g->numProcCol; }
+{ return SLOT( bnum, g ) % g->numProcCol; }
 
 /// @brief PNUM returns the processor rank that the bnum-th block
 /// (supernode) belongs to.
@@ -325,22 +558,22 @@ inline Int PNUM( Int i, Int j, const GridType* g )
 /// @brief LBi returns the local block number on the processor at
 /// processor row PROW( bnum, g ).
 inline Int LBi( Int bnum, const GridType* g )
-{ return bnum / g->numProcRow; }
+{ return SLOT( bnum, g ) / g->numProcRow; }
 
 /// @brief LBj returns the local block number on the processor at
 /// processor column PCOL( bnum, g ).
 inline Int LBj( Int bnum, const GridType* g)
-{ return bnum / g->numProcCol; }
+{ return SLOT( bnum, g ) / g->numProcCol; }
 
 /// @brief GBi returns the global block number from a local block number
 /// in the row direction.
 inline Int GBi( Int iLocal, const GridType* g )
-{ return iLocal * g->numProcRow + MYROW( g ); }
+{ return SNODE( iLocal * g->numProcRow + MYROW( g ), g ); }
 
 /// @brief GBj returns the global block number from a local block number
 /// in the column direction.
 inline Int GBj( Int jLocal, const GridType* g )
-{ return jLocal * g->numProcCol + MYCOL( g ); }
+{ return SNODE( jLocal * g->numProcCol + MYCOL( g ), g ); }
 
 /// @brief CEILING is used for computing the storage space for local
 /// number of blocks.
@@ -469,6 +702,18 @@ Int inline serialize(UBlock<T>& val, std::ostream& os, const std::vector<Int>& m
   return 0;
 }
 
+/// @brief Number of bytes written by serialize(UBlock) with mask.
+template<typename T>
+Int inline SerializedSize(const UBlock<T>& val, const std::vector<Int>& mask){
+  Int size = 0;
+  if(mask[UBlockMask::BLOCKIDX]==1) size += sizeof(Int);
+  if(mask[UBlockMask::NUMROW  ]==1) size += sizeof(Int);
+  if(mask[UBlockMask::NUMCOL  ]==1) size += sizeof(Int);
+  if(mask[UBlockMask::COLS    ]==1) size += sizeof(Int) + val.cols.ByteSize();
+  if(mask[UBlockMask::NZVAL   ]==1) size += 2*sizeof(Int) + val.nzval.ByteSize();
+  return size;
+}
+
 template<typename T>
 Int inline deserialize(UBlock<T>& val, std::istream& is, const std::vector<Int>& mask){
   Int i = 0;
@@ -541,10 +786,10 @@ Int inline deserialize(UBlock<T>& val, std::istream& is, const std::vector<Int>&
 /// - All major operations of PMatrix, including the selected inversion
 /// are defined directly as the member function of PMatrix.
 ///
-/// - In the current version of PMatrix, square grid is assumed.  This
-/// assumption is only used when sending the information to
-/// cross-diagonal blocks, i.e. from L(isup, ksup) to U(ksup, isup).
-/// This assumption can be relaxed later.
+/// - The processor grid does not have to be square.  When sending the
+/// information to cross-diagonal blocks, i.e. from L(isup, ksup) to
+/// U(ksup, isup), the processor (PROW(isup), PCOL(ksup)) sends to each
+/// (PROW(ksup), PCOL(isup)) only the blocks it owns in U(ksup, :).
 
 template<typename T>
 class PMatrix{
@@ -598,6 +843,10 @@ protected:
 
   std::vector<std::vector<Int> > workingSet_;
 
+  // Data the factorization keeps with the blocks it built, to refresh
+  // their values with the next factors, see FactorLayout.
+  std::shared_ptr<void> factorLayout_;
+
 
   // Communication variables
   BolNumMat                       isSendToBelow_;
@@ -628,6 +877,18 @@ protected:
   std::vector<std::vector<Int> > snodeTreeToBlkidx_;
   std::list<Int> syncPoints_;
 
+  // Duplicates of grid_->comm, rowComm and colComm used by SelInv_P2p,
+  // rotated over the tag epochs (see SetupEpochComm), and the epoch of
+  // each step.
+  std::vector<MPI_Comm> epochComm_;
+  std::vector<MPI_Comm> epochRowComm_;
+  std::vector<MPI_Comm> epochColComm_;
+  std::vector<Int> stepEpoch_;
+
+  // cuBLAS handles and streams of the threads (see SetupThreadHandles)
+  std::vector<cublasHandle_t> threadHandles_;
+  std::vector<cudaStream_t> threadStreams_;
+
   double localFlops_;
 
   struct SuperNodeBufferType{
@@ -653,6 +914,24 @@ protected:
     Int               Rank;
     Int               isReady;
 
+    // The U row may arrive in several chunks (see
+    // PSelInvOptions::uChunkSize): chunks arrived, number of leading
+    // chunks arrived and forwarded, read position of the next U block.
+    Int               NumUChunk;
+    std::vector<char> UChunkArrived;
+    Int               NumUChunkArrived;
+    Int               NumUChunkForwarded;
+    Int               UReadOffset;
+    // Number of U blocks (-1 until known), U blocks multiplied, and
+    // Sinv * U^T panels computed so far.
+    Int               NumUBlock;
+    Int               NumUBlockDone;
+    Int               NumUPanel;
+    bool              isComputing;
+    // The L blocks, and the U blocks unpacked but not multiplied yet.
+    std::vector<LBlock<T> > LcolRecv;
+    std::vector<UBlock<T> > UrowRecv;
+
 
     SuperNodeBufferType():
       SizeSstrLcolSend(0),
@@ -661,7 +940,15 @@ protected:
       SizeSstrUrowRecv(0),
       Index(0), 
       Rank(0), 
-      isReady(0){}
+      isReady(0),
+      NumUChunk(1),
+      NumUChunkArrived(0),
+      NumUChunkForwarded(0),
+      UReadOffset(0),
+      NumUBlock(-1),
+      NumUBlockDone(0),
+      NumUPanel(0),
+      isComputing(false){}
 
     SuperNodeBufferType(Int &pIndex) :
       SuperNodeBufferType(){
@@ -671,24 +958,258 @@ protected:
   };
 
 
+  /// @brief State of the cross-diagonal exchange U(k,i) <- L(i,k) in
+  /// PreSelInv, a pool of requests progressed during the solves.
+  struct CrossDiagExchange{
+    // Sends: a size and a content request per message.
+    std::vector<MPI_Request>            sendRequests;
+    std::deque<std::vector<char> >      sendBuffers;
+    std::deque<Int>                     sendSizes;
+    Int                                 numSendDone;
+
+    // Receives, in the order they are posted.
+    std::vector<Int>                    recvSupers;
+    std::vector<Int>                    recvSources;
+    std::vector<Int>                    recvSizes;
+    std::vector<MPI_Request>            recvSizeRequests;
+    std::vector<MPI_Request>            recvRequests;
+    std::vector<std::vector<char> >     recvBuffers;
+    Int                                 numRecvDone;
+
+    // Per source, the receives whose size has not arrived yet.
+    std::map<Int, std::deque<Int> >     pendingContent;
+    // Receives whose content is in flight.
+    std::list<Int>                      activeContent;
+    // Per supernode, the U blocks that have been updated.
+    std::map<Int, std::vector<bool> >   isBlockFound;
+
+    CrossDiagExchange(): numSendDone(0), numRecvDone(0) {}
+  };
+
+  /// @struct SinvLTWorkspace
+  /// @brief Operands and GEMM engines of the Sinv * U^T product.  One
+  /// per thread in the task-parallel SelInvIntra_P2p.
+  struct SinvLTWorkspace{
+    IndirectMatrix<T>                               AinvMat;
+    IndirectMatrix<T>                               UMat;
+    IndirectMatrix<T>                               AinvMat_quant;
+    IndirectMatrix<T>                               UMat_quant;
+    std::shared_ptr<IndirectGemmEngine<T,T> >       gemmEngine;
+    std::shared_ptr<IndirectGemmEngine<T,float> >   gemmEngineQuant;
+    // Product of the quantized blocks, kept from one panel to the next.
+    NumMat<float>                                   quantBuf;
+  };
+
+  /// @struct SelInvStepBuffer
+  /// @brief Supernode buffers and requests of one step of SelInv_P2p,
+  /// from the posting of its L / U broadcasts to the end of the step.
+  struct SelInvStepBuffer{
+    Int                                       lidx;
+    Int                                       stepSuper;
+    std::vector<SuperNodeBufferType>          arrSuperNodes;
+    std::vector<std::vector<MPI_Request> >    arrMpireqsSendToBelow;
+    std::vector<std::vector<MPI_Request> >    arrMpireqsSendToRight;
+    std::vector<MPI_Request>                  arrMpireqsRecvSizeFromAny;
+    std::vector<MPI_Request>                  arrMpireqsRecvContentFromAny;
+    // Communicators of the step, see GetStepComm.
+    MPI_Comm                                  comm;
+    MPI_Comm                                  rowComm;
+    MPI_Comm                                  colComm;
+    // Supernodes whose L and U are there, and number of L / U
+    // messages forwarded, see ProgressStepContent.
+    std::set<Int>                             readySupidx;
+    Int                                       msgForwarded;
+    // Receives of the U chunks after the first one, appended to
+    // arrMpireqsRecvContentFromAny after the 2*stepSuper first ones.
+    std::vector<Int>                          uChunkSupidx;
+    std::vector<Int>                          uChunkIdx;
+
+    SelInvStepBuffer(): lidx(-1), stepSuper(0), 
+      comm(MPI_COMM_NULL), rowComm(MPI_COMM_NULL), colComm(MPI_COMM_NULL),
+      msgForwarded(0) {}
+  };
+
+  // Steps of SelInv_P2p whose broadcasts are prefetched.
+  std::vector<SelInvStepBuffer*> stepsPrefetched_;
+
+  /// @brief PostSelInvStep allocates the buffers of the step lidx and
+  /// posts the receives and the sends of its L / U broadcasts.  rank
+  /// is advanced past the supernodes of the step.
+  inline void PostSelInvStep(Int lidx, Int & rank, SelInvStepBuffer & step);
+
+  /// @brief ProgressStepContent tests (waits for, if blocking) the
+  /// receives of the L / U blocks of the step, forwards the received
+  /// blocks down their broadcast trees and records the supernodes that
+  /// became ready.  Returns the number of completed receives.
+  inline Int ProgressStepContent(SelInvStepBuffer & step, bool blocking);
+
+  /// @brief ProgressSelInv is the polling hook of the GEMMs of
+  /// SelInvIntra_P2p: progresses the broadcasts of the current step
+  /// and of the prefetched steps, and the L reductions of the
+  /// current step.  Never blocks.
+  inline void ProgressSelInv(SelInvStepBuffer & step, std::vector<char> & redLdone);
+
+  /// @brief Whether the tags are recycled after the step lidx, rank
+  /// being the rank of the first supernode of the next step.  Steps
+  /// between two such points form a tag epoch.
+  inline bool IsBarrierAfterStep(Int lidx, Int rank) const;
+
+  /// @brief SetupEpochComm computes the epoch of every step and
+  /// duplicates numEpochComm sets of communicators, 0 for none.  The
+  /// duplicates are kept until FreeEpochComm, so only the first call
+  /// with a given numEpochComm is collective on grid_->comm.
+  inline void SetupEpochComm(Int numEpochComm);
+
+  /// @brief RestoreTreeComm gives the trees back their grid
+  /// communicators after SelInv_P2p.
+  inline void RestoreTreeComm();
+
+  /// @brief FreeEpochComm frees the duplicates (see deallocate).
+  inline void FreeEpochComm();
+
+  /// @brief Communicators of the step lidx: the set of its epoch, or
+  /// the grid communicators without SetupEpochComm.
+  inline void GetStepComm(Int lidx, MPI_Comm & comm, MPI_Comm & rowComm, MPI_Comm & colComm) const;
+
+  /// @brief SetupThreadHandles creates one cuBLAS handle per thread,
+  /// each bound to its own non-blocking stream, so the threads of
+  /// PreSelInv and SelInv do not serialize on one handle.  Nothing is
+  /// created with a single thread.
+  inline void SetupThreadHandles();
+
+  /// @brief FreeThreadHandles destroys the handles and streams of
+  /// SetupThreadHandles.
+  inline void FreeThreadHandles();
+
+  /// @brief cuBLAS handle of the thread t, the calling thread by
+  /// default, or handle without SetupThreadHandles.
+  inline cublasHandle_t& ThreadHandle(cublasHandle_t& handle, Int t = -1);
+
+  /// @brief ExchangeSuperNodeBlocks sends the blocks of Lcyclic /
+  /// Ucyclic, the local block columns / rows of the 2D block cyclic
+  /// layout, to their processor in the supernode map of the grid, with
+  /// the fields of maskL / maskU.  The part of recvBuf from source p
+  /// starts at recvDispls[p] and holds the number of L blocks, the
+  /// (ksup, block) pairs, then the same for U.
+  void ExchangeSuperNodeBlocks( std::vector<std::vector<LBlock<T> > >& Lcyclic,
+      std::vector<std::vector<UBlock<T> > >& Ucyclic, const std::vector<Int>& maskL,
+      const std::vector<Int>& maskU, std::vector<char>& recvBuf, std::vector<int>& recvDispls );
+
   /// @brief SelInvIntra_P2p
-  inline void SelInvIntra_P2p(Int lidx,Int & rank, cublasHandle_t& handle, std::set<std::string> & quantSuperNode );
+  ///
+  /// postedStep, if given, is the step lidx already posted by
+  /// PostSelInvStep.
+  inline void SelInvIntra_P2p(Int lidx,Int & rank, cublasHandle_t& handle, std::set<std::string> & quantSuperNode, SelInvStepBuffer * postedStep = NULL );
+
+  /// @brief IsReplicaBlock returns whether the U block (ksup, jsup)
+  /// is contracted by this copy of the grid.  The local block columns
+  /// are dealt round robin over the copies.
+  inline bool IsReplicaBlock( Int jsup ) const
+  { return grid_->numReplica == 1 || LBj( jsup, grid_ ) % grid_->numReplica == grid_->replicaRank; }
 
   /// @brief SelInv_lookup_indexes
-  inline void SelInv_lookup_indexes(SuperNodeBufferType & snode, std::vector<LBlock<T> > & LcolRecv, std::vector<UBlock<T> > & UrowRecv, NumMat<T> & AinvBuf, NumMat<T> & UBuf, NumMat<float> & UBuf_quant, std::set<std::string> & quantSuperNode, bool & quantUBuf);
+  /// Without replication all the U blocks are used; with it, only the
+  /// U blocks contracted by this copy (IsReplicaBlock).
+  inline void SelInv_lookup_indexes(SuperNodeBufferType & snode, std::vector<LBlock<T> > & LcolRecv, std::vector<UBlock<T> > & UrowRecv, IndirectMatrix<T> & AinvMat, IndirectMatrix<T> & UMat, IndirectMatrix<T> & AinvMat_quant, IndirectMatrix<T> & UMat_quant, std::set<std::string> & quantSuperNode);
   inline void SelInv_lookup_indexes_seq(SuperNodeBufferType & snode, std::vector<LBlock<T> > & LcolRecv, std::vector<UBlock<T> > & UrowRecv, NumMat<T> & AinvBuf,NumMat<T> & UBuf);
 
+  /// @brief GetStepFootprint estimates for every supernode the memory
+  /// (in bytes) of its buffers during a SelInv step, maximized over the
+  /// processors, from the message sizes of the trees of
+  /// ConstructCommunicationPattern.  Before the trees are built (as
+  /// with symmetricStorage = 1) it is estimated from the rows of the L
+  /// blocks and the supernode sizes.  Collective on grid_->comm.
+  inline void GetStepFootprint(std::vector<Real> & footprint);
+
+  /// @brief GetCriticalPathPriority computes for every supernode the
+  /// estimated cost of the longest path from it to a leaf of the
+  /// supernodal etree (its bottom level), from the supernode sizes and
+  /// the global block structure of L.  Collective on grid_->comm.
+  inline void GetCriticalPathPriority(std::vector<Int> & snodeEtree, std::vector<Real> & priority);
+
   /// @brief GetWorkSet
   inline void GetWorkSet(std::vector<Int> & snodeEtree, std::vector<std::vector<Int> > & WSet);
 
-  /// @brief UnpackData
-  inline void UnpackData(SuperNodeBufferType & snode, std::vector<LBlock<T> > & LcolRecv, std::vector<UBlock<T> > & UrowRecv);
+  /// @brief UnpackData unpacks the L blocks into snode.LcolRecv, once,
+  /// and appends to snode.UrowRecv the U blocks entirely within the
+  /// first sizeUArrived bytes of the U message not unpacked yet.
+  inline void UnpackData(SuperNodeBufferType & snode, Int sizeUArrived);
+
+  /// @brief Number of chunks the U message of msgSize bytes is sent
+  /// in, see PSelInvOptions::uChunkSize.
+  inline Int NumUChunk(Int msgSize) const;
+
+  /// @brief Offset of the chunk c of the U message of msgSize bytes,
+  /// msgSize for c = NumUChunk(msgSize).
+  inline Int UChunkOffset(Int msgSize, Int c) const;
+
+  /// @brief Number of leading bytes of the U message of the supernode
+  /// that have arrived.
+  inline Int SizeUArrived(const SuperNodeBufferType & snode) const;
+
+  /// @brief Whether the Sinv * U^T product of the supernode is
+  /// complete.
+  inline bool IsSinvLTDone(const SuperNodeBufferType & snode) const;
+
+  /// @brief ComputeSinvLT computes snode.LUpdateBuf = -Sinv * U^T for
+  /// a supernode whose L has been received, one column panel per call
+  /// with the U blocks within the first sizeUArrived bytes of the U
+  /// message not multiplied yet (see IsSinvLTDone).  Only reads the
+  /// shared data, so different supernodes can be processed by
+  /// concurrent threads with their own workspace.
+  inline void ComputeSinvLT(SuperNodeBufferType & snode, SinvLTWorkspace & work, std::set<std::string> & quantSuperNode, Int sizeUArrived);
+
+  /// @brief Number of threads used by the threaded parts of PreSelInv
+  /// and SelInv.
+  inline Int NumThreads() const;
+
+  /// @brief Whether the diagonal update only computes the lower
+  /// triangle of DiagBuf, and the reductions to the diagonal only carry
+  /// it in packed form.  True for symmetric storage and for real
+  /// symmetric matrices.
+  inline bool IsDiagUpdateLower() const;
+
+  /// @brief PostRecvFromCrossDiagonal posts the receives of the sizes
+  /// of all the L blocks this processor gets from across the diagonal.
+  inline void PostRecvFromCrossDiagonal(CrossDiagExchange & cd);
+
+  /// @brief SendToCrossDiagonal sends the solved L(i,k) blocks of ksup
+  /// to the processors owning U(k,i), or copies them locally.
+  inline void SendToCrossDiagonal(Int ksup, CrossDiagExchange & cd);
+
+  /// @brief ProgressCrossDiagonal advances the cross-diagonal exchange
+  /// without blocking, and returns true once it is complete.
+  inline bool ProgressCrossDiagonal(CrossDiagExchange & cd);
+
+  /// @brief UpdateUFromCrossDiagonal sets U(k,i) <- L(i,k)^T for the
+  /// received blocks.
+  inline void UpdateUFromCrossDiagonal(Int ksup, std::vector<LBlock<T> > & LcolRecv, std::vector<bool> & isBlockFound);
+
+  /// @brief SolveLColumn computes L(i,k) <- L(i,k) * L(k,k)^{-1} with
+  /// one TRSM per block.
+  inline void SolveLColumn(Int ksup, const NumMat<T> & nzvalLDiag, std::vector<LBlock<T> > & Lcol, 
+      cublasHandle_t& handle, std::set<std::string> & quantSuperNode);
+
+  /// @brief IbcastLDiag posts the broadcast of L(k,k) within the
+  /// processor column into nzvalLDiag, after completing the previous
+  /// broadcast that used the same buffer and request.
+  inline void IbcastLDiag(Int ksup, NumMat<T> & nzvalLDiag, MPI_Request & request);
+
+  /// @brief Whether Lcol has blocks below the diagonal of ksup.
+  inline bool HasOffDiagLBlock(Int ksup, const std::vector<LBlock<T> > & Lcol) const;
+
+  /// @brief ApplyLDiagInverse computes L(i,k) <- L(i,k) * L(k,k)^{-1}
+  /// for all the local blocks of supernode ksup, with an explicit
+  /// inverse of the unit lower triangular L(k,k) and one GEMM for the
+  /// double blocks and one for the quantized blocks.
+  inline void ApplyLDiagInverse(Int ksup, const NumMat<T> & nzvalLDiag, std::vector<LBlock<T> > & Lcol, 
+      cublasHandle_t& handle, std::set<std::string> & quantSuperNode);
 
   /// @brief ComputeDiagUpdate
-  inline void ComputeDiagUpdate(SuperNodeBufferType & snode, cublasHandle_t& handle, std::set<std::string> quantSuperNode);
+  inline void ComputeDiagUpdate(SuperNodeBufferType & snode, cublasHandle_t& handle, std::set<std::string> & quantSuperNode);
 
   /// @brief SendRecvCD_UpdateU
-  inline void SendRecvCD_UpdateU(std::vector<SuperNodeBufferType > & arrSuperNodes, Int stepSuper);
+  inline void SendRecvCD_UpdateU(std::vector<SuperNodeBufferType > & arrSuperNodes, Int stepSuper, MPI_Comm comm);
 
 public:
   // *********************************************************************
@@ -755,6 +1276,11 @@ public:
   /// @brief WorkingSet returns the ordered list of supernodes which could
   /// be done in parallel.
   std::vector<std::vector<int> >& WorkingSet( ) { return workingSet_; } 	
+
+  /// @brief FactorLayout is what the conversion from the factors (e.g.
+  /// SuperLUMatrix::LUstructToPMatrix) records about the blocks it
+  /// built, NULL if none.  Setup and deallocate drop it.
+  std::shared_ptr<void>& FactorLayout() { return factorLayout_; }
   //void WorkingSet(const std::vector<std::vector<int> > * pWSet,const std::vector<std::vector<int> > * pWRanks) { pWSet = &workingSet_; pWRanks = &workingRanks_; } 	
 
   /// @brief CountSendToRight returns the number of processors 
@@ -792,6 +1318,52 @@ public:
   virtual void ConstructCommunicationPattern( );
 
 
+  /// @brief RedistributeSuperNodes moves the L and U blocks from the 2D
+  /// block cyclic layout they are read from the factorization in to
+  /// the supernode map of the grid, and rebuilds ColBlockIdx and
+  /// RowBlockIdx.
+  ///
+  /// Called at the end of LUstructToPMatrix; nothing is done with the
+  /// block cyclic map.  The owner of the grid sets the map, see
+  /// ComputeSuperNodeMap.
+  void RedistributeSuperNodes( );
+
+  /// @brief RedistributeSuperNodeValues only moves the values.  The
+  /// blocks of Lcyclic / Ucyclic, indexed by the local block columns /
+  /// rows of the 2D block cyclic layout, have the structure the blocks
+  /// had when RedistributeSuperNodes moved them.  Their nzval replace
+  /// the ones of the blocks of the supernode map.
+  void RedistributeSuperNodeValues( std::vector<std::vector<LBlock<T> > >& Lcyclic,
+      std::vector<std::vector<UBlock<T> > >& Ucyclic );
+
+  /// @brief BcastReplica copies the L and U blocks of the copy root of
+  /// the grid to the other copies, along GridType::replicaComm, so that
+  /// a factorization is done by one copy only.  With isValueOnly the
+  /// blocks must already have the same structure on all the copies and
+  /// only nzval is sent; otherwise the blocks, ColBlockIdx and
+  /// RowBlockIdx are replaced.  Nothing is done without replication.
+  void BcastReplica( Int root, bool isValueOnly );
+
+  /// @brief ComputeSuperNodeMap computes a load balanced supernode map
+  /// from the block cyclic L_.  The owner of the grid sets it with
+  /// GridType::SetSuperNodeMap, before the PMatrix sharing the grid
+  /// are moved to it by RedistributeSuperNodes.
+  ///
+  /// The cost of supernode k of width w, with r rows below the diagonal
+  /// in L(:,k), is taken as w*r*r + w*w*r + w*w*w.  The supernodes are
+  /// assigned by decreasing cost to the free position whose processor
+  /// row and column have the least accumulated cost.
+  void ComputeSuperNodeMap( std::vector<Int>& slot ) const;
+
+  /// @brief CommunicationVolume returns the volume of the messages of
+  /// the SelInv trees built by ConstructCommunicationPattern, on the
+  /// processor rows and on the processor columns, summed over the
+  /// grid.  The units are the ones of the tree message sizes.
+  /// colVolume / rowVolume is the colWeight of GridPlacementRank.
+  /// Collective over the grid.
+  void CommunicationVolume( Real& rowVolume, Real& colVolume ) const;
+
+
   /// @brief ConstructCommunicationPattern_P2p constructs the communication
   /// pattern to be used later in the selected inversion stage.
   /// The supernodal elimination tree is used to add an additional level of parallelism between supernodes.
@@ -869,10 +1441,11 @@ public:
   /// Then we update the Ainv(ksup, isup) blocks, simply via the update
   /// from the cross diagonal processors.
   ///
-  /// <b> NOTE </b>: The cross diagonal processor is only well here
-  /// defined for square grids.  For a P x P square grid, (ip,
-  /// jp) is the cross diagonal processor of (jp, ip) if ip != jp.  The
-  /// current version of SelInv only works for square processor grids.
+  /// The block (isup, ksup) is sent to the processor (PROW(ksup),
+  /// PCOL(isup)) owning U(ksup, isup).  For a P x P square grid with
+  /// the block cyclic map this is the cross diagonal processor (jp, ip)
+  /// of (ip, jp); on a rectangular grid a processor of L(:,ksup) sends
+  /// to several processors of U(ksup,:) and receives from several.
   ///
   ///
   /// Communication pattern
@@ -938,17 +1511,17 @@ public:
   ///   Dimension: numSuper
   ///
   ///   Role     : At supernode ksup, if isSendToCrossDiagonal(ksup) ==
-  ///   true, send all local blocks {(isup, ksup) | isup > ksup} to the
-  ///   cross-diagonal processor.  <b> NOTE </b>: This requires a square
-  ///   processor grid.
+  ///   true, send the local blocks {(isup, ksup) | isup > ksup} to the
+  ///   processors owning U(ksup, isup).  isSendToCrossDiagonal(jp, ksup)
+  ///   flags the processor column jp.
   ///
   /// - isRecvCrossDiagonal:
   ///
   ///   Dimension: numSuper
   ///
   ///   Role     : At supernode ksup, if isRecvFromCrossDiagonal(ksup) ==
-  ///   true, receive from the cross-diagonal processor.  <b> NOTE </b>:
-  ///   This requires a square processor grid.
+  ///   true, receive from the processors owning L(jsup, ksup).
+  ///   isRecvFromCrossDiagonal(ip, ksup) flags the processor row ip.
   ///   
   ///
   ///
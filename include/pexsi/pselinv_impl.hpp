@@ -48,6 +48,7 @@ such enhancements or derivative works thereof, in binary and source code form.
 
 #include <list>
 #include <limits>
+#include <cstring>
 #include <cublas_v2.h>
 #include <cuda_runtime.h>
 #include "pexsi/timer.h"
@@ -56,24 +57,43 @@ such enhancements or derivative works thereof, in binary and source code form.
 #include "pexsi/flops.hpp"
 #include <omp.h>
 
+// The gpu_blas_* routines order their device buffers and copies on the
+// stream of the handle, and only wait for that stream.  Threads calling
+// them with different handles and streams run concurrently.
+inline cudaStream_t gpu_blas_stream( cublasHandle_t handle ){
+	cudaStream_t stream;
+	cublasGetStream( handle, &stream );
+	return stream;
+}
+
 // Multiply the arrays A and B on GPU and save the result in C
 // C(m,n) = A(m,k) * B(k,n)
 void gpu_blas_smmul(cublasHandle_t& handle, char transA, char transB, int m, int n, int k, 
   float alpha, const float* A, int lda, const float* B, int ldb,
   float beta,        float* C, int ldc ){
 
+	if( m == 0 || n == 0 ) return;
+
+	// A, B and C may be sub-blocks of larger column-major matrices
+	// (lda > rows), so copy the whole span covered by each operand.
+	int colsA = (transA == 'N') ? k : m;
+	int colsB = (transB == 'N') ? n : k;
+	size_t spanA = (size_t)lda * (colsA - 1) + ((transA == 'N') ? m : k);
+	size_t spanB = (size_t)ldb * (colsB - 1) + ((transB == 'N') ? k : n);
+	size_t spanC = (size_t)ldc * (n - 1) + m;
+
 	// Allocate 3 arrays on GPU
+	cudaStream_t stream = gpu_blas_stream( handle );
 	float *d_A, *d_B, *d_C;
-	cudaMalloc(&d_A,m * k * sizeof(float));
-	cudaMalloc(&d_B,k * n * sizeof(float));
-	cudaMalloc(&d_C,m * n * sizeof(float));
+	cudaMallocAsync(&d_A,spanA * sizeof(float), stream);
+	cudaMallocAsync(&d_B,spanB * sizeof(float), stream);
+	cudaMallocAsync(&d_C,spanC * sizeof(float), stream);
 
-    // Copy the data to device
-    cudaMemcpy(d_A, A, m * k * sizeof(float), cudaMemcpyHostToDevice);
-    cudaMemcpy(d_B, B, n * k * sizeof(float), cudaMemcpyHostToDevice);
-    // if(abs(beta - 0) != 0.000001){
-    //   cudaMemcpy(d_C, C, m * n * sizeof(float), cudaMemcpyHostToDevice);
-    // }
+    // Copy the data to device. C is always copied so that the rows
+    // between m and ldc survive the copy back.
+    cudaMemcpyAsync(d_A, A, spanA * sizeof(float), cudaMemcpyHostToDevice, stream);
+    cudaMemcpyAsync(d_B, B, spanB * sizeof(float), cudaMemcpyHostToDevice, stream);
+    cudaMemcpyAsync(d_C, C, spanC * sizeof(float), cudaMemcpyHostToDevice, stream);
 
 
 	// Create a handle for CUBLAS
@@ -94,29 +114,39 @@ void gpu_blas_smmul(cublasHandle_t& handle, char transA, char transB, int m, int
 	// cublasDestroy(handle);
 
 	// Copy (and print) the result on host memory
-	cudaMemcpy(C,d_C,m * n * sizeof(float),cudaMemcpyDeviceToHost);
+	cudaMemcpyAsync(C,d_C,spanC * sizeof(float),cudaMemcpyDeviceToHost, stream);
 
 	//Free GPU memory
-	cudaFree(d_A);
-	cudaFree(d_B);
-	cudaFree(d_C);	
+	cudaFreeAsync(d_A, stream);
+	cudaFreeAsync(d_B, stream);
+	cudaFreeAsync(d_C, stream);	
+	cudaStreamSynchronize(stream);
 }
 void gpu_blas_dmmul(cublasHandle_t& handle, char transA, char transB, int m, int n, int k, 
   double alpha, const double* A, int lda, const double* B, int ldb,
   double beta,        double* C, int ldc ){
 
+	if( m == 0 || n == 0 ) return;
+
+	// A, B and C may be sub-blocks of larger column-major matrices
+	// (lda > rows), so copy the whole span covered by each operand.
+	int colsA = (transA == 'N') ? k : m;
+	int colsB = (transB == 'N') ? n : k;
+	size_t spanA = (size_t)lda * (colsA - 1) + ((transA == 'N') ? m : k);
+	size_t spanB = (size_t)ldb * (colsB - 1) + ((transB == 'N') ? k : n);
+	size_t spanC = (size_t)ldc * (n - 1) + m;
+
 	// Allocate 3 arrays on GPU
+	cudaStream_t stream = gpu_blas_stream( handle );
 	double *d_A, *d_B, *d_C;
-	cudaMalloc(&d_A,m * k * sizeof(double));
-	cudaMalloc(&d_B,k * n * sizeof(double));
-	cudaMalloc(&d_C,m * n * sizeof(double));
+	cudaMallocAsync(&d_A,spanA * sizeof(double), stream);
+	cudaMallocAsync(&d_B,spanB * sizeof(double), stream);
+	cudaMallocAsync(&d_C,spanC * sizeof(double), stream);
 
     // Copy the data to device
-    cudaMemcpy(d_A, A, m * k * sizeof(double), cudaMemcpyHostToDevice);
-    cudaMemcpy(d_B, B, n * k * sizeof(double), cudaMemcpyHostToDevice);
-    // if(abs(beta - 0) != 0.000001){
-    cudaMemcpy(d_C, C, m * n * sizeof(double), cudaMemcpyHostToDevice);
-    // }
+    cudaMemcpyAsync(d_A, A, spanA * sizeof(double), cudaMemcpyHostToDevice, stream);
+    cudaMemcpyAsync(d_B, B, spanB * sizeof(double), cudaMemcpyHostToDevice, stream);
+    cudaMemcpyAsync(d_C, C, spanC * sizeof(double), cudaMemcpyHostToDevice, stream);
     
     
 
@@ -139,12 +169,82 @@ void gpu_blas_dmmul(cublasHandle_t& handle, char transA, char transB, int m, int
 	// cublasDestroy(handle);
 
 	// Copy (and print) the result on host memory
-	cudaMemcpy(C,d_C,m * n * sizeof(double),cudaMemcpyDeviceToHost);
+	cudaMemcpyAsync(C,d_C,spanC * sizeof(double),cudaMemcpyDeviceToHost, stream);
 
 	//Free GPU memory
-	cudaFree(d_A);
-	cudaFree(d_B);
-	cudaFree(d_C);	
+	cudaFreeAsync(d_A, stream);
+	cudaFreeAsync(d_B, stream);
+	cudaFreeAsync(d_C, stream);	
+	cudaStreamSynchronize(stream);
+}
+// Lower or upper triangle of C(n,n) = alpha * op(A) * op(B)^T + beta * C,
+// for products known to be symmetric.  With trans = 'T', A and B are k x n
+// and the product is A^T * B.
+void gpu_blas_ssyrkx(cublasHandle_t& handle, char uplo, char trans, int n, int k, 
+  float alpha, const float* A, int lda, const float* B, int ldb,
+  float beta,        float* C, int ldc ){
+
+	if( n == 0 ) return;
+
+	int colsAB = (trans == 'N') ? k : n;
+	size_t spanA = (size_t)lda * (colsAB - 1) + ((trans == 'N') ? n : k);
+	size_t spanB = (size_t)ldb * (colsAB - 1) + ((trans == 'N') ? n : k);
+	size_t spanC = (size_t)ldc * (n - 1) + n;
+
+	cudaStream_t stream = gpu_blas_stream( handle );
+	float *d_A, *d_B, *d_C;
+	cudaMallocAsync(&d_A,spanA * sizeof(float), stream);
+	cudaMallocAsync(&d_B,spanB * sizeof(float), stream);
+	cudaMallocAsync(&d_C,spanC * sizeof(float), stream);
+
+    cudaMemcpyAsync(d_A, A, spanA * sizeof(float), cudaMemcpyHostToDevice, stream);
+    cudaMemcpyAsync(d_B, B, spanB * sizeof(float), cudaMemcpyHostToDevice, stream);
+    cudaMemcpyAsync(d_C, C, spanC * sizeof(float), cudaMemcpyHostToDevice, stream);
+
+	cublasFillMode_t cuUplo = (uplo == 'L') ? CUBLAS_FILL_MODE_LOWER : CUBLAS_FILL_MODE_UPPER;
+	cublasOperation_t op = (trans == 'N') ? CUBLAS_OP_N : CUBLAS_OP_T;
+
+	cublasSsyrkx(handle, cuUplo, op, n, k, &alpha, d_A, lda, d_B, ldb, &beta, d_C, ldc);
+
+	cudaMemcpyAsync(C,d_C,spanC * sizeof(float),cudaMemcpyDeviceToHost, stream);
+
+	cudaFreeAsync(d_A, stream);
+	cudaFreeAsync(d_B, stream);
+	cudaFreeAsync(d_C, stream);	
+	cudaStreamSynchronize(stream);
+}
+void gpu_blas_dsyrkx(cublasHandle_t& handle, char uplo, char trans, int n, int k, 
+  double alpha, const double* A, int lda, const double* B, int ldb,
+  double beta,        double* C, int ldc ){
+
+	if( n == 0 ) return;
+
+	int colsAB = (trans == 'N') ? k : n;
+	size_t spanA = (size_t)lda * (colsAB - 1) + ((trans == 'N') ? n : k);
+	size_t spanB = (size_t)ldb * (colsAB - 1) + ((trans == 'N') ? n : k);
+	size_t spanC = (size_t)ldc * (n - 1) + n;
+
+	cudaStream_t stream = gpu_blas_stream( handle );
+	double *d_A, *d_B, *d_C;
+	cudaMallocAsync(&d_A,spanA * sizeof(double), stream);
+	cudaMallocAsync(&d_B,spanB * sizeof(double), stream);
+	cudaMallocAsync(&d_C,spanC * sizeof(double), stream);
+
+    cudaMemcpyAsync(d_A, A, spanA * sizeof(double), cudaMemcpyHostToDevice, stream);
+    cudaMemcpyAsync(d_B, B, spanB * sizeof(double), cudaMemcpyHostToDevice, stream);
+    cudaMemcpyAsync(d_C, C, spanC * sizeof(double), cudaMemcpyHostToDevice, stream);
+
+	cublasFillMode_t cuUplo = (uplo == 'L') ? CUBLAS_FILL_MODE_LOWER : CUBLAS_FILL_MODE_UPPER;
+	cublasOperation_t op = (trans == 'N') ? CUBLAS_OP_N : CUBLAS_OP_T;
+
+	cublasDsyrkx(handle, cuUplo, op, n, k, &alpha, d_A, lda, d_B, ldb, &beta, d_C, ldc);
+
+	cudaMemcpyAsync(C,d_C,spanC * sizeof(double),cudaMemcpyDeviceToHost, stream);
+
+	cudaFreeAsync(d_A, stream);
+	cudaFreeAsync(d_B, stream);
+	cudaFreeAsync(d_C, stream);	
+	cudaStreamSynchronize(stream);
 }
 void gpu_blas_dtrsm(cublasHandle_t& handle, char side, char uplo, char trans, char unit, int m, int n,
   double alpha, const double* A, int lda, double* B, int ldb ){
@@ -189,13 +289,14 @@ void gpu_blas_dtrsm(cublasHandle_t& handle, char side, char uplo, char trans, ch
 	}
 
 	// Allocate 3 arrays on GPU
+	cudaStream_t stream = gpu_blas_stream( handle );
 	double *d_A, *d_B;
-	cudaMalloc(&d_A,rowA * colA * sizeof(double));
-	cudaMalloc(&d_B,rowB * colB * sizeof(double));
+	cudaMallocAsync(&d_A,rowA * colA * sizeof(double), stream);
+	cudaMallocAsync(&d_B,rowB * colB * sizeof(double), stream);
 
 	// Copy the data to device
-  cudaMemcpy(d_A, A, rowA * colA * sizeof(double), cudaMemcpyHostToDevice);
-  cudaMemcpy(d_B, B, rowB * colB * sizeof(double), cudaMemcpyHostToDevice);
+  cudaMemcpyAsync(d_A, A, rowA * colA * sizeof(double), cudaMemcpyHostToDevice, stream);
+  cudaMemcpyAsync(d_B, B, rowB * colB * sizeof(double), cudaMemcpyHostToDevice, stream);
 
 	// Create a handle for CUBLAS
 	// cublasHandle_t handle;
@@ -207,11 +308,12 @@ void gpu_blas_dtrsm(cublasHandle_t& handle, char side, char uplo, char trans, ch
 	// cublasDestroy(handle);
 
 	// Copy (and print) the result on host memory
-	cudaMemcpy(B, d_B, m * n * sizeof(double), cudaMemcpyDeviceToHost);
+	cudaMemcpyAsync(B, d_B, m * n * sizeof(double), cudaMemcpyDeviceToHost, stream);
 
 	//Free GPU memory
-	cudaFree(d_A);
-	cudaFree(d_B);
+	cudaFreeAsync(d_A, stream);
+	cudaFreeAsync(d_B, stream);
+	cudaStreamSynchronize(stream);
 }
 
 
@@ -258,13 +360,14 @@ void gpu_blas_strsm(cublasHandle_t& handle, char side, char uplo, char trans, ch
 	}
 
 	// Allocate 3 arrays on GPU
+	cudaStream_t stream = gpu_blas_stream( handle );
 	float *d_A, *d_B;
-	cudaMalloc(&d_A,rowA * colA * sizeof(float));
-	cudaMalloc(&d_B,rowB * colB * sizeof(float));
+	cudaMallocAsync(&d_A,rowA * colA * sizeof(float), stream);
+	cudaMallocAsync(&d_B,rowB * colB * sizeof(float), stream);
 
 	// Copy the data to device
-    cudaMemcpy(d_A, A, rowA * colA * sizeof(float), cudaMemcpyHostToDevice);
-    cudaMemcpy(d_B, B, rowB * colB * sizeof(float), cudaMemcpyHostToDevice);
+    cudaMemcpyAsync(d_A, A, rowA * colA * sizeof(float), cudaMemcpyHostToDevice, stream);
+    cudaMemcpyAsync(d_B, B, rowB * colB * sizeof(float), cudaMemcpyHostToDevice, stream);
 
 	// Create a handle for CUBLAS
 	// cublasHandle_t handle;
@@ -276,11 +379,47 @@ void gpu_blas_strsm(cublasHandle_t& handle, char side, char uplo, char trans, ch
 	// cublasDestroy(handle);
 
 	// Copy (and print) the result on host memory
-	cudaMemcpy(B, d_B, m * n * sizeof(float), cudaMemcpyDeviceToHost);
+	cudaMemcpyAsync(B, d_B, m * n * sizeof(float), cudaMemcpyDeviceToHost, stream);
 
 	//Free GPU memory
-	cudaFree(d_A);
-	cudaFree(d_B);
+	cudaFreeAsync(d_A, stream);
+	cudaFreeAsync(d_B, stream);
+	cudaStreamSynchronize(stream);
+}
+
+namespace PEXSI{
+  /// @class IndirectGemmCublas
+  /// @brief Indirect GEMM backend running the panel products with
+  /// cuBLAS through gpu_blas_smmul / gpu_blas_dmmul.
+  ///
+  /// Every panel product moves its operands to the device, so the panel
+  /// width defaults to a larger value than on the host.  The engines of
+  /// concurrent threads must be given different handles (see
+  /// PMatrix::ThreadHandle).
+  template<typename TS, typename TC>
+    class IndirectGemmCublas: public IndirectGemmEngine<TS,TC>{
+      public:
+        IndirectGemmCublas( cublasHandle_t& handle, Int kc = 1024 ): 
+          IndirectGemmEngine<TS,TC>(kc), handle_(handle) {}
+
+      protected:
+        virtual void PanelGemm( Int m, Int n, Int k, TC alpha, const TC* A, Int lda,
+            const TC* B, Int ldb, TC beta, TC* C, Int ldc ){
+          DeviceGemm( m, n, k, alpha, A, lda, B, ldb, beta, C, ldc );
+        }
+
+      private:
+        void DeviceGemm( Int m, Int n, Int k, float alpha, const float* A, Int lda,
+            const float* B, Int ldb, float beta, float* C, Int ldc ){
+          gpu_blas_smmul( handle_, 'N', 'T', m, n, k, alpha, A, lda, B, ldb, beta, C, ldc );
+        }
+        void DeviceGemm( Int m, Int n, Int k, double alpha, const double* A, Int lda,
+            const double* B, Int ldb, double beta, double* C, Int ldc ){
+          gpu_blas_dmmul( handle_, 'N', 'T', m, n, k, alpha, A, lda, B, ldb, beta, C, ldc );
+        }
+
+        cublasHandle_t& handle_;
+    };
 }
 
 
@@ -311,7 +450,83 @@ namespace PEXSI{
 
 
 namespace PEXSI{
-  inline GridType::GridType	( MPI_Comm Bcomm, int nprow, int npcol )
+  inline Int GridPlacementRank	( MPI_Comm Bcomm, int nprow, int npcol, Int placement, Real colWeight )
+  {
+    Int rank, size;
+    MPI_Comm_rank( Bcomm, &rank );
+    MPI_Comm_size( Bcomm, &size );
+    if( size != nprow * npcol ){
+      ErrorHandling( "mpisize != nprow * npcol." ); 
+    }
+
+    if( placement == 0 ){
+      return rank;
+    }
+    if( placement == 1 ){
+      return ( rank % nprow ) * npcol + rank / nprow;
+    }
+    if( placement != 2 && placement != 3 ){
+      ErrorHandling( "Unknown grid placement." );
+    }
+
+    // 找到每个进程所在的节点
+    MPI_Comm nodeComm;
+    MPI_Comm_split_type( Bcomm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &nodeComm );
+    Int nodeRank, nodeSize;
+    MPI_Comm_rank( nodeComm, &nodeRank );
+    MPI_Comm_size( nodeComm, &nodeSize );
+    Int nodeLeader = rank;
+    MPI_Bcast( &nodeLeader, 1, MPI_INT, 0, nodeComm );
+    MPI_Comm_free( &nodeComm );
+
+    std::vector<Int> leaders( size ), sizes( size );
+    MPI_Allgather( &nodeLeader, 1, MPI_INT, &leaders[0], 1, MPI_INT, Bcomm );
+    MPI_Allgather( &nodeSize, 1, MPI_INT, &sizes[0], 1, MPI_INT, Bcomm );
+
+    // node: index of my node, offset: number of ranks on the nodes
+    // before it.
+    Int node = 0, offset = 0;
+    bool uniform = true;
+    for( Int i = 0; i < size; i++ ){
+      if( leaders[i] == i && i < nodeLeader ) node++;
+      if( leaders[i] < nodeLeader ) offset++;
+      if( sizes[i] != nodeSize ) uniform = false;
+    }
+    Int nodeMajor = offset + nodeRank;
+
+    if( placement == 3 ){
+      return nodeMajor;
+    }
+
+    Int kr = -1;
+    Real bestCost = 0.0;
+    if( uniform ){
+      for( Int r = 1; r <= nodeSize; r++ ){
+        if( nodeSize % r != 0 ) continue;
+        Int c = nodeSize / r;
+        if( nprow % r != 0 || npcol % c != 0 ) continue;
+        Real cost = colWeight * ( nprow / r ) + ( npcol / c );
+        if( kr < 0 || cost <= bestCost ){
+          kr = r;
+          bestCost = cost;
+        }
+      }
+    }
+
+    if( kr < 0 ){
+      return ( nodeMajor % nprow ) * npcol + nodeMajor / nprow;
+    }
+
+    Int kc = nodeSize / kr;
+    Int numTileRow = nprow / kr;
+    Int prow = ( node % numTileRow ) * kr + nodeRank % kr;
+    Int pcol = ( node / numTileRow ) * kc + nodeRank / kr;
+    return prow * npcol + pcol;
+  } 		// -----  end of function GridPlacementRank  ----- 
+
+
+  inline GridType::GridType	( MPI_Comm Bcomm, int nprow, int npcol, MPI_Comm Rcomm, Int placement,
+      Real colWeight )
   {
     Int info;
     MPI_Initialized( &info );
@@ -320,7 +535,12 @@ namespace PEXSI{
     }
     MPI_Group  comm_group;
     MPI_Comm_group( Bcomm, &comm_group );
-    MPI_Comm_create( Bcomm, comm_group, &comm );
+    if( placement == 0 ){
+      MPI_Comm_create( Bcomm, comm_group, &comm );
+    }
+    else{
+      MPI_Comm_split( Bcomm, 0, GridPlacementRank( Bcomm, nprow, npcol, placement, colWeight ), &comm );
+    }
     //		comm = Bcomm;
 
     MPI_Comm_rank( comm, &mpirank );
@@ -345,6 +565,37 @@ namespace PEXSI{
 
     MPI_Group_free( &comm_group );
 
+    // 每个进程所在的节点, 用于构造node-aware的树.
+    {
+      MPI_Comm nodeComm;
+      MPI_Comm_split_type( comm, MPI_COMM_TYPE_SHARED, mpirank, MPI_INFO_NULL, &nodeComm );
+      Int nodeLeader = mpirank;
+      MPI_Bcast( &nodeLeader, 1, MPI_INT, 0, nodeComm );
+      MPI_Comm_free( &nodeComm );
+
+      rankNode.resize( mpisize );
+      MPI_Allgather( &nodeLeader, 1, MPI_INT, &rankNode[0], 1, MPI_INT, comm );
+      rowRankNode.resize( npcol );
+      MPI_Allgather( &nodeLeader, 1, MPI_INT, &rowRankNode[0], 1, MPI_INT, rowComm );
+      colRankNode.resize( nprow );
+      MPI_Allgather( &nodeLeader, 1, MPI_INT, &colRankNode[0], 1, MPI_INT, colComm );
+      numNode = 0;
+      for( Int i = 0; i < mpisize; i++ ){
+        if( rankNode[i] == i ) numNode++;
+      }
+    }
+
+    if( Rcomm != MPI_COMM_NULL ){
+      MPI_Comm_dup( Rcomm, &replicaComm );
+      MPI_Comm_rank( replicaComm, &replicaRank );
+      MPI_Comm_size( replicaComm, &numReplica );
+    }
+    else{
+      replicaComm = MPI_COMM_NULL;
+      replicaRank = 0;
+      numReplica  = 1;
+    }
+
 
     return ;
   } 		// -----  end of method GridType::GridType  ----- 
@@ -357,9 +608,28 @@ namespace PEXSI{
     MPI_Comm_free( &rowComm );
     MPI_Comm_free( &colComm ); 
     MPI_Comm_free( &comm );
+    if( replicaComm != MPI_COMM_NULL ){
+      MPI_Comm_free( &replicaComm );
+    }
 
     return ;
   } 		// -----  end of method GridType::~GridType  ----- 
+
+
+  inline void GridType::SetSuperNodeMap	( const std::vector<Int>& slot )
+  {
+    Int numSuper = slot.size();
+    snodeSlot = slot;
+    slotSnode.assign( numSuper, -1 );
+    for( Int ksup = 0; ksup < numSuper; ksup++ ){
+      if( slot[ksup] < 0 || slot[ksup] >= numSuper || slotSnode[slot[ksup]] != -1 ){
+        ErrorHandling( "The supernode map is not a permutation." );
+      }
+      slotSnode[slot[ksup]] = ksup;
+    }
+
+    return ;
+  } 		// -----  end of method GridType::SetSuperNodeMap  ----- 
 }
 
 
@@ -367,6 +637,9 @@ namespace PEXSI{
   template<typename T>
     void PMatrix<T>::deallocate(){
 
+      FreeEpochComm();
+      stepEpoch_.clear();
+
       grid_ = NULL;
       super_ = NULL;
       options_ = NULL;
@@ -377,6 +650,7 @@ namespace PEXSI{
       U_.clear();
       L_.clear();
       workingSet_.clear();
+      factorLayout_.reset();
 
       // Communication variables
       isSendToBelow_.Clear();
@@ -449,6 +723,7 @@ namespace PEXSI{
         U_ = C.U_;
 
         workingSet_ = C.workingSet_;
+        factorLayout_ = C.factorLayout_;
 
 
         // Communication variables
@@ -519,6 +794,7 @@ namespace PEXSI{
       U_ = C.U_;
 
       workingSet_ = C.workingSet_;
+      factorLayout_ = C.factorLayout_;
 
 
       // Communication variables
@@ -610,11 +886,24 @@ namespace PEXSI{
         ) 
     {
 
+      // Duplicates of the previous grid
+      FreeEpochComm();
+      factorLayout_.reset();
+
       grid_          = g;
       super_         = s;
       options_       = o;
       optionsFact_       = oFact;
 
+      if( options_ != NULL ){
+        if( options_->numReplica != grid_->numReplica ){
+          std::ostringstream msg;
+          msg << "PSelInvOptions::numReplica = " << options_->numReplica
+            << " but the grid has " << grid_->numReplica << " copies." << std::endl;
+          ErrorHandling( msg.str().c_str() );
+        }
+      }
+
       //    if( grid_->numProcRow != grid_->numProcCol ){
       //ErrorHandling( "The current version of SelInv only works for square processor grids." ); }
 
@@ -671,11 +960,11 @@ namespace PEXSI{
         SuperNodeBufferType & snode, 
         std::vector<LBlock<T> > & LcolRecv, 
         std::vector<UBlock<T> > & UrowRecv, 
-        NumMat<T> & AinvBuf,
-        NumMat<T> & UBuf,
-        NumMat<float> & UBuf_quant,
-        std::set<std::string> & quantSuperNode,
-        bool & quantUBuf )
+        IndirectMatrix<T> & AinvMat,
+        IndirectMatrix<T> & UMat,
+        IndirectMatrix<T> & AinvMat_quant,
+        IndirectMatrix<T> & UMat_quant,
+        std::set<std::string> & quantSuperNode )
     {
       TIMER_START(Compute_Sinv_LT_Lookup_Indexes);
       
@@ -684,102 +973,91 @@ namespace PEXSI{
       // nonzero row in LcolRecv[ib]. The total number of rows in
       // snode.LUpdateBuf is given by rowPtr[end]-1
       std::vector<Int> rowPtr(LcolRecv.size() + 1);//它保存了每个L block的在最后的存储矩阵LUpdateBuf中的第一个非零行，并且总行数记录在最后一个元素
-      // colPtr[jb] gives the column index in UBuf for the first
-      // nonzero column in UrowRecv[jb]. The total number of rows in
-      // UBuf is given by colPtr[end]-1
-      std::vector<Int> colPtr(UrowRecv.size() + 1);//它保存了每个U block的在最后的存储矩阵UBuf第一个非零列，并且总列数记录在最后一个元素
+      // colPtr[jb] gives the column index of UrowRecv[jb] in the inner
+      // dimension of the product.  Quantized and non-quantized U blocks
+      // are numbered separately since they are multiplied separately.
+      std::vector<Int> colPtr(UrowRecv.size());
+      std::vector<bool> isQuantCol(UrowRecv.size(), false);
 
       rowPtr[0] = 0;
       for( Int ib = 0; ib < LcolRecv.size(); ib++ ){
         rowPtr[ib+1] = rowPtr[ib] + LcolRecv[ib].numRow;//后面存储的时候全都只存了非零元素，所以这种累加的效果相当于每个block的在最后存储中的偏移量了
       }
-      colPtr[0] = 0;
+
+      int snode_index = snode.Index;//记录snode的index，对于Ublock而言它是行，Ublock自身的index是列，对于Lblock而言它是列，Lblock自身的index是行
+      std::stringstream ss;//记录supernode的index
+      Int numColDouble = 0;
+      Int numColQuant = 0;
       for( Int jb = 0; jb < UrowRecv.size(); jb++ ){
-        colPtr[jb+1] = colPtr[jb] + UrowRecv[jb].numCol;
+        // The U blocks contracted by the other copies of the grid are
+        // skipped (colPtr < 0).
+        if( !IsReplicaBlock( UrowRecv[jb].blockIdx ) ){
+          colPtr[jb] = -1;
+          continue;
+        }
+        ss.str("");
+        ss<< UrowRecv[jb].blockIdx << "," << snode_index;//这里反一下，用来查L Block就行了
+        if(quantSuperNode.find(ss.str()) == quantSuperNode.end()){
+          colPtr[jb] = numColDouble;
+          numColDouble += UrowRecv[jb].numCol;
+        }
+        else{
+          isQuantCol[jb] = true;
+          colPtr[jb] = numColQuant;
+          numColQuant += UrowRecv[jb].numCol;
+        }
       }
 
       Int numRowAinvBuf = *rowPtr.rbegin();//总的非零行数量
-      Int numColAinvBuf = *colPtr.rbegin();//总的非零列数量
       TIMER_STOP(Build_colptr_rowptr);
 
       TIMER_START(Allocate_lookup);
-      // Allocate for the computational storage
-      //分配了Ainv和U矩阵的空间
-      AinvBuf.Resize( numRowAinvBuf, numColAinvBuf );//Ainv为非零行 * 非零列
-      UBuf.Resize( SuperSize( snode.Index, super_ ), numColAinvBuf );//U矩阵为supernode行 * 非零列，合理
-      UBuf_quant.Resize( SuperSize( snode.Index, super_ ), numColAinvBuf );//UBuf_quant和UBuf一样
-
-      SetValue(AinvBuf, (double)0.0);//填充它们为0，当为低精度的时候就不用计算了，后面再用低精度的计算补上
-      SetValue(UBuf, (double)0.0);//填充它们为0，当为低精度的时候就不用计算了，后面再用低精度的计算补上
-      SetValue(UBuf_quant, (float)0.0);//填充它们为0，用于做高精度的补充
-
-      int snode_index = snode.Index;//记录snode的index，对于Ublock而言它是行，Ublock自身的index是列，对于Lblock而言它是列，Lblock自身的index是行
-      std::stringstream ss;//记录supernode的index
-
+      // Nothing is allocated here: the operands only describe where the
+      // entries live, and are gathered while the GEMM runs.
+      AinvMat.Reset( numRowAinvBuf, numColDouble );
+      UMat.Reset( SuperSize( snode.Index, super_ ), numColDouble );
+      AinvMat_quant.Reset( numRowAinvBuf, numColQuant );
+      UMat_quant.Reset( SuperSize( snode.Index, super_ ), numColQuant );
       TIMER_STOP(Allocate_lookup);
 
 
       TIMER_START(Fill_UBuf);
-      // Fill UBuf first.  Make the transpose later in the Gemm phase.
+      // U is used directly from the received blocks.  Make the transpose
+      // later in the Gemm phase.
       for( Int jb = 0; jb < UrowRecv.size(); jb++ ){
+        if( colPtr[jb] < 0 ) continue;
         UBlock<T>& UB = UrowRecv[jb];
         if( UB.numRow != SuperSize(snode.Index, super_) ){
           ErrorHandling( "The size of UB is not right.  Something is seriously wrong." );
         }
-        //进行量化！ 
-        ss.str("");
-        ss<< UB.blockIdx << "," << snode_index;//这里反一下，用来查L Block就行了
-        if(quantSuperNode.find(ss.str()) == quantSuperNode.end()){
-          //如果它不是量化的supernode
-          //将接受到的U矩阵复制到Ubuf中
-          //第一个参数’A’表示把整个矩阵进行一个复制
-          //第二、三个参数表示要复制的行和列，第四个参数表示要复制的矩阵
-          //第五和第七个参数不用管
-          //第六个参数是output
-          lapack::Lacpy( 'A', UB.numRow, UB.numCol, UB.nzval.Data(),
-              UB.numRow, UBuf.VecData( colPtr[jb] ), SuperSize( snode.Index, super_ ) );	//复制
-        }else{
-          //如果它是量化的supernode
-          //首先将它的值复制到一个临时矩阵中，不过不知道这一步后面能不能优化，就是直接复制了
-          //因为感觉可能Lacpy有一些优化所以这类还是先临时复制一下
-          quantUBuf = true;
-          // std::cout<<"Step 3 : Quant:"<<ss.str()<<std::endl;
-          NumMat<float> UB_float(UB.numRow, UB.numCol);
-          for(int j = 0;j<UB.numCol;j++){
-            for(int i = 0;i<UB.numRow;i++){
-              UB_float(i, j) = (float)UB.nzval(i, j);
-            }
-          }
-          lapack::Lacpy( 'A', UB.numRow, UB.numCol, UB_float.Data(),
-              UB.numRow, UBuf_quant.VecData( colPtr[jb] ), SuperSize( snode.Index, super_ ) );	//复制
-          UB_float.deallocate();
-        }
-        
+        IndirectMatrix<T> & UDst = isQuantCol[jb] ? UMat_quant : UMat;
+        UDst.AddTile( UB.nzval.Data(), UB.numRow, NULL, NULL,
+            0, colPtr[jb], UB.numRow, UB.numCol );
       }
       TIMER_STOP(Fill_UBuf);
-      //至此U矩阵已经复制完毕，即传入的参数填充成功
 
       // Calculate the relative indices for (isup, jsup)
-      // Fill AinvBuf with the information in L or U block.
+      // and record where each block of Ainv is found in L or U.
       TIMER_START(JB_Loop);
 
-#ifdef STDFIND
-      
-#else
       for( Int jb = 0; jb < UrowRecv.size(); jb++ ){//column major的遍历，芜湖～
+        if( colPtr[jb] < 0 ) continue;
+        UBlock<T>& UB = UrowRecv[jb];//得到接收到的Ublock
+        Int jsup = UB.blockIdx;//找到对应的U block的supernode列
+        IndirectMatrix<T> & AinvDst = isQuantCol[jb] ? AinvMat_quant : AinvMat;
+
+        // Column relative indices for the blocks found in L, shared by
+        // all ib.
+        Int* relColsL = NULL;
+
         for( Int ib = 0; ib < LcolRecv.size(); ib++ ){
           LBlock<T>& LB = LcolRecv[ib];//得到接收到的Lblock
-          UBlock<T>& UB = UrowRecv[jb];//得到接收到的Ublock
           Int isup = LB.blockIdx;//找到对应的L block的supernode行
-          Int jsup = UB.blockIdx;//找到对应的U block的supernode列
-          T* nzvalAinv = &AinvBuf( rowPtr[ib], colPtr[jb] );//得到(isup, jsup)的第一个数据位置，即第j列第i行，这里是column major
-          Int     ldAinv    = AinvBuf.m();//得到有非零行，用于后续列序遍历使用
-          //此时本地的L Block和U Block都是Ainv的形状了
 
           // Pin down the corresponding block in the part of Sinv.
           if( isup >= jsup ){//如果是下三角，用L矩阵
             std::vector<LBlock<T> >&  LcolSinv = this->L( LBj(jsup, grid_ ) );//找到本processor保存的对应列的所有L Sinv block
-            bool isBlockFound = false;                                        //是因为现在算法已经开始了进行覆盖了吗？好像是用Ainv block将L block覆盖掉了
+            bool isBlockFound = false;
             TIMER_START(PARSING_ROW_BLOCKIDX);
             for( Int ibSinv = 0; ibSinv < LcolSinv.size(); ibSinv++ ){
               // Found the (isup, jsup) block in Sinv
@@ -791,128 +1069,21 @@ namespace PEXSI{
                 Int* rowsSinvBPtr = SinvB.rows.Data();//本地Sinv block的非零行的下标
 
                 // Column relative indicies
-                Int SinvColsSta = FirstBlockCol( jsup, super_ );//这个jsup对应supernode的第一个列
-
-#ifdef _OPENMP_BLOCKS_
-                Int lastRowIdxSinv = 0;
-                Int blockRowsSize = 0; 
-                Int blockColsSize = 0;
-                Int * blockRows = new Int[3*LB.numRow]; 
-                Int * blockCols = new Int[2*UB.numCol]; 
-
-
-                Int* colsUBPtr    = UB.cols.Data();
-
-                if(LB.numRow>0){
-                  //find blocks
-                  Int ifr = 0;
-                  Int fr = rowsLBPtr[0];
-                  Int nrows = 1;
-                  for( Int i = 1; i < LB.numRow; i++ ){
-                    if(rowsLBPtr[i]==rowsLBPtr[i-1]+1){ 
-                      nrows++;
-                    }
-                    else{
-                      blockRows[blockRowsSize++] = fr;
-                      blockRows[blockRowsSize++] = nrows;
-                      blockRows[blockRowsSize++] = ifr;
-                      fr = rowsLBPtr[i];
-                      nrows = 1;
-                      ifr = i;
-                    }
-                  }
-                  blockRows[blockRowsSize++] = fr;
-                  blockRows[blockRowsSize++] = nrows;
-                  blockRows[blockRowsSize++] = ifr;
-
-
-                  for(Int ii = 0; ii<blockRowsSize;ii+=3){
-                    {
-                      auto fr = blockRows[ii];
-                      auto nr = blockRows[ii+1];
-                      Int ifr = blockRows[ii+2];
-
-                      bool isRowFound = false;
-                      for( lastRowIdxSinv; lastRowIdxSinv < SinvB.numRow; lastRowIdxSinv++ ){
-                        if( fr == rowsSinvBPtr[lastRowIdxSinv] ){
-                          isRowFound = true;
-                          blockRows[ii] = lastRowIdxSinv;
-                          break;
-                        }
-                      }
-                      if( isRowFound == false ){
-                        std::ostringstream msg;
-                        msg << "Row " << rowsLBPtr[ifr] << "("<<fr<<")"
-                          " in pLB cannot find the corresponding row in SinvB" << std::endl
-                          << "LB.rows    = " << LB.rows << std::endl
-                          << "SinvB.rows = " << SinvB.rows << std::endl;
-                        ErrorHandling( msg.str().c_str() );
-                      }
-                    }
-                  }
-                }
-
-                if(UB.numCol>0){
-                  //find blocks
-                  Int fc = colsUBPtr[0]- SinvColsSta;
-                  Int ncols = 1;
-                  for( Int j = 1; j < UB.numCol; j++ ){
-                    if(colsUBPtr[j]==colsUBPtr[j-1]+1){ 
-                      ncols++;
-                    }
-                    else{
-                      blockCols[blockColsSize++] = fc;
-                      blockCols[blockColsSize++] = ncols;
-                      fc = colsUBPtr[j]- SinvColsSta;
-                      ncols = 1;
-                    }
-                  }
-                  blockCols[blockColsSize++] = fc;
-                  blockCols[blockColsSize++] = ncols;
-                }
-
-
-
-                // Transfer the values from Sinv to AinvBlock
-                T* nzvalSinv = SinvB.nzval.Data();
-                Int     ldSinv    = SinvB.numRow;
-
-                Int j = 0;
-                for(Int jj = 0; jj<blockColsSize;jj+=2){
-                  auto fc = blockCols[jj];
-                  auto nc = blockCols[jj+1];
-                  Int offsetJ = j+colPtr[jb];
-                  Int i = 0;
-                  for(Int ii = 0; ii<blockRowsSize;ii+=3){
-                    auto fr = blockRows[ii];
-                    auto nr = blockRows[ii+1];
-                    Int ifr = blockRows[ii+2];
-                    assert(i==ifr);
-                    lapack::Lacpy( 'A', nr, nc, &nzvalSinv[fr+fc*ldSinv],ldSinv,&nzvalAinv[i+j*ldAinv],ldAinv );
-                    i+=nr;
+                if( relColsL == NULL ){
+                  Int SinvColsSta = FirstBlockCol( jsup, super_ );//这个jsup对应supernode的第一个列
+                  relColsL = AinvDst.NewIndexMap( UB.numCol );
+                  for( Int j = 0; j < UB.numCol; j++ ){
+                    relColsL[j] = UB.cols[j] - SinvColsSta;
                   }
-                  j+=nc;
-                }
-
-                delete [] blockCols;
-                delete [] blockRows;
-#else
-                std::vector<Int> relCols( UB.numCol );//记录U block的相对列
-                for( Int j = 0; j < UB.numCol; j++ ){
-                  relCols[j] = UB.cols[j] - SinvColsSta;
                 }
 
-                std::vector<Int> relRows( LB.numRow );//记录L block的相对行
+                Int* relRows = AinvDst.NewIndexMap( LB.numRow );//记录L block的相对行
                 for( Int i = 0; i < LB.numRow; i++ ){
-                  bool isRowFound = false;
-                  for( Int i1 = 0; i1 < SinvB.numRow; i1++ ){
-                    if( rowsLBPtr[i] == rowsSinvBPtr[i1] ){//将LB的row转化为Sinv Bblock的本地row
-                      isRowFound = true;
-                      relRows[i] = i1;
-                      break;
-                    }
+                  Int i1 = 0;
+                  while( i1 < SinvB.numRow && rowsSinvBPtr[i1] != rowsLBPtr[i] ){//将LB的row转化为Sinv Bblock的本地row
+                    i1++;
                   }
-                  if( isRowFound == false ){
+                  if( i1 == SinvB.numRow ){
                     std::ostringstream msg;
                     msg << "Row " << rowsLBPtr[i] << 
                       " in LB cannot find the corresponding row in SinvB" << std::endl
@@ -920,21 +1091,11 @@ namespace PEXSI{
                       << "SinvB.rows = " << SinvB.rows << std::endl;
                     ErrorHandling( msg.str().c_str() );
                   }
+                  relRows[i] = i1;
                 }
-                
-                // Transfer the values from Sinv to AinvBlock
-                T* nzvalSinv = SinvB.nzval.Data();
-                Int     ldSinv    = SinvB.numRow;//得到Sinv Block的行
-                
-                  for( Int j = 0; j < UB.numCol; j++ ){
-                    for( Int i = 0; i < LB.numRow; i++ ){
-                      nzvalAinv[i+j*ldAinv] =
-                        nzvalSinv[relRows[i] + relCols[j] * ldSinv];//这里就是将Sinv Block复制到Ainv的对应地方去了
-                    }
-                  }
 
-                
-#endif
+                AinvDst.AddTile( SinvB.nzval.Data(), SinvB.numRow, relRows, relColsL,
+                    rowPtr[ib], colPtr[jb], LB.numRow, UB.numCol );
 
                 isBlockFound = true;
                 break;
@@ -949,7 +1110,7 @@ namespace PEXSI{
             }
           } // if (isup, jsup) is in L
           else{//如果是上三角，用U矩阵，同上
-            std::vector<UBlock<T> >&   UrowSinv = this->U( LBi( isup, grid_ ) );//找到本processor保存的对应列的所有U Sinv block，不懂为什么现在是U sinv了
+            std::vector<UBlock<T> >&   UrowSinv = this->U( LBi( isup, grid_ ) );//找到本processor保存的对应列的所有U Sinv block
             bool isBlockFound = false;
             TIMER_START(PARSING_COL_BLOCKIDX);
             for( Int jbSinv = 0; jbSinv < UrowSinv.size(); jbSinv++ ){
@@ -959,126 +1120,21 @@ namespace PEXSI{
 
                 // Row relative indices
                 Int SinvRowsSta = FirstBlockCol( isup, super_ );
-
-                Int* colsUBPtr    = UB.cols.Data();
-                Int* colsSinvBPtr = SinvB.cols.Data();
-#ifdef _OPENMP_BLOCKS_
-                Int* rowsLBPtr    = LB.rows.Data();
-
-                Int lastColIdxSinv = 0;
-                Int * blockCols = new Int[3*UB.numCol];
-                Int * blockRows = new Int[2*LB.numRow];
-                Int blockColsSize = 0;
-                Int blockRowsSize = 0;
-
-                if(UB.numCol>0){
-                  //find blocks
-                  Int jfc = 0;
-                  Int fc = colsUBPtr[0];
-                  Int ncols = 1;
-                  for( Int j = 1; j < UB.numCol; j++ ){
-                    if(colsUBPtr[j]==colsUBPtr[j-1]+1){ 
-                      ncols++;
-                    }
-                    else{
-                      blockCols[blockColsSize++] = fc;
-                      blockCols[blockColsSize++] = ncols;
-                      blockCols[blockColsSize++] = jfc;
-                      fc = colsUBPtr[j];
-                      ncols = 1;
-                      jfc = j;
-                    }
-                  }
-                  blockCols[blockColsSize++] = fc;
-                  blockCols[blockColsS欧提葡萄ize++] = ncols;
-                  blockCols[blockColsSize++] = jfc;
-
-                  for(Int jj = 0; jj<blockColsSize;jj+=3){
-                    auto fc = blockCols[jj];
-                    auto nc = blockCols[jj+1];
-                    Int jfc = blockCols[jj+2];
-
-                    bool isColFound = false;
-                    for( lastColIdxSinv; lastColIdxSinv < SinvB.numCol; lastColIdxSinv++ ){
-                      if( fc == colsSinvBPtr[lastColIdxSinv] ){
-                        isColFound = true;
-                        blockCols[jj] = lastColIdxSinv;
-                        break;
-                      }
-                    }
-                    if( isColFound == false ){
-                      std::ostringstream msg;
-                      msg << "Col " << colsUBPtr[jfc] << "("<<fc<<")"
-                        " in UB cannot find the corresponding row in SinvB" << std::endl
-                        << "UB.cols    = " << UB.cols << std::endl
-                        << "SinvB.cols = " << SinvB.cols << std::endl;
-                      ErrorHandling( msg.str().c_str() );
-                    }
-                  }
-                }
-
-                if(LB.numRow>0){
-                  //find blocks
-                  Int fr = rowsLBPtr[0]- SinvRowsSta;
-                  Int nrows = 1;
-                  for( Int j = 1; j < LB.numRow; j++ ){
-                    if(rowsLBPtr[j]==rowsLBPtr[j-1]+1){ 
-                      nrows++;
-                    }
-                    else{
-                      blockRows[blockRowsSize++] = fr;
-                      blockRows[blockRowsSize++] = nrows;
-                      fr = rowsLBPtr[j]- SinvRowsSta;
-                      nrows = 1;
-                    }
-                  }
-                  blockRows[blockRowsSize++] = fr;
-                  blockRows[blockRowsSize++] = nrows;
-                }
-
-
-                // Transfer the values from Sinv to AinvBlock
-                T* nzvalSinv = SinvB.nzval.Data();
-                Int     ldSinv    = SinvB.numRow;
-
-                Int j = 0;
-                for(Int jj = 0; jj<blockColsSize;jj+=3){
-                  auto fc = blockCols[jj];
-                  auto nc = blockCols[jj+1];
-                  Int jfc = blockCols[jj+2];
-                  Int offsetJ = j+colPtr[jb];
-
-                  Int i = 0;
-                  for(Int ii = 0; ii<blockRowsSize;ii+=2){
-                    auto fr = blockRows[ii];
-                    auto nr = blockRows[ii+1];
-                    Int offsetI = i+rowPtr[ib];
-                    lapack::Lacpy( 'A', nr, nc, &nzvalSinv[fr+fc*ldSinv],ldSinv,&nzvalAinv[i+j*ldAinv],ldAinv );
-                    i+=nr;
-                  }
-                  j+=nc;
-                }
-
-                delete [] blockCols;
-                delete [] blockRows;
-#else
-                std::vector<Int> relRows( LB.numRow );
+                Int* relRows = AinvDst.NewIndexMap( LB.numRow );
                 for( Int i = 0; i < LB.numRow; i++ ){
                   relRows[i] = LB.rows[i] - SinvRowsSta;
                 }
 
                 // Column relative indices
-                std::vector<Int> relCols( UB.numCol );
+                Int* colsUBPtr    = UB.cols.Data();
+                Int* colsSinvBPtr = SinvB.cols.Data();
+                Int* relCols = AinvDst.NewIndexMap( UB.numCol );
                 for( Int j = 0; j < UB.numCol; j++ ){
-                  bool isColFound = false;
-                  for( Int j1 = 0; j1 < SinvB.numCol; j1++ ){
-                    if( colsUBPtr[j] == colsSinvBPtr[j1] ){
-                      isColFound = true;
-                      relCols[j] = j1;
-                      break;
-                    }
+                  Int j1 = 0;
+                  while( j1 < SinvB.numCol && colsSinvBPtr[j1] != colsUBPtr[j] ){
+                    j1++;
                   }
-                  if( isColFound == false ){
+                  if( j1 == SinvB.numCol ){
                     std::ostringstream msg;
                     msg << "Col " << colsUBPtr[j] << 
                       " in UB cannot find the corresponding row in SinvB" << std::endl
@@ -1086,22 +1142,11 @@ namespace PEXSI{
                       << "UinvB.cols = " << SinvB.cols << std::endl;
                     ErrorHandling( msg.str().c_str() );
                   }
+                  relCols[j] = j1;
                 }
 
-
-                // Transfer the values from Sinv to AinvBlock
-                T* nzvalSinv = SinvB.nzval.Data();
-                Int     ldSinv    = SinvB.numRow;
-                
-
-                  for( Int j = 0; j < UB.numCol; j++ ){
-                    for( Int i = 0; i < LB.numRow; i++ ){
-                      nzvalAinv[i+j*ldAinv] =
-                        nzvalSinv[relRows[i] + relCols[j] * ldSinv];//这里就是将Sinv Block复制到Ainv的对应地方去了
-                    }
-                  }
-
-#endif
+                AinvDst.AddTile( SinvB.nzval.Data(), SinvB.numRow, relRows, relCols,
+                    rowPtr[ib], colPtr[jb], LB.numRow, UB.numCol );
 
                 isBlockFound = true;
                 break;
@@ -1119,8 +1164,6 @@ namespace PEXSI{
         } // for( ib )
       } // for ( jb )
 
-
-#endif
       TIMER_STOP(JB_Loop);
 
 
@@ -1130,7 +1173,7 @@ namespace PEXSI{
   template<typename T>
     inline void PMatrix<T>::SendRecvCD_UpdateU(
         std::vector<SuperNodeBufferType > & arrSuperNodes, 
-        Int stepSuper)
+        Int stepSuper, MPI_Comm comm)
     {
 
       TIMER_START(Send_CD_Update_U);
@@ -1163,7 +1206,6 @@ namespace PEXSI{
         SuperNodeBufferType & snode = arrSuperNodes[supidx];
 
         // Send LUpdateBufReduced to the cross diagonal blocks. 
-        // NOTE: This assumes square processor grid
 
         TIMER_START(Send_L_CrossDiag);
 
@@ -1179,13 +1221,41 @@ namespace PEXSI{
                 MPI_Request & mpiReqSend = arrMpiReqsSendCD[sendOffset[supidx]+sendIdx];//发送内容句柄
 
 
+                // Only the rows of the blocks owned by dest, i.e. with
+                // isup in the processor column dstCol.  On a square grid
+                // with the block cyclic map this is the whole buffer.
+                std::vector<Int> rowLocalPtrSend( 1, 0 );
+                std::vector<Int> blockIdxLocalSend;
+                for( Int ib = 0; ib < (Int)snode.BlockIdxLocal.size(); ib++ ){
+                  if( PCOL( snode.BlockIdxLocal[ib], grid_ ) == dstCol ){
+                    blockIdxLocalSend.push_back( snode.BlockIdxLocal[ib] );
+                    rowLocalPtrSend.push_back( rowLocalPtrSend.back() + 
+                        snode.RowLocalPtr[ib+1] - snode.RowLocalPtr[ib] );
+                  }
+                }
+
                 std::stringstream sstm;
                 std::vector<char> & sstrLcolSend = arrSstrLcolSendCD[sendOffset[supidx]+sendIdx];
                 Int & sstrSize = arrSstrLcolSizeSendCD[sendOffset[supidx]+sendIdx];
                 //打包Ainv的内容
-                serialize( snode.RowLocalPtr, sstm, NO_MASK );
-                serialize( snode.BlockIdxLocal, sstm, NO_MASK );
-                serialize( snode.LUpdateBuf, sstm, NO_MASK );
+                serialize( rowLocalPtrSend, sstm, NO_MASK );
+                serialize( blockIdxLocalSend, sstm, NO_MASK );
+                if( blockIdxLocalSend.size() == snode.BlockIdxLocal.size() ){
+                  serialize( snode.LUpdateBuf, sstm, NO_MASK );
+                }
+                else{
+                  NumMat<T> LUpdateBufSend( rowLocalPtrSend.back(), snode.LUpdateBuf.n() );
+                  Int cnt = 0;
+                  for( Int ib = 0; ib < (Int)snode.BlockIdxLocal.size(); ib++ ){
+                    if( PCOL( snode.BlockIdxLocal[ib], grid_ ) == dstCol ){
+                      lapack::Lacpy( 'A', snode.RowLocalPtr[ib+1] - snode.RowLocalPtr[ib], LUpdateBufSend.n(),
+                          &snode.LUpdateBuf( snode.RowLocalPtr[ib], 0 ), snode.LUpdateBuf.m(),
+                          &LUpdateBufSend( rowLocalPtrSend[cnt], 0 ), LUpdateBufSend.m() );
+                      cnt++;
+                    }
+                  }
+                  serialize( LUpdateBufSend, sstm, NO_MASK );
+                }
 
                 sstrLcolSend.resize( Size(sstm) );
                 sstm.read( &sstrLcolSend[0], sstrLcolSend.size() );//将内容发送到本地数组
@@ -1196,8 +1266,8 @@ namespace PEXSI{
                 assert(IDX_TO_TAG(snode.Rank,SELINV_TAG_L_CONTENT_CD,limIndex_)<=maxTag_);
 #endif
                 //发送
-                MPI_Isend( &sstrSize, sizeof(sstrSize), MPI_BYTE, dest, IDX_TO_TAG(snode.Rank,SELINV_TAG_L_SIZE_CD,limIndex_), grid_->comm, &mpiReqSizeSend );
-                MPI_Isend( (void*)&sstrLcolSend[0], sstrSize, MPI_BYTE, dest, IDX_TO_TAG(snode.Rank,SELINV_TAG_L_CONTENT_CD,limIndex_), grid_->comm, &mpiReqSend );
+                MPI_Isend( &sstrSize, sizeof(sstrSize), MPI_BYTE, dest, IDX_TO_TAG(snode.Rank,SELINV_TAG_L_SIZE_CD,limIndex_), comm, &mpiReqSizeSend );
+                MPI_Isend( (void*)&sstrLcolSend[0], sstrSize, MPI_BYTE, dest, IDX_TO_TAG(snode.Rank,SELINV_TAG_L_CONTENT_CD,limIndex_), comm, &mpiReqSend );
 
                 PROFILE_COMM(MYPROC(this->grid_),dest,IDX_TO_TAG(snode.Rank,SELINV_TAG_L_SIZE_CD,limIndex_),sizeof(sstrSize));
                 PROFILE_COMM(MYPROC(this->grid_),dest,IDX_TO_TAG(snode.Rank,SELINV_TAG_L_CONTENT_CD,limIndex_),sstrSize);
@@ -1231,7 +1301,7 @@ namespace PEXSI{
                 assert(IDX_TO_TAG(snode.Rank,SELINV_TAG_L_CONTENT_CD,limIndex_)<=maxTag_);
 #endif
                 //接受大小
-                MPI_Irecv( &sstrSize, 1, MPI_INT, src, IDX_TO_TAG(snode.Rank,SELINV_TAG_L_SIZE_CD,limIndex_), grid_->comm, &mpiReqSizeRecv);
+                MPI_Irecv( &sstrSize, 1, MPI_INT, src, IDX_TO_TAG(snode.Rank,SELINV_TAG_L_SIZE_CD,limIndex_), comm, &mpiReqSizeRecv);
                 recvIdx++;
               }
             }
@@ -1259,7 +1329,7 @@ namespace PEXSI{
 #if ( _DEBUGlevel_ >= 1 )
                 assert(IDX_TO_TAG(snode.Rank,SELINV_TAG_L_CONTENT_CD,limIndex_)<=maxTag_);
 #endif
-                MPI_Irecv( (void*)&sstrLcolRecv[0], sstrSize, MPI_BYTE, src, IDX_TO_TAG(snode.Rank,SELINV_TAG_L_CONTENT_CD,limIndex_), grid_->comm, &mpiReqRecv );//接受内容
+                MPI_Irecv( (void*)&sstrLcolRecv[0], sstrSize, MPI_BYTE, src, IDX_TO_TAG(snode.Rank,SELINV_TAG_L_CONTENT_CD,limIndex_), comm, &mpiReqRecv );//接受内容
                 recvIdx++;
               }
             }
@@ -1273,8 +1343,7 @@ namespace PEXSI{
       for (Int supidx=0; supidx<stepSuper; supidx++){
         SuperNodeBufferType & snode = arrSuperNodes[supidx];
 
-        // Send LUpdateBufReduced to the cross diagonal blocks. 
-        // NOTE: This assumes square processor grid
+        // Receive LUpdateBufReduced from the cross diagonal blocks. 
         if( MYROW( grid_ ) == PROW( snode.Index, grid_ ) && isRecvFromCrossDiagonal_(grid_->numProcRow, snode.Index ) ){
 
 #if ( _DEBUGlevel_ >= 1 )
@@ -1362,33 +1431,57 @@ namespace PEXSI{
   template<typename T>
     inline void PMatrix<T>::UnpackData(
         SuperNodeBufferType & snode, 
-        std::vector<LBlock<T> > & LcolRecv, 
-        std::vector<UBlock<T> > & UrowRecv )
+        Int sizeUArrived )
     {
 #if ( _DEBUGlevel_ >= 1 )
       statusOFS << std::endl << "["<<snode.Index<<"] "<<  "Unpack the received data for processors participate in Gemm. " << std::endl << std::endl; 
 #endif
+      std::vector<LBlock<T> > & LcolRecv = snode.LcolRecv;
+      std::vector<UBlock<T> > & UrowRecv = snode.UrowRecv;
+
       // U part
       if( MYROW( grid_ ) != PROW( snode.Index, grid_ ) ){
-        std::stringstream sstm;
-        sstm.write( &snode.SstrUrowRecv[0], snode.SstrUrowRecv.size() );
+        // Only the blocks entirely within the bytes arrived so far.
+        const char * buf = &snode.SstrUrowRecv[0];
+        if( snode.NumUBlock < 0 ){
+          if( sizeUArrived < (Int)sizeof(Int) ){
+            return;
+          }
+          std::memcpy( &snode.NumUBlock, buf, sizeof(Int) );
+          snode.UReadOffset = sizeof(Int);
+        }
         std::vector<Int> mask( UBlockMask::TOTAL_NUMBER, 1 );
-        Int numUBlock;
-        deserialize( numUBlock, sstm, NO_MASK );
-        UrowRecv.resize( numUBlock );
-        for( Int jb = 0; jb < numUBlock; jb++ ){
-          deserialize( UrowRecv[jb], sstm, mask );
+        while( snode.NumUBlockDone + (Int)UrowRecv.size() < snode.NumUBlock ){
+          Int offset = snode.UReadOffset;
+          if( offset + (Int)sizeof(Int) > sizeUArrived ){
+            break;
+          }
+          // Each block is preceded by its size in bytes, see
+          // SelInvIntra_P2p.
+          Int blockSize;
+          std::memcpy( &blockSize, buf + offset, sizeof(Int) );
+          if( offset + (Int)sizeof(Int) + blockSize > sizeUArrived ){
+            break;
+          }
+          ByteIStream sstm( buf + offset + sizeof(Int), blockSize );
+          UrowRecv.push_back( UBlock<T>() );
+          deserialize( UrowRecv.back(), sstm, mask );
+          snode.UReadOffset += sizeof(Int) + blockSize;
         } 
       } // sender is not the same as receiver
-      else{
+      else if( snode.NumUBlock < 0 ){
         // U is obtained locally, just make a copy. Include everything
         // (there is no diagonal block)
         // Is it a copy ?  LL: YES. Maybe we should replace the copy by
         // something more efficient especially for mpisize == 1
         UrowRecv.resize(this->U( LBi( snode.Index, grid_ ) ).size());
         std::copy(this->U( LBi( snode.Index, grid_ ) ).begin(),this->U( LBi( snode.Index, grid_ )).end(),UrowRecv.begin());
+        snode.NumUBlock = UrowRecv.size();
       } // sender is the same as receiver
 
+      if( snode.NumUPanel > 0 ){
+        return;
+      }
 
       //L part
       if( MYCOL( grid_ ) != PCOL( snode.Index, grid_ ) ){
@@ -1414,117 +1507,284 @@ namespace PEXSI{
     }
 
   template<typename T>
-    inline void PMatrix<T>::ComputeDiagUpdate(SuperNodeBufferType & snode, cublasHandle_t& handle, std::set<std::string> quantSuperNode)
+    inline Int PMatrix<T>::NumUChunk(Int msgSize) const
     {
+      Int chunkSize = ( options_ != NULL ) ? options_->uChunkSize : 0;
+      if( chunkSize <= 0 || msgSize <= chunkSize ){
+        return 1;
+      }
+      return ( msgSize + chunkSize - 1 ) / chunkSize;
+    }
 
-      //---------Computing  Diagonal block, all processors in the column are participating to all pipelined supernodes
-      if( MYCOL( grid_ ) == PCOL( snode.Index, grid_ ) ){ //如果本processor和这个supernode在一列，即Ljk
-#if ( _DEBUGlevel_ >= 2 )
-        statusOFS << std::endl << "["<<snode.Index<<"] "<<   "Updating the diagonal block" << std::endl << std::endl; 
-#endif
-        std::vector<LBlock<T> >&  Lcol = this->L( LBj( snode.Index, grid_ ) ); //得到本地的所有L block
+  template<typename T>
+    inline Int PMatrix<T>::UChunkOffset(Int msgSize, Int c) const
+    {
+      if( c >= NumUChunk( msgSize ) ){
+        return msgSize;
+      }
+      return ( c == 0 ) ? 0 : c * options_->uChunkSize;
+    }
 
-        //Allocate DiagBuf even if Lcol.size() == 0
-        snode.DiagBuf.Resize(SuperSize( snode.Index, super_ ), SuperSize( snode.Index, super_ )); //设置本地的Lkk
-        SetValue(snode.DiagBuf, ZERO<T>());
+  template<typename T>
+    inline Int PMatrix<T>::SizeUArrived(const SuperNodeBufferType & snode) const
+    {
+      return UChunkOffset( snode.SizeSstrUrowRecv, snode.NumUChunkArrived );
+    }
 
-        
-        std::stringstream ss;
-        // Do I own the diagonal block ?
-        Int startIb = (MYROW( grid_ ) == PROW( snode.Index, grid_ ))?1:0;//如果我拥有Lkk，那么要跳过这个block
+  template<typename T>
+    inline bool PMatrix<T>::IsSinvLTDone(const SuperNodeBufferType & snode) const
+    {
+      return snode.NumUPanel > 0 && snode.NumUBlockDone == snode.NumUBlock;
+    }
 
-        // NumMat<float> LUpdateBuf_quant(snode.LUpdateBuf.m(), snode.LUpdateBuf.n());
-        // for(int j = 0;j<LUpdateBuf_quant.n();j++){
-        //   for(int i = 0;i<LUpdateBuf_quant.m();i++){
-        //     LUpdateBuf_quant(i, j) = (float)snode.LUpdateBuf(i, j);
-        //   }
-        // }
-        for( Int ib = startIb; ib < Lcol.size(); ib++ ){
+  template<typename T>
+    inline void PMatrix<T>::ComputeSinvLT(
+        SuperNodeBufferType & snode,
+        SinvLTWorkspace & work,
+        std::set<std::string> & quantSuperNode,
+        Int sizeUArrived)
+    {
+      // Only the processors received information participate in the Gemm 
+      if( isRecvFromAbove_( snode.Index ) && isRecvFromLeft_( snode.Index ) && !IsSinvLTDone( snode ) ){
+
+        std::vector<LBlock<T> > & LcolRecv = snode.LcolRecv;
+        std::vector<UBlock<T> > & UrowRecv = snode.UrowRecv;
+        // Save all the data to be updated for { L( isup, snode.Index ) | isup > snode.Index }.
+        // The size will be updated in the Gemm phase and the reduce phase
+
+        UnpackData(snode, sizeUArrived);//将接收到的数据放回LU block中，即它接收到的L block和U block现在都在LcolRecv以及UrowRecv里面了
+        // The first panel initializes LUpdateBuf, even without U blocks.
+        if( snode.NumUBlock < 0 || ( snode.NumUPanel > 0 && UrowRecv.size() == 0 ) ){
+          return;
+        }
+        //这一步记录AinvBuf和UBuf的每一块在Sinv和UrowRecv中的位置，GEMM的时候再直接从那里读取
+        SelInv_lookup_indexes(snode,LcolRecv, UrowRecv,work.AinvMat, work.UMat, work.AinvMat_quant, work.UMat_quant, quantSuperNode);
 
+        // The panels of the U blocks arrived later are accumulated.
+        T beta = ( snode.NumUPanel == 0 ) ? ZERO<T>() : ONE<T>();
+        if( snode.NumUPanel == 0 ){
+          snode.LUpdateBuf.Resize( work.AinvMat.m(), SuperSize( snode.Index, super_ ) );//调整LUpdateBuf的大小，为AinvBuf行，snode对应supernode大小的列
+        }
 #ifdef GEMM_PROFILE
-          gemm_stat.push_back(snode.DiagBuf.m());
-          gemm_stat.push_back(snode.DiagBuf.n());
-          gemm_stat.push_back(Lcol[ib].numRow);
+#ifdef _OMP_ENABLED_
+#pragma omp critical(PEXSI_gemm_stat)
 #endif
+        {
+          gemm_stat.push_back(work.AinvMat.m());
+          gemm_stat.push_back(work.UMat.m());
+          gemm_stat.push_back(work.AinvMat.n());
+        }
+#endif
+        TIMER_START(Compute_Sinv_LT_GEMM);
+        //下面的意思表示:LUpdateBuf = -1 * AinvBuf * Ubuf^T + 0 * LUpdateBuf
+        work.gemmEngine->GemmNT( MINUS_ONE<T>(), work.AinvMat, work.UMat, beta,
+            snode.LUpdateBuf.Data(), snode.LUpdateBuf.m() );
 
-          LBlock<T> & LB = Lcol[ib];
-          
-          ss.str("");
-          ss<<LB.blockIdx << "," <<snode.Index;
-
-          if(quantSuperNode.find(ss.str()) == quantSuperNode.end()){
-            //下面应该是第四步，意思是：
-            //Lkk = -1 * (A^-1)^T * L + 1 * Lkk
-            //但是这里为什么是A-1的转置不太懂
-            //这里Lik和A-1的下标都是一样的，所以直接判断Lik的坐标就可以进行量化了
-
-            // NumMat<double> tmpCuda(snode.DiagBuf.m(), snode.DiagBuf.n());
-            NumMat<double> tmp_quant(LB.numRow, snode.DiagBuf.m());
-            for(int j = 0;j<tmp_quant.n(); j++){
-              for(int i = 0;i<tmp_quant.m();i++){
-                tmp_quant(i, j) = snode.LUpdateBuf(snode.RowLocalPtr[ib - startIb] + i, j);
-              }
+        if(work.AinvMat_quant.n() > 0){//UBuf有被量化的部分，用单精度计算后加到LUpdateBuf中
+#ifdef GEMM_PROFILE
+#ifdef _OMP_ENABLED_
+#pragma omp critical(PEXSI_gemm_stat)
+#endif
+          {
+            gemm_stat.push_back(work.AinvMat_quant.m());
+            gemm_stat.push_back(work.UMat_quant.m());
+            gemm_stat.push_back(work.AinvMat_quant.n());
+          }
+#endif
+          NumMat<float> & quantBuf = work.quantBuf;
+          quantBuf.Resize(work.AinvMat_quant.m(), SuperSize( snode.Index, super_ ));//记录公式的临时量化数据大小
+          work.gemmEngineQuant->GemmNT( MINUS_ONE<float>(), work.AinvMat_quant, work.UMat_quant, ZERO<float>(),
+              quantBuf.Data(), quantBuf.m() );
+
+          //将quantBuf的结果添加到LUpadateBuf中
+          for(int j = 0;j<quantBuf.n();j++){
+            for(int i = 0;i<quantBuf.m();i++){
+              snode.LUpdateBuf(i, j) = snode.LUpdateBuf(i, j) + (double)quantBuf(i, j);
             }
-            gpu_blas_dmmul(handle, 'T', 'N', snode.DiagBuf.m(), snode.DiagBuf.n(), LB.numRow, 
-                MINUS_ONE<T>(), tmp_quant.Data(), tmp_quant.m(),
-                LB.nzval.Data(), LB.nzval.m(),ONE<T>(), snode.DiagBuf.Data(), snode.DiagBuf.m() );
+          }
+        }
+        TIMER_STOP(Compute_Sinv_LT_GEMM);
+        //第三步量化已经完成
+
+        snode.NumUBlockDone += UrowRecv.size();
+        snode.NumUPanel++;
+        UrowRecv.clear();
+        if( IsSinvLTDone( snode ) ){
+          std::vector<LBlock<T> >().swap( LcolRecv );
+        }
 
-          }else{
-            //进行量化，但是由于精度不同，应该分为两步
-            //先把A-1和L进行量化
-            // std::cout<<"Step 5 : Quant "<<ss.str()<<std::endl;
-            
+#if ( _DEBUGlevel_ >= 2 )
+        statusOFS << std::endl << "["<<snode.Index<<"] "<<  "snode.LUpdateBuf: " << snode.LUpdateBuf << std::endl;
+#endif
+      } // if Gemm is to be done locally
+    }
 
-            // double* LUpdateBuf_data =  &snode.LUpdateBuf( snode.RowLocalPtr[ib-startIb], 0 );
-            // for(int j = 0;j<LUpdateBuf_quant.n();j++){
-            //   for(int i = 0;i<LUpdateBuf_quant.m();i++){
-            //     LUpdateBuf_quant(i, j) = (float)LUpdateBuf_data[i + j * LUpdateBuf_quant.m()];
-            //   }
-            // }
-            NumMat<float> tmp_quant(LB.numRow, snode.DiagBuf.m());
-            for(int j = 0;j<tmp_quant.n(); j++){
-              for(int i = 0;i<tmp_quant.m();i++){
-                tmp_quant(i, j) = (float)snode.LUpdateBuf(snode.RowLocalPtr[ib - startIb] + i, j);
-              }
+  template<typename T>
+    inline Int PMatrix<T>::NumThreads() const
+    {
+      if( options_ != NULL && options_->numThreads > 0 ){
+        return options_->numThreads;
+      }
+#ifdef _OMP_ENABLED_
+      return omp_get_max_threads();
+#else
+      return 1;
+#endif
+    }
+
+  template<typename T>
+    inline bool PMatrix<T>::IsDiagUpdateLower() const
+    {
+      if( options_ != NULL && options_->symmetricStorage == 1 ){
+        return true;
+      }
+      return optionsFact_ != NULL && optionsFact_->Symmetric == 1 && !flops::is_complex<T>();
+    }
+
+  template<typename T>
+    inline void PMatrix<T>::ComputeDiagUpdate(SuperNodeBufferType & snode, cublasHandle_t& handle, std::set<std::string> & quantSuperNode)
+    {
+
+      //---------Computing  Diagonal block, all processors in the column are participating to all pipelined supernodes
+      if( MYCOL( grid_ ) == PCOL( snode.Index, grid_ ) ){ //如果本processor和这个supernode在一列，即Ljk
+#if ( _DEBUGlevel_ >= 2 )
+        statusOFS << std::endl << "["<<snode.Index<<"] "<<   "Updating the diagonal block" << std::endl << std::endl; 
+#endif
+        std::vector<LBlock<T> >&  Lcol = this->L( LBj( snode.Index, grid_ ) ); //得到本地的所有L block
+
+        //Allocate DiagBuf even if Lcol.size() == 0
+        snode.DiagBuf.Resize(SuperSize( snode.Index, super_ ), SuperSize( snode.Index, super_ )); //设置本地的Lkk
+        SetValue(snode.DiagBuf, ZERO<T>());
+
+        std::stringstream ss;
+        // Do I own the diagonal block ?
+        Int startIb = (MYROW( grid_ ) == PROW( snode.Index, grid_ ))?1:0;//如果我拥有Lkk，那么要跳过这个block
+
+        // DiagBuf -= sum_ib LUpdateBuf(ib)^T * L(ib) is batched into one
+        // GEMM per precision.  The L blocks of each precision are packed
+        // into one panel.  The rows of LUpdateBuf of the double blocks
+        // are used in place when they are contiguous, i.e. when there is
+        // no quantized block in between, and packed otherwise.  The
+        // quantized blocks are packed into a single float panel.
+        // For symmetric matrices only the lower triangle is computed.
+        bool lowerOnly = IsDiagUpdateLower();
+        std::vector<bool> isQuantBlock(Lcol.size(), false);
+        Int numRowQuant = 0;
+        Int numRowDouble = 0;
+        Int numRunDouble = 0;
+        Int ibFirstDouble = -1;
+        for( Int ib = startIb; ib < (Int)Lcol.size(); ib++ ){
+          ss.str("");
+          ss<<Lcol[ib].blockIdx << "," <<snode.Index;
+          if(quantSuperNode.find(ss.str()) != quantSuperNode.end()){
+            isQuantBlock[ib] = true;
+            numRowQuant += Lcol[ib].numRow;
+          }
+          else{
+            if( ib == startIb || isQuantBlock[ib-1] ){
+              numRunDouble++;
             }
-            NumMat<float> LB_quant(LB.numRow, LB.numCol);
-            for(int j = 0;j<LB_quant.n();j++){
-              for(int i = 0;i<LB_quant.m();i++){
-                LB_quant(i, j) = (float)LB.nzval(i, j);
-              }
+            if( ibFirstDouble < 0 ){
+              ibFirstDouble = ib;
             }
+            numRowDouble += Lcol[ib].numRow;
+          }
+        }
 
-            //然后用一个临时的量化Lkk保存它们的结果，而不能直接加进来
-            NumMat<float> DiagBuf_quant(SuperSize( snode.Index, super_ ), SuperSize( snode.Index, super_ ));
+        // Double blocks.
+        if( numRowDouble > 0 ){
+          NumMat<T> LPanel( numRowDouble, snode.DiagBuf.n() );
+          NumMat<T> AinvPanel;
+          if( numRunDouble > 1 ){
+            AinvPanel.Resize( numRowDouble, snode.DiagBuf.m() );
+          }
+          Int rowOffset = 0;
+          for( Int jb = startIb; jb < (Int)Lcol.size(); jb++ ){
+            if( isQuantBlock[jb] ) continue;
+            LBlock<T> & LB = Lcol[jb];
+            lapack::Lacpy( 'A', LB.numRow, LB.numCol, LB.nzval.Data(), LB.numRow,
+                &LPanel( rowOffset, 0 ), LPanel.m() );
+            if( numRunDouble > 1 ){
+              lapack::Lacpy( 'A', LB.numRow, AinvPanel.n(),
+                  &snode.LUpdateBuf( snode.RowLocalPtr[jb - startIb], 0 ), snode.LUpdateBuf.m(),
+                  &AinvPanel( rowOffset, 0 ), AinvPanel.m() );
+            }
+            rowOffset += LB.numRow;
+          }
+          const T* AinvPtr = ( numRunDouble > 1 ) ? AinvPanel.Data() :
+            &snode.LUpdateBuf( snode.RowLocalPtr[ibFirstDouble - startIb], 0 );
+          Int ldAinv = ( numRunDouble > 1 ) ? AinvPanel.m() : snode.LUpdateBuf.m();
 
-            gpu_blas_smmul(handle, 'T', 'N', snode.DiagBuf.m(), snode.DiagBuf.n(), LB.numRow, 
-                MINUS_ONE<float>(), tmp_quant.Data(), tmp_quant.m(),
-                LB_quant.Data(), LB.nzval.m(), ZERO<float>(), DiagBuf_quant.Data(), snode.DiagBuf.m() );
-            // blas::Gemm( 'T', 'N', snode.DiagBuf.m(), snode.DiagBuf.n(), LB.numRow, 
-            //     MINUS_ONE<float>(), tmp_quant.Data(), tmp_quant.m(),
-            //     LB_quant.Data(), LB.nzval.m(), ZERO<float>(), DiagBuf_quant.Data(), snode.DiagBuf.m() );
+#ifdef GEMM_PROFILE
+          gemm_stat.push_back(snode.DiagBuf.m());
+          gemm_stat.push_back(snode.DiagBuf.n());
+          gemm_stat.push_back(numRowDouble);
+#endif
+          //Lkk = -1 * (A^-1)^T * L + 1 * Lkk
+          if( lowerOnly ){
+            gpu_blas_dsyrkx(handle, 'L', 'T', snode.DiagBuf.m(), numRowDouble, 
+                MINUS_ONE<T>(), AinvPtr, ldAinv,
+                LPanel.Data(), LPanel.m(), ONE<T>(), snode.DiagBuf.Data(), snode.DiagBuf.m() );
+          }
+          else{
+            gpu_blas_dmmul(handle, 'T', 'N', snode.DiagBuf.m(), snode.DiagBuf.n(), numRowDouble, 
+                MINUS_ONE<T>(), AinvPtr, ldAinv,
+                LPanel.Data(), LPanel.m(), ONE<T>(), snode.DiagBuf.Data(), snode.DiagBuf.m() );
+          }
+#ifdef _PRINT_STATS_
+          this->localFlops_+=flops::Gemm<T>(snode.DiagBuf.m(), snode.DiagBuf.n(), numRowDouble);
+#endif
+        }
 
-            // blas::Gemm( 'T', 'N', snode.DiagBuf.m(), snode.DiagBuf.n(), LB.numRow, 
-            //     MINUS_ONE<float>(), &LUpdateBuf_quant( snode.RowLocalPtr[ib-startIb], 0 ), snode.LUpdateBuf.m(),
-            //     LB_quant.Data(), LB.nzval.m(), ZERO<float>(), DiagBuf_quant.Data(), snode.DiagBuf.m() );
-            //最后把结果加到Lkk中
-            for(int j = 0;j<DiagBuf_quant.n();j++){
-              for(int i = 0;i<DiagBuf_quant.m();i++){
-                snode.DiagBuf(i, j) = snode.DiagBuf(i, j) + (double)DiagBuf_quant(i, j);
+        // Quantized blocks, packed in float and accumulated separately.
+        if( numRowQuant > 0 ){
+          NumMat<float> AinvPanel_quant( numRowQuant, snode.DiagBuf.m() );
+          NumMat<float> LPanel_quant( numRowQuant, snode.DiagBuf.n() );
+          Int rowOffset = 0;
+          for( Int jb = startIb; jb < (Int)Lcol.size(); jb++ ){
+            if( !isQuantBlock[jb] ) continue;
+            LBlock<T> & LB = Lcol[jb];
+            Int rowLocal = snode.RowLocalPtr[jb - startIb];
+            for(int j = 0;j<AinvPanel_quant.n(); j++){
+              for(int i = 0;i<LB.numRow;i++){
+                AinvPanel_quant(rowOffset + i, j) = (float)snode.LUpdateBuf(rowLocal + i, j);
               }
             }
+            for(int j = 0;j<LB.numCol;j++){
+              for(int i = 0;i<LB.numRow;i++){
+                LPanel_quant(rowOffset + i, j) = (float)LB.nzval(i, j);
+              }
+            }
+            rowOffset += LB.numRow;
+          }
 
-            //释放资源
-            DiagBuf_quant.deallocate();
-            LB_quant.deallocate();
-            tmp_quant.deallocate();
+          NumMat<float> DiagBuf_quant(snode.DiagBuf.m(), snode.DiagBuf.n());
+#ifdef GEMM_PROFILE
+          gemm_stat.push_back(snode.DiagBuf.m());
+          gemm_stat.push_back(snode.DiagBuf.n());
+          gemm_stat.push_back(numRowQuant);
+#endif
+          if( lowerOnly ){
+            gpu_blas_ssyrkx(handle, 'L', 'T', snode.DiagBuf.m(), numRowQuant, 
+                MINUS_ONE<float>(), AinvPanel_quant.Data(), AinvPanel_quant.m(),
+                LPanel_quant.Data(), LPanel_quant.m(), ZERO<float>(), DiagBuf_quant.Data(), DiagBuf_quant.m() );
+          }
+          else{
+            gpu_blas_smmul(handle, 'T', 'N', snode.DiagBuf.m(), snode.DiagBuf.n(), numRowQuant, 
+                MINUS_ONE<float>(), AinvPanel_quant.Data(), AinvPanel_quant.m(),
+                LPanel_quant.Data(), LPanel_quant.m(), ZERO<float>(), DiagBuf_quant.Data(), DiagBuf_quant.m() );
           }
-          
 #ifdef _PRINT_STATS_
-                this->localFlops_+=flops::Gemm<T>(snode.DiagBuf.m(), snode.DiagBuf.n(), LB.numRow);
+          this->localFlops_+=flops::Gemm<float>(snode.DiagBuf.m(), snode.DiagBuf.n(), numRowQuant);
 #endif
-        } 
-        // LUpdateBuf_quant.deallocate();
+
+          //最后把结果加到Lkk中
+          for(int j = 0;j<DiagBuf_quant.n();j++){
+            for(int i = (lowerOnly ? j : 0);i<DiagBuf_quant.m();i++){
+              snode.DiagBuf(i, j) = snode.DiagBuf(i, j) + (double)DiagBuf_quant(i, j);
+            }
+          }
+        }
 
 #if ( _DEBUGlevel_ >= 1 )
         statusOFS << std::endl << "["<<snode.Index<<"] "<<   "Updated the diagonal block" << std::endl << std::endl; 
@@ -1600,6 +1860,123 @@ namespace PEXSI{
     } 		// -----  end of method PMatrix::GetEtree  ----- 
 
 
+  template<typename T>
+    inline void PMatrix<T>::GetStepFootprint(
+        std::vector<Real> & footprint)
+    {
+      Int numSuper = this->NumSuper();
+
+      // Buffers held by this processor while a supernode is in flight
+      // in SelInvIntra_P2p: the serialized U row and L column (sent or
+      // received), LUpdateBuf and DiagBuf with the receive buffers of
+      // their reductions.  All sizes are the message sizes of the
+      // trees built by ConstructCommunicationPattern.
+      std::vector<Real> localFootprint( numSuper, 0.0 );
+      bool hasTrees = (Int)fwdToBelowTree_.size() == numSuper && (Int)fwdToRightTree_.size() == numSuper 
+        && (Int)redToLeftTree_.size() == numSuper && (Int)redToAboveTree_.size() == numSuper;
+      if( hasTrees ){
+        for( Int ksup = 0; ksup < numSuper; ksup++ ){
+          Real bytes = 0.0;
+          TreeBcast * bcastUTree = fwdToBelowTree_[ksup];
+          TreeBcast * bcastLTree = fwdToRightTree_[ksup];
+          TreeReduce<T> * redLTree = redToLeftTree_[ksup];
+          TreeReduce<T> * redDTree = redToAboveTree_[ksup];
+          if( bcastUTree != NULL ){
+            bytes += bcastUTree->GetMsgSize();
+          }
+          if( bcastLTree != NULL ){
+            bytes += bcastLTree->GetMsgSize();
+          }
+          if( redLTree != NULL ){
+            bytes += (Real)redLTree->GetMsgSize() * ( 1 + redLTree->GetDestCount() );
+          }
+          if( redDTree != NULL ){
+            bytes += (Real)redDTree->GetMsgSize() * ( 1 + redDTree->GetDestCount() );
+          }
+          localFootprint[ksup] = bytes;
+        }
+      }
+
+      // All the processors must build the same steps.
+      footprint.resize( numSuper );
+      mpi::Allreduce( &localFootprint[0], &footprint[0], numSuper, MPI_MAX, grid_->comm );
+      if( hasTrees ) return;
+
+      // Without the trees (symmetricStorage = 1 builds them after
+      // GetWorkSet), estimate the same buffers from the rows of
+      // L(:,ksup) below the diagonal, spread over the processor grid.
+      statusOFS << "GetStepFootprint: the SelInv trees are not built yet, "
+        << "the step footprints are estimated from the block structure." << std::endl;
+      std::vector<Real> localRows( numSuper, 0.0 );
+      std::vector<Real> rows( numSuper, 0.0 );
+      for( Int ksup = 0; ksup < numSuper; ksup++ ){
+        if( MYCOL( grid_ ) == PCOL( ksup, grid_ ) ){
+          std::vector<LBlock<T> >&  Lcol = this->L( LBj( ksup, grid_ ) );
+          for( Int ib = 0; ib < (Int)Lcol.size(); ib++ ){
+            if( Lcol[ib].blockIdx > ksup ){
+              localRows[ksup] += Lcol[ib].numRow;
+            }
+          }
+        }
+      }
+      mpi::Allreduce( &localRows[0], &rows[0], numSuper, MPI_SUM, grid_->comm );
+      for( Int ksup = 0; ksup < numSuper; ksup++ ){
+        Real s = SuperSize( ksup, super_ );
+        Real mRow = rows[ksup] / grid_->numProcRow;
+        Real mCol = rows[ksup] / grid_->numProcCol;
+        // L column and LUpdateBuf on a processor row, U row on a
+        // processor column, DiagBuf and its reduction buffer.
+        footprint[ksup] = sizeof(T) * s * ( 2.0 * mRow + mCol + 2.0 * s );
+      }
+    }
+
+  template<typename T>
+    inline void PMatrix<T>::GetCriticalPathPriority(
+        std::vector<Int> & snodeEtree, 
+        std::vector<Real> & priority)
+    {
+      Int numSuper = this->NumSuper();
+
+      // Number of rows and of blocks of L(:,ksup) below the diagonal.
+      // Each block is owned by one processor, so a sum gives the global
+      // counts.
+      std::vector<Real> localCount( 2 * numSuper, 0.0 );
+      std::vector<Real> count( 2 * numSuper, 0.0 );
+      for( Int ksup = 0; ksup < numSuper; ksup++ ){
+        if( MYCOL( grid_ ) == PCOL( ksup, grid_ ) ){
+          std::vector<LBlock<T> >&  Lcol = this->L( LBj( ksup, grid_ ) );
+          for( Int ib = 0; ib < (Int)Lcol.size(); ib++ ){
+            if( Lcol[ib].blockIdx > ksup ){
+              localCount[2*ksup]   += Lcol[ib].numRow;
+              localCount[2*ksup+1] += 1.0;
+            }
+          }
+        }
+      }
+      mpi::Allreduce( &localCount[0], &count[0], 2 * numSuper, MPI_SUM, grid_->comm );
+
+      // Cost of a step: the Sinv * U^T GEMM and the diagonal update in
+      // flops, plus a fixed cost per pair of blocks for the index
+      // lookups and the gathers.
+      const Real blockPairCost = 1.0e3;
+      priority.assign( numSuper + 1, 0.0 );
+      std::vector<Real> below( numSuper + 1, 0.0 );
+      // The etree is postordered: the children come before their parent.
+      for( Int ksup = 0; ksup < numSuper; ksup++ ){
+        Real m = count[2*ksup];
+        Real nb = count[2*ksup+1];
+        Real s = SuperSize( ksup, super_ );
+        Real cost = 2.0 * s * m * ( m + s ) + blockPairCost * nb * nb;
+        priority[ksup] = cost + below[ksup];
+        Int parent = snodeEtree[ksup];
+        below[parent] = std::max( below[parent], priority[ksup] );
+      }
+
+#if ( _DEBUGlevel_ >= 1 )
+      statusOFS << std::endl << "Critical path priority: " << priority << std::endl;
+#endif
+    }
+
   template<typename T>
     inline void PMatrix<T>::GetWorkSet(
         std::vector<Int> & snodeEtree, 
@@ -1677,13 +2054,51 @@ namespace PEXSI{
 
         }
 
+        // Within a level, the supernodes with the longest remaining
+        // path in the etree come first: they are posted, and the
+        // pipeline splits below keep them, first.
+        if( options_->criticalPathOrder == 1 ){
+          std::vector<Real> priority;
+          GetCriticalPathPriority( snodeEtree, priority );
+          for( Int lidx = 0; lidx < (Int)WSet.size(); lidx++ ){
+            // Ties keep the reverse postorder.
+            std::stable_sort( WSet[lidx].begin(), WSet[lidx].end(), 
+                [&priority]( Int a, Int b ){ return priority[a] > priority[b]; } );
+          }
+        }
+
 #if 1
         //Constrain the size of each list to be min(MPI_MAX_COMM,options_->maxPipelineDepth)
         Int limit = maxDepth; //(options_->maxPipelineDepth>0)?std::min(MPI_MAX_COMM,options_->maxPipelineDepth):MPI_MAX_COMM;
         Int rank = 0;
+
+        // Per-process memory budget of a step, see
+        // PSelInvOptions::pipelineMemoryBudget.
+        Real budget = (Real)options_->pipelineMemoryBudget * 1024.0 * 1024.0;
+        std::vector<Real> footprint;
+        if( budget > 0 ){
+          GetStepFootprint( footprint );
+        }
+        Real maxStepBytes = 0.0;
+
         for (Int lidx=0; lidx<WSet.size() ; lidx++){
           //Assign a rank in the order they are processed ?
 
+          // Keep the leading supernodes of the level that fit in the
+          // budget (at least one), the others go to the next step.
+          Int levelLimit = limit;
+          if( budget > 0 ){
+            Real stepBytes = 0.0;
+            Int numFit = 0;
+            while( numFit < (Int)WSet[lidx].size() && 
+                ( numFit == 0 || stepBytes + footprint[WSet[lidx][numFit]] <= budget ) ){
+              stepBytes += footprint[WSet[lidx][numFit]];
+              numFit++;
+            }
+            levelLimit = std::min( limit, numFit );
+            maxStepBytes = std::max( maxStepBytes, stepBytes );
+          }
+
           bool split = false;
           Int splitIdx = 0;
 
@@ -1699,13 +2114,13 @@ namespace PEXSI{
             splitIdx = limIndex_-(rank%limIndex_)-1;
           }
 
-          Int splitPoint = std::min((Int)WSet[lidx].size()-1,splitIdx>0?std::min(limit-1,splitIdx):limit-1);
+          Int splitPoint = std::min((Int)WSet[lidx].size()-1,splitIdx>0?std::min(levelLimit-1,splitIdx):levelLimit-1);
 #if ( _DEBUGlevel_ >= 1 )
           if(split){ 
             statusOFS<<"TEST SPLIT at "<<splitIdx<<" "<<std::endl;
           }
 #endif
-          split = split || (WSet[lidx].size()>limit);
+          split = split || ((Int)WSet[lidx].size()>levelLimit);
 
           rank += splitPoint+1;
 
@@ -1713,7 +2128,7 @@ namespace PEXSI{
           {
             statusOFS<<"SPLITPOINT is "<<splitPoint<<" "<<std::endl;
 #if ( _DEBUGlevel_ >= 1 )
-            if(splitPoint != limit-1){
+            if(splitPoint != levelLimit-1){
               statusOFS<<"-----------------------"<<std::endl;
               statusOFS<<lidx<<": "<<orank<<" -- "<<maxRank<<std::endl;
               statusOFS<<"            is NOW         "<<std::endl;
@@ -1728,7 +2143,7 @@ namespace PEXSI{
             WSet[lidx].erase(WSet[lidx].begin()+splitPoint+1,WSet[lidx].end());
 
 #if ( _DEBUGlevel_ >= 1 )
-            if(splitPoint != limit-1){
+            if(splitPoint != levelLimit-1){
               assert((orank+WSet[lidx].size()-1)%limIndex_==0);
             }
 #endif
@@ -1782,6 +2197,12 @@ namespace PEXSI{
 
         }
 
+        if( budget > 0 ){
+          statusOFS << "Pipeline memory budget " << options_->pipelineMemoryBudget 
+            << " MB: " << WSet.size() << " steps, largest step footprint " 
+            << maxStepBytes / ( 1024.0 * 1024.0 ) << " MB" << std::endl;
+        }
+
         //for (Int lidx=0; lidx<WSet.size() ; lidx++){
         //  std::sort(WSet[lidx].begin(),WSet[lidx].end();WSet[lidx].size());
         //}
@@ -1841,24 +2262,22 @@ namespace PEXSI{
     }
 
   template<typename T>
-    inline void PMatrix<T>::SelInvIntra_P2p(Int lidx,Int & rank, cublasHandle_t& handle, std::set<std::string> & quantSuperNode ) {
-      //这是一次并行
-      if (options_->symmetricStorage!=1){
-#if defined (PROFILE) || defined(PMPI) || defined(USE_TAU)
-      Real begin_SendULWaitContentFirst, end_SendULWaitContentFirst, time_SendULWaitContentFirst = 0;
-#endif
-      Int numSuper = this->NumSuper(); //得到总的supernode数量
-      std::vector<std::vector<Int> > & superList = this->WorkingSet();//得到可并行操作的supernode数组
-      Int numSteps = superList.size();//总的并行次数
-      Int stepSuper = superList[lidx].size(); //本次并行的supernode数量
-
-
-
+    inline void PMatrix<T>::PostSelInvStep(Int lidx, Int & rank, SelInvStepBuffer & step)
+    {
+      std::vector<std::vector<Int> > & superList = this->WorkingSet();
+      step.lidx = lidx;
+      Int & stepSuper = step.stepSuper;
+      std::vector<SuperNodeBufferType> & arrSuperNodes = step.arrSuperNodes;
+      std::vector<std::vector<MPI_Request> > & arrMpireqsSendToBelow = step.arrMpireqsSendToBelow;
+      std::vector<std::vector<MPI_Request> > & arrMpireqsSendToRight = step.arrMpireqsSendToRight;
+      std::vector<MPI_Request> & arrMpireqsRecvSizeFromAny = step.arrMpireqsRecvSizeFromAny;
+      std::vector<MPI_Request> & arrMpireqsRecvContentFromAny = step.arrMpireqsRecvContentFromAny;
+      GetStepComm( lidx, step.comm, step.rowComm, step.colComm );
 
       TIMER_START(AllocateBuffer);//分配缓存
 
       stepSuper = 0;//为啥又赋值0了= - =，逗我玩呢
-      for (Int supidx=0; supidx<superList[lidx].size(); supidx++){//这里应该是对本次并行的每个supernode进行操作
+      for (Int supidx=0; supidx<(Int)superList[lidx].size(); supidx++){//这里应该是对本次并行的每个supernode进行操作
         Int snodeIdx = superList[lidx][supidx]; //得到要操作的supernode下标
         TreeBcast * bcastLTree = fwdToRightTree_[snodeIdx];//这个supernode要往右边发送的L数据
         TreeBcast * bcastUTree = fwdToBelowTree_[snodeIdx];//这个supernode要往下面发送的U数据
@@ -1885,23 +2304,19 @@ namespace PEXSI{
 
 
       //This is required to send the size and content of U/L
-      std::vector<std::vector<MPI_Request> >  arrMpireqsSendToBelow;//发送到下边的句柄
       arrMpireqsSendToBelow.resize( stepSuper, std::vector<MPI_Request>( 2 * grid_->numProcRow, MPI_REQUEST_NULL ));//2倍是因为LU，下面同理
-      std::vector<std::vector<MPI_Request> >  arrMpireqsSendToRight;//发送到右边的句柄
       arrMpireqsSendToRight.resize(stepSuper, std::vector<MPI_Request>( 2 * grid_->numProcCol, MPI_REQUEST_NULL ));
 
 
       //This is required to receive the size and content of U/L
-      std::vector<MPI_Request>   arrMpireqsRecvSizeFromAny;//接受size的句柄
       arrMpireqsRecvSizeFromAny.resize(stepSuper*2 , MPI_REQUEST_NULL);
-      std::vector<MPI_Request>   arrMpireqsRecvContentFromAny;//接受内容的句柄
       arrMpireqsRecvContentFromAny.resize(stepSuper*2 , MPI_REQUEST_NULL);
 
       //allocate the buffers for this supernode
       //用来缓冲supernode的数组
-      std::vector<SuperNodeBufferType> arrSuperNodes(stepSuper);
+      arrSuperNodes.resize(stepSuper);
       Int pos = 0;
-      for (Int supidx=0; supidx<superList[lidx].size(); supidx++){ 
+      for (Int supidx=0; supidx<(Int)superList[lidx].size(); supidx++){ 
         Int snodeIdx = superList[lidx][supidx]; 
         TreeBcast * bcastLTree = fwdToRightTree_[snodeIdx];
         TreeBcast * bcastUTree = fwdToBelowTree_[snodeIdx];
@@ -1925,6 +2340,12 @@ namespace PEXSI{
           arrSuperNodes[pos].Index = superList[lidx][supidx];  //保存要操作的supernode下标，对于U矩阵而言就是行，对于L矩阵而言就是列
           arrSuperNodes[pos].Rank = rank; //设置要操作的supernode的rank？是priority list中的rank吗？不懂
 
+          // The trees of the supernode communicate in the epoch of the step.
+          if(bcastUTree!=NULL){ bcastUTree->SetComm(step.colComm); }
+          if(bcastLTree!=NULL){ bcastLTree->SetComm(step.rowComm); }
+          if(redLTree!=NULL){ redLTree->SetComm(step.rowComm); }
+          if(redDTree!=NULL){ redDTree->SetComm(step.colComm); }
+
 
           SuperNodeBufferType & snode = arrSuperNodes[pos];//这一步干嘛不懂
 
@@ -1933,14 +2354,16 @@ namespace PEXSI{
         rank++;
       }
 
-
-
-      int numSentToLeft = 0;
-      std::vector<int> reqSentToLeft;
-
-
-      NumMat<T> AinvBuf, UBuf;
-
+      // A U row sent in several chunks needs a send request per chunk
+      // and destination.
+      for (Int supidx=0; supidx<stepSuper; supidx++){
+        SuperNodeBufferType & snode = arrSuperNodes[supidx];
+        TreeBcast * bcastUTree = fwdToBelowTree_[snode.Index];
+        if(bcastUTree!=NULL){
+          snode.NumUChunk = NumUChunk( bcastUTree->GetMsgSize() );
+          arrMpireqsSendToBelow[supidx].resize( 2 * grid_->numProcRow * snode.NumUChunk, MPI_REQUEST_NULL );
+        }
+      }
       TIMER_STOP(AllocateBuffer);
 
 #if ( _DEBUGlevel_ >= 1 )
@@ -1953,6 +2376,7 @@ namespace PEXSI{
 
 
         // Receivers (Content)
+        std::vector<MPI_Request> mpireqsRecvUChunk;
         for (Int supidx=0; supidx<stepSuper ; supidx++){
           SuperNodeBufferType & snode = arrSuperNodes[supidx];//得到要操作的supernode的缓存
           MPI_Request * mpireqsRecvFromAbove = &arrMpireqsRecvContentFromAny[supidx*2];//得到接受上面传来的数据的句柄
@@ -1965,9 +2389,22 @@ namespace PEXSI{
               Int myRoot = bcastUTree->GetRoot();//得到发送数据的root
               snode.SizeSstrUrowRecv = bcastUTree->GetMsgSize();//得到接受数据的大小
               snode.SstrUrowRecv.resize( snode.SizeSstrUrowRecv);//调整保存数据的char数组的大小
-              MPI_Irecv( &snode.SstrUrowRecv[0], snode.SizeSstrUrowRecv, MPI_BYTE, 
-                  myRoot, IDX_TO_TAG(snode.Rank,SELINV_TAG_U_CONTENT,limIndex_), 
-                  grid_->colComm, mpireqsRecvFromAbove );//接受这一列上面的数据，和U矩阵相关的东西，具体是啥？不懂
+              // The chunks are sent in order on the same tag, so they are
+              // matched in order.  The first one uses the request of the
+              // supernode, the others are appended after the loop.
+              snode.UChunkArrived.assign( snode.NumUChunk, 0 );
+              for( Int c = 0; c < snode.NumUChunk; c++ ){
+                Int offset = UChunkOffset( snode.SizeSstrUrowRecv, c );
+                MPI_Request mpireqChunk = MPI_REQUEST_NULL;
+                MPI_Irecv( &snode.SstrUrowRecv[offset], UChunkOffset( snode.SizeSstrUrowRecv, c+1 ) - offset, MPI_BYTE, 
+                    myRoot, IDX_TO_TAG(snode.Rank,SELINV_TAG_U_CONTENT,limIndex_), 
+                    step.colComm, ( c == 0 ) ? mpireqsRecvFromAbove : &mpireqChunk );//接受这一列上面的数据，和U矩阵相关的东西，具体是啥？不懂
+                if( c > 0 ){
+                  mpireqsRecvUChunk.push_back( mpireqChunk );
+                  step.uChunkSupidx.push_back( supidx );
+                  step.uChunkIdx.push_back( c );
+                }
+              }
 #if ( _DEBUGlevel_ >= 1 )
               statusOFS << std::endl << "["<<snode.Index<<"] "<<  "Receiving U " << snode.SizeSstrUrowRecv << " BYTES from "<<myRoot<<" on tag "<<IDX_TO_TAG(snode.Rank,SELINV_TAG_U_CONTENT,limIndex_)<< std::endl <<  std::endl; 
 #endif
@@ -1983,13 +2420,15 @@ namespace PEXSI{
               snode.SstrLcolRecv.resize(snode.SizeSstrLcolRecv);//调整保存数据的char数组大小
               MPI_Irecv( &snode.SstrLcolRecv[0], snode.SizeSstrLcolRecv, MPI_BYTE, 
                   myRoot, IDX_TO_TAG(snode.Rank,SELINV_TAG_L_CONTENT,limIndex_), 
-                  grid_->rowComm, mpireqsRecvFromLeft );//接受这一行左边的数据，这里应该是L矩阵相关的东西，也不太懂
+                  step.rowComm, mpireqsRecvFromLeft );//接受这一行左边的数据，这里应该是L矩阵相关的东西，也不太懂
 #if ( _DEBUGlevel_ >= 1 )
               statusOFS << std::endl << "["<<snode.Index<<"] "<<  "Receiving L " << snode.SizeSstrLcolRecv << " BYTES from "<<myRoot<<" on tag "<<IDX_TO_TAG(snode.Rank,SELINV_TAG_L_CONTENT,limIndex_)<< std::endl <<  std::endl; 
 #endif
             }
           } // if I need to receive from left
         }
+        arrMpireqsRecvContentFromAny.insert( arrMpireqsRecvContentFromAny.end(), 
+            mpireqsRecvUChunk.begin(), mpireqsRecvUChunk.end() );
         TIMER_STOP(IRecv_Content_UL);
 
         // Senders
@@ -2012,10 +2451,20 @@ namespace PEXSI{
             std::stringstream sstm;
 
             std::vector<Int> mask( UBlockMask::TOTAL_NUMBER, 1 );
-            // All blocks are to be sent down.
-            serialize( (Int)Urow.size(), sstm, NO_MASK );//打包U Block数量
-            for( Int jb = 0; jb < Urow.size(); jb++ ){
-              serialize( Urow[jb], sstm, mask );//打包每个U Block的内容
+            // All blocks are to be sent down, with 2.5D replication only
+            // the ones contracted by this copy.
+            Int numUBlockSend = 0;
+            for( Int jb = 0; jb < (Int)Urow.size(); jb++ ){
+              if( IsReplicaBlock( Urow[jb].blockIdx ) ) numUBlockSend++;
+            }
+            serialize( numUBlockSend, sstm, NO_MASK );//打包U Block数量
+            // Each block is preceded by its size, so that the receivers
+            // can unpack the blocks of the chunks arrived so far.
+            for( Int jb = 0; jb < (Int)Urow.size(); jb++ ){
+              if( IsReplicaBlock( Urow[jb].blockIdx ) ){
+                serialize( SerializedSize( Urow[jb], mask ), sstm, NO_MASK );
+                serialize( Urow[jb], sstm, mask );//打包每个U Block的内容
+              }
             }
             snode.SstrUrowSend.resize( Size( sstm ) );
             sstm.read( &snode.SstrUrowSend[0], snode.SstrUrowSend.size() );//将发送的内容放到supernode缓存中
@@ -2024,8 +2473,14 @@ namespace PEXSI{
 
             TreeBcast * bcastUTree = fwdToBelowTree_[snode.Index];
             if(bcastUTree!=NULL){//应该是在这里判断是否需要向下发送数据
-              bcastUTree->ForwardMessage((char*)&snode.SstrUrowSend[0], snode.SizeSstrUrowSend, 
-                  IDX_TO_TAG(snode.Rank,SELINV_TAG_U_CONTENT,limIndex_), &mpireqsSendToBelow[0]);//发送数据
+              if( snode.SizeSstrUrowSend != bcastUTree->GetMsgSize() ){
+                ErrorHandling( "The size of the U message does not match its broadcast tree." );
+              }
+              for( Int c = 0; c < snode.NumUChunk; c++ ){
+                Int offset = UChunkOffset( snode.SizeSstrUrowSend, c );
+                bcastUTree->ForwardMessage((char*)&snode.SstrUrowSend[offset], UChunkOffset( snode.SizeSstrUrowSend, c+1 ) - offset, 
+                    IDX_TO_TAG(snode.Rank,SELINV_TAG_U_CONTENT,limIndex_), &mpireqsSendToBelow[2 * grid_->numProcRow * c]);//发送数据
+              }
               for( Int idxRecv = 0; idxRecv < bcastUTree->GetDestCount(); ++idxRecv ){
                 Int iProcRow = bcastUTree->GetDest(idxRecv);
 #if ( _DEBUGlevel_ >= 1 )
@@ -2058,7 +2513,7 @@ namespace PEXSI{
             else
               serialize( (Int)Lcol.size(), sstm, NO_MASK );
 
-            for( Int ib = 0; ib < Lcol.size(); ib++ ){
+            for( Int ib = 0; ib < (Int)Lcol.size(); ib++ ){
               if( Lcol[ib].blockIdx > snode.Index ){
 #if ( _DEBUGlevel_ >= 2 )
                 statusOFS << std::endl << "["<<snode.Index<<"] "<<  "Serializing Block index " << Lcol[ib].blockIdx << std::endl;
@@ -2087,69 +2542,438 @@ namespace PEXSI{
         } //Senders
         TIMER_STOP(ISend_Content_UL);
       }
+    } 		// -----  end of method PMatrix::PostSelInvStep  ----- 
 
-      vector<char> redLdone(stepSuper,0);//不懂
-      //这一步也不太懂干嘛
-      for (Int supidx=0; supidx<stepSuper; supidx++){
-        SuperNodeBufferType & snode = arrSuperNodes[supidx];
-        TreeReduce<T> * redLTree = redToLeftTree_[snode.Index];
+  template<typename T>
+    inline bool PMatrix<T>::IsBarrierAfterStep(Int lidx, Int rank) const
+    {
+#ifdef LIST_BARRIER
+#ifndef ALL_BARRIER
+      if (options_->maxPipelineDepth!=-1)
+#endif
+      {
+        return true;
+      }
+#endif
+      // The tags of the steps are recycled every limIndex_ supernodes.
+      return lidx>0 && (rank-1)%limIndex_==0;
+    }
 
-        if(redLTree != NULL){
-          redLTree->SetTag(IDX_TO_TAG(snode.Rank,SELINV_TAG_L_REDUCE,limIndex_));
-          //Initialize the tree
-          redLTree->AllocRecvBuffers();
-          //Post All Recv requests;
-          redLTree->PostFirstRecv();
+  template<typename T>
+    inline void PMatrix<T>::SetupEpochComm(Int numEpochComm)
+    {
+      std::vector<std::vector<Int> > & superList = this->WorkingSet();
+      Int numSteps = superList.size();
+
+      stepEpoch_.resize( numSteps );
+      Int rank = 0;
+      Int epoch = 0;
+      for( Int lidx = 0; lidx < numSteps; lidx++ ){
+        stepEpoch_[lidx] = epoch;
+        rank += superList[lidx].size();
+        if( IsBarrierAfterStep( lidx, rank ) ){
+          epoch++;
         }
       }
 
+      // The duplicates are kept from one SelInv to the next.
+      if( (Int)epochComm_.size() == numEpochComm ) return;
+      FreeEpochComm();
+      epochComm_.resize( numEpochComm );
+      epochRowComm_.resize( numEpochComm );
+      epochColComm_.resize( numEpochComm );
+      for( Int i = 0; i < numEpochComm; i++ ){
+        MPI_Comm_dup( grid_->comm, &epochComm_[i] );
+        MPI_Comm_dup( grid_->rowComm, &epochRowComm_[i] );
+        MPI_Comm_dup( grid_->colComm, &epochColComm_[i] );
+      }
+    }
 
-      TIMER_START(Compute_Sinv_LT);//计算-Aji^-1 * Lij？有可能是
-      {
-        Int msgForwarded = 0;
-        Int msgToFwd = 0;
-        Int gemmProcessed = 0;
-        Int gemmToDo = 0;
-        //      Int toRecvGemm = 0;
-        //copy the list of supernodes we need to process
-        std::list<Int> readySupidx;
-        //find local things to do
-        for(Int supidx = 0;supidx<stepSuper;supidx++){//在这里进行一些本地操作？
-          SuperNodeBufferType & snode = arrSuperNodes[supidx];
+  template<typename T>
+    inline void PMatrix<T>::RestoreTreeComm()
+    {
+      if( epochComm_.size() > 0 ){
+        for( Int ksup = 0; ksup < (Int)fwdToBelowTree_.size(); ksup++ ){
+          if( fwdToBelowTree_[ksup] != NULL ){ fwdToBelowTree_[ksup]->SetComm( grid_->colComm ); }
+        }
+        for( Int ksup = 0; ksup < (Int)fwdToRightTree_.size(); ksup++ ){
+          if( fwdToRightTree_[ksup] != NULL ){ fwdToRightTree_[ksup]->SetComm( grid_->rowComm ); }
+        }
+        for( Int ksup = 0; ksup < (Int)redToLeftTree_.size(); ksup++ ){
+          if( redToLeftTree_[ksup] != NULL ){ redToLeftTree_[ksup]->SetComm( grid_->rowComm ); }
+        }
+        for( Int ksup = 0; ksup < (Int)redToAboveTree_.size(); ksup++ ){
+          if( redToAboveTree_[ksup] != NULL ){ redToAboveTree_[ksup]->SetComm( grid_->colComm ); }
+        }
+      }
+    }
 
+  template<typename T>
+    inline void PMatrix<T>::FreeEpochComm()
+    {
+      for( Int i = 0; i < (Int)epochComm_.size(); i++ ){
+        MPI_Comm_free( &epochComm_[i] );
+        MPI_Comm_free( &epochRowComm_[i] );
+        MPI_Comm_free( &epochColComm_[i] );
+      }
+      epochComm_.clear();
+      epochRowComm_.clear();
+      epochColComm_.clear();
+    }
 
-          if( isRecvFromAbove_( snode.Index ) && isRecvFromLeft_( snode.Index )){//如果我接受了两边的数据
-            gemmToDo++;//不懂
-            //剩下几个ready应该是判断这个processor是不是Lkk，即对角线上的processor
-            if( MYCOL( grid_ ) == PCOL( snode.Index, grid_ ) ){
-              snode.isReady++;
-            }
+  template<typename T>
+    inline void PMatrix<T>::SetupThreadHandles()
+    {
+      Int numThreads = this->NumThreads();
+      if( numThreads <= 1 || (Int)threadHandles_.size() == numThreads ) return;
+      FreeThreadHandles();
+      threadHandles_.resize( numThreads );
+      threadStreams_.resize( numThreads );
+      for( Int t = 0; t < numThreads; t++ ){
+        cudaStreamCreateWithFlags( &threadStreams_[t], cudaStreamNonBlocking );
+        cublasCreate( &threadHandles_[t] );
+        cublasSetStream( threadHandles_[t], threadStreams_[t] );
+      }
+    }
 
-            if(  MYROW( grid_ ) == PROW( snode.Index, grid_ ) ){
-              snode.isReady++;
-            }
+  template<typename T>
+    inline void PMatrix<T>::FreeThreadHandles()
+    {
+      for( Int t = 0; t < (Int)threadHandles_.size(); t++ ){
+        cublasDestroy( threadHandles_[t] );
+        cudaStreamDestroy( threadStreams_[t] );
+      }
+      threadHandles_.clear();
+      threadStreams_.clear();
+    }
 
-            if(snode.isReady==2){
-              readySupidx.push_back(supidx);
-#if ( _DEBUGlevel_ >= 1 )
-              statusOFS<<std::endl<<"Locally processing ["<<snode.Index<<"]"<<std::endl;
+  template<typename T>
+    inline cublasHandle_t& PMatrix<T>::ThreadHandle(cublasHandle_t& handle, Int t)
+    {
+#ifdef _OMP_ENABLED_
+      if( t < 0 ) t = omp_get_thread_num();
+#else
+      if( t < 0 ) t = 0;
 #endif
-            }
-          }
-          else if( (isRecvFromLeft_( snode.Index )  ) && MYCOL( grid_ ) != PCOL( snode.Index, grid_ ) )//如果接受了左边的数据并且确实不是同一列
-          {                                                                                            //这里应该是只计算L或者U部分所以才只管了从左边来的数据
-            //Get the reduction tree
-            TreeReduce<T> * redLTree = redToLeftTree_[snode.Index];
-            //下面的都不太懂
-            if(redLTree != NULL){
-              TIMER_START(Reduce_Sinv_LT_Isend);
-              //send the data to NULL to ensure 0 byte send
-              redLTree->SetLocalBuffer(NULL);
-              redLTree->SetDataReady(true);
+      return ( t < (Int)threadHandles_.size() ) ? threadHandles_[t] : handle;
+    }
 
-              bool done = redLTree->Progress();
+  template<typename T>
+    inline void PMatrix<T>::GetStepComm(Int lidx, MPI_Comm & comm, MPI_Comm & rowComm, MPI_Comm & colComm) const
+    {
+      if( epochComm_.size() > 0 ){
+        Int i = stepEpoch_[lidx] % epochComm_.size();
+        comm = epochComm_[i];
+        rowComm = epochRowComm_[i];
+        colComm = epochColComm_[i];
+      }
+      else{
+        comm = grid_->comm;
+        rowComm = grid_->rowComm;
+        colComm = grid_->colComm;
+      }
+    }
 
-#if ( _DEBUGlevel_ >= 1 )
+  template<typename T>
+    inline Int PMatrix<T>::ProgressStepContent( SelInvStepBuffer & step, bool blocking )
+    {
+      Int stepSuper = step.stepSuper;
+      std::vector<SuperNodeBufferType> & arrSuperNodes = step.arrSuperNodes;
+      std::vector<std::vector<MPI_Request> > & arrMpireqsSendToBelow = step.arrMpireqsSendToBelow;
+      std::vector<std::vector<MPI_Request> > & arrMpireqsSendToRight = step.arrMpireqsSendToRight;
+      std::vector<MPI_Request> & arrMpireqsRecvContentFromAny = step.arrMpireqsRecvContentFromAny;
+      if( stepSuper == 0 ){
+        return 0;
+      }
+
+      Int reqidx = MPI_UNDEFINED;
+      Int supidx = -1;
+
+      int reqIndices[arrMpireqsRecvContentFromAny.size()];
+      int numRecv = 0; 
+      numRecv = 0;
+      int err;
+      if( !blocking ){
+        err = MPI_Testsome(arrMpireqsRecvContentFromAny.size(), &arrMpireqsRecvContentFromAny[0], &numRecv, reqIndices, MPI_STATUSES_IGNORE);
+      }
+      else{
+        err = MPI_Waitsome(arrMpireqsRecvContentFromAny.size(), &arrMpireqsRecvContentFromAny[0], &numRecv, reqIndices, MPI_STATUSES_IGNORE);//等待数据,numRecv记录接收到的数据,reqIndices记录了完成的操作下标
+      }
+      assert(err==MPI_SUCCESS);
+
+      for(int i =0;i<numRecv;i++){
+        reqidx = reqIndices[i];
+        //I've received something
+        //下面好像是发送数据，不懂
+        if(reqidx!=MPI_UNDEFINED)
+        {
+          //this stays true
+          supidx = reqidx/2;
+          // U chunks after the first one
+          bool isU = reqidx%2==0;
+          Int chunk = 0;
+          if( reqidx >= 2*stepSuper ){
+            supidx = step.uChunkSupidx[reqidx-2*stepSuper];
+            chunk = step.uChunkIdx[reqidx-2*stepSuper];
+            isU = true;
+          }
+          SuperNodeBufferType & snode = arrSuperNodes[supidx];//得到supernode缓存
+
+          //If it's a U block 
+          if(isU){
+            snode.UChunkArrived[chunk] = 1;
+            while( snode.NumUChunkArrived < snode.NumUChunk && snode.UChunkArrived[snode.NumUChunkArrived] ){
+              snode.NumUChunkArrived++;
+            }
+
+            // The chunks share one tag, so the children match them in
+            // the order they are sent: only the leading chunks arrived
+            // are forwarded, in order.
+            TreeBcast * bcastUTree = fwdToBelowTree_[snode.Index];//得到它的broad cast树
+            if(bcastUTree != NULL){
+              if(bcastUTree->GetDestCount()>0){
+
+                std::vector<MPI_Request> & mpireqsSendToBelow = arrMpireqsSendToBelow[supidx];//得到发送到下面数据的句柄
+                for( ; snode.NumUChunkForwarded < snode.NumUChunkArrived; snode.NumUChunkForwarded++ ){
+                  Int fwdChunk = snode.NumUChunkForwarded;
+                  Int chunkOffset = UChunkOffset( snode.SizeSstrUrowRecv, fwdChunk );
+                  Int chunkSize = UChunkOffset( snode.SizeSstrUrowRecv, fwdChunk+1 ) - chunkOffset;
+#if ( _DEBUGlevel_ >= 1 )
+                  for( Int idxRecv = 0; idxRecv < bcastUTree->GetDestCount(); ++idxRecv ){
+                    Int iProcRow = bcastUTree->GetDest(idxRecv);
+                    statusOFS << std::endl << "["<<snode.Index<<"] "<<  "Forwarding U " << chunkSize << " BYTES to "<<iProcRow<<" on tag "<<IDX_TO_TAG(snode.Rank,SELINV_TAG_U_CONTENT,limIndex_)<< std::endl <<  std::endl; 
+                  }
+#endif
+
+                  bcastUTree->ForwardMessage( (char*)&snode.SstrUrowRecv[chunkOffset], chunkSize, 
+                      IDX_TO_TAG(snode.Rank,SELINV_TAG_U_CONTENT,limIndex_), &mpireqsSendToBelow[2 * grid_->numProcRow * fwdChunk] );//发送U矩阵行数据
+#if ( _DEBUGlevel_ >= 1 )
+                  for( Int idxRecv = 0; idxRecv < bcastUTree->GetDestCount(); ++idxRecv ){
+                    Int iProcRow = bcastUTree->GetDest(idxRecv);
+                    statusOFS << std::endl << "["<<snode.Index<<"] "<<  "Forwarded U " << chunkSize << " BYTES to "<<iProcRow<<" on tag "<<IDX_TO_TAG(snode.Rank,SELINV_TAG_U_CONTENT,limIndex_)<< std::endl <<  std::endl; 
+                  }
+#endif
+
+                  step.msgForwarded++;
+                }
+              }
+            }
+          }
+          //If it's a L block 
+          else{
+            TreeBcast * bcastLTree = fwdToRightTree_[snode.Index];//得到它的broad cast树
+            if(bcastLTree != NULL){
+              if(bcastLTree->GetDestCount()>0){
+
+                std::vector<MPI_Request> & mpireqsSendToRight = arrMpireqsSendToRight[supidx];//得到发送右边数据的句柄
+#if ( _DEBUGlevel_ >= 1 )
+                for( Int idxRecv = 0; idxRecv < bcastLTree->GetDestCount(); ++idxRecv ){
+                  Int iProcCol = bcastLTree->GetDest(idxRecv);
+                  statusOFS << std::endl << "["<<snode.Index<<"] "<<  "Forwarding L " << snode.SizeSstrLcolRecv << " BYTES to "<<iProcCol<<" on tag "<<IDX_TO_TAG(snode.Rank,SELINV_TAG_L_CONTENT,limIndex_)<< std::endl <<  std::endl; 
+                }
+#endif
+
+                bcastLTree->ForwardMessage( (char*)&snode.SstrLcolRecv[0], snode.SizeSstrLcolRecv, 
+                    IDX_TO_TAG(snode.Rank,SELINV_TAG_L_CONTENT,limIndex_), &mpireqsSendToRight[0]);//发送L矩阵列数据
+
+                //                    for( Int idxRecv = 0; idxRecv < bcastLTree->GetDestCount(); ++idxRecv ){
+                //                      Int iProcCol = bcastLTree->GetDest(idxRecv);
+                //                      PROFILE_COMM(MYPROC(this->grid_),PNUM(MYROW(this->grid_),iProcCol,this->grid_),IDX_TO_TAG(snode.Index,SELINV_TAG_L_CONTENT),snode.SizeSstrLcolRecv);
+                //                    }
+#if ( _DEBUGlevel_ >= 1 )
+                for( Int idxRecv = 0; idxRecv < bcastLTree->GetDestCount(); ++idxRecv ){
+                  Int iProcCol = bcastLTree->GetDest(idxRecv);
+                  statusOFS << std::endl << "["<<snode.Index<<"] "<<  "Forwarded L " << snode.SizeSstrLcolRecv << " BYTES to "<<iProcCol<<" on tag "<<IDX_TO_TAG(snode.Rank,SELINV_TAG_L_CONTENT,limIndex_)<< std::endl <<  std::endl; 
+                }
+#endif
+                step.msgForwarded++;
+              }
+            }
+          }
+
+
+#if ( _DEBUGlevel_ >= 1 )
+          statusOFS<<std::endl<<"Received data for ["<<snode.Index<<"] reqidx%2="<<reqidx%2<<" is ready ?"<<snode.isReady<<std::endl;
+#endif
+          //下面检查是否接受到了全部的LU矩阵
+          if( isRecvFromAbove_( snode.Index ) && isRecvFromLeft_( snode.Index )){
+            // The U row counts once all its chunks are there.
+            if( !isU || snode.NumUChunkArrived == snode.NumUChunk ){
+              snode.isReady++;
+            }
+
+            //if we received both L and U, the supernode is ready
+            bool isLcolArrived = MYCOL( grid_ ) == PCOL( snode.Index, grid_ ) 
+              || arrMpireqsRecvContentFromAny[2*supidx+1] == MPI_REQUEST_NULL;
+            if(snode.isReady==2){
+              step.readySupidx.insert(supidx);
+            }
+            else if( snode.NumUChunk > 1 && snode.NumUChunkArrived > 0 && isLcolArrived ){
+              // The U blocks of the chunks arrived can be multiplied.
+              step.readySupidx.insert(supidx);
+            }
+          }
+        }
+
+      }//end for waitsome
+
+      return std::max( numRecv, 0 );
+    }
+
+  template<typename T>
+    inline void PMatrix<T>::ProgressSelInv( SelInvStepBuffer & step, std::vector<char> & redLdone )
+    {
+      TIMER_START(Progress_SelInv);
+      // Forward the L / U blocks received for the current step and for
+      // the prefetched steps.
+      ProgressStepContent( step, false );
+      for( Int i = 0; i < (Int)stepsPrefetched_.size(); i++ ){
+        ProgressStepContent( *stepsPrefetched_[i], false );
+      }
+
+      // Only the reductions of the current step are initialized.
+      for (Int supidx=0; supidx<step.stepSuper; supidx++){
+        TreeReduce<T> * redLTree = redToLeftTree_[step.arrSuperNodes[supidx].Index];
+        if(redLTree != NULL && !redLdone[supidx]){
+          redLTree->Progress();
+        }
+      }
+      TIMER_STOP(Progress_SelInv);
+    }
+
+  template<typename T>
+    inline void PMatrix<T>::SelInvIntra_P2p(Int lidx,Int & rank, cublasHandle_t& handle, std::set<std::string> & quantSuperNode, SelInvStepBuffer * postedStep ) {
+      //这是一次并行
+      if (options_->symmetricStorage!=1){
+#if defined (PROFILE) || defined(PMPI) || defined(USE_TAU)
+      Real begin_SendULWaitContentFirst, end_SendULWaitContentFirst, time_SendULWaitContentFirst = 0;
+#endif
+      Int numSuper = this->NumSuper(); //得到总的supernode数量
+      std::vector<std::vector<Int> > & superList = this->WorkingSet();//得到可并行操作的supernode数组
+      Int numSteps = superList.size();//总的并行次数
+
+      // The L / U broadcasts of the step may have been prefetched by
+      // SelInv_P2p.
+      SelInvStepBuffer localStep;
+      SelInvStepBuffer & step = ( postedStep != NULL ) ? *postedStep : localStep;
+      if( postedStep == NULL ){
+        PostSelInvStep( lidx, rank, step );
+      }
+      else{
+        rank += superList[lidx].size();
+      }
+      Int stepSuper = step.stepSuper; //本次并行的supernode数量
+      std::vector<SuperNodeBufferType> & arrSuperNodes = step.arrSuperNodes;
+      std::vector<std::vector<MPI_Request> > & arrMpireqsSendToBelow = step.arrMpireqsSendToBelow;
+      std::vector<std::vector<MPI_Request> > & arrMpireqsSendToRight = step.arrMpireqsSendToRight;
+      std::vector<MPI_Request> & arrMpireqsRecvContentFromAny = step.arrMpireqsRecvContentFromAny;
+
+      TIMER_START(AllocateBuffer);
+
+      int numSentToLeft = 0;
+      std::vector<int> reqSentToLeft;
+
+
+      // Operands of the Sinv * U^T product, gathered while the GEMM runs.
+      // In the task-parallel mode every thread has its own set.
+      bool isTaskParallel = false;
+#ifdef _OMP_ENABLED_
+      isTaskParallel = options_->taskParallelSelInv == 1 && this->NumThreads() > 1;
+#endif
+      Int numWorkspace = isTaskParallel ? this->NumThreads() : 1;
+      std::vector<SinvLTWorkspace> sinvLTWork( numWorkspace );
+      for( Int t = 0; t < numWorkspace; t++ ){
+        if( options_->gemmBackend == 1 ){
+          // Large panel products are split further into OpenMP tasks.
+          sinvLTWork[t].gemmEngine.reset( new IndirectGemmCPU<T,T>( 256, isTaskParallel,
+                options_->complexGemmMode, options_->complexGemmMinDim ) );
+          sinvLTWork[t].gemmEngineQuant.reset( new IndirectGemmCPU<T,float>( 256, isTaskParallel ) );
+        }
+        else{
+          sinvLTWork[t].gemmEngine.reset( new IndirectGemmCublas<T,T>( this->ThreadHandle( handle, t ) ) );
+          sinvLTWork[t].gemmEngineQuant.reset( new IndirectGemmCublas<T,float>( this->ThreadHandle( handle, t ) ) );
+        }
+      }
+
+      TIMER_STOP(AllocateBuffer);
+
+
+      vector<char> redLdone(stepSuper,0);//不懂
+
+      // Without worker threads the main thread is inside the GEMMs most
+      // of the time, so it progresses the trees between the panels.  In
+      // the task-parallel mode the master thread does it already.
+      if( !isTaskParallel && options_->asyncProgress == 1 ){
+        std::function<void()> progressHook = [this, &step, &redLdone](){ this->ProgressSelInv( step, redLdone ); };
+        sinvLTWork[0].gemmEngine->SetProgressHook( progressHook );
+        sinvLTWork[0].gemmEngineQuant->SetProgressHook( progressHook );
+      }
+      //这一步也不太懂干嘛
+      for (Int supidx=0; supidx<stepSuper; supidx++){
+        SuperNodeBufferType & snode = arrSuperNodes[supidx];
+        TreeReduce<T> * redLTree = redToLeftTree_[snode.Index];
+
+        if(redLTree != NULL){
+          redLTree->SetTag(IDX_TO_TAG(snode.Rank,SELINV_TAG_L_REDUCE,limIndex_));
+          //Initialize the tree
+          redLTree->AllocRecvBuffers();
+          //Post All Recv requests;
+          redLTree->PostFirstRecv();
+        }
+      }
+
+
+      TIMER_START(Compute_Sinv_LT);//计算-Aji^-1 * Lij？有可能是
+      {
+        // Messages may be forwarded, and supernodes become ready, as
+        // soon as the step is posted (see ProgressSelInv).
+        Int & msgForwarded = step.msgForwarded;
+        Int msgToFwd = 0;
+        Int gemmProcessed = 0;
+        Int gemmToDo = 0;
+        //      Int toRecvGemm = 0;
+        //copy the list of supernodes we need to process
+        // arrSuperNodes follows superList, sorted by decreasing critical
+        // path priority (see GetWorkSet), so the smallest ready supidx
+        // is processed first.
+        std::set<Int> & readySupidx = step.readySupidx;
+        //find local things to do
+        for(Int supidx = 0;supidx<stepSuper;supidx++){//在这里进行一些本地操作？
+          SuperNodeBufferType & snode = arrSuperNodes[supidx];
+
+
+          if( isRecvFromAbove_( snode.Index ) && isRecvFromLeft_( snode.Index )){//如果我接受了两边的数据
+            gemmToDo++;//不懂
+            //剩下几个ready应该是判断这个processor是不是Lkk，即对角线上的processor
+            if( MYCOL( grid_ ) == PCOL( snode.Index, grid_ ) ){
+              snode.isReady++;
+            }
+
+            if(  MYROW( grid_ ) == PROW( snode.Index, grid_ ) ){
+              snode.isReady++;
+            }
+
+            if(snode.isReady==2){
+              readySupidx.insert(supidx);
+#if ( _DEBUGlevel_ >= 1 )
+              statusOFS<<std::endl<<"Locally processing ["<<snode.Index<<"]"<<std::endl;
+#endif
+            }
+          }
+          else if( (isRecvFromLeft_( snode.Index )  ) && MYCOL( grid_ ) != PCOL( snode.Index, grid_ ) )//如果接受了左边的数据并且确实不是同一列
+          {                                                                                            //这里应该是只计算L或者U部分所以才只管了从左边来的数据
+            //Get the reduction tree
+            TreeReduce<T> * redLTree = redToLeftTree_[snode.Index];
+            //下面的都不太懂
+            if(redLTree != NULL){
+              TIMER_START(Reduce_Sinv_LT_Isend);
+              //send the data to NULL to ensure 0 byte send
+              redLTree->SetLocalBuffer(NULL);
+              redLTree->SetDataReady(true);
+
+              bool done = redLTree->Progress();
+
+#if ( _DEBUGlevel_ >= 1 )
               statusOFS<<"["<<snode.Index<<"] "<<" trying to progress reduce L "<<done<<std::endl;
 #endif
               TIMER_STOP(Reduce_Sinv_LT_Isend);
@@ -2160,7 +2984,7 @@ namespace PEXSI{
             TreeBcast * bcastUTree = fwdToBelowTree_[snode.Index];
             if(bcastUTree != NULL){
               if(bcastUTree->GetDestCount()>0){
-                msgToFwd++;
+                msgToFwd += snode.NumUChunk;
               }
             }
           }
@@ -2185,11 +3009,21 @@ namespace PEXSI{
         end_SendULWaitContentFirst=0;
         begin_SendULWaitContentFirst=0;
 #endif
-        
+
+        // Task-parallel mode: the master thread progresses MPI and the
+        // reductions, the other threads run the Sinv * U^T products of
+        // the ready supernodes.
+        Int numTaskRunning = 0;
+        std::vector<Int> doneSupidx;
+#ifdef _OMP_ENABLED_
+#pragma omp parallel num_threads(numWorkspace) if(isTaskParallel)
+#pragma omp master
+#endif
+        {
         while(gemmProcessed<gemmToDo || msgForwarded < msgToFwd)
         {
-          Int reqidx = MPI_UNDEFINED;
           Int supidx = -1;
+          Int numTaskDone = 0;
 
 
           //while I don't have anything to do, wait for data to arrive 
@@ -2211,221 +3045,99 @@ namespace PEXSI{
 
 
 
-            int reqIndices[arrMpireqsRecvContentFromAny.size()];
-            int numRecv = 0; 
-            numRecv = 0;
-            int err = MPI_Waitsome(2*stepSuper, &arrMpireqsRecvContentFromAny[0], &numRecv, reqIndices, MPI_STATUSES_IGNORE);//等待数据,numRecv记录接收到的数据,reqIndices记录了完成的操作下标
-            assert(err==MPI_SUCCESS);
-
-            for(int i =0;i<numRecv;i++){
-              reqidx = reqIndices[i];
-              //I've received something
-              //下面好像是发送数据，不懂
-              if(reqidx!=MPI_UNDEFINED)
-              {
-                //this stays true
-                supidx = reqidx/2;
-                SuperNodeBufferType & snode = arrSuperNodes[supidx];//得到supernode缓存
-
-                //If it's a U block 
-                if(reqidx%2==0){
-
-                  TreeBcast * bcastUTree = fwdToBelowTree_[snode.Index];//得到它的broad cast树
-                  if(bcastUTree != NULL){
-                    if(bcastUTree->GetDestCount()>0){
-
-                      std::vector<MPI_Request> & mpireqsSendToBelow = arrMpireqsSendToBelow[supidx];//得到发送到下面数据的句柄
-#if ( _DEBUGlevel_ >= 1 )
-                      for( Int idxRecv = 0; idxRecv < bcastUTree->GetDestCount(); ++idxRecv ){
-                        Int iProcRow = bcastUTree->GetDest(idxRecv);
-                        statusOFS << std::endl << "["<<snode.Index<<"] "<<  "Forwarding U " << snode.SizeSstrUrowRecv << " BYTES to "<<iProcRow<<" on tag "<<IDX_TO_TAG(snode.Rank,SELINV_TAG_U_CONTENT,limIndex_)<< std::endl <<  std::endl; 
-                      }
-#endif
-
-                      bcastUTree->ForwardMessage( (char*)&snode.SstrUrowRecv[0], snode.SizeSstrUrowRecv, 
-                          IDX_TO_TAG(snode.Rank,SELINV_TAG_U_CONTENT,limIndex_), &mpireqsSendToBelow[0] );//发送U矩阵行数据
-#if ( _DEBUGlevel_ >= 1 )
-                      for( Int idxRecv = 0; idxRecv < bcastUTree->GetDestCount(); ++idxRecv ){
-                        Int iProcRow = bcastUTree->GetDest(idxRecv);
-                        statusOFS << std::endl << "["<<snode.Index<<"] "<<  "Forwarded U " << snode.SizeSstrUrowRecv << " BYTES to "<<iProcRow<<" on tag "<<IDX_TO_TAG(snode.Rank,SELINV_TAG_U_CONTENT,limIndex_)<< std::endl <<  std::endl; 
-                      }
-#endif
-
-                      msgForwarded++;
-                    }
-                  }
-                }
-                //If it's a L block 
-                else if(reqidx%2==1){
-                  TreeBcast * bcastLTree = fwdToRightTree_[snode.Index];//得到它的broad cast树
-                  if(bcastLTree != NULL){
-                    if(bcastLTree->GetDestCount()>0){
-
-                      std::vector<MPI_Request> & mpireqsSendToRight = arrMpireqsSendToRight[supidx];//得到发送右边数据的句柄
-#if ( _DEBUGlevel_ >= 1 )
-                      for( Int idxRecv = 0; idxRecv < bcastLTree->GetDestCount(); ++idxRecv ){
-                        Int iProcCol = bcastLTree->GetDest(idxRecv);
-                        statusOFS << std::endl << "["<<snode.Index<<"] "<<  "Forwarding L " << snode.SizeSstrLcolRecv << " BYTES to "<<iProcCol<<" on tag "<<IDX_TO_TAG(snode.Rank,SELINV_TAG_L_CONTENT,limIndex_)<< std::endl <<  std::endl; 
-                      }
-#endif
-
-                      bcastLTree->ForwardMessage( (char*)&snode.SstrLcolRecv[0], snode.SizeSstrLcolRecv, 
-                          IDX_TO_TAG(snode.Rank,SELINV_TAG_L_CONTENT,limIndex_), &mpireqsSendToRight[0]);//发送L矩阵列数据
-
-                      //                    for( Int idxRecv = 0; idxRecv < bcastLTree->GetDestCount(); ++idxRecv ){
-                      //                      Int iProcCol = bcastLTree->GetDest(idxRecv);
-                      //                      PROFILE_COMM(MYPROC(this->grid_),PNUM(MYROW(this->grid_),iProcCol,this->grid_),IDX_TO_TAG(snode.Index,SELINV_TAG_L_CONTENT),snode.SizeSstrLcolRecv);
-                      //                    }
-#if ( _DEBUGlevel_ >= 1 )
-                      for( Int idxRecv = 0; idxRecv < bcastLTree->GetDestCount(); ++idxRecv ){
-                        Int iProcCol = bcastLTree->GetDest(idxRecv);
-                        statusOFS << std::endl << "["<<snode.Index<<"] "<<  "Forwarded L " << snode.SizeSstrLcolRecv << " BYTES to "<<iProcCol<<" on tag "<<IDX_TO_TAG(snode.Rank,SELINV_TAG_L_CONTENT,limIndex_)<< std::endl <<  std::endl; 
-                      }
-#endif
-                      msgForwarded++;
-                    }
-                  }
-                }
-
-
-#if ( _DEBUGlevel_ >= 1 )
-                statusOFS<<std::endl<<"Received data for ["<<snode.Index<<"] reqidx%2="<<reqidx%2<<" is ready ?"<<snode.isReady<<std::endl;
-#endif
-                //下面检查是否接受到了全部的LU矩阵
-                if( isRecvFromAbove_( snode.Index ) && isRecvFromLeft_( snode.Index )){
-                  snode.isReady++;
-
-                  //if we received both L and U, the supernode is ready
-                  if(snode.isReady==2){
-                    readySupidx.push_back(supidx);
+            // Progress the prefetched steps without blocking, then
+            // wait for the current one.  Do not block while the workers
+            // are busy, their results have to be reduced, nor when the
+            // progress hook of the GEMMs has already found work.
+            for( Int i = 0; i < (Int)stepsPrefetched_.size(); i++ ){
+              ProgressStepContent( *stepsPrefetched_[i], false );
+            }
+            bool blocking = numTaskRunning == 0 
+              && ( (gemmProcessed<gemmToDo && readySupidx.size()==0) || (gemmProcessed==gemmToDo && msgForwarded<msgToFwd) );
+            ProgressStepContent( step, blocking );
 
 #if defined(PROFILE)
-                    if(end_SendULWaitContentFirst==0){
-                      TIMER_STOP(WaitContent_UL_First);
-                      end_SendULWaitContentFirst=1;
-                    }
+            if(end_SendULWaitContentFirst==0 && readySupidx.size()>0){
+              TIMER_STOP(WaitContent_UL_First);
+              end_SendULWaitContentFirst=1;
+            }
 #endif
-                  }
-                }
-              }
-
-            }//end for waitsome
 
             TIMER_STOP(WaitContent_UL);
 
-          } while( (gemmProcessed<gemmToDo && readySupidx.size()==0) || (gemmProcessed==gemmToDo && msgForwarded<msgToFwd) );
+            numTaskDone = 0;
+            if( numTaskRunning > 0 ){
+#ifdef _OMP_ENABLED_
+#pragma omp critical(PEXSI_sinv_done)
+#endif
+              numTaskDone = doneSupidx.size();
+            }
+
+          } while( (gemmProcessed<gemmToDo && readySupidx.size()==0 && numTaskDone==0) || (gemmProcessed==gemmToDo && msgForwarded<msgToFwd) );
           //上面应该都是为了U，L矩阵数据的接收
 
           //If I have some work to do 
           //如果LU矩阵都接受到了就可以开始工作了
+          std::vector<Int> computedSupidx;
+#ifdef _OMP_ENABLED_
+          if( isTaskParallel ){
+            // Hand all the ready supernodes to the workers, and take the
+            // ones they have finished.  A supernode whose U is still
+            // arriving may be ready again while its previous panel is
+            // computed, it waits for that task.
+            std::set<Int> busySupidx;
+            while(readySupidx.size()>0){
+              Int taskSupidx = *readySupidx.begin();
+              readySupidx.erase(readySupidx.begin());
+              SuperNodeBufferType & snode = arrSuperNodes[taskSupidx];
+              if( snode.isComputing ){
+                busySupidx.insert( taskSupidx );
+                continue;
+              }
+              if( IsSinvLTDone( snode ) ){
+                continue;
+              }
+              snode.isComputing = true;
+              Int sizeUArrived = SizeUArrived( snode );
+              numTaskRunning++;
+#pragma omp task firstprivate(taskSupidx, sizeUArrived)
+              {
+                ComputeSinvLT( arrSuperNodes[taskSupidx], sinvLTWork[omp_get_thread_num()], quantSuperNode, sizeUArrived );
+#pragma omp critical(PEXSI_sinv_done)
+                doneSupidx.push_back( taskSupidx );
+              }
+            }
+            readySupidx.insert( busySupidx.begin(), busySupidx.end() );
+
+            std::vector<Int> finishedSupidx;
+#pragma omp critical(PEXSI_sinv_done)
+            finishedSupidx.swap( doneSupidx );
+            numTaskRunning -= finishedSupidx.size();
+            for( Int i = 0; i < finishedSupidx.size(); i++ ){
+              arrSuperNodes[finishedSupidx[i]].isComputing = false;
+              if( IsSinvLTDone( arrSuperNodes[finishedSupidx[i]] ) ){
+                computedSupidx.push_back( finishedSupidx[i] );
+              }
+            }
+          }
+          else
+#endif
           if(readySupidx.size()>0)
           {
-            supidx = readySupidx.back();
-            readySupidx.pop_back();
+            supidx = *readySupidx.begin();
+            readySupidx.erase(readySupidx.begin());
             SuperNodeBufferType & snode = arrSuperNodes[supidx];
-
-
-            // Only the processors received information participate in the Gemm 
-            if( isRecvFromAbove_( snode.Index ) && isRecvFromLeft_( snode.Index ) ){
-
-              std::vector<LBlock<T> > LcolRecv;
-              std::vector<UBlock<T> > UrowRecv;
-              // Save all the data to be updated for { L( isup, snode.Index ) | isup > snode.Index }.
-              // The size will be updated in the Gemm phase and the reduce phase
-          
-              NumMat<float> UBuf_other;//记录量化部分的UBuf
-              
-              bool quantUBuf = false;//记录UBuf是否有被量化的部分
-
-              UnpackData(snode, LcolRecv, UrowRecv);//将接收到的数据放回LU block中，即它接收到的L block和U block现在都在LcolRecv以及UrowRecv里面了
-              //NumMat<T> AinvBuf, UBuf;
-              SelInv_lookup_indexes(snode,LcolRecv, UrowRecv,AinvBuf, UBuf, UBuf_other, quantSuperNode, quantUBuf);//这一步是把UrowRecv里面的东西都复制到UBuf中，把LcolRecv和UrowRecv里面的东西复制到AinvBuf中
-
-              snode.LUpdateBuf.Resize( AinvBuf.m(), SuperSize( snode.Index, super_ ) );//调整LUpdateBuf的大小，为AinvBuf行，snode对应supernode大小的列
-              if(!quantUBuf){//如果左右都没有量化的supernode，那么就是一个普通的GEMM
-  #ifdef GEMM_PROFILE
-                gemm_stat.push_back(AinvBuf.m());
-                gemm_stat.push_back(UBuf.m());
-                gemm_stat.push_back(AinvBuf.n());
-  #endif
-                TIMER_START(Compute_Sinv_LT_GEMM);
-                //进行一次GEMM，计算的结果保存在snode的LUpdateBuf中，这一步对应在算法中的哪一步还不清楚，但感觉像是第三步
-                //没错！这里就是第三步，这里有一个U的转置！
-                //所以一定是第三步！
-                //下面的意思表示:LUpdateBuf = -1 * AinvBuf * Ubuf^T + 0 * LUpdateBuf
-                // blas::Gemm( 'N', 'T', AinvBuf.m(), UBuf.m(), AinvBuf.n(), MINUS_ONE<T>(), 
-                //     AinvBuf.Data(), AinvBuf.m(), 
-                //     UBuf.Data(), UBuf.m(), ZERO<T>(),
-                //     snode.LUpdateBuf.Data(), snode.LUpdateBuf.m() );
-                gpu_blas_dmmul(handle, 'N', 'T', AinvBuf.m(), UBuf.m(), AinvBuf.n(), MINUS_ONE<T>(), 
-                    AinvBuf.Data(), AinvBuf.m(), 
-                    UBuf.Data(), UBuf.m(), ZERO<T>(),
-                    snode.LUpdateBuf.Data(), snode.LUpdateBuf.m() );
-                TIMER_STOP(Compute_Sinv_LT_GEMM);
-              }else{//如果只有UBuf进行量化，AinvBuf没有量化的supernode
-                // std::cout<<"Step 3 : UBuf Quant!"<<std::endl;
-                NumMat<float> quantBuf(AinvBuf.m(), SuperSize( snode.Index, super_ ));//记录公式的临时量化数据大小
-                NumMat<float> AinvBuf_quant(AinvBuf.m(), AinvBuf.n());//记录AinvBuf的量化
-
-                //对AinvBuf和UBuf进行量化，保存到AinfBuf_quant和UBuf_quant中，后面公式要用到
-                for(int j = 0;j<AinvBuf.n();j++){
-                  for(int i = 0;i<AinvBuf.m();i++){
-                    AinvBuf_quant(i, j) = (float)AinvBuf(i, j);
-                  }
-                }
-
-  #ifdef GEMM_PROFILE
-                gemm_stat.push_back(AinvBuf.m());
-                gemm_stat.push_back(UBuf.m());
-                gemm_stat.push_back(AinvBuf.n());
-  #endif
-                TIMER_START(Compute_Sinv_LT_GEMM);
-                //公式为-1 * AinvBuf * (UBuf + UBuf_other)^T
-                //即(1) -1 * AinvBuf * Ubuf^T + (2) -1 * AinvBuf* UBuf_other^T
-                //这里首先计算(1)，并且把结果保存在最终的结果LUpdateBuf中，后面的结果都是直接加在上面的
-                gpu_blas_dmmul(handle, 'N', 'T', AinvBuf.m(), UBuf.m(), AinvBuf.n(), MINUS_ONE<T>(), 
-                    AinvBuf.Data(), AinvBuf.m(), 
-                    UBuf.Data(), UBuf.m(), ZERO<T>(),
-                    snode.LUpdateBuf.Data(), snode.LUpdateBuf.m() ); 
-                // blas::Gemm( 'N', 'T', AinvBuf.m(), UBuf.m(), AinvBuf.n(), MINUS_ONE<T>(), 
-                //     AinvBuf.Data(), AinvBuf.m(), 
-                //     UBuf.Data(), UBuf.m(), ZERO<T>(),
-                //     snode.LUpdateBuf.Data(), snode.LUpdateBuf.m() ); 
-                
-                //然后计算(2)，将结果保存在quantBuf中
-                gpu_blas_smmul(handle, 'N', 'T', AinvBuf_quant.m(), UBuf_other.m(), AinvBuf_quant.n(), MINUS_ONE<float>(),
-                    AinvBuf_quant.Data(), AinvBuf_quant.m(),
-                    UBuf_other.Data(), UBuf_other.m(), ZERO<float>(),
-                    quantBuf.Data(), quantBuf.m());
-                // blas::Gemm('N', 'T', AinvBuf_quant.m(), UBuf_other.m(), AinvBuf_quant.n(), MINUS_ONE<float>(),
-                //     AinvBuf_quant.Data(), AinvBuf_quant.m(),
-                //     UBuf_other.Data(), UBuf_other.m(), ZERO<float>(),
-                //     quantBuf.Data(), quantBuf.m());
-                
-                //将quantBuf的结果添加到LUpadateBuf中
-                for(int j = 0;j<quantBuf.n();j++){
-                  for(int i = 0;i<quantBuf.m();i++){
-                    snode.LUpdateBuf(i, j) = snode.LUpdateBuf(i, j) + (double)quantBuf(i, j);
-                  }
-                }
-
-                TIMER_STOP(Compute_Sinv_LT_GEMM);
-                //最后释放这些资源
-                UBuf_other.deallocate();
-                AinvBuf_quant.deallocate();
-                quantBuf.deallocate();
+            // Only count the supernode once its last panel is done.
+            if( !IsSinvLTDone( snode ) ){
+              ComputeSinvLT( snode, sinvLTWork[0], quantSuperNode, SizeUArrived( snode ) );
+              if( IsSinvLTDone( snode ) ){
+                computedSupidx.push_back( supidx );
+              }
             }
-              
-            //第三步量化已经完成
-              
-              
-              
-
+          }
 
-#if ( _DEBUGlevel_ >= 2 )
-              statusOFS << std::endl << "["<<snode.Index<<"] "<<  "snode.LUpdateBuf: " << snode.LUpdateBuf << std::endl;
-#endif
-            } // if Gemm is to be done locally
+          for( Int idone = 0; idone < (Int)computedSupidx.size(); idone++ ){
+            SuperNodeBufferType & snode = arrSuperNodes[computedSupidx[idone]];
 
             //Get the reduction tree
             //下面这一步不太懂，按照论文中的算法来说应该是把结果Reduce到Ljk去了
@@ -2450,7 +3162,10 @@ namespace PEXSI{
 #if ( _DEBUGlevel_ >= 1 )
             statusOFS<<std::endl<<"gemmProcessed ="<<gemmProcessed<<"/"<<gemmToDo<<std::endl;
 #endif
+          }
 
+          if(computedSupidx.size()>0)
+          {
             //advance reductions
             //这里也不懂
             for (Int supidx=0; supidx<stepSuper; supidx++){
@@ -2466,6 +3181,7 @@ namespace PEXSI{
             }
           }
         }
+        } // omp master
 
       }
       TIMER_STOP(Compute_Sinv_LT);
@@ -2549,6 +3265,45 @@ namespace PEXSI{
       }
       TIMER_STOP(Reduce_Sinv_LT);
 
+      // 2.5D: each copy of the grid contracted and reduced a share of the
+      // U blocks, sum the reduced LUpdateBuf over the copies.  All the
+      // copies hold the same LUpdateBuf shapes, so the buffers of the
+      // step are packed in supernode order and summed in one Allreduce.
+      if( grid_->numReplica > 1 ){
+        TIMER_START(Reduce_Sinv_LT_Replica);
+        Int packSize = 0;
+        for (Int supidx=0; supidx<stepSuper; supidx++){
+          SuperNodeBufferType & snode = arrSuperNodes[supidx];
+          if( MYCOL( grid_ ) == PCOL( snode.Index, grid_ ) ){
+            packSize += snode.LUpdateBuf.Size();
+          }
+        }
+        if( packSize > 0 ){
+          std::vector<T> packSend( packSize );
+          std::vector<T> packRecv( packSize );
+          Int offset = 0;
+          for (Int supidx=0; supidx<stepSuper; supidx++){
+            SuperNodeBufferType & snode = arrSuperNodes[supidx];
+            if( MYCOL( grid_ ) == PCOL( snode.Index, grid_ ) && snode.LUpdateBuf.Size() > 0 ){
+              std::copy( snode.LUpdateBuf.Data(), snode.LUpdateBuf.Data() + snode.LUpdateBuf.Size(),
+                  packSend.begin() + offset );
+              offset += snode.LUpdateBuf.Size();
+            }
+          }
+          mpi::Allreduce( &packSend[0], &packRecv[0], packSize, MPI_SUM, grid_->replicaComm );
+          offset = 0;
+          for (Int supidx=0; supidx<stepSuper; supidx++){
+            SuperNodeBufferType & snode = arrSuperNodes[supidx];
+            if( MYCOL( grid_ ) == PCOL( snode.Index, grid_ ) && snode.LUpdateBuf.Size() > 0 ){
+              std::copy( packRecv.begin() + offset, packRecv.begin() + offset + snode.LUpdateBuf.Size(),
+                  snode.LUpdateBuf.Data() );
+              offset += snode.LUpdateBuf.Size();
+            }
+          }
+        }
+        TIMER_STOP(Reduce_Sinv_LT_Replica);
+      }
+
 
 
       //--------------------- End of reduce of LUpdateBuf-------------------------
@@ -2574,6 +3329,10 @@ namespace PEXSI{
           }
 
 
+          //只reduce打包后的下三角部分
+          if( IsDiagUpdateLower() ){
+            PackLower( snode.DiagBuf );
+          }
           redDTree->SetLocalBuffer(snode.DiagBuf.Data());
           if(!redDTree->IsAllocated()){
             redDTree->SetTag(IDX_TO_TAG(snode.Rank,SELINV_TAG_D_REDUCE,limIndex_));
@@ -2635,6 +3394,9 @@ namespace PEXSI{
                   if( MYCOL( grid_ ) == PCOL( snode.Index, grid_ ) ){
                     if( MYROW( grid_ ) == PROW( snode.Index, grid_ ) ){//如果是Lkk的话
                       LBlock<T> &  LB = this->L( LBj( snode.Index, grid_ ) )[0]; //得到Lkk
+                      if( IsDiagUpdateLower() ){
+                        UnpackLower( snode.DiagBuf );
+                      }
                       // Symmetrize LB
                       //Lkk = DiagBuf + Lkk
                       blas::Axpy( LB.numRow * LB.numCol, ONE<T>(), snode.DiagBuf.Data(), 1, LB.nzval.Data(), 1 );
@@ -2657,7 +3419,7 @@ namespace PEXSI{
 
 
 
-      SendRecvCD_UpdateU(arrSuperNodes, stepSuper);//这里是第五步！将更新的Ainv发送到U那一边！芜湖！
+      SendRecvCD_UpdateU(arrSuperNodes, stepSuper, step.comm);//这里是第五步！将更新的Ainv发送到U那一边！芜湖！
 
 
 
@@ -3317,7 +4079,8 @@ sstm.rdbuf()->pubsetbuf((char*)tree->GetLocalBuffer(), tree->GetMsgSize());
             } // if (isup, jsup) is in L
 #ifndef _OPENMP_BLOCKS_
             TIMER_START(Compute_Sinv_LT_GEMM);
-            blas::Gemm('N','N',AinvBuf.m(), superSize,AinvBuf.n(), MINUS_ONE<T>(), 
+            blas::Gemm(options_->complexGemmMode, options_->complexGemmMinDim,
+                'N','N',AinvBuf.m(), superSize,AinvBuf.n(), MINUS_ONE<T>(), 
                 AinvBuf.Data(), AinvBuf.m(), 
                 nzvalLB2, ldLB2, beta1,
                 nzvalLUpd1, ldLUBuf1);
@@ -3326,7 +4089,8 @@ sstm.rdbuf()->pubsetbuf((char*)tree->GetLocalBuffer(), tree->GetMsgSize());
 #endif
 
             if(pLB1 != pLB2){
-              blas::Gemm('T','N', AinvBuf.n() ,  superSize, AinvBuf.m() , MINUS_ONE<T>(), 
+              blas::Gemm(options_->complexGemmMode, options_->complexGemmMinDim,
+                  'T','N', AinvBuf.n() ,  superSize, AinvBuf.m() , MINUS_ONE<T>(), 
                   AinvBuf.Data(), AinvBuf.m(), 
                   nzvalLB1, ldLB1, beta2,
                   nzvalLUpd2, ldLUBuf2);
@@ -3615,7 +4379,8 @@ sstm.rdbuf()->pubsetbuf((char*)tree->GetLocalBuffer(), tree->GetMsgSize());
 #endif
                     assert(LB.nzval.Size()==LUpdateBuf.Size());
                     assert(LUpdateBuf.m()>=LB.numRow);
-                    blas::Gemm( 'T', 'N', snode.DiagBuf.m(), snode.DiagBuf.n(), LB.numRow,
+                    // Only the lower triangle is reduced, see IsDiagUpdateLower
+                    blas::Gemmt( 'L', 'T', 'N', snode.DiagBuf.m(), LB.numRow,
                         MINUS_ONE<T>(), 
                         LUpdateBuf.Data(), LUpdateBuf.m(),
                         LB.nzval.Data(), LB.nzval.m(), 
@@ -3648,6 +4413,7 @@ sstm.rdbuf()->pubsetbuf((char*)tree->GetLocalBuffer(), tree->GetMsgSize());
                     }
 
                     //set the buffer and mark as active
+                    PackLower( snode.DiagBuf );
                     redDTree->SetLocalBuffer(snode.DiagBuf.Data());
 #ifdef _PRINT_STATS_
                     this->localFlops_+=flops::Axpy<T>(snode.DiagBuf.Size());
@@ -3747,6 +4513,7 @@ sstm.rdbuf()->pubsetbuf((char*)tree->GetLocalBuffer(), tree->GetMsgSize());
                 SetValue(snode.DiagBuf, ZERO<T>());
               }
               redDTree->SetLocalBuffer(snode.DiagBuf.Data());
+              UnpackLower( snode.DiagBuf );
 
               LBlock<T> &  LB = this->L( LBj( snode.Index, this->grid_ ) ).front();
               //Transpose(LB.nzval, LB.nzval);
@@ -3794,13 +4561,475 @@ sstm.rdbuf()->pubsetbuf((char*)tree->GetLocalBuffer(), tree->GetMsgSize());
     } 		// -----  end of method PMatrix::ConstructCommunicationPattern  ----- 
 
 
-
   template<typename T>
-    void PMatrix<T>::ConstructCommunicationPattern_P2p	(  )
+    void PMatrix<T>::CommunicationVolume	( Real& rowVolume, Real& colVolume ) const
     {
-      if (options_->symmetricStorage!=1){
+      // 每棵树按本进程收发的消息计数, 加起来就是总的通信量.
+      Real vol[2] = { 0.0, 0.0 };
+      for( Int ksup = 0; ksup < (Int)fwdToRightTree_.size(); ksup++ ){
+        if( fwdToRightTree_[ksup] != NULL ){
+          vol[0] += (Real)fwdToRightTree_[ksup]->GetMsgSize() * fwdToRightTree_[ksup]->GetDestCount();
+        }
+        if( redToLeftTree_[ksup] != NULL ){
+          vol[0] += (Real)redToLeftTree_[ksup]->GetMsgSize() * redToLeftTree_[ksup]->GetDestCount();
+        }
+        if( fwdToBelowTree_[ksup] != NULL ){
+          vol[1] += (Real)fwdToBelowTree_[ksup]->GetMsgSize() * fwdToBelowTree_[ksup]->GetDestCount();
+        }
+        if( redToAboveTree_[ksup] != NULL ){
+          vol[1] += (Real)redToAboveTree_[ksup]->GetMsgSize() * redToAboveTree_[ksup]->GetDestCount();
+        }
+      }
 
-#ifdef COMMUNICATOR_PROFILE
+      // The v2 trees are on grid_->comm: a message inside a processor
+      // column counts for the columns, the other ones for the rows.
+      Int mycol = MYCOL( grid_ );
+      for( auto & tree : bcastLDataTree_ ){
+        if( !tree ) continue;
+        for( Int i = 0; i < tree->GetDestCount(); i++ ){
+          vol[ ( tree->GetDest( i ) % grid_->numProcCol == mycol ) ? 1 : 0 ] += (Real)tree->GetMsgSize();
+        }
+      }
+      for( auto & tree : redLTree2_ ){
+        if( !tree ) continue;
+        for( Int i = 0; i < tree->GetDestCount(); i++ ){
+          vol[ ( tree->GetDest( i ) % grid_->numProcCol == mycol ) ? 1 : 0 ] += (Real)tree->GetMsgSize();
+        }
+      }
+      for( auto & tree : redDTree2_ ){
+        if( !tree ) continue;
+        for( Int i = 0; i < tree->GetDestCount(); i++ ){
+          vol[ ( tree->GetDest( i ) % grid_->numProcCol == mycol ) ? 1 : 0 ] += (Real)tree->GetMsgSize();
+        }
+      }
+
+      MPI_Allreduce( MPI_IN_PLACE, vol, 2, MPI_DOUBLE, MPI_SUM, grid_->comm );
+      rowVolume = vol[0];
+      colVolume = vol[1];
+    } 		// -----  end of method PMatrix::CommunicationVolume  ----- 
+
+  template<typename T>
+    void PMatrix<T>::ComputeSuperNodeMap	( std::vector<Int>& slot ) const
+    {
+      Int numSuper = this->NumSuper();
+      if( !grid_->snodeSlot.empty() ){
+        ErrorHandling( "ComputeSuperNodeMap requires the 2D block cyclic supernode map." );
+      }
+      Int numProcRow = grid_->numProcRow;
+      Int numProcCol = grid_->numProcCol;
+
+      // Number of rows below the diagonal block of each L(:,k).  L_ is
+      // still block cyclic here.
+      std::vector<Int> localRows( numSuper, 0 );
+      std::vector<Int> numRows( numSuper, 0 );
+      for( Int jb = 0; jb < this->NumLocalBlockCol(); jb++ ){
+        Int ksup = jb * numProcCol + MYCOL( grid_ );
+        if( ksup >= numSuper ) continue;
+        const std::vector<LBlock<T> >& Lcol = L_[jb];
+        for( Int ib = 0; ib < (Int)Lcol.size(); ib++ ){
+          if( Lcol[ib].blockIdx > ksup ){
+            localRows[ksup] += Lcol[ib].numRow;
+          }
+        }
+      }
+      mpi::Allreduce( localRows.data(), numRows.data(), numSuper, MPI_SUM, grid_->comm );
+
+      std::vector<double> cost( numSuper );
+      for( Int ksup = 0; ksup < numSuper; ksup++ ){
+        double w = SuperSize( ksup, super_ );
+        double r = numRows[ksup];
+        cost[ksup] = w * r * r + w * w * r + w * w * w;
+      }
+
+      std::vector<Int> order( numSuper );
+      for( Int ksup = 0; ksup < numSuper; ksup++ ){ order[ksup] = ksup; }
+      std::stable_sort( order.begin(), order.end(),
+          [&cost]( Int a, Int b ){ return cost[a] > cost[b]; } );
+
+      // The position s is owned by processor row s % numProcRow and
+      // column s % numProcCol, so the free positions are grouped by
+      // s % lcm(numProcRow, numProcCol).  The smallest free position of
+      // a group is at the back.
+      Int a = numProcRow, b = numProcCol;
+      while( b != 0 ){ Int t = a % b; a = b; b = t; }
+      Int numClass = numProcRow / a * numProcCol;
+      std::vector<std::vector<Int> > freeSlot( numClass );
+      for( Int s = numSuper - 1; s >= 0; s-- ){
+        freeSlot[s % numClass].push_back( s );
+      }
+
+      std::vector<double> rowLoad( numProcRow, 0.0 );
+      std::vector<double> colLoad( numProcCol, 0.0 );
+      slot.assign( numSuper, 0 );
+      for( Int i = 0; i < numSuper; i++ ){
+        Int ksup = order[i];
+        Int best = -1;
+        double bestLoad = 0.0;
+        for( Int c = 0; c < numClass; c++ ){
+          if( freeSlot[c].empty() ) continue;
+          double load = std::max( rowLoad[c % numProcRow], colLoad[c % numProcCol] );
+          if( best < 0 || load < bestLoad ){
+            best = c;
+            bestLoad = load;
+          }
+        }
+        slot[ksup] = freeSlot[best].back();
+        freeSlot[best].pop_back();
+        rowLoad[slot[ksup] % numProcRow] += cost[ksup];
+        colLoad[slot[ksup] % numProcCol] += cost[ksup];
+      }
+
+#if ( _DEBUGlevel_ >= 1 )
+      statusOFS << std::endl << "Load balanced supernode map, max / min row load = "
+        << *std::max_element( rowLoad.begin(), rowLoad.end() ) << " / "
+        << *std::min_element( rowLoad.begin(), rowLoad.end() )
+        << ", max / min column load = "
+        << *std::max_element( colLoad.begin(), colLoad.end() ) << " / "
+        << *std::min_element( colLoad.begin(), colLoad.end() ) << std::endl;
+#endif
+    } 		// -----  end of method PMatrix::ComputeSuperNodeMap  ----- 
+
+
+  template<typename T>
+    void PMatrix<T>::ExchangeSuperNodeBlocks	( std::vector<std::vector<LBlock<T> > >& Lcyclic,
+        std::vector<std::vector<UBlock<T> > >& Ucyclic, const std::vector<Int>& maskL,
+        const std::vector<Int>& maskU, std::vector<char>& recvBuf, std::vector<int>& recvDispls )
+    {
+      Int mpisize = grid_->mpisize;
+      Int numSuper = this->NumSuper();
+      Int numProcRow = grid_->numProcRow;
+      Int numProcCol = grid_->numProcCol;
+
+      // Blocks sent to each processor, as (local block column, index) for
+      // L and (local block row, index) for U in the block cyclic layout.
+      std::vector<std::vector<std::pair<Int,Int> > > sendL( mpisize );
+      std::vector<std::vector<std::pair<Int,Int> > > sendU( mpisize );
+      for( Int jb = 0; jb < (Int)Lcyclic.size(); jb++ ){
+        Int ksup = jb * numProcCol + MYCOL( grid_ );
+        if( ksup >= numSuper ) continue;
+        std::vector<LBlock<T> >& Lcol = Lcyclic[jb];
+        for( Int ib = 0; ib < (Int)Lcol.size(); ib++ ){
+          Int dest = PNUM( PROW( Lcol[ib].blockIdx, grid_ ), PCOL( ksup, grid_ ), grid_ );
+          sendL[dest].push_back( std::make_pair( jb, ib ) );
+        }
+      }
+      for( Int ib = 0; ib < (Int)Ucyclic.size(); ib++ ){
+        Int ksup = ib * numProcRow + MYROW( grid_ );
+        if( ksup >= numSuper ) continue;
+        std::vector<UBlock<T> >& Urow = Ucyclic[ib];
+        for( Int jb = 0; jb < (Int)Urow.size(); jb++ ){
+          Int dest = PNUM( PROW( ksup, grid_ ), PCOL( Urow[jb].blockIdx, grid_ ), grid_ );
+          sendU[dest].push_back( std::make_pair( ib, jb ) );
+        }
+      }
+
+      std::vector<char> sendBuf;
+      std::vector<int> sendCount( mpisize, 0 ), sendDispls( mpisize + 1, 0 );
+      for( Int dest = 0; dest < mpisize; dest++ ){
+        std::stringstream sstm;
+        Int numL = sendL[dest].size();
+        Int numU = sendU[dest].size();
+        serialize( numL, sstm, NO_MASK );
+        for( Int i = 0; i < numL; i++ ){
+          Int jb = sendL[dest][i].first;
+          Int ksup = jb * numProcCol + MYCOL( grid_ );
+          serialize( ksup, sstm, NO_MASK );
+          serialize( Lcyclic[jb][sendL[dest][i].second], sstm, maskL );
+        }
+        serialize( numU, sstm, NO_MASK );
+        for( Int i = 0; i < numU; i++ ){
+          Int ib = sendU[dest][i].first;
+          Int ksup = ib * numProcRow + MYROW( grid_ );
+          serialize( ksup, sstm, NO_MASK );
+          serialize( Ucyclic[ib][sendU[dest][i].second], sstm, maskU );
+        }
+        std::string str = sstm.str();
+        sendCount[dest] = str.size();
+        sendDispls[dest+1] = sendDispls[dest] + sendCount[dest];
+        sendBuf.insert( sendBuf.end(), str.begin(), str.end() );
+      }
+
+      std::vector<int> recvCount( mpisize, 0 );
+      recvDispls.assign( mpisize + 1, 0 );
+      MPI_Alltoall( sendCount.data(), 1, MPI_INT, recvCount.data(), 1, MPI_INT, grid_->comm );
+      for( Int src = 0; src < mpisize; src++ ){
+        recvDispls[src+1] = recvDispls[src] + recvCount[src];
+      }
+      recvBuf.resize( std::max( recvDispls.back(), 1 ) );
+      MPI_Alltoallv( sendBuf.data(), sendCount.data(), sendDispls.data(), MPI_BYTE,
+          recvBuf.data(), recvCount.data(), recvDispls.data(), MPI_BYTE, grid_->comm );
+    } 		// -----  end of method PMatrix::ExchangeSuperNodeBlocks  ----- 
+
+
+  template<typename T>
+    void PMatrix<T>::RedistributeSuperNodes	(  )
+    {
+      Int numSuper = this->NumSuper();
+      if( grid_->snodeSlot.empty() ) return;
+      if( (Int)grid_->snodeSlot.size() != numSuper ){
+        ErrorHandling( "The supernode map of the grid does not match the number of supernodes." );
+      }
+
+      TIMER_START(RedistributeSuperNodes);
+
+      Int mpisize = grid_->mpisize;
+      std::vector<Int> mask( LBlockMask::TOTAL_NUMBER, 1 );
+      std::vector<Int> maskU( UBlockMask::TOTAL_NUMBER, 1 );
+
+      std::vector<char> recvBuf;
+      std::vector<int> recvDispls;
+      ExchangeSuperNodeBlocks( L_, U_, mask, maskU, recvBuf, recvDispls );
+
+      for( Int jb = 0; jb < this->NumLocalBlockCol(); jb++ ){
+        std::vector<LBlock<T> >().swap( this->L( jb ) );
+        ColBlockIdx_[jb].clear();
+      }
+      for( Int ib = 0; ib < this->NumLocalBlockRow(); ib++ ){
+        std::vector<UBlock<T> >().swap( this->U( ib ) );
+        RowBlockIdx_[ib].clear();
+      }
+
+      for( Int src = 0; src < mpisize; src++ ){
+        if( recvDispls[src+1] == recvDispls[src] ) continue;
+        std::stringstream sstm;
+        sstm.write( &recvBuf[recvDispls[src]], recvDispls[src+1] - recvDispls[src] );
+        Int numL, numU, ksup;
+        deserialize( numL, sstm, NO_MASK );
+        for( Int i = 0; i < numL; i++ ){
+          deserialize( ksup, sstm, NO_MASK );
+          std::vector<LBlock<T> >& Lcol = this->L( LBj( ksup, grid_ ) );
+          Lcol.push_back( LBlock<T>() );
+          deserialize( Lcol.back(), sstm, mask );
+          ColBlockIdx_[LBj( ksup, grid_ )].push_back( Lcol.back().blockIdx );
+          RowBlockIdx_[LBi( Lcol.back().blockIdx, grid_ )].push_back( ksup );
+        }
+        deserialize( numU, sstm, NO_MASK );
+        for( Int i = 0; i < numU; i++ ){
+          deserialize( ksup, sstm, NO_MASK );
+          std::vector<UBlock<T> >& Urow = this->U( LBi( ksup, grid_ ) );
+          Urow.push_back( UBlock<T>() );
+          deserialize( Urow.back(), sstm, maskU );
+          RowBlockIdx_[LBi( ksup, grid_ )].push_back( Urow.back().blockIdx );
+          ColBlockIdx_[LBj( Urow.back().blockIdx, grid_ )].push_back( ksup );
+        }
+      }
+
+      // The blocks by increasing blockIdx, as LUstructToPMatrix sorts
+      // L(:,k), so that the diagonal block comes first.
+      for( Int jb = 0; jb < this->NumLocalBlockCol(); jb++ ){
+        std::vector<LBlock<T> >& Lcol = this->L( jb );
+        std::sort( Lcol.begin(), Lcol.end(),
+            []( const LBlock<T>& a, const LBlock<T>& b ){ return a.blockIdx < b.blockIdx; } );
+        std::sort( ColBlockIdx_[jb].begin(), ColBlockIdx_[jb].end() );
+      }
+      for( Int ib = 0; ib < this->NumLocalBlockRow(); ib++ ){
+        std::vector<UBlock<T> >& Urow = this->U( ib );
+        std::sort( Urow.begin(), Urow.end(),
+            []( const UBlock<T>& a, const UBlock<T>& b ){ return a.blockIdx < b.blockIdx; } );
+        std::sort( RowBlockIdx_[ib].begin(), RowBlockIdx_[ib].end() );
+      }
+
+      TIMER_STOP(RedistributeSuperNodes);
+    } 		// -----  end of method PMatrix::RedistributeSuperNodes  ----- 
+
+
+  template<typename T>
+    void PMatrix<T>::RedistributeSuperNodeValues	( std::vector<std::vector<LBlock<T> > >& Lcyclic,
+        std::vector<std::vector<UBlock<T> > >& Ucyclic )
+    {
+      if( grid_->snodeSlot.empty() ) return;
+
+      TIMER_START(RedistributeSuperNodeValues);
+
+      Int mpisize = grid_->mpisize;
+      // Only the block index and nzval are sent, the blocks are found
+      // by their block index.
+      std::vector<Int> mask( LBlockMask::TOTAL_NUMBER, 0 );
+      mask[LBlockMask::BLOCKIDX] = 1;
+      mask[LBlockMask::NZVAL] = 1;
+      std::vector<Int> maskU( UBlockMask::TOTAL_NUMBER, 0 );
+      maskU[UBlockMask::BLOCKIDX] = 1;
+      maskU[UBlockMask::NZVAL] = 1;
+
+      std::vector<char> recvBuf;
+      std::vector<int> recvDispls;
+      ExchangeSuperNodeBlocks( Lcyclic, Ucyclic, mask, maskU, recvBuf, recvDispls );
+
+      for( Int src = 0; src < mpisize; src++ ){
+        if( recvDispls[src+1] == recvDispls[src] ) continue;
+        std::stringstream sstm;
+        sstm.write( &recvBuf[recvDispls[src]], recvDispls[src+1] - recvDispls[src] );
+        Int numL, numU, ksup, blockIdx;
+        deserialize( numL, sstm, NO_MASK );
+        for( Int i = 0; i < numL; i++ ){
+          deserialize( ksup, sstm, NO_MASK );
+          deserialize( blockIdx, sstm, NO_MASK );
+          std::vector<LBlock<T> >& Lcol = this->L( LBj( ksup, grid_ ) );
+          auto it = std::lower_bound( Lcol.begin(), Lcol.end(), blockIdx,
+              []( const LBlock<T>& a, Int idx ){ return a.blockIdx < idx; } );
+          if( it == Lcol.end() || it->blockIdx != blockIdx ){
+            ErrorHandling( "The L blocks do not match the ones of RedistributeSuperNodes." );
+          }
+          deserialize( it->nzval, sstm, NO_MASK );
+          if( it->nzval.m() != it->numRow || it->nzval.n() != it->numCol ){
+            ErrorHandling( "The L blocks do not match the ones of RedistributeSuperNodes." );
+          }
+        }
+        deserialize( numU, sstm, NO_MASK );
+        for( Int i = 0; i < numU; i++ ){
+          deserialize( ksup, sstm, NO_MASK );
+          deserialize( blockIdx, sstm, NO_MASK );
+          std::vector<UBlock<T> >& Urow = this->U( LBi( ksup, grid_ ) );
+          auto it = std::lower_bound( Urow.begin(), Urow.end(), blockIdx,
+              []( const UBlock<T>& a, Int idx ){ return a.blockIdx < idx; } );
+          if( it == Urow.end() || it->blockIdx != blockIdx ){
+            ErrorHandling( "The U blocks do not match the ones of RedistributeSuperNodes." );
+          }
+          deserialize( it->nzval, sstm, NO_MASK );
+          if( it->nzval.m() != it->numRow || it->nzval.n() != it->numCol ){
+            ErrorHandling( "The U blocks do not match the ones of RedistributeSuperNodes." );
+          }
+        }
+      }
+
+      TIMER_STOP(RedistributeSuperNodeValues);
+    } 		// -----  end of method PMatrix::RedistributeSuperNodeValues  ----- 
+
+
+  template<typename T>
+    void PMatrix<T>::BcastReplica	( Int root, bool isValueOnly )
+    {
+      if( grid_->numReplica == 1 ) return;
+
+      TIMER_START(BcastReplica);
+
+      bool isRoot = ( grid_->replicaRank == root );
+      if( !isValueOnly ){
+        // Only the structure goes through serialize, nzval is sent below
+        // like in the value only case.
+        std::vector<Int> mask( LBlockMask::TOTAL_NUMBER, 1 );
+        std::vector<Int> maskU( UBlockMask::TOTAL_NUMBER, 1 );
+        mask[LBlockMask::NZVAL] = 0;
+        maskU[UBlockMask::NZVAL] = 0;
+        std::vector<char> buf;
+        Int size = 0;
+        if( isRoot ){
+          std::stringstream sstm;
+          for( Int jb = 0; jb < this->NumLocalBlockCol(); jb++ ){
+            serialize( (Int)L_[jb].size(), sstm, NO_MASK );
+            for( Int ib = 0; ib < (Int)L_[jb].size(); ib++ ){
+              serialize( L_[jb][ib], sstm, mask );
+            }
+            serialize( ColBlockIdx_[jb], sstm, NO_MASK );
+          }
+          for( Int ib = 0; ib < this->NumLocalBlockRow(); ib++ ){
+            serialize( (Int)U_[ib].size(), sstm, NO_MASK );
+            for( Int jb = 0; jb < (Int)U_[ib].size(); jb++ ){
+              serialize( U_[ib][jb], sstm, maskU );
+            }
+            serialize( RowBlockIdx_[ib], sstm, NO_MASK );
+          }
+          std::string str = sstm.str();
+          if( str.size() > (size_t)std::numeric_limits<int>::max() ){
+            ErrorHandling( "The structure of the blocks is too large for BcastReplica." );
+          }
+          buf.assign( str.begin(), str.end() );
+          size = buf.size();
+        }
+
+        MPI_Bcast( &size, 1, MPI_INT, root, grid_->replicaComm );
+        buf.resize( std::max( size, 1 ) );
+        MPI_Bcast( buf.data(), size, MPI_BYTE, root, grid_->replicaComm );
+
+        if( !isRoot ){
+          std::stringstream sstm;
+          sstm.write( buf.data(), size );
+          L_.resize( this->NumLocalBlockCol() );
+          U_.resize( this->NumLocalBlockRow() );
+          ColBlockIdx_.resize( this->NumLocalBlockCol() );
+          RowBlockIdx_.resize( this->NumLocalBlockRow() );
+          Int numBlock;
+          for( Int jb = 0; jb < this->NumLocalBlockCol(); jb++ ){
+            deserialize( numBlock, sstm, NO_MASK );
+            L_[jb].resize( numBlock );
+            for( Int ib = 0; ib < numBlock; ib++ ){
+              deserialize( L_[jb][ib], sstm, mask );
+              L_[jb][ib].nzval.Resize( L_[jb][ib].numRow, L_[jb][ib].numCol );
+            }
+            deserialize( ColBlockIdx_[jb], sstm, NO_MASK );
+          }
+          for( Int ib = 0; ib < this->NumLocalBlockRow(); ib++ ){
+            deserialize( numBlock, sstm, NO_MASK );
+            U_[ib].resize( numBlock );
+            for( Int jb = 0; jb < numBlock; jb++ ){
+              deserialize( U_[ib][jb], sstm, maskU );
+              U_[ib][jb].nzval.Resize( U_[ib][jb].numRow, U_[ib][jb].numCol );
+            }
+            deserialize( RowBlockIdx_[ib], sstm, NO_MASK );
+          }
+        }
+      }
+
+      // nzval is sent in place: the blocks are gathered in an hindexed
+      // datatype of T, and a new message is started before the total
+      // reaches INT_MAX bytes.
+      MPI_Datatype elemType;
+      MPI_Type_contiguous( sizeof(T), MPI_BYTE, &elemType );
+      MPI_Type_commit( &elemType );
+      const Int maxCount = std::numeric_limits<int>::max() / sizeof(T);
+      std::vector<int> lens;
+      std::vector<MPI_Aint> disps;
+      Int count = 0;
+      auto flush = [&](){
+        if( lens.empty() ) return;
+        MPI_Datatype type;
+        MPI_Type_create_hindexed( (int)lens.size(), lens.data(), disps.data(), elemType, &type );
+        MPI_Type_commit( &type );
+        MPI_Bcast( MPI_BOTTOM, 1, type, root, grid_->replicaComm );
+        MPI_Type_free( &type );
+        lens.clear();
+        disps.clear();
+        count = 0;
+      };
+      auto append = [&]( NumMat<T>& nzval ){
+        T* ptr = nzval.Data();
+        Int left = nzval.Size();
+        while( left > 0 ){
+          Int len = std::min( left, maxCount - count );
+          MPI_Aint disp;
+          MPI_Get_address( ptr, &disp );
+          lens.push_back( len );
+          disps.push_back( disp );
+          ptr += len;
+          left -= len;
+          count += len;
+          if( count == maxCount ) flush();
+        }
+      };
+      for( Int jb = 0; jb < (Int)L_.size(); jb++ ){
+        for( Int ib = 0; ib < (Int)L_[jb].size(); ib++ ){
+          append( L_[jb][ib].nzval );
+        }
+      }
+      for( Int ib = 0; ib < (Int)U_.size(); ib++ ){
+        for( Int jb = 0; jb < (Int)U_[ib].size(); jb++ ){
+          append( U_[ib][jb].nzval );
+        }
+      }
+      flush();
+      MPI_Type_free( &elemType );
+
+      TIMER_STOP(BcastReplica);
+    } 		// -----  end of method PMatrix::BcastReplica  ----- 
+
+
+
+  template<typename T>
+    void PMatrix<T>::ConstructCommunicationPattern_P2p	(  )
+    {
+      if (options_->symmetricStorage!=1){
+
+#ifdef COMMUNICATOR_PROFILE
         CommunicatorStat stats;
         stats.countSendToBelow_.Resize(numSuper);
         stats.countSendToRight_.Resize(numSuper);
@@ -3815,6 +5044,12 @@ sstm.rdbuf()->pubsetbuf((char*)tree->GetLocalBuffer(), tree->GetMsgSize());
 
         Int numSuper = this->NumSuper();
 
+        // 非空时构造node-aware的树, 见PSelInvOptions::nodeAwareTree.
+        const std::vector<Int> * rowRankNode = 
+          ( options_->nodeAwareTree && grid_->numNode > 1 ) ? &grid_->rowRankNode : NULL;
+        const std::vector<Int> * colRankNode = 
+          ( options_->nodeAwareTree && grid_->numNode > 1 ) ? &grid_->colRankNode : NULL;
+
         TIMER_START(Allocate);
 
 
@@ -3963,8 +5198,9 @@ sstm.rdbuf()->pubsetbuf((char*)tree->GetLocalBuffer(), tree->GetMsgSize());
             Int jsupLocalBlockCol = LBj( jsup, grid_ );//找到这个supernode的local block
             Int jsupProcCol = PCOL( jsup, grid_ );//找到这个supernode对应了processor column
             if( MYCOL( grid_ ) == jsupProcCol ){//如果本processor和这个supernode对应的processor在同一个column
-              // SendToBelow / RecvFromAbove only if (ksup, jsup) is nonzero.
-              if( localColBlockRowIdx[jsupLocalBlockCol].count( ksup ) > 0 ) {
+              // SendToBelow / RecvFromAbove only if (ksup, jsup) is nonzero,
+              // and with 2.5D replication contracted by this copy.
+              if( IsReplicaBlock( jsup ) && localColBlockRowIdx[jsupLocalBlockCol].count( ksup ) > 0 ) {
                 for( std::set<Int>::iterator si = localColBlockRowIdx[jsupLocalBlockCol].begin();
                     si != localColBlockRowIdx[jsupLocalBlockCol].end(); si++	 ){//遍历这个processor的这个supernode的非空的row block
                   Int isup = *si;
@@ -4032,7 +5268,7 @@ sstm.rdbuf()->pubsetbuf((char*)tree->GetLocalBuffer(), tree->GetMsgSize());
                     si != localRowBlockColIdx[isupLocalBlockRow].end(); si++ ){
                   Int jsup = *si;
                   Int jsupProcCol = PCOL( jsup, grid_ );
-                  if( jsup > ksup ){
+                  if( jsup > ksup && IsReplicaBlock( jsup ) ){
                     if( MYCOL( grid_ ) == jsupProcCol ){
                       isRecvFromLeft_(ksup) = true;
                     }
@@ -4211,7 +5447,7 @@ sstm.rdbuf()->pubsetbuf((char*)tree->GetLocalBuffer(), tree->GetMsgSize());
 
               TreeBcast * & BcastLTree = fwdToRightTree_[ksup];
               if(BcastLTree!=NULL){delete BcastLTree; BcastLTree=NULL;}
-              BcastLTree = TreeBcast::Create(this->grid_->rowComm,&tree_ranks[0],tree_ranks.size(),msgSize,SeedRFL[ksup]);
+              BcastLTree = TreeBcast::Create(this->grid_->rowComm,&tree_ranks[0],tree_ranks.size(),msgSize,SeedRFL[ksup],rowRankNode);
 #ifdef COMM_PROFILE_BCAST
               BcastLTree->SetGlobalComm(grid_->comm);
 #endif
@@ -4239,12 +5475,12 @@ sstm.rdbuf()->pubsetbuf((char*)tree->GetLocalBuffer(), tree->GetMsgSize());
               Int totalSize = 0;
               //one integer holding the number of Lblocks
               totalSize+=sizeof(Int);
+              std::vector<Int> mask( UBlockMask::TOTAL_NUMBER, 1 );
               for( Int jb = 0; jb < Urow.size(); jb++ ){
-                if( Urow[jb].blockIdx >= ksup ){
-                  //three indices + one IntNumVec + one NumMat<T>
-                  totalSize+=3*sizeof(Int);
-                  totalSize+= sizeof(Int)+Urow[jb].cols.ByteSize();
-                  totalSize+= 2*sizeof(Int)+Urow[jb].nzval.ByteSize();
+                if( Urow[jb].blockIdx >= ksup && IsReplicaBlock( Urow[jb].blockIdx ) ){
+                  //size of the block + the block
+                  totalSize+=sizeof(Int);
+                  totalSize+=SerializedSize( Urow[jb], mask );
                 }
               }
               aggRFA[ksup]=totalSize;
@@ -4299,7 +5535,7 @@ sstm.rdbuf()->pubsetbuf((char*)tree->GetLocalBuffer(), tree->GetMsgSize());
 
               TreeBcast * & BcastUTree = fwdToBelowTree_[ksup];
               if(BcastUTree!=NULL){delete BcastUTree; BcastUTree=NULL;}
-              BcastUTree = TreeBcast::Create(this->grid_->colComm,&tree_ranks[0],tree_ranks.size(),msgSize,SeedRFA[ksup]);
+              BcastUTree = TreeBcast::Create(this->grid_->colComm,&tree_ranks[0],tree_ranks.size(),msgSize,SeedRFA[ksup],colRankNode);
 #ifdef COMM_PROFILE_BCAST
               BcastUTree->SetGlobalComm(grid_->comm);
 #endif
@@ -4316,7 +5552,8 @@ sstm.rdbuf()->pubsetbuf((char*)tree->GetLocalBuffer(), tree->GetMsgSize());
           vector<Int> globalAggSTD(numSuper*grid_->numProcRow); 
           for( Int ksup = 0; ksup < numSuper; ksup++ ){
             if( MYCOL( grid_ ) == PCOL(ksup, grid_) &&  MYROW(grid_)==PROW(ksup,grid_)){
-              Int totalSize = sizeof(T)*SuperSize( ksup, super_ )*SuperSize( ksup, super_ );
+              Int supSize = SuperSize( ksup, super_ );
+              Int totalSize = IsDiagUpdateLower() ? sizeof(T)*supSize*(supSize+1)/2 : sizeof(T)*supSize*supSize;
               aggSTD[ksup]=totalSize;
               SeedSTD[ksup]=rand();
             }
@@ -4399,7 +5636,7 @@ sstm.rdbuf()->pubsetbuf((char*)tree->GetLocalBuffer(), tree->GetMsgSize());
 
 
                 if(redDTree!=NULL){delete redDTree; redDTree=NULL;}
-                redDTree = TreeReduce<T>::Create(this->grid_->colComm,&tree_ranks[0],tree_ranks.size(),msgSize,SeedSTD[ksup]);
+                redDTree = TreeReduce<T>::Create(this->grid_->colComm,&tree_ranks[0],tree_ranks.size(),msgSize,SeedSTD[ksup],colRankNode);
 #ifdef COMM_PROFILE
                 redDTree->SetGlobalComm(grid_->comm);
 #endif
@@ -4461,7 +5698,12 @@ sstm.rdbuf()->pubsetbuf((char*)tree->GetLocalBuffer(), tree->GetMsgSize());
 #if ( _DEBUGlevel_ >= 1 )
             statusOFS<<"6 "<<ksup<<std::endl;
 #endif
-            if( isRecvFromLeft_(ksup) || CountSendToRight(ksup)>0 ){
+            // With 2.5D replication the copies reduce a share each, the
+            // root takes part in every copy so that LUpdateBuf is summed
+            // over all of them.
+            bool isReplicaRoot = grid_->numReplica > 1 &&
+              MYCOL( grid_ ) == PCOL( ksup, grid_ ) && aggRTL[ksup] > 0;
+            if( isRecvFromLeft_(ksup) || CountSendToRight(ksup)>0 || isReplicaRoot ){
               vector<Int> tree_ranks;
               Int msgSize = 0;
 #if 0
@@ -4510,7 +5752,7 @@ sstm.rdbuf()->pubsetbuf((char*)tree->GetLocalBuffer(), tree->GetMsgSize());
 
               TreeReduce<T> * & redLTree = redToLeftTree_[ksup];
               if(redLTree!=NULL){delete redLTree; redLTree=NULL;}
-              redLTree = TreeReduce<T>::Create(this->grid_->rowComm,&tree_ranks[0],tree_ranks.size(),msgSize,SeedRTL[ksup]);
+              redLTree = TreeReduce<T>::Create(this->grid_->rowComm,&tree_ranks[0],tree_ranks.size(),msgSize,SeedRTL[ksup],rowRankNode);
 #ifdef COMM_PROFILE
               redLTree->SetGlobalComm(grid_->comm);
 #endif
@@ -4642,12 +5884,20 @@ sstm.rdbuf()->pubsetbuf((char*)tree->GetLocalBuffer(), tree->GetMsgSize());
         //Build the list of supernodes based on the elimination tree from SuperLU
         GetWorkSet(snodeEtree,this->WorkingSet());
 
+        // The communicators of the tag epochs are duplicated once here
+        // and reused by every SelInv.
+        SetupEpochComm( std::max( options_->numEpochComm, 0 ) );
+
         return ;
       }
       else{
         TIMER_START(ConstructCommunicationPattern);
         Int numSuper = this->NumSuper();
 
+        // 非空时构造node-aware的树, 见PSelInvOptions::nodeAwareTree.
+        const std::vector<Int> * rankNode = 
+          ( options_->nodeAwareTree && grid_->numNode > 1 ) ? &grid_->rankNode : NULL;
+
         TIMER_START(GetEtree);
         snodeEtree_.resize(numSuper);
         GetEtree(snodeEtree_);
@@ -4850,9 +6100,11 @@ sstm.rdbuf()->pubsetbuf((char*)tree->GetLocalBuffer(), tree->GetMsgSize());
             std::vector<bool> mask(this->grid_->mpisize,false);
 
             Int proot = PNUM(PROW(ksup,this->grid_),PCOL(ksup,this->grid_),this->grid_);
-            double seed = ( (double)ksup / (double)numSuper);
+            // 整数种子, 见BuildNodeTree.
+            double seed = ksup;
             Int supSize = SuperSize(ksup, this->super_);  
-            Int msgSize = supSize * supSize;
+            // Packed lower triangle, see IsDiagUpdateLower
+            Int msgSize = supSize * (supSize + 1) / 2;
 
             senders.push_back(proot);
             mask[proot] = true;
@@ -4867,7 +6119,7 @@ sstm.rdbuf()->pubsetbuf((char*)tree->GetLocalBuffer(), tree->GetMsgSize());
             }
 
             auto & redDTree = this->redDTree2_[ksup];
-            redDTree.reset(TreeReduce_v2<T>::Create(this->grid_->comm,senders.data(),senders.size(),msgSize,seed));
+            redDTree.reset(TreeReduce_v2<T>::Create(this->grid_->comm,senders.data(),senders.size(),msgSize,seed,rankNode));
 #ifdef COMM_PROFILE_BCAST
             redDTree->SetGlobalComm(this->grid_->comm);
 #endif
@@ -5264,7 +6516,7 @@ sstm.rdbuf()->pubsetbuf((char*)tree->GetLocalBuffer(), tree->GetMsgSize());
 
               GetTime( timeSta3 );
               auto & bcastLTree = bcastLDataTree_[ snodeTreeOffset_[ksup] + offset ];
-              bcastLTree.reset(TreeBcast_v2<char>::Create(this->grid_->comm,ranklist,ranklistSize,messageSize,seed));
+              bcastLTree.reset(TreeBcast_v2<char>::Create(this->grid_->comm,ranklist,ranklistSize,messageSize,seed,rankNode));
               bcastLTree->SetTag(tag);
 #ifdef COMM_PROFILE_BCAST
               bcastLTree->SetGlobalComm(this->grid_->comm);
@@ -5277,7 +6529,7 @@ sstm.rdbuf()->pubsetbuf((char*)tree->GetLocalBuffer(), tree->GetMsgSize());
 #endif
 
               auto & redLTree = redLTree2_[ snodeTreeOffset_[ksup] + offset ];
-              redLTree.reset(TreeReduce_v2<T>::Create(this->grid_->comm,ranklist,ranklistSize,blockSize,seed));
+              redLTree.reset(TreeReduce_v2<T>::Create(this->grid_->comm,ranklist,ranklistSize,blockSize,seed,rankNode));
               redLTree->SetTag(tag+1);
 #ifdef COMM_PROFILE_BCAST
               redLTree->SetGlobalComm(this->grid_->comm);
@@ -5484,31 +6736,83 @@ sstm.rdbuf()->pubsetbuf((char*)tree->GetLocalBuffer(), tree->GetMsgSize());
       Int lidx=0;//不懂
       Int rank = 0;//不懂，这个是会在函数中变化的，因为参数是引用的
 
+      // Steps whose L / U broadcasts are already posted.  Their content
+      // does not depend on the previous steps, so the broadcasts of the
+      // next bcastPrefetchSteps steps are prefetched while the current
+      // step is computed, up to the next barrier.  The Sinv blocks used
+      // by a step are the ones of its etree ancestors, written by the
+      // previous steps, so the reductions and the computations still
+      // follow the steps.
+      std::deque<SelInvStepBuffer> postedSteps;
+      Int postRank = 0;
+      Int numPrefetch = (options_->symmetricStorage!=1) ? std::max( options_->bcastPrefetchSteps, 0 ) : 0;
+
+      // Tag epochs.  Instead of a barrier at the end of an epoch, the
+      // next epoch communicates on another set of communicators.  A set
+      // is reused once the MPI_Ibarrier posted at the end of its
+      // previous epoch has completed.  The sets are normally duplicated
+      // by ConstructCommunicationPattern, this only refreshes the epochs
+      // of the steps (and duplicates the sets of a copied PMatrix).
+      Int numEpochComm = (options_->symmetricStorage!=1) ? std::max( options_->numEpochComm, 0 ) : 0;
+      SetupEpochComm( numEpochComm );
+      std::vector<MPI_Request> epochBarriers( numEpochComm, MPI_REQUEST_NULL );
+      SetupThreadHandles();
+
       auto itNextSync = syncPoints_.begin();//同步点，应该是每次并行完都要同步一次
       for (lidx=0; lidx<numSteps ; lidx++){//开始numSteps次并行
-        SelInvIntra_P2p(lidx,rank, handle, quantSuperNode);
+        if( numEpochComm > 0 && ( lidx == 0 || stepEpoch_[lidx] != stepEpoch_[lidx-1] ) ){
+          MPI_Wait( &epochBarriers[stepEpoch_[lidx] % numEpochComm], MPI_STATUS_IGNORE );
+        }
+
+        if( numPrefetch > 0 ){
+          if( postedSteps.empty() ){
+            postedSteps.push_back( SelInvStepBuffer() );
+            PostSelInvStep( lidx, postRank, postedSteps.back() );
+          }
+          while( (Int)postedSteps.size() <= numPrefetch && postedSteps.back().lidx + 1 < numSteps 
+              && !IsBarrierAfterStep( postedSteps.back().lidx, postRank ) ){
+            Int nextLidx = postedSteps.back().lidx + 1;
+            postedSteps.push_back( SelInvStepBuffer() );
+            PostSelInvStep( nextLidx, postRank, postedSteps.back() );
+          }
+          stepsPrefetched_.clear();
+          for( Int i = 1; i < (Int)postedSteps.size(); i++ ){
+            stepsPrefetched_.push_back( &postedSteps[i] );
+          }
+          SelInvIntra_P2p(lidx,rank, handle, quantSuperNode, &postedSteps.front());
+          stepsPrefetched_.clear();
+          postedSteps.pop_front();
+        }
+        else{
+          SelInvIntra_P2p(lidx,rank, handle, quantSuperNode);
+        }
 
 #if ( _DEBUGlevel_ >= 1 )
         statusOFS<<"OUT "<<lidx<<"/"<<numSteps<<" "<<limIndex_<<std::endl;
 #endif
 
-#ifdef LIST_BARRIER
-#ifndef ALL_BARRIER
-        if (options_->maxPipelineDepth!=-1)
-#endif
-        {
-          MPI_Barrier(grid_->comm);
-        }
-#endif
-
         //每次并行完同步一下？
         if (options_->symmetricStorage!=1){
           //find max snode.Index
-          if(lidx>0 && (rank-1)%limIndex_==0){
-            MPI_Barrier(grid_->comm);
+          if(IsBarrierAfterStep(lidx, rank)){
+            if( numEpochComm > 0 ){
+              Int i = stepEpoch_[lidx] % numEpochComm;
+              MPI_Ibarrier( epochComm_[i], &epochBarriers[i] );
+            }
+            else{
+              MPI_Barrier(grid_->comm);
+            }
           }
         }
         else{
+#ifdef LIST_BARRIER
+#ifndef ALL_BARRIER
+          if (options_->maxPipelineDepth!=-1)
+#endif
+          {
+            MPI_Barrier(grid_->comm);
+          }
+#endif
           if(itNextSync!=syncPoints_.end()){
             if(*itNextSync == lidx+1){
               MPI_Barrier(grid_->comm);
@@ -5518,6 +6822,10 @@ sstm.rdbuf()->pubsetbuf((char*)tree->GetLocalBuffer(), tree->GetMsgSize());
         }
       }
 
+      mpi::Waitall( epochBarriers );
+      RestoreTreeComm();
+      FreeThreadHandles();
+
       MPI_Barrier(grid_->comm);
 
       TIMER_STOP(SelInv_P2p);
@@ -5526,440 +6834,624 @@ sstm.rdbuf()->pubsetbuf((char*)tree->GetLocalBuffer(), tree->GetMsgSize());
 
 
 
-  template<typename T> 
-    void PMatrix<T>::PreSelInv	(cublasHandle_t& handle, std::set<std::string> & quantSuperNode)
+  template<typename T>
+    inline void PMatrix<T>::PostRecvFromCrossDiagonal( CrossDiagExchange & cd )
     {
-      if (options_->symmetricStorage!=1){
-#ifdef _PRINT_STATS_
-      this->localFlops_ = 0.0;
-#endif
-      // if(grid_->mpirank == 0){
-      //   std::cout<<"Begin PreSelInv"<<std::endl;
-      // }
-      // Real timeCost = 0;//复制数据需要的总时间
-      // Real timeSta = 0;//一次复制开始的时间
-      // Real timeEnd = 0;//一次复制结束的时间
-      Int numSuper = this->NumSuper(); //得到总的supernode数量
-      //if(
-      // if(grid_->mpirank == 0){
-      //   std::cout<<"Quant Indices:"<<std::endl;
-      //   for(std::string str : quanSuperNode){
-      //     std::cout<<str<<std::endl;
-      //   }
-      // }
-#if ( _DEBUGlevel_ >= 1 )
-      statusOFS << std::endl << "L(i,k) <- L(i,k) * L(k,k)^{-1}" << std::endl << std::endl; 
-#endif
-      // int cnt_zero = 0;
-      for( Int ksup = 0; ksup < numSuper; ksup++ ){
-        //如果processor和supernode在同一列
-        //MYCOL返回当前processor所在的Column
-        //PCOL返回对应supernod所在的processor所在的Column
-        if( MYCOL( grid_ ) == PCOL( ksup, grid_ ) ){
-          // Broadcast the diagonal L block
-          NumMat<T> nzvalLDiag;
-          //得到supernode在本地的L矩阵的nonzero block数组，这里有多个L矩阵的原因主要是一个processor可能会在
-          //一列占据多个L block
-          //LBj返回supernode在本地的nonzero column block number
-          std::vector<LBlock<T> >& Lcol = this->L( LBj( ksup, grid_ ) );
-          if( MYROW( grid_ ) == PROW( ksup, grid_ ) ){//如果processor和supernode也在同一行
-            nzvalLDiag = Lcol[0].nzval;//第0个就是Lkk
-            if( nzvalLDiag.m() != SuperSize(ksup, super_) ||
-                nzvalLDiag.n() != SuperSize(ksup, super_) ){
-              ErrorHandling( "The size of the diagonal block of L is wrong." );
-            }
-          } // Owns the diagonal block
-          else
-          {
-            nzvalLDiag.Resize( SuperSize(ksup, super_), SuperSize(ksup, super_) );
-          }
-          //将Lkk传递给同一列的所有processor
-          MPI_Bcast( (void*)nzvalLDiag.Data(), nzvalLDiag.ByteSize(),
-              MPI_BYTE, PROW( ksup, grid_ ), grid_->colComm );
-          
-          std::stringstream ss;
-          // Triangular solve
-          for( Int ib = 0; ib < Lcol.size(); ib++ ){
-            LBlock<T> & LB = Lcol[ib];
-            if( LB.blockIdx > ksup ){//这里是确保它在下三角矩阵？
-            #if ( _DEBUGlevel_ >= 2 )
-              // Check the correctness of the triangular solve for the first local column
-              if( LBj( ksup, grid_ ) == 0 ){
-                statusOFS << "Diag   L(" << ksup << ", " << ksup << "): " << nzvalLDiag << std::endl;
-                statusOFS << "Before solve L(" << LB.blockIdx << ", " << ksup << "): " << LB.nzval << std::endl;
-              }
-            #endif
-              ss.str("");
-              ss<<LB.blockIdx<<","<<ksup;
-              //这里就是可以用来加速的地方了
-              //这里是通过求解X * OP(A) = alpha * B来得到具体的值的
-              //第一个参数R表示OP(A)在X右边，即X * OP(A)
-              //第二个参数L表示A为下三角矩阵，因为它是L吗嘛
-              //第三个参数N表示不需要对A进行操作，即OP(A) = A
-              //第四个参数U表示A为单位三角矩阵，对角线为1
-              //最后会把结果覆盖到LB.nzvl.Data()里面
-              if(quantSuperNode.find(ss.str()) == quantSuperNode.end()){
-                gpu_blas_dtrsm(handle, 'R', 'L', 'N', 'U', LB.numRow, LB.numCol, ONE<T>(),
-                  nzvalLDiag.Data(), LB.numCol, LB.nzval.Data(), LB.numRow );
-                // blas::Trsm( 'R', 'L', 'N', 'U', LB.numRow, LB.numCol, ONE<T>(),
-                //   nzvalLDiag.Data(), LB.numCol, LB.nzval.Data(), LB.numRow );
-              }else{
-                //这是我魔改的部分
-                // std::cout<<"Step 2 : Quant "<<ss.str()<<std::endl;
-                // GetTime(timeSta);
-                int m = nzvalLDiag.m_;
-                int n = nzvalLDiag.n_;
-                NumMat<float> nzvalLDiag_float(m, n);
-                for(int j = 0;j<n;j++){
-                  for(int i = 0;i<m;i++){
-                    nzvalLDiag_float(i, j) = (float)nzvalLDiag(i, j);
-                  }
-                }
-                // std::cout<<"Copy nzvalDiag done"<<std::endl;
-                
-                int LBm = LB.nzval.m_;
-                int LBn = LB.nzval.n_;
-                NumMat<float> LB_float(LBm, LBn);
-                
-                
-                for(int j = 0;j<LBn;j++){
-                  for(int i = 0;i<LBm;i++){
-                    LB_float(i, j) = (float)LB.nzval(i, j);
-                  }
-                }
-                
-                // GetTime(timeEnd);
-                // timeCost += timeEnd - timeSta;
-                // std::cout<<"Copy LB done"<<std::endl;
-                gpu_blas_strsm(handle, 'R', 'L', 'N', 'U', LB.numRow, LB.numCol, ONE<float>(), (const float*)nzvalLDiag_float.Data(), LB.numCol, LB_float.Data(), LB.numRow);
-                // blas::Trsm('R', 'L', 'N', 'U', LB.numRow, LB.numCol, ONE<float>(), (const float*)nzvalLDiag_float.Data(), LB.numCol, LB_float.Data(), LB.numRow);
-                // blas::Trsm( 'R', 'L', 'N', 'U', LB.numRow, LB.numCol, ONE<float>(),
-                //   (const float*)nzvalLDiag.Data(), LB.numCol, (float)LB.nzval.Data(), LB.numRow );
-                // std::cout<<"float TRSM done"<<std::endl;
-                // GetTime(timeSta);
-                for(int j = 0;j<LBn;j++){
-                  for(int i = 0;i<LBm;i++){
-                    LB.nzval(i, j) = (Real)LB_float(i, j);
-                  }
-                }
-                // GetTime(timeEnd);
-                // timeCost += timeEnd - timeSta;
-                // std::cout<<"Copy back done"<<std::endl;
-                LB_float.deallocate();
-                nzvalLDiag_float.deallocate();
-              }
+      Int numSuper = this->NumSuper();
 
-              
-#ifdef _PRINT_STATS_
-              this->localFlops_+=flops::Trsm<T>('R',LB.numRow, LB.numCol);
-#endif
-#if ( _DEBUGlevel_ >= 2 )
-              // Check the correctness of the triangular solve for the first local column
-              if( LBj( ksup, grid_ ) == 0 ){
-                statusOFS << "After solve  L(" << LB.blockIdx << ", " << ksup << "): " << LB.nzval << std::endl;
-              }
-#endif
+      // Messages from a given source arrive in increasing ksup order,
+      // the order in which the solves are done.
+      for( Int ksup = 0; ksup < numSuper; ksup++ ){
+        if( !isRecvFromCrossDiagonal_(grid_->numProcRow,ksup) ){
+          continue;
+        }
+        cd.isBlockFound[ksup].assign( this->U( LBi( ksup, grid_ ) ).size(), false );
+        for(Int srcRow = 0; srcRow<grid_->numProcRow; srcRow++){
+          if(isRecvFromCrossDiagonal_(srcRow,ksup) ){
+            Int src = PNUM(srcRow,PCOL(ksup,grid_),grid_);
+            if(MYPROC(grid_)!= src){
+              cd.recvSupers.push_back( ksup );
+              cd.recvSources.push_back( src );
             }
           }
-        } // if( MYCOL( grid_ ) == PCOL( ksup, grid_ ) )
-      } // for (ksup)
-//            if(grid_->mpirank == 0){
-//        std::cout<<"End of Ksup"<<std::endl;
-//      }
+        }
+      }
 
-      // std::cout<<grid_->mpirank<<":"<<cnt_zero<<std::endl;        
-              // double* recv_data = NULL;
-              // int mpisize = grid_->mpisize;
-              // int mpirank = grid_->mpirank;
-              // // std::cout<<mpirank<<" Replicate time : " << timeCost << std::endl;
-              // if(mpirank == 0){
-              //   recv_data = (double*)malloc(sizeof(Real) * mpisize);
-              // }
-              // MPI_Gather(&timeCost, 1, MPI_DOUBLE, recv_data, 1, MPI_DOUBLE, 0, grid_->comm);
-              // if(mpirank == 0){
-              //   Real totalTime = 0;
-              //   for(int i = 0;i<mpisize;i++){
-              //     totalTime += recv_data[i];
-              //   }
-              //   std::cout<<"Replicate time : " << totalTime << std::endl;
-              //   free(recv_data);
-              // }
+      Int numRecv = cd.recvSupers.size();
+      cd.recvSizes.assign( numRecv, 0 );
+      cd.recvSizeRequests.assign( numRecv, MPI_REQUEST_NULL );
+      cd.recvRequests.assign( numRecv, MPI_REQUEST_NULL );
+      cd.recvBuffers.resize( numRecv );
+      for( Int i = 0; i < numRecv; i++ ){
+        //接受数据大小
+        MPI_Irecv( &cd.recvSizes[i], 1, MPI_INT, cd.recvSources[i], SELINV_TAG_L_SIZE_CD, 
+            grid_->comm, &cd.recvSizeRequests[i] );
+        cd.pendingContent[cd.recvSources[i]].push_back( i );
+      }
+    } 		// -----  end of method PMatrix::PostRecvFromCrossDiagonal  ----- 
 
+  template<typename T>
+    inline void PMatrix<T>::SendToCrossDiagonal( Int ksup, CrossDiagExchange & cd )
+    {
+      // Sender
+      if( isSendToCrossDiagonal_(grid_->numProcCol,ksup) ){
 #if ( _DEBUGlevel_ >= 1 )
-      statusOFS << std::endl << "U(k,i) <- L(i,k)" << std::endl << std::endl; 
-#endif
-//if(grid_->mpirank == 0){
-//        std::cout<<"Begin Send and Recv"<<std::endl;
-//      }
-
-      for( Int ksup = 0; ksup < numSuper; ksup++ ){
-        Int ksupProcRow = PROW( ksup, grid_ );//得到supernode对应的processor列
-        Int ksupProcCol = PCOL( ksup, grid_ );//得到supernode对应的processor行
-
-        Int sendCount = CountSendToCrossDiagonal(ksup);//需要发送到对称的另一边的L元素数量
-        Int recvCount = CountRecvFromCrossDiagonal(ksup);//需要接受的对称的另一边的L元素数量，都是用于后面转化为U矩阵
+        statusOFS<<"["<<ksup<<"] P"<<MYPROC(grid_)<<" should send to "<<CountSendToCrossDiagonal(ksup)<<" processors"<<std::endl;
+#endif
+
+        for(Int dstCol = 0; dstCol<grid_->numProcCol; dstCol++){
+          if(isSendToCrossDiagonal_(dstCol,ksup) ){
+            Int dst = PNUM(PROW(ksup,grid_),dstCol,grid_);//这里好像就是要去找Ukc的processor rank了
+            if(MYPROC(grid_)!= dst){//如果不是Lkk
+              // Pack L data
+              std::stringstream sstm;
+              cd.sendBuffers.push_back( std::vector<char>() );
+              cd.sendSizes.push_back( 0 );
+              std::vector<char> & sstrLcolSend = cd.sendBuffers.back();
+              Int & sstrSize = cd.sendSizes.back();
+
+              std::vector<Int> mask( LBlockMask::TOTAL_NUMBER, 1 );
+              std::vector<LBlock<T> >&  Lcol = this->L( LBj(ksup, grid_) );//得到supernode在本地所有nonzero block数组
+              // All blocks except for the diagonal block are to be sent right
 
-        std::vector<MPI_Request > arrMpiReqsSend(sendCount, MPI_REQUEST_NULL );//发送L矩阵的句柄
-        std::vector<MPI_Request > arrMpiReqsSizeSend(sendCount, MPI_REQUEST_NULL );//发送L矩阵大小的句柄
-        std::vector<std::vector<char> > arrSstrLcolSend(sendCount);//临时记录发送数据
-        std::vector<Int > arrSstrLcolSizeSend(sendCount);//发送数据大小
+              Int count = 0;
+              for( Int ib = 0; ib < (Int)Lcol.size(); ib++ ){
+                if( Lcol[ib].blockIdx > ksup &&  PCOL( Lcol[ib].blockIdx, grid_ ) == dstCol  ){
+                  count++;
+                }
+              }
 
-        std::vector<MPI_Request > arrMpiReqsRecv(recvCount, MPI_REQUEST_NULL );//同上
-        std::vector<MPI_Request > arrMpiReqsSizeRecv(recvCount, MPI_REQUEST_NULL );
-        std::vector<std::vector<char> > arrSstrLcolRecv(recvCount);
-        std::vector<Int > arrSstrLcolSizeRecv(recvCount);
+              serialize( (Int)count, sstm, NO_MASK );//将发送数量打包
 
+              for( Int ib = 0; ib < (Int)Lcol.size(); ib++ ){
+                if( Lcol[ib].blockIdx > ksup &&  PCOL( Lcol[ib].blockIdx, grid_ ) == dstCol  ){ 
+#if ( _DEBUGlevel_ >= 1 )
+                  statusOFS<<"["<<ksup<<"] SEND contains "<<Lcol[ib].blockIdx<< " which corresponds to "<<GBj(ib,grid_)<<std::endl;
+#endif
+                  serialize( Lcol[ib], sstm, mask );//将发送数据打包
+                }
+              }
 
+              sstrLcolSend.resize( Size(sstm) );
+              sstm.read( &sstrLcolSend[0], sstrLcolSend.size() );//将数据放到sstrLcolSend里面
+              sstrSize = sstrLcolSend.size();
 
-        // Sender
-        if( isSendToCrossDiagonal_(grid_->numProcCol,ksup) ){
 #if ( _DEBUGlevel_ >= 1 )
-          statusOFS<<"["<<ksup<<"] P"<<MYPROC(grid_)<<" should send to "<<CountSendToCrossDiagonal(ksup)<<" processors"<<std::endl;
+              statusOFS<<"["<<ksup<<"] P"<<MYPROC(grid_)<<" ("<<MYROW(grid_)<<","<<MYCOL(grid_)<<") ---> LBj("<<ksup<<")="<<LBj(ksup,grid_)<<" ---> P"<<dst<<" ("<<PROW(ksup,grid_)<<","<<dstCol<<")"<<std::endl;
 #endif
+              cd.sendRequests.push_back( MPI_REQUEST_NULL );
+              cd.sendRequests.push_back( MPI_REQUEST_NULL );
+              MPI_Request * mpiReqs = &cd.sendRequests[cd.sendRequests.size() - 2];
+              MPI_Isend( &sstrSize, sizeof(sstrSize), MPI_BYTE, dst, SELINV_TAG_L_SIZE_CD, grid_->comm, &mpiReqs[0] );//发送数据大小
+              MPI_Isend( (void*)&sstrLcolSend[0], sstrSize, MPI_BYTE, dst, SELINV_TAG_L_CONTENT_CD, grid_->comm, &mpiReqs[1] );//发送数据
 
-          Int sendIdx = 0;
-          for(Int dstCol = 0; dstCol<grid_->numProcCol; dstCol++){
-            if(isSendToCrossDiagonal_(dstCol,ksup) ){
-              Int dst = PNUM(PROW(ksup,grid_),dstCol,grid_);//这里好像就是要去找Ukc的processor rank了
-              if(MYPROC(grid_)!= dst){//如果不是Lkk
-                // Pack L data
-                std::stringstream sstm;
-                std::vector<char> & sstrLcolSend = arrSstrLcolSend[sendIdx];
-                Int & sstrSize = arrSstrLcolSizeSend[sendIdx];
-                MPI_Request & mpiReqSend = arrMpiReqsSend[sendIdx];
-                MPI_Request & mpiReqSizeSend = arrMpiReqsSizeSend[sendIdx];
-
-                std::vector<Int> mask( LBlockMask::TOTAL_NUMBER, 1 );
-                std::vector<LBlock<T> >&  Lcol = this->L( LBj(ksup, grid_) );//得到supernode在本地所有nonzero block数组
-                // All blocks except for the diagonal block are to be sent right
-                //TODO not true > this is a scatter operation ! Can we know the destination ?
-
-                Int count = 0;
-                if( MYROW( grid_ ) == PROW( ksup, grid_ ) ){
-                  for( Int ib = 1; ib < Lcol.size(); ib++ ){
-                    if( Lcol[ib].blockIdx > ksup &&  (Lcol[ib].blockIdx % grid_->numProcCol) == dstCol  ){
-                      count++;
-                    }
-                  }
-                }
-                else{
-
-                  for( Int ib = 0; ib < Lcol.size(); ib++ ){
-                    if( Lcol[ib].blockIdx > ksup &&  (Lcol[ib].blockIdx % grid_->numProcCol) == dstCol  ){
-                      count++;
-                    }
-                  }
-                }
-
-                serialize( (Int)count, sstm, NO_MASK );//将发送数量打包
-
-                for( Int ib = 0; ib < Lcol.size(); ib++ ){
-                  if( Lcol[ib].blockIdx > ksup &&  (Lcol[ib].blockIdx % grid_->numProcCol) == dstCol  ){ 
-#if ( _DEBUGlevel_ >= 1 )
-                    statusOFS<<"["<<ksup<<"] SEND contains "<<Lcol[ib].blockIdx<< " which corresponds to "<<GBj(ib,grid_)<<std::endl;
-#endif
-                    serialize( Lcol[ib], sstm, mask );//将发送数据打包
-                  }
-                }
-
-                sstrLcolSend.resize( Size(sstm) );
-                sstm.read( &sstrLcolSend[0], sstrLcolSend.size() );//将数据放到sstrLcolSend里面
-                sstrSize = sstrLcolSend.size();
+              PROFILE_COMM(MYPROC(this->grid_),dst,SELINV_TAG_L_SIZE_CD,sizeof(sstrSize));
+              PROFILE_COMM(MYPROC(this->grid_),dst,SELINV_TAG_L_CONTENT_CD,sstrSize);
+            } // if I am a sender
+          }
+        }
+      }
 
+      // L is obtained locally, just make a copy. Do not include the diagonal block
+      if( isRecvFromCrossDiagonal_(grid_->numProcRow,ksup) &&
+          isRecvFromCrossDiagonal_(MYROW(grid_),ksup) && MYCOL(grid_) == PCOL(ksup,grid_) ){
+        std::vector<LBlock<T> > LcolRecv;
+        std::vector<LBlock<T> >& Lcol = this->L( LBj( ksup, grid_ ) );
+        if( MYROW( grid_ ) != PROW( ksup, grid_ ) ){
+          LcolRecv.resize( Lcol.size() );
+          for( Int ib = 0; ib < (Int)Lcol.size(); ib++ ){
+            LcolRecv[ib] = Lcol[ib];
+          }
+        }
+        else{
+          LcolRecv.resize( Lcol.size() - 1 );
+          for( Int ib = 0; ib < (Int)Lcol.size() - 1; ib++ ){
+            LcolRecv[ib] = Lcol[ib+1];
+          }
+        }
+        UpdateUFromCrossDiagonal( ksup, LcolRecv, cd.isBlockFound[ksup] );
+      }
+    } 		// -----  end of method PMatrix::SendToCrossDiagonal  ----- 
 
+  template<typename T>
+    inline bool PMatrix<T>::ProgressCrossDiagonal( CrossDiagExchange & cd )
+    {
+      // Post the content receives once the sizes are known, in the order
+      // of the messages of each source.
+      for( std::map<Int, std::deque<Int> >::iterator it = cd.pendingContent.begin();
+          it != cd.pendingContent.end(); it++ ){
+        std::deque<Int> & pending = it->second;
+        while( !pending.empty() ){
+          Int i = pending.front();
+          int flag = 0;
+          MPI_Test( &cd.recvSizeRequests[i], &flag, MPI_STATUS_IGNORE );
+          if( !flag ) break;
+
+          cd.recvBuffers[i].resize( cd.recvSizes[i] );
+          MPI_Irecv( &cd.recvBuffers[i][0], cd.recvSizes[i], MPI_BYTE, cd.recvSources[i], 
+              SELINV_TAG_L_CONTENT_CD, grid_->comm, &cd.recvRequests[i] );//接受数据
+          cd.activeContent.push_back( i );
+          pending.pop_front();
+        }
+      }
 
-                // Send/Recv is possible here due to the one to one correspondence
-                // in the case of square processor grid
+      // Transpose what has landed into U
+      for( std::list<Int>::iterator it = cd.activeContent.begin(); it != cd.activeContent.end(); ){
+        Int i = *it;
+        int flag = 0;
+        MPI_Test( &cd.recvRequests[i], &flag, MPI_STATUS_IGNORE );
+        if( !flag ){
+          it++;
+          continue;
+        }
 
+        Int ksup = cd.recvSupers[i];
 #if ( _DEBUGlevel_ >= 1 )
-                statusOFS<<"["<<ksup<<"] P"<<MYPROC(grid_)<<" ("<<MYROW(grid_)<<","<<MYCOL(grid_)<<") ---> LBj("<<ksup<<")="<<LBj(ksup,grid_)<<" ---> P"<<dst<<" ("<<ksupProcRow<<","<<dstCol<<")"<<std::endl;
+        statusOFS<<"["<<ksup<<"] P"<<MYPROC(grid_)<<" ("<<MYROW(grid_)<<","<<MYCOL(grid_)<<") <--- LBj("<<ksup<<") <--- P"<<cd.recvSources[i]<<std::endl;
 #endif
-                MPI_Isend( &sstrSize, sizeof(sstrSize), MPI_BYTE, dst, SELINV_TAG_L_SIZE_CD, grid_->comm, &mpiReqSizeSend );//发送数据大小
-                MPI_Isend( (void*)&sstrLcolSend[0], sstrSize, MPI_BYTE, dst, SELINV_TAG_L_CONTENT_CD, grid_->comm, &mpiReqSend );//发送数据
-
-
-                PROFILE_COMM(MYPROC(this->grid_),dst,SELINV_TAG_L_SIZE_CD,sizeof(sstrSize));
-                PROFILE_COMM(MYPROC(this->grid_),dst,SELINV_TAG_L_CONTENT_CD,sstrSize);
-
-                //mpi::Send( sstm, dst,SELINV_TAG_L_SIZE_CD, SELINV_TAG_L_CONTENT_CD, grid_->comm );
+        std::stringstream sstm;
+        sstm.write( &cd.recvBuffers[i][0], cd.recvSizes[i] );
 
-                sendIdx++;
-              } // if I am a sender
-            }
-          }
+        // Unpack L data.  
+        std::vector<LBlock<T> > LcolRecv;
+        Int numLBlock;
+        std::vector<Int> mask( LBlockMask::TOTAL_NUMBER, 1 );
+        deserialize( numLBlock, sstm, NO_MASK );
+        LcolRecv.resize(numLBlock);
+        for( Int ib = 0; ib < numLBlock; ib++ ){
+          deserialize( LcolRecv[ib], sstm, mask );//解码输入的L矩阵
         }
+        std::vector<char>().swap( cd.recvBuffers[i] );
 
+        UpdateUFromCrossDiagonal( ksup, LcolRecv, cd.isBlockFound[ksup] );
+        cd.numRecvDone++;
+        it = cd.activeContent.erase( it );
+      }
 
+      // Release the send buffers, sends complete roughly in order
+      while( cd.numSendDone < (Int)cd.sendBuffers.size() ){
+        int flag = 0;
+        MPI_Testall( 2, &cd.sendRequests[2 * cd.numSendDone], &flag, MPI_STATUSES_IGNORE );
+        if( !flag ) break;
+        std::vector<char>().swap( cd.sendBuffers[cd.numSendDone] );
+        cd.numSendDone++;
+      }
 
+      return cd.numRecvDone == (Int)cd.recvSupers.size() && cd.numSendDone == (Int)cd.sendBuffers.size();
+    } 		// -----  end of method PMatrix::ProgressCrossDiagonal  ----- 
 
+  template<typename T>
+    inline void PMatrix<T>::UpdateUFromCrossDiagonal( Int ksup, std::vector<LBlock<T> > & LcolRecv, 
+        std::vector<bool> & isBlockFound )
+    {
+      //得到这个supernode在本地的所有U矩阵的nonzero block row
+      std::vector<UBlock<T> >& Urow = this->U( LBi( ksup, grid_ ) );
+      // (ib, jb) pairs, transposed concurrently once all are matched
+      std::vector<std::pair<Int,Int> > pairs;
+
+      // Update U
+      // Make sure that the size of L and the corresponding U blocks match.
+      for( Int ib = 0; ib < (Int)LcolRecv.size(); ib++ ){
+        LBlock<T> & LB = LcolRecv[ib];
+        if( LB.blockIdx <= ksup ){
+          ErrorHandling( "LcolRecv contains the wrong blocks." );
+        }
+        for( Int jb = 0; jb < (Int)Urow.size(); jb++ ){
+          UBlock<T> &  UB = Urow[jb];
+          if( LB.blockIdx == UB.blockIdx ){
+            // Compare size
+            if( LB.numRow != UB.numCol || LB.numCol != UB.numRow ){
+              std::ostringstream msg;
+              msg << "LB(" << LB.blockIdx << ", " << ksup << ") and UB(" 
+                << ksup << ", " << UB.blockIdx << ")	do not share the same size." << std::endl
+                << "LB: " << LB.numRow << " x " << LB.numCol << std::endl
+                << "UB: " << UB.numRow << " x " << UB.numCol << std::endl;
+              ErrorHandling( msg.str().c_str() );
+            }
 
-        // Receiver
-        if( isRecvFromCrossDiagonal_(grid_->numProcRow,ksup) ){
-
+            // Note that the order of the column indices of the U
+            // block may not follow the order of the row indices,
+            // overwrite the information in U.
+            UB.cols = LB.rows;
+            pairs.push_back( std::make_pair( ib, jb ) );
 
 #if ( _DEBUGlevel_ >= 1 )
-          statusOFS<<"["<<ksup<<"] P"<<MYPROC(grid_)<<" should receive from "<<CountRecvFromCrossDiagonal(ksup)<<" processors"<<std::endl;
+            statusOFS<<"["<<ksup<<"] USING "<<LB.blockIdx<< std::endl;
 #endif
+            isBlockFound[jb] = true;
+            break;
+          } // if( LB.blockIdx == UB.blockIdx )
+        } // for (jb)
+      } // for (ib)
 
-          //得到这个supernode在本地的所有U矩阵的nonzero block row
-          std::vector<UBlock<T> >& Urow = this->U( LBi( ksup, grid_ ) );
-          std::vector<bool> isBlockFound(Urow.size(),false);
-
-
-          Int recvIdx = 0;
-          //receive size first
-          for(Int srcRow = 0; srcRow<grid_->numProcRow; srcRow++){
-            if(isRecvFromCrossDiagonal_(srcRow,ksup) ){
-              std::vector<LBlock<T> > LcolRecv;
-              Int src = PNUM(srcRow,PCOL(ksup,grid_),grid_);//找到来源
-              if(MYPROC(grid_)!= src){
-                MPI_Request & mpiReqSizeRecv = arrMpiReqsSizeRecv[recvIdx];
-                Int & sstrSize = arrSstrLcolSizeRecv[recvIdx];
-
-                MPI_Irecv( &sstrSize, 1, MPI_INT, src, SELINV_TAG_L_SIZE_CD, grid_->comm, &mpiReqSizeRecv );//接受数据大小
+      Int numPair = pairs.size();
+#ifdef _OMP_ENABLED_
+#pragma omp parallel for schedule(dynamic) num_threads(this->NumThreads())
+#endif
+      for( Int p = 0; p < numPair; p++ ){
+        Transpose( LcolRecv[pairs[p].first].nzval, Urow[pairs[p].second].nzval );//对矩阵L进行转置
+      }
+    } 		// -----  end of method PMatrix::UpdateUFromCrossDiagonal  ----- 
 
-                recvIdx++;
+  template<typename T>
+    inline void PMatrix<T>::SolveLColumn(Int ksup, const NumMat<T> & nzvalLDiag, std::vector<LBlock<T> > & Lcol, 
+        cublasHandle_t& handle, std::set<std::string> & quantSuperNode)
+    {
+      // The blocks are solved by concurrent threads, each with its own
+      // cuBLAS handle.
+      Int numBlock = Lcol.size();
+#ifdef _PRINT_STATS_
+      double flopsColumn = 0.0;
+#endif
+      // Triangular solve
+#ifdef _OMP_ENABLED_
+#ifdef _PRINT_STATS_
+#pragma omp parallel for schedule(dynamic) num_threads(this->NumThreads()) reduction(+:flopsColumn)
+#else
+#pragma omp parallel for schedule(dynamic) num_threads(this->NumThreads())
+#endif
+#endif
+      for( Int ib = 0; ib < numBlock; ib++ ){
+        LBlock<T> & LB = Lcol[ib];
+        if( LB.blockIdx > ksup ){//这里是确保它在下三角矩阵？
+          std::stringstream ss;
+        #if ( _DEBUGlevel_ >= 2 )
+          // Check the correctness of the triangular solve for the first local column
+          if( LBj( ksup, grid_ ) == 0 ){
+            statusOFS << "Diag   L(" << ksup << ", " << ksup << "): " << nzvalLDiag << std::endl;
+            statusOFS << "Before solve L(" << LB.blockIdx << ", " << ksup << "): " << LB.nzval << std::endl;
+          }
+        #endif
+          ss<<LB.blockIdx<<","<<ksup;
+          //这里就是可以用来加速的地方了
+          //这里是通过求解X * OP(A) = alpha * B来得到具体的值的
+          //第一个参数R表示OP(A)在X右边，即X * OP(A)
+          //第二个参数L表示A为下三角矩阵，因为它是L吗嘛
+          //第三个参数N表示不需要对A进行操作，即OP(A) = A
+          //第四个参数U表示A为单位三角矩阵，对角线为1
+          //最后会把结果覆盖到LB.nzvl.Data()里面
+          if(quantSuperNode.find(ss.str()) == quantSuperNode.end()){
+            gpu_blas_dtrsm(this->ThreadHandle( handle ), 'R', 'L', 'N', 'U', LB.numRow, LB.numCol, ONE<T>(),
+              nzvalLDiag.Data(), LB.numCol, LB.nzval.Data(), LB.numRow );
+            // blas::Trsm( 'R', 'L', 'N', 'U', LB.numRow, LB.numCol, ONE<T>(),
+            //   nzvalLDiag.Data(), LB.numCol, LB.nzval.Data(), LB.numRow );
+          }else{
+            //这是我魔改的部分
+            // std::cout<<"Step 2 : Quant "<<ss.str()<<std::endl;
+            // GetTime(timeSta);
+            int m = nzvalLDiag.m_;
+            int n = nzvalLDiag.n_;
+            NumMat<float> nzvalLDiag_float(m, n);
+            for(int j = 0;j<n;j++){
+              for(int i = 0;i<m;i++){
+                nzvalLDiag_float(i, j) = (float)nzvalLDiag(i, j);
               }
             }
-          }
-
-          mpi::Waitall(arrMpiReqsSizeRecv);
-
-
-
-          //receive content
-          recvIdx = 0;
-          for(Int srcRow = 0; srcRow<grid_->numProcRow; srcRow++){
-            if(isRecvFromCrossDiagonal_(srcRow,ksup) ){
-              std::vector<LBlock<T> > LcolRecv;
-              Int src = PNUM(srcRow,PCOL(ksup,grid_),grid_);
-              if(MYPROC(grid_)!= src){
-                MPI_Request & mpiReqRecv = arrMpiReqsRecv[recvIdx];
-                Int & sstrSize = arrSstrLcolSizeRecv[recvIdx];
-                std::vector<char> & sstrLcolRecv = arrSstrLcolRecv[recvIdx];
-                sstrLcolRecv.resize(sstrSize);
-
-                MPI_Irecv( &sstrLcolRecv[0], sstrSize, MPI_BYTE, src, SELINV_TAG_L_CONTENT_CD, grid_->comm, &mpiReqRecv );//接受数据
-
-                recvIdx++;
+            // std::cout<<"Copy nzvalDiag done"<<std::endl;
+            
+            int LBm = LB.nzval.m_;
+            int LBn = LB.nzval.n_;
+            NumMat<float> LB_float(LBm, LBn);
+            
+            
+            for(int j = 0;j<LBn;j++){
+              for(int i = 0;i<LBm;i++){
+                LB_float(i, j) = (float)LB.nzval(i, j);
               }
             }
+            
+            // GetTime(timeEnd);
+            // timeCost += timeEnd - timeSta;
+            // std::cout<<"Copy LB done"<<std::endl;
+            gpu_blas_strsm(this->ThreadHandle( handle ), 'R', 'L', 'N', 'U', LB.numRow, LB.numCol, ONE<float>(), (const float*)nzvalLDiag_float.Data(), LB.numCol, LB_float.Data(), LB.numRow);
+            // blas::Trsm('R', 'L', 'N', 'U', LB.numRow, LB.numCol, ONE<float>(), (const float*)nzvalLDiag_float.Data(), LB.numCol, LB_float.Data(), LB.numRow);
+            // blas::Trsm( 'R', 'L', 'N', 'U', LB.numRow, LB.numCol, ONE<float>(),
+            //   (const float*)nzvalLDiag.Data(), LB.numCol, (float)LB.nzval.Data(), LB.numRow );
+            // std::cout<<"float TRSM done"<<std::endl;
+            // GetTime(timeSta);
+            for(int j = 0;j<LBn;j++){
+              for(int i = 0;i<LBm;i++){
+                LB.nzval(i, j) = (Real)LB_float(i, j);
+              }
+            }
+            // GetTime(timeEnd);
+            // timeCost += timeEnd - timeSta;
+            // std::cout<<"Copy back done"<<std::endl;
+            LB_float.deallocate();
+            nzvalLDiag_float.deallocate();
           }
 
-          mpi::Waitall(arrMpiReqsRecv);
+          
+#ifdef _PRINT_STATS_
+          flopsColumn+=flops::Trsm<T>('R',LB.numRow, LB.numCol);
+#endif
+#if ( _DEBUGlevel_ >= 2 )
+          // Check the correctness of the triangular solve for the first local column
+          if( LBj( ksup, grid_ ) == 0 ){
+            statusOFS << "After solve  L(" << LB.blockIdx << ", " << ksup << "): " << LB.nzval << std::endl;
+          }
+#endif
+        }
+      }
+#ifdef _PRINT_STATS_
+      this->localFlops_ += flopsColumn;
+#endif
 
+      return ;
+    } 		// -----  end of method PMatrix::SolveLColumn  ----- 
 
+  template<typename T>
+    inline void PMatrix<T>::IbcastLDiag( Int ksup, NumMat<T> & nzvalLDiag, MPI_Request & request )
+    {
+      // The buffer may still be used by an earlier broadcast
+      MPI_Wait( &request, MPI_STATUS_IGNORE );
+
+      if( MYROW( grid_ ) == PROW( ksup, grid_ ) ){
+        nzvalLDiag = this->L( LBj( ksup, grid_ ) )[0].nzval;
+        if( nzvalLDiag.m() != SuperSize(ksup, super_) ||
+            nzvalLDiag.n() != SuperSize(ksup, super_) ){
+          ErrorHandling( "The size of the diagonal block of L is wrong." );
+        }
+      } // Owns the diagonal block
+      else{
+        nzvalLDiag.Resize( SuperSize(ksup, super_), SuperSize(ksup, super_) );
+      }
 
-          //Process the content
-          //对接收到的数据进行unpack和转置，从而得到需要的矩阵
-          recvIdx = 0;
-          for(Int srcRow = 0; srcRow<grid_->numProcRow; srcRow++){
-            if(isRecvFromCrossDiagonal_(srcRow,ksup) ){//如果我是接受者
-              std::vector<LBlock<T> > LcolRecv;
-              Int src = PNUM(srcRow,PCOL(ksup,grid_),grid_);
-              if(MYPROC(grid_)!= src){
+      //将Lkk传递给同一列的所有processor
+      MPI_Ibcast( (void*)nzvalLDiag.Data(), nzvalLDiag.ByteSize(),
+          MPI_BYTE, PROW( ksup, grid_ ), grid_->colComm, &request );
+    } 		// -----  end of method PMatrix::IbcastLDiag  ----- 
 
-                Int & sstrSize = arrSstrLcolSizeRecv[recvIdx];
-                std::vector<char> & sstrLcolRecv = arrSstrLcolRecv[recvIdx];
-                std::stringstream sstm;
+  template<typename T>
+    inline bool PMatrix<T>::HasOffDiagLBlock( Int ksup, const std::vector<LBlock<T> > & Lcol ) const
+    {
+      for( Int ib = 0; ib < (Int)Lcol.size(); ib++ ){
+        if( Lcol[ib].blockIdx > ksup ){
+          return true;
+        }
+      }
+      return false;
+    }
 
-#if ( _DEBUGlevel_ >= 1 )
-                statusOFS<<"["<<ksup<<"] P"<<MYPROC(grid_)<<" ("<<MYROW(grid_)<<","<<MYCOL(grid_)<<") <--- LBj("<<ksup<<") <--- P"<<src<<" ("<<srcRow<<","<<ksupProcCol<<")"<<std::endl;
-#endif
+  template<typename T>
+    inline void PMatrix<T>::ApplyLDiagInverse(Int ksup, const NumMat<T> & nzvalLDiag, std::vector<LBlock<T> > & Lcol, 
+        cublasHandle_t& handle, std::set<std::string> & quantSuperNode)
+    {
+      Int supSize = SuperSize( ksup, super_ );
+
+      // Off-diagonal blocks computed in double and in float
+      std::vector<Int> blocks, blocksQuant;
+      Int numRow = 0;
+      Int numRowQuant = 0;
+      std::stringstream ss;
+      for( Int ib = 0; ib < (Int)Lcol.size(); ib++ ){
+        LBlock<T> & LB = Lcol[ib];
+        if( LB.blockIdx <= ksup ) continue;
+        ss.str("");
+        ss<<LB.blockIdx<<","<<ksup;
+        if( quantSuperNode.find(ss.str()) == quantSuperNode.end() ){
+          blocks.push_back( ib );
+          numRow += LB.numRow;
+        }
+        else{
+          blocksQuant.push_back( ib );
+          numRowQuant += LB.numRow;
+        }
+      }
+      if( numRow + numRowQuant == 0 ) return;
+
+      // L(k,k)^{-1}.  nzvalLDiag also holds U(k,k), which is cleared.
+      NumMat<T> LDiagInv( supSize, supSize );
+      SetValue( LDiagInv, ZERO<T>() );
+      lapack::Lacpy( 'L', supSize, supSize, nzvalLDiag.Data(), nzvalLDiag.m(), 
+          LDiagInv.Data(), LDiagInv.m() );
+      lapack::Trtri( 'L', 'U', supSize, LDiagInv.Data(), LDiagInv.m() );
+      for( Int i = 0; i < supSize; i++ ){
+        LDiagInv( i, i ) = ONE<T>();
+      }
 
+      bool useHost = ( options_->gemmBackend == 1 || options_->symmetricStorage == 1 );
+
+      if( numRow > 0 ){
+        NumMat<T> LPanel( numRow, supSize );
+        NumMat<T> XPanel( numRow, supSize );
+        Int row = 0;
+        for( Int b = 0; b < (Int)blocks.size(); b++ ){
+          LBlock<T> & LB = Lcol[blocks[b]];
+          lapack::Lacpy( 'A', LB.numRow, supSize, LB.nzval.Data(), LB.numRow, 
+              &LPanel( row, 0 ), LPanel.m() );
+          row += LB.numRow;
+        }
 
-                sstm.write( &sstrLcolRecv[0], sstrSize );
+        if( useHost ){
+          blas::Gemm( options_->complexGemmMode, options_->complexGemmMinDim,
+              'N', 'N', numRow, supSize, supSize, ONE<T>(), 
+              LPanel.Data(), LPanel.m(), LDiagInv.Data(), LDiagInv.m(), 
+              ZERO<T>(), XPanel.Data(), XPanel.m() );
+        }
+        else{
+          gpu_blas_dmmul( handle, 'N', 'N', numRow, supSize, supSize, ONE<T>(), 
+              LPanel.Data(), LPanel.m(), LDiagInv.Data(), LDiagInv.m(), 
+              ZERO<T>(), XPanel.Data(), XPanel.m() );
+        }
 
-                // Unpack L data.  
-                Int numLBlock;
-                std::vector<Int> mask( LBlockMask::TOTAL_NUMBER, 1 );
-                deserialize( numLBlock, sstm, NO_MASK );
-                LcolRecv.resize(numLBlock);
-                for( Int ib = 0; ib < numLBlock; ib++ ){
-                  deserialize( LcolRecv[ib], sstm, mask );//解码输入的L矩阵
-#if ( _DEBUGlevel_ >= 1 )
-                  statusOFS<<"["<<ksup<<"] RECV contains "<<LcolRecv[ib].blockIdx<< " which corresponds to "<< ib * grid_->numProcRow + srcRow; // <<std::endl;
-                  //                  statusOFS<<" L is on row "<< srcRow <<" whereas U is on col "<<((ib * grid_->numProcRow + srcRow)/grid_->numProcCol)%grid_->numProcCol <<std::endl;
-                  statusOFS<<" L is on row "<< srcRow <<" whereas U is on col "<< LcolRecv[ib].blockIdx % grid_->numProcCol <<std::endl;
+        row = 0;
+        for( Int b = 0; b < (Int)blocks.size(); b++ ){
+          LBlock<T> & LB = Lcol[blocks[b]];
+          lapack::Lacpy( 'A', LB.numRow, supSize, &XPanel( row, 0 ), XPanel.m(), 
+              LB.nzval.Data(), LB.numRow );
+          row += LB.numRow;
+        }
+#ifdef _PRINT_STATS_
+        this->localFlops_+=flops::Gemm<T>(numRow, supSize, supSize);
 #endif
-                }
-
+      }
 
-                recvIdx++;
+      if( numRowQuant > 0 ){
+        //量化的block拼成一个float panel
+        NumMat<float> LDiagInv_float( supSize, supSize );
+        for( Int j = 0; j < supSize; j++ ){
+          for( Int i = 0; i < supSize; i++ ){
+            LDiagInv_float( i, j ) = (float)LDiagInv( i, j );
+          }
+        }
+        NumMat<float> LPanel_float( numRowQuant, supSize );
+        NumMat<float> XPanel_float( numRowQuant, supSize );
+        Int row = 0;
+        for( Int b = 0; b < (Int)blocksQuant.size(); b++ ){
+          LBlock<T> & LB = Lcol[blocksQuant[b]];
+          for( Int j = 0; j < supSize; j++ ){
+            for( Int i = 0; i < LB.numRow; i++ ){
+              LPanel_float( row + i, j ) = (float)LB.nzval( i, j );
+            }
+          }
+          row += LB.numRow;
+        }
 
-              } // sender is not the same as receiver
-              else{
-                // L is obtained locally, just make a copy. Do not include the diagonal block
-                std::vector<LBlock<T> >& Lcol = this->L( LBj( ksup, grid_ ) );
-                if( MYROW( grid_ ) != PROW( ksup, grid_ ) ){
-                  LcolRecv.resize( Lcol.size() );
-                  for( Int ib = 0; ib < Lcol.size(); ib++ ){
-                    LcolRecv[ib] = Lcol[ib];
-                  }
-                }
-                else{
-                  LcolRecv.resize( Lcol.size() - 1 );
-                  for( Int ib = 0; ib < Lcol.size() - 1; ib++ ){
-                    LcolRecv[ib] = Lcol[ib+1];
-                  }
-                }
-              } // sender is the same as receiver
+        if( useHost ){
+          blas::Gemm( 'N', 'N', numRowQuant, supSize, supSize, ONE<float>(), 
+              LPanel_float.Data(), LPanel_float.m(), LDiagInv_float.Data(), LDiagInv_float.m(), 
+              ZERO<float>(), XPanel_float.Data(), XPanel_float.m() );
+        }
+        else{
+          gpu_blas_smmul( handle, 'N', 'N', numRowQuant, supSize, supSize, ONE<float>(), 
+              LPanel_float.Data(), LPanel_float.m(), LDiagInv_float.Data(), LDiagInv_float.m(), 
+              ZERO<float>(), XPanel_float.Data(), XPanel_float.m() );
+        }
 
-              // Update U
-              // Make sure that the size of L and the corresponding U blocks match.
-              for( Int ib = 0; ib < LcolRecv.size(); ib++ ){
-                LBlock<T> & LB = LcolRecv[ib];
-                if( LB.blockIdx <= ksup ){
-                  ErrorHandling( "LcolRecv contains the wrong blocks." );
-                }
-                for( Int jb = 0; jb < Urow.size(); jb++ ){
-                  UBlock<T> &  UB = Urow[jb];
-                  if( LB.blockIdx == UB.blockIdx ){
-                    // Compare size
-                    if( LB.numRow != UB.numCol || LB.numCol != UB.numRow ){
-                      std::ostringstream msg;
-                      msg << "LB(" << LB.blockIdx << ", " << ksup << ") and UB(" 
-                        << ksup << ", " << UB.blockIdx << ")	do not share the same size." << std::endl
-                        << "LB: " << LB.numRow << " x " << LB.numCol << std::endl
-                        << "UB: " << UB.numRow << " x " << UB.numCol << std::endl;
-                      ErrorHandling( msg.str().c_str() );
-                    }
+        row = 0;
+        for( Int b = 0; b < (Int)blocksQuant.size(); b++ ){
+          LBlock<T> & LB = Lcol[blocksQuant[b]];
+          for( Int j = 0; j < supSize; j++ ){
+            for( Int i = 0; i < LB.numRow; i++ ){
+              LB.nzval( i, j ) = (T)XPanel_float( row + i, j );
+            }
+          }
+          row += LB.numRow;
+        }
+#ifdef _PRINT_STATS_
+        this->localFlops_+=flops::Gemm<float>(numRowQuant, supSize, supSize);
+#endif
+      }
 
-                    // Note that the order of the column indices of the U
-                    // block may not follow the order of the row indices,
-                    // overwrite the information in U.
-                    UB.cols = LB.rows;
-                    Transpose( LB.nzval, UB.nzval );//对矩阵L进行转置
+      return ;
+    } 		// -----  end of method PMatrix::ApplyLDiagInverse  ----- 
 
+  template<typename T> 
+    void PMatrix<T>::PreSelInv	(cublasHandle_t& handle, std::set<std::string> & quantSuperNode)
+    {
+      SetupThreadHandles();
+      if (options_->symmetricStorage!=1){
+#ifdef _PRINT_STATS_
+      this->localFlops_ = 0.0;
+#endif
+      // if(grid_->mpirank == 0){
+      //   std::cout<<"Begin PreSelInv"<<std::endl;
+      // }
+      // Real timeCost = 0;//复制数据需要的总时间
+      // Real timeSta = 0;//一次复制开始的时间
+      // Real timeEnd = 0;//一次复制结束的时间
+      Int numSuper = this->NumSuper(); //得到总的supernode数量
+      //if(
+      // if(grid_->mpirank == 0){
+      //   std::cout<<"Quant Indices:"<<std::endl;
+      //   for(std::string str : quanSuperNode){
+      //     std::cout<<str<<std::endl;
+      //   }
+      // }
 #if ( _DEBUGlevel_ >= 1 )
-                    statusOFS<<"["<<ksup<<"] USING "<<LB.blockIdx<< std::endl;
+      statusOFS << std::endl << "L(i,k) <- L(i,k) * L(k,k)^{-1}" << std::endl << std::endl; 
 #endif
-                    isBlockFound[jb] = true;
-                    break;
-                  } // if( LB.blockIdx == UB.blockIdx )
-                } // for (jb)
-              } // for (ib)
-            }
-          }
-
-          for( Int jb = 0; jb < Urow.size(); jb++ ){
-            UBlock<T> & UB = Urow[jb];
-            if( !isBlockFound[jb] ){//检查是否所有的矩阵都转置完了
-              ErrorHandling( "UBlock cannot find its update. Something is seriously wrong." );
-            }
-          }
+      // int cnt_zero = 0;
+      //MYCOL返回当前processor所在的Column
+      //PCOL返回对应supernod所在的processor所在的Column
+      std::vector<Int> colSupers;
+      for( Int ksup = 0; ksup < numSuper; ksup++ ){
+        if( MYCOL( grid_ ) == PCOL( ksup, grid_ ) ){
+          colSupers.push_back( ksup );
+        }
+      }
 
+      // The cross-diagonal exchange U(k,i) <- L(i,k) runs during the
+      // solves: L(i,k) is sent once solved and U(k,i) is updated as the
+      // messages land.
+      CrossDiagExchange crossDiag;
+      PostRecvFromCrossDiagonal( crossDiag );
+
+      // The broadcasts of Lkk are posted lookAhead supernodes ahead of
+      // the triangular solves.
+      Int lookAhead = std::max( 1, options_->diagBcastLookAhead );
+      std::vector<NumMat<T> > arrLDiag( lookAhead + 1 );
+      std::vector<MPI_Request> arrReqLDiag( lookAhead + 1, MPI_REQUEST_NULL );
+      Int numPosted = 0;
+
+      for( Int idx = 0; idx < (Int)colSupers.size(); idx++ ){
+        Int ksup = colSupers[idx];
+        for( ; numPosted < (Int)colSupers.size() && numPosted <= idx + lookAhead; numPosted++ ){
+          IbcastLDiag( colSupers[numPosted], arrLDiag[numPosted % (lookAhead + 1)], 
+              arrReqLDiag[numPosted % (lookAhead + 1)] );
+        }
 
+        //得到supernode在本地的L矩阵的nonzero block数组，这里有多个L矩阵的原因主要是一个processor可能会在
+        //一列占据多个L block
+        //LBj返回supernode在本地的nonzero column block number
+        std::vector<LBlock<T> >& Lcol = this->L( LBj( ksup, grid_ ) );
+        // Without off-diagonal blocks there is nothing to solve, the
+        // broadcast is completed later.
+        if( HasOffDiagLBlock( ksup, Lcol ) ){
+          MPI_Wait( &arrReqLDiag[idx % (lookAhead + 1)], MPI_STATUS_IGNORE );
+          NumMat<T> & nzvalLDiag = arrLDiag[idx % (lookAhead + 1)];
+
+          if( options_->diagInverseGemm == 1 ){
+            ApplyLDiagInverse( ksup, nzvalLDiag, Lcol, handle, quantSuperNode );
+          }
+          else{
+            SolveLColumn( ksup, nzvalLDiag, Lcol, handle, quantSuperNode );
+          }
+        }
 
-        } // if I am a receiver
+        // U(k,i) <- L(i,k) can start as soon as L(i,k) is solved
+        SendToCrossDiagonal( ksup, crossDiag );
+        ProgressCrossDiagonal( crossDiag );
+      } // for (idx)
+      mpi::Waitall( arrReqLDiag );
+//            if(grid_->mpirank == 0){
+//        std::cout<<"End of Ksup"<<std::endl;
+//      }
 
+      // std::cout<<grid_->mpirank<<":"<<cnt_zero<<std::endl;        
+              // double* recv_data = NULL;
+              // int mpisize = grid_->mpisize;
+              // int mpirank = grid_->mpirank;
+              // // std::cout<<mpirank<<" Replicate time : " << timeCost << std::endl;
+              // if(mpirank == 0){
+              //   recv_data = (double*)malloc(sizeof(Real) * mpisize);
+              // }
+              // MPI_Gather(&timeCost, 1, MPI_DOUBLE, recv_data, 1, MPI_DOUBLE, 0, grid_->comm);
+              // if(mpirank == 0){
+              //   Real totalTime = 0;
+              //   for(int i = 0;i<mpisize;i++){
+              //     totalTime += recv_data[i];
+              //   }
+              //   std::cout<<"Replicate time : " << totalTime << std::endl;
+              //   free(recv_data);
+              // }
 
-        //Wait until every receiver is done
-        mpi::Waitall(arrMpiReqsSizeSend);
-        mpi::Waitall(arrMpiReqsSend);
+#if ( _DEBUGlevel_ >= 1 )
+      statusOFS << std::endl << "U(k,i) <- L(i,k)" << std::endl << std::endl; 
+#endif
 
+      // Finish the messages still in flight
+      while( !ProgressCrossDiagonal( crossDiag ) );
 
-      } // for (ksup)
+      for( std::map<Int, std::vector<bool> >::iterator it = crossDiag.isBlockFound.begin();
+          it != crossDiag.isBlockFound.end(); it++ ){
+        for( Int jb = 0; jb < (Int)it->second.size(); jb++ ){
+          if( !it->second[jb] ){//检查是否所有的矩阵都转置完了
+            ErrorHandling( "UBlock cannot find its update. Something is seriously wrong." );
+          }
+        }
+      }
 //if(grid_->mpirank == 0){
   //      std::cout<<"End of Send and Recv"<<std::endl;
     //  }
@@ -5970,6 +7462,17 @@ sstm.rdbuf()->pubsetbuf((char*)tree->GetLocalBuffer(), tree->GetMsgSize());
       statusOFS << std::endl << "L(i,i) <- [L(k,k) * U(k,k)]^{-1}" << std::endl << std::endl; 
 #endif
 
+      // The diagonal blocks are inverted by concurrent threads
+#ifdef _PRINT_STATS_
+      double flopsDiag = 0.0;
+#endif
+#ifdef _OMP_ENABLED_
+#ifdef _PRINT_STATS_
+#pragma omp parallel for schedule(dynamic) num_threads(this->NumThreads()) reduction(+:flopsDiag)
+#else
+#pragma omp parallel for schedule(dynamic) num_threads(this->NumThreads())
+#endif
+#endif
       for( Int ksup3 = 0; ksup3 < numSuper; ksup3++ ){
         Int ksup2 = ksup3;
         if( MYROW( grid_ ) == PROW( ksup3, grid_ ) &&
@@ -5997,7 +7500,7 @@ sstm.rdbuf()->pubsetbuf((char*)tree->GetLocalBuffer(), tree->GetMsgSize());
 
 
 #ifdef _PRINT_STATS_
-          this->localFlops_+=flops::Getri<T>(SuperSize( ksup3, this->super_ ));
+          flopsDiag+=flops::Getri<T>(SuperSize( ksup3, this->super_ ));
 #endif
           // Symmetrize the diagonal block
           Symmetrize( LB.nzval );//将Lk据矩阵保持对称
@@ -6008,6 +7511,9 @@ sstm.rdbuf()->pubsetbuf((char*)tree->GetLocalBuffer(), tree->GetMsgSize());
 #endif
         } // if I need to inverse the diagonal block
       } // for (ksup)
+#ifdef _PRINT_STATS_
+      this->localFlops_ += flopsDiag;
+#endif
   //    if(grid_->mpirank == 0){
 //	std::cout<<"end of Preselinv"<<std::endl;
 //}
@@ -6024,41 +7530,80 @@ sstm.rdbuf()->pubsetbuf((char*)tree->GetLocalBuffer(), tree->GetMsgSize());
           << std::endl << std::endl; 
 #endif
 
-        //TODO These BCASTS can be done with a single Allgatherv within each row / column
+        std::vector<Int> colSupers;
         for( Int ksup = 0; ksup < numSuper; ksup++ ){
           if( MYCOL( this->grid_ ) == PCOL( ksup, this->grid_ ) ){
-            // Broadcast the diagonal L block
-            NumMat<T> nzvalLDiag;
+            colSupers.push_back( ksup );
+          }
+        }
+
+        // Broadcasts of the diagonal L blocks, lookAhead supernodes ahead
+        Int lookAhead = std::max( 1, this->options_->diagBcastLookAhead );
+        std::vector<NumMat<T> > arrLDiag( lookAhead + 1 );
+        std::vector<MPI_Request> arrReqLDiag( lookAhead + 1, MPI_REQUEST_NULL );
+        Int numPosted = 0;
+
+        for( Int idx = 0; idx < (Int)colSupers.size(); idx++ ){
+          Int ksup = colSupers[idx];
+          for( ; numPosted < (Int)colSupers.size() && numPosted <= idx + lookAhead; numPosted++ ){
+            IbcastLDiag( colSupers[numPosted], arrLDiag[numPosted % (lookAhead + 1)], 
+                arrReqLDiag[numPosted % (lookAhead + 1)] );
+          }
+
+          {
             std::vector<LBlock<T> >& Lcol = this->L( LBj( ksup, this->grid_ ) );
-            if( MYROW( this->grid_ ) == PROW( ksup, this->grid_ ) ){
-              nzvalLDiag = Lcol[0].nzval;
-              if( nzvalLDiag.m() != SuperSize(ksup, this->super_) ||
-                  nzvalLDiag.n() != SuperSize(ksup, this->super_) ){
-                ErrorHandling( 
-                    "The size of the diagonal block of L is wrong." );
-              }
-            } // Owns the diagonal block
-            else {
-              nzvalLDiag.Resize(SuperSize(ksup, this->super_), SuperSize(ksup, this->super_));
+            if( !HasOffDiagLBlock( ksup, Lcol ) ){
+              continue;
+            }
+            MPI_Wait( &arrReqLDiag[idx % (lookAhead + 1)], MPI_STATUS_IGNORE );
+            NumMat<T> & nzvalLDiag = arrLDiag[idx % (lookAhead + 1)];
+
+            if( this->options_->diagInverseGemm == 1 ){
+              std::set<std::string> noQuant;
+              ApplyLDiagInverse( ksup, nzvalLDiag, Lcol, handle, noQuant );
+              continue;
             }
-            MPI_Bcast( (void*)nzvalLDiag.Data(), nzvalLDiag.ByteSize(),
-                MPI_BYTE, PROW( ksup, this->grid_ ), this->grid_->colComm );
 
             // Triangular solve
-            for( Int ib = 0; ib < Lcol.size(); ib++ ){
+            Int numBlock = Lcol.size();
+#ifdef _PRINT_STATS_
+            double flopsColumn = 0.0;
+#endif
+#ifdef _OMP_ENABLED_
+#ifdef _PRINT_STATS_
+#pragma omp parallel for schedule(dynamic) num_threads(this->NumThreads()) reduction(+:flopsColumn)
+#else
+#pragma omp parallel for schedule(dynamic) num_threads(this->NumThreads())
+#endif
+#endif
+            for( Int ib = 0; ib < numBlock; ib++ ){
               LBlock<T> & LB = Lcol[ib];
               if( LB.blockIdx > ksup  ){
                 blas::Trsm( 'R', 'L', 'N', 'U', LB.numRow, LB.numCol,
                     ONE<T>(), nzvalLDiag.Data(), LB.numCol, 
                     LB.nzval.Data(), LB.numRow );
 #ifdef _PRINT_STATS_
-                this->localFlops_+=flops::Trsm<T>('R',LB.numRow, LB.numCol);
+                flopsColumn+=flops::Trsm<T>('R',LB.numRow, LB.numCol);
 #endif
               }
             }
-          } // if( MYCOL( this->grid_ ) == PCOL( ksup, this->grid_ ) )
-        } // for (ksup)
+#ifdef _PRINT_STATS_
+            this->localFlops_ += flopsColumn;
+#endif
+          }
+        } // for (idx)
+        mpi::Waitall( arrReqLDiag );
 
+#ifdef _PRINT_STATS_
+        double flopsDiag = 0.0;
+#endif
+#ifdef _OMP_ENABLED_
+#ifdef _PRINT_STATS_
+#pragma omp parallel for schedule(dynamic) num_threads(this->NumThreads()) reduction(+:flopsDiag)
+#else
+#pragma omp parallel for schedule(dynamic) num_threads(this->NumThreads())
+#endif
+#endif
         for( Int ksup = 0; ksup < numSuper; ksup++ ){
           if( MYPROC( this->grid_ ) == PNUM( PROW(ksup,this->grid_),PCOL(ksup,this->grid_), this->grid_ ) ){
             IntNumVec ipiv( SuperSize( ksup, this->super_ ) );
@@ -6073,17 +7618,21 @@ sstm.rdbuf()->pubsetbuf((char*)tree->GetLocalBuffer(), tree->GetMsgSize());
             lapack::Getri( SuperSize( ksup, this->super_ ), LB.nzval.Data(), 
                 SuperSize( ksup, this->super_ ), ipiv.Data() );
 #ifdef _PRINT_STATS_
-            this->localFlops_+=flops::Getri<T>(SuperSize( ksup, this->super_ ));
+            flopsDiag+=flops::Getri<T>(SuperSize( ksup, this->super_ ));
 #endif
             // Symmetrize the diagonal block
             Symmetrize( LB.nzval );
 
           } // if I need to invert the diagonal block
         } // for (ksup)
+#ifdef _PRINT_STATS_
+        this->localFlops_ += flopsDiag;
+#endif
       }
   //    if(grid_->mpirank == 0){
 //	std::cout<<"Return PselInv"<<std::endl;
 //}
+      FreeThreadHandles();
       return ;
     } 		// -----  end of method PMatrix::PreSelInv  ----- 
 
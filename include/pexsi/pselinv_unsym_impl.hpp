@@ -80,6 +80,10 @@ namespace PEXSI{
 
       PMatrix<T>::Setup(g,s,o,oFact);
 
+      if( !g->snodeSlot.empty() || ( o != NULL && o->loadBalancedMapping == 1 ) ){
+        ErrorHandling( "PMatrixUnsym requires the 2D block cyclic supernode map." );
+      }
+
 
 
       Lrow_.clear();
@@ -4465,6 +4469,10 @@ namespace PEXSI{
 
         Int numSuper = this->NumSuper();
 
+        // 非空时构造node-aware的树, 见PSelInvOptions::nodeAwareTree.
+        const std::vector<Int> * rankNode = 
+          ( this->options_->nodeAwareTree && this->grid_->numNode > 1 ) ? &this->grid_->rankNode : NULL;
+
         TIMER_START(GetEtree);
         std::vector<Int> snodeEtree(this->NumSuper());
         this->GetEtree(snodeEtree);
@@ -4822,9 +4830,9 @@ namespace PEXSI{
 
             std::sort(ranks.begin()+1,ranks.end());
 
-            double rseed = (double)seed / (double)this->grid_->mpisize;
+            double rseed = seed;
             auto & bcastLTree = this->bcastLDataTree_[ksup];
-            bcastLTree.reset(TreeBcast_v2<char>::Create(this->grid_->comm,ranks.data(),ranks.size(),msgSize,rseed));
+            bcastLTree.reset(TreeBcast_v2<char>::Create(this->grid_->comm,ranks.data(),ranks.size(),msgSize,rseed,rankNode));
 #ifdef COMM_PROFILE_BCAST
             bcastLTree->SetGlobalComm(this->grid_->comm);
 #endif
@@ -4834,7 +4842,7 @@ namespace PEXSI{
             double rseed2 = (double)seed / (double)this->grid_->mpisize;
             auto & redUTree = this->redUTree2_[ksup];
 
-            redUTree.reset(TreeReduce_v2<T>::Create(this->grid_->comm,ranks.data(),ranks.size(),0,rseed2));
+            redUTree.reset(TreeReduce_v2<T>::Create(this->grid_->comm,ranks.data(),ranks.size(),0,rseed2,rankNode));
 #ifdef COMM_PROFILE_BCAST
             redUTree->SetGlobalComm(this->grid_->comm);
 #endif
@@ -4988,9 +4996,9 @@ namespace PEXSI{
 
             std::sort(ranks.begin()+1,ranks.end());
 
-            double rseed = (double)seed / (double)this->grid_->mpisize;
+            double rseed = seed;
             auto & bcastUTree = this->bcastUDataTree_[ksup];
-            bcastUTree.reset(TreeBcast_v2<char>::Create(this->grid_->comm,ranks.data(),ranks.size(),msgSize,rseed));
+            bcastUTree.reset(TreeBcast_v2<char>::Create(this->grid_->comm,ranks.data(),ranks.size(),msgSize,rseed,rankNode));
 #ifdef COMM_PROFILE_BCAST
             bcastUTree->SetGlobalComm(this->grid_->comm);
 #endif
@@ -5000,7 +5008,7 @@ namespace PEXSI{
             double rseed2 = (double)seed / (double)this->grid_->mpisize;
             auto & redLTree = this->redLTree2_[ksup];
 
-            redLTree.reset(TreeReduce_v2<T>::Create(this->grid_->comm,ranks.data(),ranks.size(),0,rseed2));
+            redLTree.reset(TreeReduce_v2<T>::Create(this->grid_->comm,ranks.data(),ranks.size(),0,rseed2,rankNode));
 #ifdef COMM_PROFILE_BCAST
             redLTree->SetGlobalComm(this->grid_->comm);
 #endif
@@ -5138,9 +5146,9 @@ namespace PEXSI{
             //Create redDTree
             Int msgSize = SuperSize(ksup, this->super_)*SuperSize(ksup, this->super_);
 
-            double rseed = (double)seed / (double)this->grid_->mpisize;
+            double rseed = seed;
             auto & redDTree = this->redDTree2_[ksup];
-            redDTree.reset(TreeReduce_v2<T>::Create(this->grid_->comm,ranks.data(),ranks.size(),msgSize,rseed));
+            redDTree.reset(TreeReduce_v2<T>::Create(this->grid_->comm,ranks.data(),ranks.size(),msgSize,rseed,rankNode));
 #ifdef COMM_PROFILE_BCAST
             redDTree->SetGlobalComm(this->grid_->comm);
 #endif
@@ -5236,9 +5244,9 @@ namespace PEXSI{
               //Create redDTree
               Int msgSize = SuperSize(ksup, this->super_)*SuperSize(ksup, this->super_);
 
-              double rseed = (double)seed / (double)this->grid_->mpisize;
+              double rseed = seed;
               auto & redDTree = this->redDTree2_[ksup];
-              redDTree.reset(TreeReduce_v2<T>::Create(this->grid_->comm,ranks.data(),ranks.size(),msgSize,rseed));
+              redDTree.reset(TreeReduce_v2<T>::Create(this->grid_->comm,ranks.data(),ranks.size(),msgSize,rseed,rankNode));
 #ifdef COMM_PROFILE_BCAST
               redDTree->SetGlobalComm(this->grid_->comm);
 #endif
@@ -0,0 +1,184 @@
+/// @file small_gemm.hpp
+/// @brief Register-blocked kernels for small GEMMs.
+///
+/// Most supernodes are narrow, so many of the GEMMs issued by the
+/// selected inversion are a few dozen rows/columns at most, where the
+/// call overhead of a vendor BLAS dominates.  blas::Gemm forwards those
+/// products to smallgemm::Gemm when SMALL_GEMM is defined.
+///
+/// Two kinds of kernels are provided:
+///
+/// - A generic register-blocked kernel for any m, n, k up to
+///   PEXSI_SMALL_GEMM_CUTOFF.
+/// - Kernels where m, n and k are compile-time constants, for the
+///   shapes listed in small_gemm_shapes.hpp.  That list is generated
+///   from GEMM_PROFILE dumps by examples/my_tuneSmallGemm.py.
+#ifndef _PEXSI_SMALL_GEMM_HPP_
+#define _PEXSI_SMALL_GEMM_HPP_
+
+#include "pexsi/environment.hpp"
+
+#include <complex>
+#include <algorithm>
+
+// GEMMs with m, n and k all below this value use the small kernels.
+#ifndef PEXSI_SMALL_GEMM_CUTOFF
+#define PEXSI_SMALL_GEMM_CUTOFF 32
+#endif
+
+namespace PEXSI{
+  namespace smallgemm{
+
+    /// @brief Register block (MR x NR) used for each scalar type.
+    template<typename T> struct RegisterBlock;
+    template<> struct RegisterBlock<float>    { enum{ MR = 8, NR = 4 }; };
+    template<> struct RegisterBlock<double>   { enum{ MR = 4, NR = 4 }; };
+    template<> struct RegisterBlock<std::complex<float> >  { enum{ MR = 4, NR = 2 }; };
+    template<> struct RegisterBlock<std::complex<double> > { enum{ MR = 2, NR = 2 }; };
+
+    // Operation applied to an operand: 0 = 'N', 1 = 'T', 2 = 'C'.
+    inline float    ConjOp( float a )    { return a; }
+    inline double   ConjOp( double a )   { return a; }
+    inline std::complex<float>  ConjOp( std::complex<float> a )  { return std::conj(a); }
+    inline std::complex<double> ConjOp( std::complex<double> a ) { return std::conj(a); }
+
+    template<typename T, Int OP>
+      inline T LoadOp( const T* X, Int ld, Int i, Int l ){
+        // Element (i,l) of op(X).
+        return ( OP == 0 ) ? X[i + l * ld] :
+          ( ( OP == 1 ) ? X[l + i * ld] : ConjOp( X[l + i * ld] ) );
+      }
+
+    /// @brief C(0:mr,0:nr) = alpha * op(A) * op(B) + beta * C for a
+    /// single register block.  When KC > 0 the inner dimension is a
+    /// compile-time constant.
+    template<typename T, Int MR, Int NR, Int OPA, Int OPB, Int KC>
+      inline void MicroKernel( Int mr, Int nr, Int k, T alpha,
+          const T* A, Int lda, const T* B, Int ldb, T beta, T* C, Int ldc )
+      {
+        const Int kk = ( KC > 0 ) ? KC : k;
+        T acc[MR][NR];
+        for( Int j = 0; j < NR; j++ )
+          for( Int i = 0; i < MR; i++ )
+            acc[i][j] = ZERO<T>();
+
+        if( mr == MR && nr == NR ){
+          for( Int l = 0; l < kk; l++ ){
+            T a[MR], b[NR];
+            for( Int i = 0; i < MR; i++ ) a[i] = LoadOp<T,OPA>( A, lda, i, l );
+            // Element (l,j) of op(B).
+            for( Int j = 0; j < NR; j++ ) b[j] = ( OPB == 0 ) ? B[l + j * ldb] :
+              ( ( OPB == 1 ) ? B[j + l * ldb] : ConjOp( B[j + l * ldb] ) );
+            for( Int j = 0; j < NR; j++ )
+              for( Int i = 0; i < MR; i++ )
+                acc[i][j] += a[i] * b[j];
+          }
+        }
+        else{
+          for( Int l = 0; l < kk; l++ ){
+            T a[MR], b[NR];
+            for( Int i = 0; i < mr; i++ ) a[i] = LoadOp<T,OPA>( A, lda, i, l );
+            for( Int j = 0; j < nr; j++ ) b[j] = ( OPB == 0 ) ? B[l + j * ldb] :
+              ( ( OPB == 1 ) ? B[j + l * ldb] : ConjOp( B[j + l * ldb] ) );
+            for( Int j = 0; j < nr; j++ )
+              for( Int i = 0; i < mr; i++ )
+                acc[i][j] += a[i] * b[j];
+          }
+        }
+
+        if( beta == ZERO<T>() ){
+          for( Int j = 0; j < nr; j++ )
+            for( Int i = 0; i < mr; i++ )
+              C[i + j * ldc] = alpha * acc[i][j];
+        }
+        else{
+          for( Int j = 0; j < nr; j++ )
+            for( Int i = 0; i < mr; i++ )
+              C[i + j * ldc] = alpha * acc[i][j] + beta * C[i + j * ldc];
+        }
+      }
+
+    /// @brief Tiles C into register blocks.  MC, NC, KC > 0 fix the
+    /// corresponding dimension at compile time.
+    template<typename T, Int OPA, Int OPB, Int MC, Int NC, Int KC>
+      inline void BlockedGemm( Int m, Int n, Int k, T alpha,
+          const T* A, Int lda, const T* B, Int ldb, T beta, T* C, Int ldc )
+      {
+        const Int MR = RegisterBlock<T>::MR;
+        const Int NR = RegisterBlock<T>::NR;
+        const Int mm = ( MC > 0 ) ? MC : m;
+        const Int nn = ( NC > 0 ) ? NC : n;
+
+        for( Int j0 = 0; j0 < nn; j0 += NR ){
+          Int nr = std::min( NR, nn - j0 );
+          const T* Bj = ( OPB == 0 ) ? B + j0 * ldb : B + j0;
+          for( Int i0 = 0; i0 < mm; i0 += MR ){
+            Int mr = std::min( MR, mm - i0 );
+            const T* Ai = ( OPA == 0 ) ? A + i0 : A + i0 * lda;
+            MicroKernel<T, RegisterBlock<T>::MR, RegisterBlock<T>::NR, OPA, OPB, KC>(
+                mr, nr, k, alpha, Ai, lda, Bj, ldb, beta, C + i0 + j0 * ldc, ldc );
+          }
+        }
+      }
+
+    template<typename T, Int MC, Int NC, Int KC>
+      inline void DispatchOp( Int opA, Int opB, Int m, Int n, Int k, T alpha,
+          const T* A, Int lda, const T* B, Int ldb, T beta, T* C, Int ldc )
+      {
+#define PEXSI_SMALL_GEMM_OP_CASE(OA,OB) \
+        if( opA == OA && opB == OB ){ \
+          BlockedGemm<T,OA,OB,MC,NC,KC>( m, n, k, alpha, A, lda, B, ldb, beta, C, ldc ); \
+          return; \
+        }
+        PEXSI_SMALL_GEMM_OP_CASE(0,0)
+        PEXSI_SMALL_GEMM_OP_CASE(0,1)
+        PEXSI_SMALL_GEMM_OP_CASE(1,0)
+        PEXSI_SMALL_GEMM_OP_CASE(1,1)
+        PEXSI_SMALL_GEMM_OP_CASE(0,2)
+        PEXSI_SMALL_GEMM_OP_CASE(2,0)
+        PEXSI_SMALL_GEMM_OP_CASE(2,2)
+        PEXSI_SMALL_GEMM_OP_CASE(1,2)
+        PEXSI_SMALL_GEMM_OP_CASE(2,1)
+#undef PEXSI_SMALL_GEMM_OP_CASE
+      }
+
+    inline Int TransToOp( char trans ){
+      return ( trans == 'N' || trans == 'n' ) ? 0 :
+        ( ( trans == 'T' || trans == 't' ) ? 1 : 2 );
+    }
+
+    /// @brief C = alpha * op(A) * op(B) + beta * C with the small
+    /// kernels.
+    ///
+    /// @return false if the product is outside the range of the small
+    /// kernels, in which case nothing is computed and the caller is
+    /// expected to call the vendor BLAS.
+    template<typename T>
+      inline bool Gemm( char transA, char transB, Int m, Int n, Int k, T alpha,
+          const T* A, Int lda, const T* B, Int ldb, T beta, T* C, Int ldc )
+      {
+        if( m <= 0 || n <= 0 || k <= 0 ) return false;
+        if( m > PEXSI_SMALL_GEMM_CUTOFF || n > PEXSI_SMALL_GEMM_CUTOFF ||
+            k > PEXSI_SMALL_GEMM_CUTOFF ) return false;
+
+        Int opA = TransToOp( transA );
+        Int opB = TransToOp( transB );
+
+        // Shapes seen often enough in the profiles get fully unrolled
+        // kernels.
+#define PEXSI_SMALL_GEMM_SHAPE(M,N,K) \
+        if( m == M && n == N && k == K ){ \
+          DispatchOp<T,M,N,K>( opA, opB, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc ); \
+          return true; \
+        }
+#include "pexsi/small_gemm_shapes.hpp"
+#undef PEXSI_SMALL_GEMM_SHAPE
+
+        DispatchOp<T,0,0,0>( opA, opB, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc );
+        return true;
+      }
+
+  } // namespace smallgemm
+} // namespace PEXSI
+
+#endif
@@ -0,0 +1,10 @@
+/// @file small_gemm_shapes.hpp
+/// @brief (m,n,k) shapes with fully unrolled small-GEMM kernels.
+///
+/// Included by smallgemm::Gemm with PEXSI_SMALL_GEMM_SHAPE defined; no
+/// include guard on purpose.  Regenerate from GEMM_PROFILE dumps with
+///
+///   python examples/my_tuneSmallGemm.py stat0 stat1 ... > include/pexsi/small_gemm_shapes.hpp
+///
+/// Every shape adds nine kernels per scalar type, so keep the list
+/// short.  Shapes not listed here still use the generic small kernel.
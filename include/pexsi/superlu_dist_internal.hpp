@@ -112,9 +112,27 @@ struct SuperLUOptions{
   /// Note that this has an impact only for unsymmetric matrices.
   Int              Transpose;
 
+  /// @brief Option to free the numerical values of the factors while
+  /// LUstructToPMatrix converts them.
+  ///
+  /// - 0: The values are kept in LUstruct (default).
+  /// - 1: Each block column of L and block row of U is freed as soon as
+  /// it has been copied to the PMatrix, so that about one copy of the
+  /// factors is alive during the conversion and the selected
+  /// inversion.  The storage is allocated again by the next
+  /// Distribute; SolveDistMultiVector cannot be used in between.
+  /// The PMatrix keeps its values until they are refreshed by the next
+  /// LUstructToPMatrix, so the factorization of the next shift still
+  /// peaks at two copies of the factors; only the conversion and the
+  /// selected inversion run next to one copy.
+  /// Rejected by the SuperLUMatrix constructor when the SuperLU_DIST
+  /// in use keeps the values of the factors in one array
+  /// (Lnzval_bc_dat / Unzval_br_dat).
+  Int              freeLUValues;
+
 
   // Member functions to setup the default value
-  SuperLUOptions(): numProcSymbFact(0), ColPerm("MMD_AT_PLUS_A"), Symmetric(1), RowPerm("NOROWPERM"), Transpose(0), Equil("NO") {}
+  SuperLUOptions(): numProcSymbFact(0), ColPerm("MMD_AT_PLUS_A"), Symmetric(1), RowPerm("NOROWPERM"), Transpose(0), Equil("NO"), freeLUValues(0) {}
 };
 
 
@@ -124,6 +142,31 @@ template<typename T> class PMatrix;
 class ComplexSuperLUData_internal;
 class RealSuperLUData_internal;
 
+/// @struct SuperLUPMatrixLayout
+/// @brief Where the L blocks of a PMatrix are read from in the
+/// LUstruct.
+///
+/// Recorded by the LUstructToPMatrix building the blocks of a PMatrix
+/// and kept in it (PMatrix::FactorLayout) until its next Setup.  The
+/// structure of LUstruct is fixed by the symbolic factorization, so the
+/// following calls for the same PMatrix only copy the values of the
+/// new factors into the existing blocks.
+struct SuperLUPMatrixLayout{
+  /// @brief The symbolic factorization of the LUstruct the blocks were
+  /// built from.
+  Int                    symbolicId;
+
+  /// @brief For each L block, in the order of the LUstruct, its
+  /// position in L(:,k) after sorting by blockIdx.
+  std::vector<Int>       LblockPos;
+
+  /// @brief The permutation sorting the rows of each L block,
+  /// concatenated in the same order.
+  std::vector<Int>       LrowPerm;
+
+  SuperLUPMatrixLayout(): symbolicId(0) {}
+};
+
 class RealSuperLUData{
 protected:
   RealSuperLUData_internal * ptrData;
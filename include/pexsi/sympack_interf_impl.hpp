@@ -139,6 +139,10 @@ namespace PEXSI{
     int mpirank, mpisize;
     const GridType *g = PMat.Grid();
 
+    if( !g->snodeSlot.empty() || ( PMat.Options() != nullptr && PMat.Options()->loadBalancedMapping == 1 ) ){
+      ErrorHandling( "symPACKMatrixToPMatrix requires the 2D block cyclic supernode map." );
+    }
+
     // FIXME Check PMatrix and symPACKMatrix has the same communicator
     MPI_Comm comm = g->comm;
     MPI_Comm colComm = g->colComm;
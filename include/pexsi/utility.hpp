@@ -496,6 +496,24 @@ template <class F> inline std::ostream& operator<<( std::ostream& os, const NumT
 // class files
 // *********************************************************************
 
+/// @brief Read-only input stream over a byte buffer, to deserialize
+/// part of a message without copying it into a std::stringstream.
+struct ByteIStream : std::istream
+{
+  struct ByteStreamBuffer : std::streambuf
+  {
+    ByteStreamBuffer( const char* buf, std::size_t size ){
+      char* p = const_cast<char*>( buf );
+      this->setg( p, p, p + size );
+    }
+  } byteStreamBuffer_;
+
+  ByteIStream( const char* buf, std::size_t size )
+    : std::ios(&byteStreamBuffer_), std::istream(&byteStreamBuffer_), 
+    byteStreamBuffer_( buf, size )
+    { }
+};
+
 
 
 
@@ -95,6 +95,33 @@ private:
   const GridType*           gridPole_;          
   const GridType*           gridSelInv_;        // Inner layer communicator for SelInv
 
+  // Pole scheduling, see BeginPoleLoop and IsMyPole.
+  Int                       poleScheduling_;
+  Int                       poleGroupIdx_;
+  Int                       poleNumGroup_;
+  MPI_Win                   poleWin_;
+  Int*                      poleCounter_;
+  Int                       poleClaim_;
+  bool                      poleReplicated_;
+
+  // Merged pole groups for the tail poles of
+  // CalculateFermiOperatorReal: the replicated grid and PMatrix of this
+  // set of groups (NULL on the idle groups), built for poleTailNum_
+  // tail poles.  Freed by FreeTailPole at the next symbolic
+  // factorization of the complex matrix.
+  GridType*                 gridTail_;
+  PMatrix<Complex>*         PMTailMat_;
+  PSelInvOptions            selinvTailOpt_;
+  Int                       poleTailNum_;
+
+  // Overlap of the factorization of the next pole with the selected
+  // inversion of the current one, see the constructor.
+  Int                       poleOverlap_;
+
+  // SuperLUOptions::freeLUValues for the factorizations, see the
+  // constructor.
+  Int                       freeLUValues_;
+
   // Inner layer communicator for SuperLU factorization
   const SuperLUGrid<Real>*       gridSuperLUReal_;           
   const SuperLUGrid<Complex>*    gridSuperLUComplex_;           
@@ -202,11 +229,46 @@ private:
   // *********************************************************************
 
 public:
+  /// @brief numReplica is the number of copies of the SelInv grid (see
+  /// PSelInvOptions::numReplica), and gridPlacement the placement of
+  /// the processors on it (see GridPlacementRank, with
+  /// placementColWeight as colWeight).  The first pole group, which
+  /// holds the input and output matrices, is not placed: it keeps the
+  /// rank order of comm, since the matrices are distributed in that
+  /// order.  Hence gridPlacement only applies to the other pole groups
+  /// and has no effect (a warning is logged) when mpisize equals
+  /// numProcRow * numProcCol; such a run should order comm itself, e.g.
+  /// by MPI_Comm_split with the key of GridPlacementRank.  poleScheduling
+  /// selects how the poles are distributed over the pole groups:
+  /// statically (0, default) or dynamically (1), see IsMyPole.  With
+  /// dynamic scheduling CalculateFermiOperatorReal also inverts the
+  /// last numPole % numGroup poles on merged pole groups, each set of
+  /// groups sharing one pole as the copies of a replicated grid
+  /// (without numReplica and with symmetricStorage = 0 only).
+  ///
+  /// poleOverlap = 1 lets CalculateFermiOperatorReal factorize the
+  /// next pole of a group while the current one is inverted, each
+  /// stage on half of the OpenMP threads (SuperLU_DIST only, requires
+  /// MPI_THREAD_MULTIPLE).  No second SuperLUMatrix / PMatrix is
+  /// needed since the factors are copied to the PMatrix first; the
+  /// extra memory is the SuperLU workspace living next to the SelInv
+  /// buffers.
+  ///
+  /// freeLUValues = 1 frees the values of the SuperLU factors as they
+  /// are copied to the PMatrix (see SuperLUOptions::freeLUValues), so
+  /// that the selected inversion runs next to one copy of the factors
+  /// only.
   PPEXSIData(
       MPI_Comm   comm,
       Int        numProcRow, 
       Int        numProcCol, 
-      Int        outputFileIndex );
+      Int        outputFileIndex,
+      Int        numReplica = 1,
+      Int        gridPlacement = 0,
+      Int        poleScheduling = 0,
+      Int        poleOverlap = 0,
+      Int        freeLUValues = 0,
+      Real       placementColWeight = 1.0 );
 
   ~PPEXSIData();
 
@@ -832,6 +894,36 @@ public:
 
   const GridType*  GridPole() const {return gridPole_;}
 
+  /// @brief BeginPoleLoop starts a loop over the poles, shared by the
+  /// numGroup pole groups linked by groupComm, this group being
+  /// groupIdx.  By default the pole groups of gridPole_; with 2.5D
+  /// replication the numReplica consecutive pole groups holding the
+  /// copies of gridSelInv_ count as one and share the claims of the
+  /// first copy.
+  ///
+  /// With dynamic pole scheduling the poles are handed out by a
+  /// counter in an MPI window over groupComm.  Collective over
+  /// groupComm.
+  void BeginPoleLoop( MPI_Comm groupComm, Int groupIdx, Int numGroup );
+  void BeginPoleLoop();
+  void EndPoleLoop();
+
+  /// @brief Free the grid and PMatrix of the merged tail pole groups.
+  void FreeTailPole();
+
+  /// @brief Whether this pole group works on the pole l.  Must be
+  /// called by all the processors of the group, for every l of the
+  /// loop in increasing order.
+  ///
+  /// - static:  l % numGroup == groupIdx.
+  /// - dynamic: the group claims the next pole once the previous one
+  ///   is done, so a group that finishes early takes more poles.
+  bool IsMyPole( Int l );
+
+  /// @brief The first pole after l this group works on, numPole if
+  /// none.  Calls IsMyPole for the poles in between.
+  Int NextMyPole( Int l, Int numPole );
+
 
   /// @brief Density matrix.
   ///
@@ -44,6 +44,10 @@ such enhancements or derivative works thereof, in binary and source code form.
 /// @brief Thin interface to BLAS
 /// @date 2012-09-12
 #include "pexsi/blas.hpp"
+#include <vector>
+#ifdef SMALL_GEMM
+#include "pexsi/small_gemm.hpp"
+#endif
 
 namespace PEXSI {
 namespace blas {
@@ -962,6 +966,9 @@ void Gemm
   float alpha, const float* A, Int lda, const float* B, Int ldb,
   float beta,        float* C, Int ldc )
 {
+#ifdef SMALL_GEMM
+  if( smallgemm::Gemm( transA, transB, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc ) ) return;
+#endif
   const char fixedTransA = ( transA == 'C' ? 'T' : transA );
   const char fixedTransB = ( transB == 'C' ? 'T' : transB );
   BLAS(sgemm)( &fixedTransA, &fixedTransB, &m, &n, &k,
@@ -974,17 +981,165 @@ void Gemm
   double alpha, const double* A, Int lda, const double* B, Int ldb,
   double beta,        double* C, Int ldc )
 {
+#ifdef SMALL_GEMM
+  if( smallgemm::Gemm( transA, transB, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc ) ) return;
+#endif
   const char fixedTransA = ( transA == 'C' ? 'T' : transA );
   const char fixedTransB = ( transB == 'C' ? 'T' : transB );
   BLAS(dgemm)( &fixedTransA, &fixedTransB, &m, &n, &k,
       &alpha, A, &lda, B, &ldb, &beta, C, &ldc );
 }
 
+//----------------------------------------------------------------------------//
+// Complex GEMM on split real / imaginary planes                              //
+//----------------------------------------------------------------------------//
+template<typename R>
+void ComplexPlanes<R>::Split
+( Int mode, char trans, Int m, Int n, const std::complex<R>* X, Int ldx )
+{
+  m_ = m;
+  n_ = n;
+  re_.resize( m * n );
+  im_.resize( m * n );
+  bool opX  = ( trans != 'N' && trans != 'n' );
+  R    sign = ( trans == 'C' || trans == 'c' ) ? -1 : 1;
+  for( Int j = 0; j < n; j++ ){
+    for( Int i = 0; i < m; i++ ){
+      const std::complex<R>& x = opX ? X[j + i * ldx] : X[i + j * ldx];
+      re_[i + j * m] = x.real();
+      im_[i + j * m] = sign * x.imag();
+    }
+  }
+  if( mode == COMPLEX_GEMM_3M ){
+    sum_.resize( m * n );
+    for( Int i = 0; i < m * n; i++ ) sum_[i] = re_[i] + im_[i];
+  }
+  else{
+    sum_.clear();
+  }
+}
+
+template class ComplexPlanes<float>;
+template class ComplexPlanes<double>;
+
+namespace {
+
+template<typename R>
+void GemmPlanesImpl
+( Int mode, Int m, Int n, Int k, 
+  std::complex<R> alpha, const ComplexPlanes<R>& A, const ComplexPlanes<R>& B,
+  std::complex<R> beta, std::complex<R>* C, Int ldc )
+{
+  if( A.m() != m || A.n() != k || B.m() != k || B.n() != n ){
+    ErrorHandling( "The split operands do not match the product." );
+  }
+  if( mode == COMPLEX_GEMM_3M && !( A.HasSum() && B.HasSum() ) ){
+    ErrorHandling( "3M needs operands split with COMPLEX_GEMM_3M." );
+  }
+
+  // P = A * B
+  std::vector<R> Pr( m * n ), Pi( m * n );
+  if( mode == COMPLEX_GEMM_3M ){
+    // Pr = Ar*Br - Ai*Bi, Pi = (Ar+Ai)*(Br+Bi) - Ar*Br - Ai*Bi
+    std::vector<R> T( m * n );
+    Gemm( 'N', 'N', m, n, k, R(1), A.Re(),  m, B.Re(),  k, R(0), &Pr[0], m );
+    Gemm( 'N', 'N', m, n, k, R(1), A.Im(),  m, B.Im(),  k, R(0), &T[0],  m );
+    Gemm( 'N', 'N', m, n, k, R(1), A.Sum(), m, B.Sum(), k, R(0), &Pi[0], m );
+    for( Int i = 0; i < m * n; i++ ){
+      Pi[i] -= Pr[i] + T[i];
+      Pr[i] -= T[i];
+    }
+  }
+  else{
+    Gemm( 'N', 'N', m, n, k, R(1),  A.Re(), m, B.Re(), k, R(0), &Pr[0], m );
+    Gemm( 'N', 'N', m, n, k, R(-1), A.Im(), m, B.Im(), k, R(1), &Pr[0], m );
+    Gemm( 'N', 'N', m, n, k, R(1),  A.Re(), m, B.Im(), k, R(0), &Pi[0], m );
+    Gemm( 'N', 'N', m, n, k, R(1),  A.Im(), m, B.Re(), k, R(1), &Pi[0], m );
+  }
+
+  // C = alpha * P + beta * C
+  bool betaZero = ( beta == std::complex<R>(0) );
+  for( Int j = 0; j < n; j++ ){
+    for( Int i = 0; i < m; i++ ){
+      std::complex<R> p( Pr[i + j * m], Pi[i + j * m] );
+      std::complex<R>& c = C[i + j * ldc];
+      c = betaZero ? alpha * p : alpha * p + beta * c;
+    }
+  }
+}
+
+inline bool UseGemmSplit( Int mode, Int minDim, Int m, Int n, Int k )
+{
+  if( mode < COMPLEX_GEMM_4M || mode > COMPLEX_GEMM_SPLIT ){
+    ErrorHandling( "Unknown complex GEMM mode." );
+  }
+  return mode != COMPLEX_GEMM_4M && 
+    m >= minDim && n >= minDim && k >= minDim;
+}
+
+template<typename R>
+void GemmSplit
+( Int mode, char transA, char transB, Int m, Int n, Int k, 
+  std::complex<R> alpha, const std::complex<R>* A, Int lda, 
+  const std::complex<R>* B, Int ldb,
+  std::complex<R> beta, std::complex<R>* C, Int ldc )
+{
+  ComplexPlanes<R> Ap, Bp;
+  Ap.Split( mode, transA, m, k, A, lda );
+  Bp.Split( mode, transB, k, n, B, ldb );
+  GemmPlanesImpl( mode, m, n, k, alpha, Ap, Bp, beta, C, ldc );
+}
+
+} // anonymous namespace
+
+void GemmPlanes
+( Int mode, Int m, Int n, Int k,
+  scomplex alpha, const ComplexPlanes<float>& A, const ComplexPlanes<float>& B,
+  scomplex beta,        scomplex* C, Int ldc )
+{
+  GemmPlanesImpl( mode, m, n, k, alpha, A, B, beta, C, ldc );
+}
+
+void GemmPlanes
+( Int mode, Int m, Int n, Int k,
+  dcomplex alpha, const ComplexPlanes<double>& A, const ComplexPlanes<double>& B,
+  dcomplex beta,        dcomplex* C, Int ldc )
+{
+  GemmPlanesImpl( mode, m, n, k, alpha, A, B, beta, C, ldc );
+}
+
+void Gemm
+( Int mode, Int minDim, char transA, char transB, Int m, Int n, Int k, 
+  scomplex alpha, const scomplex* A, Int lda, const scomplex* B, Int ldb,
+  scomplex beta,        scomplex* C, Int ldc )
+{
+  if( UseGemmSplit( mode, minDim, m, n, k ) ){
+    GemmSplit( mode, transA, transB, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc );
+    return;
+  }
+  Gemm( transA, transB, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc );
+}
+
+void Gemm
+( Int mode, Int minDim, char transA, char transB, Int m, Int n, Int k, 
+  dcomplex alpha, const dcomplex* A, Int lda, const dcomplex* B, Int ldb,
+  dcomplex beta,        dcomplex* C, Int ldc )
+{
+  if( UseGemmSplit( mode, minDim, m, n, k ) ){
+    GemmSplit( mode, transA, transB, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc );
+    return;
+  }
+  Gemm( transA, transB, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc );
+}
+
 void Gemm
 ( char transA, char transB, Int m, Int n, Int k, 
   scomplex alpha, const scomplex* A, Int lda, const scomplex* B, Int ldb,
   scomplex beta,        scomplex* C, Int ldc )
 {
+#ifdef SMALL_GEMM
+  if( smallgemm::Gemm( transA, transB, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc ) ) return;
+#endif
   BLAS(cgemm)( &transA, &transB, &m, &n, &k,
       &alpha, A, &lda, B, &ldb, &beta, C, &ldc );
 }
@@ -994,6 +1149,9 @@ void Gemm
   dcomplex alpha, const dcomplex* A, Int lda, const dcomplex* B, Int ldb,
   dcomplex beta,        dcomplex* C, Int ldc )
 {
+#ifdef SMALL_GEMM
+  if( smallgemm::Gemm( transA, transB, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc ) ) return;
+#endif
   BLAS(zgemm)( &transA, &transB, &m, &n, &k,
       &alpha, A, &lda, B, &ldb, &beta, C, &ldc );
 }
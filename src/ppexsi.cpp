@@ -60,7 +60,13 @@ PPEXSIData::PPEXSIData    (
     MPI_Comm   comm,
     Int        numProcRow, 
     Int        numProcCol, 
-    Int        outputFileIndex ){
+    Int        outputFileIndex,
+    Int        numReplica,
+    Int        gridPlacement,
+    Int        poleScheduling,
+    Int        poleOverlap,
+    Int        freeLUValues,
+    Real       placementColWeight ){
 
   Int mpirank, mpisize;
   MPI_Comm_rank( comm, &mpirank );
@@ -76,14 +82,73 @@ PPEXSIData::PPEXSIData    (
     ErrorHandling( msg.str().c_str() );
   }
 
-  gridPole_     = new GridType( comm, mpisize / npPerPole, npPerPole );
+  // With gridPlacement the other pole groups hold whole nodes when
+  // possible (node major), and inside them the processors are ordered
+  // as the SelInv grid places them, so that gridPole_->rowComm, the
+  // SuperLU grids and gridSelInv_ agree.  The first pole group keeps
+  // the first npPerPole processors of comm in order: it holds the
+  // input and output matrices (LoadRealMatrix, ...), which are
+  // distributed in the rank order of the caller.
+  if( gridPlacement != 0 ){
+    Int isFirstGroup = ( mpirank < npPerPole ) ? 1 : 0;
+    MPI_Comm restComm, placedComm;
+    MPI_Comm_split( comm, isFirstGroup, mpirank, &restComm );
+    Int key = mpirank;
+    if( !isFirstGroup ){
+      Int nodeMajor = GridPlacementRank( restComm, mpisize / npPerPole - 1, npPerPole, 3 );
+      MPI_Comm groupComm;
+      MPI_Comm_split( restComm, nodeMajor / npPerPole, nodeMajor, &groupComm );
+      Int gridRank = GridPlacementRank( groupComm, numProcRow, numProcCol, gridPlacement,
+          placementColWeight );
+      MPI_Comm_free( &groupComm );
+      key = ( nodeMajor / npPerPole + 1 ) * npPerPole + gridRank;
+    }
+    MPI_Comm_free( &restComm );
+    MPI_Comm_split( comm, 0, key, &placedComm );
+    gridPole_     = new GridType( placedComm, mpisize / npPerPole, npPerPole );
+    MPI_Comm_free( &placedComm );
+  }
+  else{
+    gridPole_     = new GridType( comm, mpisize / npPerPole, npPerPole );
+  }
   gridSuperLUReal_     = new SuperLUGrid<Real>( 
       gridPole_->rowComm, numProcRow, numProcCol );
   gridSuperLUComplex_  = new SuperLUGrid<Complex>( 
       gridPole_->rowComm, numProcRow, numProcCol );
 
+  // 2.5D复制: numReplica个相邻的pole group各存一份gridSelInv_上的矩阵,
+  // 每份只负责一部分收缩, 结果在replicaComm上合并. 每个pole只分解一次,
+  // 因子从分解它的那一份广播给其它几份.
+  MPI_Comm replicaComm = MPI_COMM_NULL;
+  if( numReplica > 1 ){
+    if( gridPole_->numProcRow % numReplica != 0 ){
+      std::ostringstream msg;
+      msg 
+        << "number of pole groups = " << gridPole_->numProcRow << std::endl
+        << "numReplica            = " << numReplica << std::endl
+        << "The number of pole groups is not divisible by numReplica!" << std::endl;
+      ErrorHandling( msg.str().c_str() );
+    }
+    MPI_Comm_split( gridPole_->colComm, MYROW( gridPole_ ) / numReplica,
+        MYROW( gridPole_ ), &replicaComm );
+  }
+
   gridSelInv_   = new GridType( gridPole_->rowComm, 
-      numProcRow, numProcCol );
+      numProcRow, numProcCol, replicaComm );
+
+  if( replicaComm != MPI_COMM_NULL ){
+    MPI_Comm_free( &replicaComm );
+  }
+
+  poleScheduling_ = poleScheduling;
+  poleWin_        = MPI_WIN_NULL;
+  poleCounter_    = NULL;
+  poleClaim_      = -1;
+  gridTail_       = NULL;
+  PMTailMat_      = NULL;
+  poleTailNum_    = 0;
+  poleOverlap_    = poleOverlap;
+  freeLUValues_   = freeLUValues;
 
   // Start the log file. Append to previous log files
   //#ifndef _RELEASE_
@@ -119,6 +184,14 @@ PPEXSIData::PPEXSIData    (
     statusOFS.open( ss.str().c_str(), std::ios_base::app );
   }
 
+  // The first pole group is not placed (see above), so with a single
+  // pole group gridPlacement has no effect.
+  if( gridPlacement != 0 && mpisize == npPerPole ){
+    statusOFS << " Warning, gridPlacement = " << gridPlacement
+      << " has no effect with a single pole group, the processors keep"
+      << " the rank order of comm." << std::endl << std::flush;
+  }
+
   // Initialize the saved variables
   isMatrixLoaded_       = false;
   isRealSymmetricSymbolicFactorized_ = false;
@@ -200,6 +273,8 @@ PPEXSIData::~PPEXSIData    (  )
     delete PMComplexUnsymMat_;
   }
 
+  FreeTailPole();
+
 
   if( gridSuperLUReal_ != NULL ){
     delete gridSuperLUReal_;
@@ -832,7 +907,11 @@ PPEXSIData::SymbolicFactorizeRealSymmetricMatrix    (
     PMloc = PMatrix<Real>();
 
     selinvOpt_.maxPipelineDepth = -1;
+    selinvOpt_.numReplica = gridSelInv_->numReplica;
     selinvOpt_.symmetricStorage = symmetricStorage;
+    // The v2 trees of the symmetric storage are not progressed between
+    // the GEMM panels.
+    if( symmetricStorage == 1 ) selinvOpt_.asyncProgress = 0;
     factOpt_.ColPerm = ColPerm;
 
     switch (solver) {
@@ -846,6 +925,7 @@ PPEXSIData::SymbolicFactorizeRealSymmetricMatrix    (
           factOpt_.ColPerm = ColPerm;
           luOpt_.ColPerm = ColPerm;
           luOpt_.numProcSymbFact = numProcSymbFact;
+          luOpt_.freeLUValues = freeLUValues_;
 
 
           luMat.Setup( *gridSuperLUReal_, luOpt_ );  // SuperLU matrix.
@@ -1054,6 +1134,7 @@ PPEXSIData::SymbolicFactorizeRealUnsymmetricMatrix    (
     PMloc = PMatrixUnsym<Real>();
 
     selinvOpt_.maxPipelineDepth = -1;
+    selinvOpt_.numReplica = gridSelInv_->numReplica;
     factOpt_.ColPerm = ColPerm;
     factOpt_.RowPerm = RowPerm;
     factOpt_.Symmetric = 0;
@@ -1069,6 +1150,7 @@ PPEXSIData::SymbolicFactorizeRealUnsymmetricMatrix    (
           luOpt_.ColPerm = ColPerm;
           luOpt_.RowPerm = RowPerm;
           luOpt_.numProcSymbFact = numProcSymbFact;
+          luOpt_.freeLUValues = freeLUValues_;
           luOpt_.Symmetric = 0;
           luOpt_.Transpose = Transpose;
 
@@ -1212,10 +1294,15 @@ PPEXSIData::SymbolicFactorizeComplexSymmetricMatrix    (
 
     // Clear the matrices first
     PMloc = PMatrix<Complex>();
+    FreeTailPole();
 
     factOpt_.ColPerm = ColPerm;
     selinvOpt_.maxPipelineDepth = -1;
+    selinvOpt_.numReplica = gridSelInv_->numReplica;
     selinvOpt_.symmetricStorage = symmetricStorage;
+    // The v2 trees of the symmetric storage are not progressed between
+    // the GEMM panels.
+    if( symmetricStorage == 1 ) selinvOpt_.asyncProgress = 0;
 
     switch (solver) {
       case 0:
@@ -1226,6 +1313,7 @@ PPEXSIData::SymbolicFactorizeComplexSymmetricMatrix    (
 
           luOpt_.ColPerm = ColPerm;
           luOpt_.numProcSymbFact = numProcSymbFact;
+          luOpt_.freeLUValues = freeLUValues_;
 
           luMat.Setup( *gridSuperLUComplex_, luOpt_ );  // SuperLU matrix.
 
@@ -1431,6 +1519,7 @@ PPEXSIData::SymbolicFactorizeComplexUnsymmetricMatrix    (
     PMloc = PMatrixUnsym<Complex>();
 
     selinvOpt_.maxPipelineDepth = -1;
+    selinvOpt_.numReplica = gridSelInv_->numReplica;
     factOpt_.ColPerm = ColPerm;
     factOpt_.RowPerm = RowPerm;
     factOpt_.Symmetric = 0;
@@ -1448,6 +1537,7 @@ PPEXSIData::SymbolicFactorizeComplexUnsymmetricMatrix    (
           luOpt_.RowPerm = RowPerm;
           luOpt_.Symmetric = 0;
           luOpt_.numProcSymbFact = numProcSymbFact;
+          luOpt_.freeLUValues = freeLUValues_;
           luOpt_.Transpose = Transpose;
 
           luMat.Setup( *gridSuperLUComplex_, luOpt_ );  // SuperLU matrix.
@@ -1590,8 +1680,9 @@ PPEXSIData::SelInvRealSymmetricMatrix(
     ErrorHandling( msg.str().c_str() );
   }
 
-  // Only the processor group corresponding to the first pole participate
-  if( MYROW( gridPole_ ) == 0 ){
+  // Only the processor group corresponding to the first pole participate,
+  // with its copies for the 2.5D replication
+  if( MYROW( gridPole_ ) < gridSelInv_->numReplica ){
 
     Real timeTotalSelInvSta, timeTotalSelInvEnd;
     PMatrix<Real>&          PMloc     = *PMRealMat_;
@@ -1601,109 +1692,117 @@ PPEXSIData::SelInvRealSymmetricMatrix(
     CopyPattern( PatternMat_, AMat );
     blas::Copy( AMat.nnzLocal, AnzvalLocal, 1, AMat.nzvalLocal.Data(), 1 );
 
-    switch (solver) {
-      case 0:
-        {
-          SuperLUMatrix<Real>&    luMat     = *luRealMat_;
+    // 2.5D: the first copy factorizes, the factors are broadcast to
+    // the other ones.
+    if( gridSelInv_->replicaRank == 0 ){
+      switch (solver) {
+        case 0:
+          {
+            SuperLUMatrix<Real>&    luMat     = *luRealMat_;
 
-          if( verbosity >= 2 ){
-            statusOFS << "Before DistSparseMatrixToSuperMatrixNRloc." << std::endl;
-          }
-          luMat.DistSparseMatrixToSuperMatrixNRloc( AMat, luOpt_ );
-          if( verbosity >= 2 ){
-            statusOFS << "After DistSparseMatrixToSuperMatrixNRloc." << std::endl;
-          }
+            if( verbosity >= 2 ){
+              statusOFS << "Before DistSparseMatrixToSuperMatrixNRloc." << std::endl;
+            }
+            luMat.DistSparseMatrixToSuperMatrixNRloc( AMat, luOpt_ );
+            if( verbosity >= 2 ){
+              statusOFS << "After DistSparseMatrixToSuperMatrixNRloc." << std::endl;
+            }
 
-          Real timeTotalFactorizationSta, timeTotalFactorizationEnd;
+            Real timeTotalFactorizationSta, timeTotalFactorizationEnd;
 
-          GetTime( timeTotalFactorizationSta );
+            GetTime( timeTotalFactorizationSta );
 
-          // Data redistribution
-          if( verbosity >= 2 ){
-            statusOFS << "Before Distribute." << std::endl;
-          }
-          luMat.Distribute();
-          if( verbosity >= 2 ){
-            statusOFS << "After Distribute." << std::endl;
-          }
+            // Data redistribution
+            if( verbosity >= 2 ){
+              statusOFS << "Before Distribute." << std::endl;
+            }
+            luMat.Distribute();
+            if( verbosity >= 2 ){
+              statusOFS << "After Distribute." << std::endl;
+            }
 
-          // Numerical factorization
-          if( verbosity >= 2 ){
-            statusOFS << "Before NumericalFactorize." << std::endl;
-          }
-          luMat.NumericalFactorize();
-          if( verbosity >= 2 ){
-            statusOFS << "After NumericalFactorize." << std::endl;
-          }
-          luMat.DestroyAOnly();
+            // Numerical factorization
+            if( verbosity >= 2 ){
+              statusOFS << "Before NumericalFactorize." << std::endl;
+            }
+            luMat.NumericalFactorize();
+            if( verbosity >= 2 ){
+              statusOFS << "After NumericalFactorize." << std::endl;
+            }
+            luMat.DestroyAOnly();
 
-          GetTime( timeTotalFactorizationEnd );
+            GetTime( timeTotalFactorizationEnd );
 
-          if( verbosity >= 1 ){
-            statusOFS << "Time for total factorization is " << timeTotalFactorizationEnd - timeTotalFactorizationSta<< " [s]" << std::endl; 
-          }
+            if( verbosity >= 1 ){
+              statusOFS << "Time for total factorization is " << timeTotalFactorizationEnd - timeTotalFactorizationSta<< " [s]" << std::endl; 
+            }
 
-          GetTime( timeTotalSelInvSta );
+            GetTime( timeTotalSelInvSta );
 
-          luMat.LUstructToPMatrix( PMloc );
-        }
-        break;
-#ifdef WITH_SYMPACK
-      case 1:
-        {
-          symPACK::symPACKMatrix<Real>& symPACKMat = *symPACKRealMat_ ;
-          symPACK::DistSparseMatrix<Real> ltAMat;
-          if( verbosity >= 2 ){
-            statusOFS << "Before ToLowerTriangular." << std::endl;
-          }
-          Convert(AMat,ltAMat);
-          ltAMat.ToLowerTriangular();
-          ltAMat.GetLocalGraph().SetSorted(false);
-          ltAMat.SortGraph();
-          if( verbosity >= 2 ){
-            statusOFS << "After ToLowerTriangular." << std::endl;
+            luMat.LUstructToPMatrix( PMloc );
           }
+          break;
+#ifdef WITH_SYMPACK
+        case 1:
+          {
+            symPACK::symPACKMatrix<Real>& symPACKMat = *symPACKRealMat_ ;
+            symPACK::DistSparseMatrix<Real> ltAMat;
+            if( verbosity >= 2 ){
+              statusOFS << "Before ToLowerTriangular." << std::endl;
+            }
+            Convert(AMat,ltAMat);
+            ltAMat.ToLowerTriangular();
+            ltAMat.GetLocalGraph().SetSorted(false);
+            ltAMat.SortGraph();
+            if( verbosity >= 2 ){
+              statusOFS << "After ToLowerTriangular." << std::endl;
+            }
 
 
-          Real timeTotalFactorizationSta, timeTotalFactorizationEnd;
+            Real timeTotalFactorizationSta, timeTotalFactorizationEnd;
 
-          GetTime( timeTotalFactorizationSta );
+            GetTime( timeTotalFactorizationSta );
 
-          // Data redistribution
-          if( verbosity >= 2 ){
-            statusOFS << "Before Distribute." << std::endl;
-          }
-          symPACKMat.DistributeMatrix(ltAMat);
-          if( verbosity >= 2 ){
-            statusOFS << "After Distribute." << std::endl;
-          }
+            // Data redistribution
+            if( verbosity >= 2 ){
+              statusOFS << "Before Distribute." << std::endl;
+            }
+            symPACKMat.DistributeMatrix(ltAMat);
+            if( verbosity >= 2 ){
+              statusOFS << "After Distribute." << std::endl;
+            }
 
-          // Numerical factorization
-          if( verbosity >= 2 ){
-            statusOFS << "Before NumericalFactorize." << std::endl;
-          }
-          symPACKMat.Factorize();
-          // Numerical factorization
-          if( verbosity >= 2 ){
-            statusOFS << "After NumericalFactorize." << std::endl;
-          }
+            // Numerical factorization
+            if( verbosity >= 2 ){
+              statusOFS << "Before NumericalFactorize." << std::endl;
+            }
+            symPACKMat.Factorize();
+            // Numerical factorization
+            if( verbosity >= 2 ){
+              statusOFS << "After NumericalFactorize." << std::endl;
+            }
 
-          GetTime( timeTotalFactorizationEnd );
+            GetTime( timeTotalFactorizationEnd );
 
-          if( verbosity >= 1 ){
-            statusOFS << "Time for total factorization is " << timeTotalFactorizationEnd - timeTotalFactorizationSta<< " [s]" << std::endl; 
-          }
+            if( verbosity >= 1 ){
+              statusOFS << "Time for total factorization is " << timeTotalFactorizationEnd - timeTotalFactorizationSta<< " [s]" << std::endl; 
+            }
 
-          //make a symmetric matrix out of that....
-          GetTime( timeTotalSelInvSta );
-          symPACKMatrixToPMatrix( symPACKMat, PMloc );
-        }
-        break;
+            //make a symmetric matrix out of that....
+            GetTime( timeTotalSelInvSta );
+            symPACKMatrixToPMatrix( symPACKMat, PMloc );
+          }
+          break;
 #endif
-      default:
-        ErrorHandling("Unsupported solver.");
-        break;
+        default:
+          ErrorHandling("Unsupported solver.");
+          break;
+      }
+    }
+    else{
+      GetTime( timeTotalSelInvSta );
     }
+    PMloc.BcastReplica( 0, false );
 
     PMloc.PreSelInv();
 
@@ -1762,7 +1861,8 @@ PPEXSIData::SelInvRealUnsymmetricMatrix(
     ErrorHandling( msg.str().c_str() );
   }
 
-  // Only the processor group corresponding to the first pole participate
+  // Only the processor group corresponding to the first pole participate.
+  // PMatrixUnsym is not replicated, the first copy is enough.
   if( MYROW( gridPole_ ) == 0 ){
 
     PMatrixUnsym<Real>& PMloc         = *PMRealUnsymMat_;
@@ -1889,8 +1989,9 @@ PPEXSIData::SelInvComplexSymmetricMatrix(
     ErrorHandling( msg.str().c_str() );
   }
 
-  // Only the processor group corresponding to the first pole participate
-  if( MYROW( gridPole_ ) == 0 ){
+  // Only the processor group corresponding to the first pole participate,
+  // with its copies for the 2.5D replication
+  if( MYROW( gridPole_ ) < gridSelInv_->numReplica ){
 
     Real timeTotalSelInvSta, timeTotalSelInvEnd;
     PMatrix<Complex>&          PMloc     = *PMComplexMat_;
@@ -1901,109 +2002,117 @@ PPEXSIData::SelInvComplexSymmetricMatrix(
     blas::Copy( 2*AMat.nnzLocal, AnzvalLocal, 1, 
         reinterpret_cast<double*>(AMat.nzvalLocal.Data()), 1 );
 
-    switch (solver) {
-      case 0:
-        {
-          SuperLUMatrix<Complex>&    luMat     = *luComplexMat_;
+    // 2.5D: the first copy factorizes, the factors are broadcast to
+    // the other ones.
+    if( gridSelInv_->replicaRank == 0 ){
+      switch (solver) {
+        case 0:
+          {
+            SuperLUMatrix<Complex>&    luMat     = *luComplexMat_;
 
-          if( verbosity >= 2 ){
-            statusOFS << "Before DistSparseMatrixToSuperMatrixNRloc." << std::endl;
-          }
-          luMat.DistSparseMatrixToSuperMatrixNRloc( AMat, luOpt_ );
-          if( verbosity >= 2 ){
-            statusOFS << "After DistSparseMatrixToSuperMatrixNRloc." << std::endl;
-          }
+            if( verbosity >= 2 ){
+              statusOFS << "Before DistSparseMatrixToSuperMatrixNRloc." << std::endl;
+            }
+            luMat.DistSparseMatrixToSuperMatrixNRloc( AMat, luOpt_ );
+            if( verbosity >= 2 ){
+              statusOFS << "After DistSparseMatrixToSuperMatrixNRloc." << std::endl;
+            }
 
-          Real timeTotalFactorizationSta, timeTotalFactorizationEnd;
+            Real timeTotalFactorizationSta, timeTotalFactorizationEnd;
 
-          GetTime( timeTotalFactorizationSta );
+            GetTime( timeTotalFactorizationSta );
 
-          // Data redistribution
-          if( verbosity >= 2 ){
-            statusOFS << "Before Distribute." << std::endl;
-          }
-          luMat.Distribute();
-          if( verbosity >= 2 ){
-            statusOFS << "After Distribute." << std::endl;
-          }
+            // Data redistribution
+            if( verbosity >= 2 ){
+              statusOFS << "Before Distribute." << std::endl;
+            }
+            luMat.Distribute();
+            if( verbosity >= 2 ){
+              statusOFS << "After Distribute." << std::endl;
+            }
 
-          // Numerical factorization
-          if( verbosity >= 2 ){
-            statusOFS << "Before NumericalFactorize." << std::endl;
-          }
-          luMat.NumericalFactorize();
-          if( verbosity >= 2 ){
-            statusOFS << "After NumericalFactorize." << std::endl;
-          }
-          luMat.DestroyAOnly();
+            // Numerical factorization
+            if( verbosity >= 2 ){
+              statusOFS << "Before NumericalFactorize." << std::endl;
+            }
+            luMat.NumericalFactorize();
+            if( verbosity >= 2 ){
+              statusOFS << "After NumericalFactorize." << std::endl;
+            }
+            luMat.DestroyAOnly();
 
-          GetTime( timeTotalFactorizationEnd );
+            GetTime( timeTotalFactorizationEnd );
 
-          if( verbosity >= 1 ){
-            statusOFS << "Time for total factorization is " << timeTotalFactorizationEnd - timeTotalFactorizationSta<< " [s]" << std::endl; 
-          }
+            if( verbosity >= 1 ){
+              statusOFS << "Time for total factorization is " << timeTotalFactorizationEnd - timeTotalFactorizationSta<< " [s]" << std::endl; 
+            }
 
-          GetTime( timeTotalSelInvSta );
+            GetTime( timeTotalSelInvSta );
 
-          luMat.LUstructToPMatrix( PMloc );
-        }
-        break;
-#ifdef WITH_SYMPACK
-      case 1:
-        {
-          symPACK::symPACKMatrix<Complex>& symPACKMat = *symPACKComplexMat_ ;
-          symPACK::DistSparseMatrix<Complex> ltAMat;
-          if( verbosity >= 2 ){
-            statusOFS << "Before ToLowerTriangular." << std::endl;
-          }
-          Convert(AMat,ltAMat);
-          ltAMat.ToLowerTriangular();
-          ltAMat.GetLocalGraph().SetSorted(false);
-          ltAMat.SortGraph();
-          if( verbosity >= 2 ){
-            statusOFS << "After ToLowerTriangular." << std::endl;
+            luMat.LUstructToPMatrix( PMloc );
           }
+          break;
+#ifdef WITH_SYMPACK
+        case 1:
+          {
+            symPACK::symPACKMatrix<Complex>& symPACKMat = *symPACKComplexMat_ ;
+            symPACK::DistSparseMatrix<Complex> ltAMat;
+            if( verbosity >= 2 ){
+              statusOFS << "Before ToLowerTriangular." << std::endl;
+            }
+            Convert(AMat,ltAMat);
+            ltAMat.ToLowerTriangular();
+            ltAMat.GetLocalGraph().SetSorted(false);
+            ltAMat.SortGraph();
+            if( verbosity >= 2 ){
+              statusOFS << "After ToLowerTriangular." << std::endl;
+            }
 
 
-          Real timeTotalFactorizationSta, timeTotalFactorizationEnd;
+            Real timeTotalFactorizationSta, timeTotalFactorizationEnd;
 
-          GetTime( timeTotalFactorizationSta );
+            GetTime( timeTotalFactorizationSta );
 
-          // Data redistribution
-          if( verbosity >= 2 ){
-            statusOFS << "Before Distribute." << std::endl;
-          }
-          symPACKMat.DistributeMatrix(ltAMat);
-          if( verbosity >= 2 ){
-            statusOFS << "After Distribute." << std::endl;
-          }
+            // Data redistribution
+            if( verbosity >= 2 ){
+              statusOFS << "Before Distribute." << std::endl;
+            }
+            symPACKMat.DistributeMatrix(ltAMat);
+            if( verbosity >= 2 ){
+              statusOFS << "After Distribute." << std::endl;
+            }
 
-          // Numerical factorization
-          if( verbosity >= 2 ){
-            statusOFS << "Before NumericalFactorize." << std::endl;
-          }
-          symPACKMat.Factorize();
-          // Numerical factorization
-          if( verbosity >= 2 ){
-            statusOFS << "After NumericalFactorize." << std::endl;
-          }
+            // Numerical factorization
+            if( verbosity >= 2 ){
+              statusOFS << "Before NumericalFactorize." << std::endl;
+            }
+            symPACKMat.Factorize();
+            // Numerical factorization
+            if( verbosity >= 2 ){
+              statusOFS << "After NumericalFactorize." << std::endl;
+            }
 
-          GetTime( timeTotalFactorizationEnd );
+            GetTime( timeTotalFactorizationEnd );
 
-          if( verbosity >= 1 ){
-            statusOFS << "Time for total factorization is " << timeTotalFactorizationEnd - timeTotalFactorizationSta<< " [s]" << std::endl; 
-          }
+            if( verbosity >= 1 ){
+              statusOFS << "Time for total factorization is " << timeTotalFactorizationEnd - timeTotalFactorizationSta<< " [s]" << std::endl; 
+            }
 
-          //make a symmetric matrix out of that....
-          GetTime( timeTotalSelInvSta );
-          symPACKMatrixToPMatrix( symPACKMat, PMloc );
-        }
-        break;
+            //make a symmetric matrix out of that....
+            GetTime( timeTotalSelInvSta );
+            symPACKMatrixToPMatrix( symPACKMat, PMloc );
+          }
+          break;
 #endif
-      default:
-        ErrorHandling("Unsupported solver.");
-        break;
+        default:
+          ErrorHandling("Unsupported solver.");
+          break;
+      }
+    }
+    else{
+      GetTime( timeTotalSelInvSta );
     }
+    PMloc.BcastReplica( 0, false );
 
     PMloc.PreSelInv();
 
@@ -2063,7 +2172,8 @@ PPEXSIData::SelInvComplexUnsymmetricMatrix(
     ErrorHandling( msg.str().c_str() );
   }
 
-  // Only the processor group corresponding to the first pole participate
+  // Only the processor group corresponding to the first pole participate.
+  // PMatrixUnsym is not replicated, the first copy is enough.
   if( MYROW( gridPole_ ) == 0 ){
 
     DistSparseMatrix<Complex>& AMat      = shiftComplexMat_;
@@ -2164,6 +2274,88 @@ PPEXSIData::SelInvComplexUnsymmetricMatrix(
 
 
 
+void PPEXSIData::BeginPoleLoop( MPI_Comm groupComm, Int groupIdx, Int numGroup ){
+  poleGroupIdx_ = groupIdx;
+  poleNumGroup_ = numGroup;
+  poleClaim_    = -1;
+  poleReplicated_ = false;
+  if( poleScheduling_ == 0 ){
+    return;
+  }
+
+  // 计数器放在groupComm的0号进程上, 各pole group的0号进程 (MYCOL == 0)
+  // 用MPI_Fetch_and_op领取下一个pole.
+  MPI_Win_allocate( sizeof(Int), sizeof(Int), MPI_INFO_NULL, groupComm,
+      &poleCounter_, &poleWin_ );
+  // The counter is set inside the passive target epoch, and
+  // MPI_Win_sync makes the store visible to the RMA operations before
+  // the barrier lets the groups claim poles.
+  MPI_Win_lock_all( 0, poleWin_ );
+  *poleCounter_ = 0;
+  MPI_Win_sync( poleWin_ );
+  MPI_Barrier( groupComm );
+}         // -----  end of method PPEXSIData::BeginPoleLoop  ----- 
+
+void PPEXSIData::BeginPoleLoop(){
+  BeginPoleLoop( gridPole_->colComm, MYROW( gridPole_ ) / gridSelInv_->numReplica,
+      gridPole_->numProcRow / gridSelInv_->numReplica );
+  poleReplicated_ = ( gridSelInv_->numReplica > 1 );
+}         // -----  end of method PPEXSIData::BeginPoleLoop  ----- 
+
+void PPEXSIData::EndPoleLoop(){
+  if( poleWin_ != MPI_WIN_NULL ){
+    MPI_Win_unlock_all( poleWin_ );
+    MPI_Win_free( &poleWin_ );
+    poleCounter_ = NULL;
+  }
+}         // -----  end of method PPEXSIData::EndPoleLoop  ----- 
+
+void PPEXSIData::FreeTailPole(){
+  if( PMTailMat_ != NULL ){
+    delete PMTailMat_;
+    PMTailMat_ = NULL;
+  }
+  if( gridTail_ != NULL ){
+    delete gridTail_;
+    gridTail_ = NULL;
+  }
+  poleTailNum_ = 0;
+}         // -----  end of method PPEXSIData::FreeTailPole  ----- 
+
+bool PPEXSIData::IsMyPole( Int l ){
+  if( poleScheduling_ == 0 ){
+    return poleGroupIdx_ == l % poleNumGroup_;
+  }
+
+  // The loops visit the poles in increasing order, so once l is past
+  // the pole claimed last, that pole is done and the next one is
+  // claimed.  The copies of the SelInv grid follow the claims of the
+  // first one.
+  if( l > poleClaim_ ){
+    Int claim = 0;
+    if( MYCOL( gridPole_ ) == 0 && ( !poleReplicated_ || gridSelInv_->replicaRank == 0 ) ){
+      Int one = 1;
+      MPI_Fetch_and_op( &one, &claim, MPI_INT, 0, 0, MPI_SUM, poleWin_ );
+      MPI_Win_flush( 0, poleWin_ );
+    }
+    if( poleReplicated_ && MYCOL( gridPole_ ) == 0 ){
+      MPI_Bcast( &claim, 1, MPI_INT, 0, gridSelInv_->replicaComm );
+    }
+    MPI_Bcast( &claim, 1, MPI_INT, 0, gridPole_->rowComm );
+    poleClaim_ = claim;
+  }
+  return l == poleClaim_;
+}         // -----  end of method PPEXSIData::IsMyPole  ----- 
+
+Int PPEXSIData::NextMyPole( Int l, Int numPole ){
+  for( Int k = l + 1; k < numPole; k++ ){
+    if( IsMyPole( k ) ){
+      return k;
+    }
+  }
+  return numPole;
+}         // -----  end of method PPEXSIData::NextMyPole  ----- 
+
 void PPEXSIData::CalculateNegativeInertiaReal(
     const std::vector<Real>&       shiftVec, 
     std::vector<Real>&             inertiaVec,
@@ -2210,8 +2402,11 @@ void PPEXSIData::CalculateNegativeInertiaReal(
     inertiaVec[l]      = 0.0;
   }
 
+  // The inertia only needs the factorization, every pole group takes
+  // its own shifts, also with 2.5D replication.
+  BeginPoleLoop( gridPole_->colComm, MYROW( gridPole_ ), gridPole_->numProcRow );
   for(Int l = 0; l < numShift; l++){
-    if( MYROW( gridPole_ ) == PROW( l, gridPole_ ) ){
+    if( IsMyPole( l ) ){
 
       GetTime( timeShiftSta );
 
@@ -2359,6 +2554,7 @@ void PPEXSIData::CalculateNegativeInertiaReal(
       }
     } // if I am in charge of this shift
   } // for(l)
+  EndPoleLoop();
 
   // Collect all the negative inertia together
   mpi::Allreduce( &inertiaVecLocal[0], &inertiaVec[0], numShift, 
@@ -2417,8 +2613,11 @@ void PPEXSIData::CalculateNegativeInertiaComplex(
     inertiaVec[l]      = 0.0;
   }
 
+  // The inertia only needs the factorization, every pole group takes
+  // its own shifts, also with 2.5D replication.
+  BeginPoleLoop( gridPole_->colComm, MYROW( gridPole_ ), gridPole_->numProcRow );
   for(Int l = 0; l < numShift; l++){
-    if( MYROW( gridPole_ ) == PROW( l, gridPole_ ) ){
+    if( IsMyPole( l ) ){
 
       GetTime( timeShiftSta );
 
@@ -2566,6 +2765,7 @@ void PPEXSIData::CalculateNegativeInertiaComplex(
 
     } // if I am in charge of this shift
   } // for(l)
+  EndPoleLoop();
 
   // Collect all the negative inertia together
   mpi::Allreduce( &inertiaVecLocal[0], &inertiaVec[0], numShift, 
@@ -2866,271 +3066,515 @@ void PPEXSIData::CalculateFermiOperatorReal(
   // for each pole, perform LDLT factoriation and selected inversion
   Real timePoleSta, timePoleEnd;
 
-  Int numPoleComputed = 0;
-  for(Int lidx = 0; lidx < numPole; lidx++){
-    if( MYROW( gridPole_ ) == PROW( lidx, gridPole_ ) ){
-
-      Int l = poleIdx[lidx];
-
-      GetTime( timePoleSta );
-
-      if( verbosity >= 1 ){
-        statusOFS << "Pole " << lidx << " processing..." << std::endl;
+  // Shift and factorize the pole l.  The factors stay in luMat
+  // (symPACKMat) until ConvertPole.  Returns the factorization time.
+  auto FactorizePole = [&]( Int l, Int verb ) -> Real {
+    if( SMat.size != 0 ){
+      // S is not an identity matrix
+      for( Int i = 0; i < HMat.nnzLocal; i++ ){
+        AMat.nzvalLocal(i) = HMat.nzvalLocal(i) - zshift_[l] * SMat.nzvalLocal(i);
       }
-      if( verbosity >= 2 ){
-        statusOFS << "zshift           = " << zshift_[l] << std::endl;
-        statusOFS    << "zweightRho       = " << zweightRho_[l] << std::endl;
-        statusOFS    << "zweightRhoDrvMu  = " << zweightRhoDrvMu_[l] << std::endl;
-        if( isFreeEnergyDensityMatrix )
-          statusOFS << "zweightHelmholtz = " << zweightHelmholtz_[l] << std::endl;
-        if( isEnergyDensityMatrix )
-          statusOFS << "zweightForce     = " << zweightForce_[l] << std::endl;
-        if( isDerivativeTMatrix )
-          statusOFS << "zweightRhoDrvT   = " << zweightRhoDrvT_[l] << std::endl;
+    }
+    else{
+      // S is an identity matrix
+      for( Int i = 0; i < HMat.nnzLocal; i++ ){
+        AMat.nzvalLocal(i) = HMat.nzvalLocal(i);
       }
 
-      {
-        AinvMat.Clear();
+      for( Int i = 0; i < (Int)diagIdxLocal_.size(); i++ ){
+        AMat.nzvalLocal( diagIdxLocal_[i] ) -= zshift_[l];
+      }
+    } // if (SMat.size != 0 )
 
+    Real timeTotalFactorizationSta, timeTotalFactorizationEnd;
+    switch(solver){
+      case 0:
+        {
+          // Important: the distribution in pzsymbfact is going to mess up the
+          // A matrix.  Recompute the matrix A here.
+          if( verb >= 2 ){
+            statusOFS << "Before DistSparseMatrixToSuperMatrixNRloc." << std::endl;
+          }
+          luMat.DistSparseMatrixToSuperMatrixNRloc( AMat, luOpt_ );
+          if( verb >= 2 ){
+            statusOFS << "After DistSparseMatrixToSuperMatrixNRloc." << std::endl;
+          }
 
-        numPoleComputed++;
+          GetTime( timeTotalFactorizationSta );
 
+          // Data redistribution
+          if( verb >= 2 ){
+            statusOFS << "Before Distribute." << std::endl;
+          }
+          luMat.Distribute();
+          if( verb >= 2 ){
+            statusOFS << "After Distribute." << std::endl;
+          }
 
-        if( SMat.size != 0 ){
-          // S is not an identity matrix
-          for( Int i = 0; i < HMat.nnzLocal; i++ ){
-            AMat.nzvalLocal(i) = HMat.nzvalLocal(i) - zshift_[l] * SMat.nzvalLocal(i);
+          // Numerical factorization
+          if( verb >= 2 ){
+            statusOFS << "Before NumericalFactorize." << std::endl;
           }
+          luMat.NumericalFactorize();
+          if( verb >= 2 ){
+            statusOFS << "After NumericalFactorize." << std::endl;
+          }
+          luMat.DestroyAOnly();
+
+          GetTime( timeTotalFactorizationEnd );
         }
-        else{
-          // S is an identity matrix
-          for( Int i = 0; i < HMat.nnzLocal; i++ ){
-            AMat.nzvalLocal(i) = HMat.nzvalLocal(i);
+        break;
+#ifdef WITH_SYMPACK
+      case 1:
+        {
+          symPACK::symPACKMatrix<Complex>& symPACKMat = *symPACKComplexMat_ ;
+          symPACK::DistSparseMatrix<Complex> ltAMat;
+          if( verb >= 2 ){
+            statusOFS << "Before ToLowerTriangular." << std::endl;
+          }
+          Convert(AMat,ltAMat);
+          ltAMat.ToLowerTriangular();
+          ltAMat.GetLocalGraph().SetSorted(false);
+          ltAMat.SortGraph();
+          if( verb >= 2 ){
+            statusOFS << "After ToLowerTriangular." << std::endl;
           }
 
-          for( Int i = 0; i < diagIdxLocal_.size(); i++ ){
-            AMat.nzvalLocal( diagIdxLocal_[i] ) -= zshift_[l];
+          GetTime( timeTotalFactorizationSta );
+          // Data redistribution
+          if( verb >= 2 ){
+            statusOFS << "Before Distribute." << std::endl;
           }
-        } // if (SMat.size != 0 )
+          symPACKMat.DistributeMatrix(ltAMat);
+          if( verb >= 2 ){
+            statusOFS << "After Distribute." << std::endl;
+          }
+
+          // Numerical factorization
+          if( verb >= 2 ){
+            statusOFS << "Before NumericalFactorize." << std::endl;
+          }
+          symPACKMat.Factorize();
+          // Numerical factorization
+          if( verb >= 2 ){
+            statusOFS << "After NumericalFactorize." << std::endl;
+          }
+
+          GetTime( timeTotalFactorizationEnd );
+        }
+        break;
+#endif
+      default:
+        ErrorHandling("Unsupported solver.");
+        break;
+    }
+    return timeTotalFactorizationEnd - timeTotalFactorizationSta;
+  };
+
+  // Copy the factors of the last factorized pole to PM.
+  auto ConvertPole = [&]( PMatrix<Complex>& PM ){
+    switch(solver){
+      case 0:
+        luMat.LUstructToPMatrix( PM );
+        break;
+#ifdef WITH_SYMPACK
+      case 1:
+        symPACKMatrixToPMatrix( *symPACKComplexMat_, PM );
+        break;
+#endif
+      default:
+        ErrorHandling("Unsupported solver.");
+        break;
+    }
+  };
+
+  // Selected inversion of the pole l held by PM, and, if
+  // isAccumulated, accumulation of the density matrices.
+  auto InvertPole = [&]( PMatrix<Complex>& PM, Int l, Real timeTotalSelInvSta,
+      bool isAccumulated ){
+    PM.PreSelInv();
+
+    // Main subroutine for selected inversion
+    //
+    // P2p communication version
+    PM.SelInv();
+
+    // Collective communication version
+    //          PM.SelInv_Collectives();
+
+    Real timeTotalSelInvEnd;
+    GetTime( timeTotalSelInvEnd );
 
+    if( verbosity >= 1 ){
+      statusOFS << "Time for total selected inversion is " <<
+        timeTotalSelInvEnd  - timeTotalSelInvSta << " [s]" << std::endl;
+    }
 
+    // *********************************************************************
+    // Postprocessing
+    // *********************************************************************
 
+    Real timePostProcessingSta, timePostProcessingEnd;
 
+    GetTime( timePostProcessingSta );
 
-        Real timeTotalSelInvSta, timeTotalSelInvEnd;
-        // *********************************************************************
-        // Factorization
-        // *********************************************************************
-        switch(solver){
-          case 0:
-            {
-              // Important: the distribution in pzsymbfact is going to mess up the
-              // A matrix.  Recompute the matrix A here.
-              if( verbosity >= 2 ){
-                statusOFS << "Before DistSparseMatrixToSuperMatrixNRloc." << std::endl;
-              }
-              luMat.DistSparseMatrixToSuperMatrixNRloc( AMat, luOpt_ );
-              if( verbosity >= 2 ){
-                statusOFS << "After DistSparseMatrixToSuperMatrixNRloc." << std::endl;
-              }
+    //TODO convert to symmAinvMat too
+    PM.PMatrixToDistSparseMatrix( PatternMat_, AinvMat );
 
-              Real timeTotalFactorizationSta, timeTotalFactorizationEnd;
+    if( !isAccumulated ){
+      return;
+    }
 
-              GetTime( timeTotalFactorizationSta );
+    if( verbosity >= 2 ){
+      statusOFS << "rhoMat.nnzLocal = " << rhoMat.nnzLocal << std::endl;
+      statusOFS << "AinvMat.nnzLocal = " << AinvMat.nnzLocal << std::endl;
+    }
 
-              // Data redistribution
-              if( verbosity >= 2 ){
-                statusOFS << "Before Distribute." << std::endl;
-              }
-              luMat.Distribute();
-              if( verbosity >= 2 ){
-                statusOFS << "After Distribute." << std::endl;
-              }
 
-              // Numerical factorization
-              if( verbosity >= 2 ){
-                statusOFS << "Before NumericalFactorize." << std::endl;
-              }
-              luMat.NumericalFactorize();
-              if( verbosity >= 2 ){
-                statusOFS << "After NumericalFactorize." << std::endl;
-              }
-              luMat.DestroyAOnly();
+    // Update the density matrix. The following lines are equivalent to
+    //
+    //                for( Int i = 0; i < rhoMat.nnzLocal; i++ ){
+    //                    rhoMat.nzvalLocal(i) += 
+    //                        zweightRho_[l].real() * AinvMat.nzvalLocal(i).imag() + 
+    //                        zweightRho_[l].imag() * AinvMat.nzvalLocal(i).real();
+    //                }
+    // 
+    // But done more cache-efficiently with blas.
+    Real* AinvMatRealPtr = (Real*)AinvMat.nzvalLocal.Data();
+    Real* AinvMatImagPtr = AinvMatRealPtr + 1;
+    blas::Axpy( rhoMat.nnzLocal, zweightRho_[l].real(), AinvMatImagPtr, 2, 
+        rhoMat.nzvalLocal.Data(), 1 );
+    blas::Axpy( rhoMat.nnzLocal, zweightRho_[l].imag(), AinvMatRealPtr, 2,
+        rhoMat.nzvalLocal.Data(), 1 );
+
+    // Derivative of the Fermi-Dirac with respect to mu
+    blas::Axpy( rhoDrvMuMat.nnzLocal, zweightRhoDrvMu_[l].real(), AinvMatImagPtr, 2, 
+        rhoDrvMuMat.nzvalLocal.Data(), 1 );
+    blas::Axpy( rhoDrvMuMat.nnzLocal, zweightRhoDrvMu_[l].imag(), AinvMatRealPtr, 2,
+        rhoDrvMuMat.nzvalLocal.Data(), 1 );
+
+    // Free energy density matrix
+    if( isFreeEnergyDensityMatrix ){
+      blas::Axpy( hmzMat.nnzLocal, zweightHelmholtz_[l].real(), AinvMatImagPtr, 2,
+          hmzMat.nzvalLocal.Data(), 1 );
+      blas::Axpy( hmzMat.nnzLocal, zweightHelmholtz_[l].imag(), AinvMatRealPtr, 2,
+          hmzMat.nzvalLocal.Data(), 1 );
+    }
 
-              GetTime( timeTotalFactorizationEnd );
+    // Energy density matrix
+    if( isEnergyDensityMatrix ){
+      blas::Axpy( frcMat.nnzLocal, zweightForce_[l].real(), AinvMatImagPtr, 2,
+          frcMat.nzvalLocal.Data(), 1 );
+      blas::Axpy( frcMat.nnzLocal, zweightForce_[l].imag(), AinvMatRealPtr, 2, 
+          frcMat.nzvalLocal.Data(), 1 );
+    }
 
-              if( verbosity >= 1 ){
-                statusOFS << "Time for total factorization is " << timeTotalFactorizationEnd - timeTotalFactorizationSta<< " [s]" << std::endl; 
-              }
+    // Derivative of the Fermi-Dirac with respect to T
+    if( isDerivativeTMatrix ){
+      blas::Axpy( rhoDrvTMat.nnzLocal, zweightRhoDrvT_[l].real(), AinvMatImagPtr, 2, 
+          rhoDrvTMat.nzvalLocal.Data(), 1 );
+      blas::Axpy( rhoDrvTMat.nnzLocal, zweightRhoDrvT_[l].imag(), AinvMatRealPtr, 2,
+          rhoDrvTMat.nzvalLocal.Data(), 1 );
+    }
 
-              // *********************************************************************
-              // Selected inversion
-              // *********************************************************************
-              GetTime( timeTotalSelInvSta );
+    GetTime( timePostProcessingEnd );
 
-              luMat.LUstructToPMatrix( PMloc );
-            }
-            break;
-#ifdef WITH_SYMPACK
-          case 1:
-            {
-              symPACK::symPACKMatrix<Complex>& symPACKMat = *symPACKComplexMat_ ;
-              symPACK::DistSparseMatrix<Complex> ltAMat;
-              if( verbosity >= 2 ){
-                statusOFS << "Before ToLowerTriangular." << std::endl;
-              }
-              Convert(AMat,ltAMat);
-              ltAMat.ToLowerTriangular();
-              ltAMat.GetLocalGraph().SetSorted(false);
-              ltAMat.SortGraph();
-              if( verbosity >= 2 ){
-                statusOFS << "After ToLowerTriangular." << std::endl;
-              }
+    if( verbosity >= 1 ){
+      statusOFS << "Time for postprocessing is " <<
+        timePostProcessingEnd - timePostProcessingSta << " [s]" << std::endl;
+    }
+  };
+
+  // Overlap the factorization of the next pole with the selected
+  // inversion of the current one.  The factors are copied to PMloc
+  // before the inversion starts, so luMat is free to factorize the
+  // next pole, and the two stages communicate on different
+  // communicators (the SuperLU grid and gridSelInv_).
+  // Not with 2.5D replication, where the factors go through PMloc to
+  // the other copies.
+  bool overlapPoles = ( poleOverlap_ != 0 && solver == 0 &&
+      gridSelInv_->numReplica == 1 );
+  if( overlapPoles ){
+    Int provided;
+    MPI_Query_thread( &provided );
+#if defined(_OMP_ENABLED_) && !defined(PROFILE)
+    if( provided < MPI_THREAD_MULTIPLE ){
+      overlapPoles = false;
+      statusOFS << "MPI_THREAD_MULTIPLE is not provided, the poles are not overlapped." << std::endl;
+    }
+#else
+    overlapPoles = false;
+    statusOFS << "The poles are only overlapped with OpenMP and without PROFILE." << std::endl;
+#endif
+  }
 
-              Real timeTotalFactorizationSta, timeTotalFactorizationEnd;
+  Int numPoleComputed = 0;
+  BeginPoleLoop();
+
+  // With numPole = q * numGroup + t, the last t poles would keep t pole
+  // groups busy while the other ones wait.  With dynamic scheduling they
+  // are left out of the loop and inverted by merged groups afterwards.
+  Int numPoleMain = numPole;
+  Int numPoleTail = numPole % poleNumGroup_;
+  bool isTailMerged = ( poleScheduling_ != 0 && numPoleTail > 0 &&
+      poleNumGroup_ / numPoleTail >= 2 && gridSelInv_->numReplica == 1 &&
+      selinvOpt_.symmetricStorage == 0 );
+  if( isTailMerged ){
+    numPoleMain = numPole - numPoleTail;
+  }
+  Int lidx = NextMyPole( -1, numPoleMain );
+
+  // 2.5D replication: the copies take the poles of the replica set
+  // numReplica at a time.  Each copy factorizes one pole of the batch,
+  // then the factors are broadcast by their owner and all the copies
+  // invert the pole together.
+  bool isReplicaBuilt = false;
+  while( gridSelInv_->numReplica > 1 && lidx < numPoleMain ){
+    std::vector<Int> batch;
+    while( lidx < numPoleMain ){
+      batch.push_back( lidx );
+      if( (Int)batch.size() == gridSelInv_->numReplica ){
+        break;
+      }
+      lidx = NextMyPole( lidx, numPoleMain );
+    }
 
-              GetTime( timeTotalFactorizationSta );
-              // Data redistribution
-              if( verbosity >= 2 ){
-                statusOFS << "Before Distribute." << std::endl;
-              }
-              symPACKMat.DistributeMatrix(ltAMat);
-              if( verbosity >= 2 ){
-                statusOFS << "After Distribute." << std::endl;
-              }
+    if( gridSelInv_->replicaRank < (Int)batch.size() ){
+      Real timeFactorization = 
+        FactorizePole( poleIdx[batch[gridSelInv_->replicaRank]], verbosity );
+      if( verbosity >= 1 ){
+        statusOFS << "Time for total factorization of pole " << 
+          batch[gridSelInv_->replicaRank] << " is " << timeFactorization << " [s]" << std::endl; 
+      }
+    }
 
-              // Numerical factorization
-              if( verbosity >= 2 ){
-                statusOFS << "Before NumericalFactorize." << std::endl;
-              }
-              symPACKMat.Factorize();
-              // Numerical factorization
-              if( verbosity >= 2 ){
-                statusOFS << "After NumericalFactorize." << std::endl;
-              }
+    for( Int b = 0; b < (Int)batch.size(); b++ ){
+      Int l = poleIdx[batch[b]];
 
-              GetTime( timeTotalFactorizationEnd );
+      GetTime( timePoleSta );
 
-              if( verbosity >= 1 ){
-                statusOFS << "Time for total factorization is " << timeTotalFactorizationEnd - timeTotalFactorizationSta<< " [s]" << std::endl; 
-              }
+      if( verbosity >= 1 ){
+        statusOFS << "Pole " << batch[b] << " processing..." << std::endl;
+      }
 
-              GetTime( timeTotalSelInvSta );
-              symPACKMatrixToPMatrix( symPACKMat, PMloc );
-            }
-            break;
-#endif
-          default:
-            ErrorHandling("Unsupported solver.");
-            break;
-        }
+      AinvMat.Clear();
 
+      numPoleComputed++;
 
+      Real timeTotalSelInvSta;
+      GetTime( timeTotalSelInvSta );
 
-        PMloc.PreSelInv();
+      if( b == gridSelInv_->replicaRank ){
+        ConvertPole( PMloc );
+      }
+      PMloc.BcastReplica( b, isReplicaBuilt );
+      isReplicaBuilt = true;
 
-        // Main subroutine for selected inversion
-        //
-        // P2p communication version
-        PMloc.SelInv();
+      InvertPole( PMloc, l, timeTotalSelInvSta, true );
 
-        // Collective communication version
-        //          PMloc.SelInv_Collectives();
+      GetTime( timePoleEnd );
 
-        GetTime( timeTotalSelInvEnd );
+      if( verbosity >= 1 ){
+        statusOFS << "Time for pole " << batch[b] << " is " <<
+          timePoleEnd - timePoleSta << " [s]" << std::endl << std::endl;
+      }
+    }
 
-        if( verbosity >= 1 ){
-          statusOFS << "Time for total selected inversion is " <<
-            timeTotalSelInvEnd  - timeTotalSelInvSta << " [s]" << std::endl;
-        }
+    lidx = ( lidx < numPoleMain ) ? NextMyPole( lidx, numPoleMain ) : numPoleMain;
+  } // while(numReplica)
 
-        // *********************************************************************
-        // Postprocessing
-        // *********************************************************************
+  if( overlapPoles && lidx < numPoleMain ){
+    Real timeFactorization = FactorizePole( poleIdx[lidx], verbosity );
+    if( verbosity >= 1 ){
+      statusOFS << "Time for total factorization is " << timeFactorization << " [s]" << std::endl; 
+    }
+  }
+  while( lidx < numPoleMain ){
+    Int l = poleIdx[lidx];
 
-        Real timePostProcessingSta, timePostProcessingEnd;
+    GetTime( timePoleSta );
 
-        GetTime( timePostProcessingSta );
+    if( verbosity >= 1 ){
+      statusOFS << "Pole " << lidx << " processing..." << std::endl;
+    }
+    if( verbosity >= 2 ){
+      statusOFS << "zshift           = " << zshift_[l] << std::endl;
+      statusOFS    << "zweightRho       = " << zweightRho_[l] << std::endl;
+      statusOFS    << "zweightRhoDrvMu  = " << zweightRhoDrvMu_[l] << std::endl;
+      if( isFreeEnergyDensityMatrix )
+        statusOFS << "zweightHelmholtz = " << zweightHelmholtz_[l] << std::endl;
+      if( isEnergyDensityMatrix )
+        statusOFS << "zweightForce     = " << zweightForce_[l] << std::endl;
+      if( isDerivativeTMatrix )
+        statusOFS << "zweightRhoDrvT   = " << zweightRhoDrvT_[l] << std::endl;
+    }
 
-        //TODO convert to symmAinvMat too
-        PMloc.PMatrixToDistSparseMatrix( PatternMat_, AinvMat );
+    AinvMat.Clear();
 
-        if( verbosity >= 2 ){
-          statusOFS << "rhoMat.nnzLocal = " << rhoMat.nnzLocal << std::endl;
-          statusOFS << "AinvMat.nnzLocal = " << AinvMat.nnzLocal << std::endl;
-        }
+    numPoleComputed++;
 
+    // *********************************************************************
+    // Factorization
+    // *********************************************************************
+    if( !overlapPoles ){
+      Real timeFactorization = FactorizePole( l, verbosity );
+      if( verbosity >= 1 ){
+        statusOFS << "Time for total factorization is " << timeFactorization << " [s]" << std::endl; 
+      }
+    }
 
-        // Update the density matrix. The following lines are equivalent to
-        //
-        //                for( Int i = 0; i < rhoMat.nnzLocal; i++ ){
-        //                    rhoMat.nzvalLocal(i) += 
-        //                        zweightRho_[l].real() * AinvMat.nzvalLocal(i).imag() + 
-        //                        zweightRho_[l].imag() * AinvMat.nzvalLocal(i).real();
-        //                }
-        // 
-        // But done more cache-efficiently with blas.
-        Real* AinvMatRealPtr = (Real*)AinvMat.nzvalLocal.Data();
-        Real* AinvMatImagPtr = AinvMatRealPtr + 1;
-        blas::Axpy( rhoMat.nnzLocal, zweightRho_[l].real(), AinvMatImagPtr, 2, 
-            rhoMat.nzvalLocal.Data(), 1 );
-        blas::Axpy( rhoMat.nnzLocal, zweightRho_[l].imag(), AinvMatRealPtr, 2,
-            rhoMat.nzvalLocal.Data(), 1 );
+    // *********************************************************************
+    // Selected inversion
+    // *********************************************************************
+    Real timeTotalSelInvSta;
+    GetTime( timeTotalSelInvSta );
 
-        // Derivative of the Fermi-Dirac with respect to mu
-        blas::Axpy( rhoDrvMuMat.nnzLocal, zweightRhoDrvMu_[l].real(), AinvMatImagPtr, 2, 
-            rhoDrvMuMat.nzvalLocal.Data(), 1 );
-        blas::Axpy( rhoDrvMuMat.nnzLocal, zweightRhoDrvMu_[l].imag(), AinvMatRealPtr, 2,
-            rhoDrvMuMat.nzvalLocal.Data(), 1 );
+    ConvertPole( PMloc );
 
-        // Free energy density matrix
-        if( isFreeEnergyDensityMatrix ){
-          blas::Axpy( hmzMat.nnzLocal, zweightHelmholtz_[l].real(), AinvMatImagPtr, 2,
-              hmzMat.nzvalLocal.Data(), 1 );
-          blas::Axpy( hmzMat.nnzLocal, zweightHelmholtz_[l].imag(), AinvMatRealPtr, 2,
-              hmzMat.nzvalLocal.Data(), 1 );
-        }
+    Int lidxNext = numPoleMain;
+    if( overlapPoles ){
+      lidxNext = NextMyPole( lidx, numPoleMain );
+    }
 
-        // Energy density matrix
-        if( isEnergyDensityMatrix ){
-          blas::Axpy( frcMat.nnzLocal, zweightForce_[l].real(), AinvMatImagPtr, 2,
-              frcMat.nzvalLocal.Data(), 1 );
-          blas::Axpy( frcMat.nnzLocal, zweightForce_[l].imag(), AinvMatRealPtr, 2, 
-              frcMat.nzvalLocal.Data(), 1 );
+    if( overlapPoles && lidxNext < numPoleMain ){
+      Real timeFactorization = 0.0;
+#ifdef _OMP_ENABLED_
+      // Half of the threads for each stage.  Only the inversion
+      // writes to statusOFS.
+      Int numThreads = omp_get_max_threads();
+      Int maxLevels  = omp_get_max_active_levels();
+      omp_set_max_active_levels( std::max( maxLevels, 2 ) );
+#pragma omp parallel sections num_threads(2)
+      {
+#pragma omp section
+        {
+          omp_set_num_threads( std::max( numThreads / 2, 1 ) );
+          timeFactorization = FactorizePole( poleIdx[lidxNext], 0 );
+        }
+#pragma omp section
+        {
+          omp_set_num_threads( std::max( numThreads - numThreads / 2, 1 ) );
+          InvertPole( PMloc, l, timeTotalSelInvSta, true );
         }
+      }
+      omp_set_max_active_levels( maxLevels );
+#endif
+      if( verbosity >= 1 ){
+        statusOFS << "Time for total factorization of pole " << lidxNext << 
+          " (overlapped) is " << timeFactorization << " [s]" << std::endl; 
+      }
+    }
+    else{
+      InvertPole( PMloc, l, timeTotalSelInvSta, true );
+      if( !overlapPoles ){
+        lidxNext = NextMyPole( lidx, numPoleMain );
+      }
+    }
+
+    GetTime( timePoleEnd );
 
-        // Derivative of the Fermi-Dirac with respect to T
-        if( isDerivativeTMatrix ){
-          blas::Axpy( rhoDrvTMat.nnzLocal, zweightRhoDrvT_[l].real(), AinvMatImagPtr, 2, 
-              rhoDrvTMat.nzvalLocal.Data(), 1 );
-          blas::Axpy( rhoDrvTMat.nnzLocal, zweightRhoDrvT_[l].imag(), AinvMatRealPtr, 2,
-              rhoDrvTMat.nzvalLocal.Data(), 1 );
+    if( verbosity >= 1 ){
+      statusOFS << "Time for pole " << lidx << " is " <<
+        timePoleEnd - timePoleSta << " [s]" << std::endl << std::endl;
+    }
+
+    lidx = lidxNext;
+  } // while(lidx)
+  EndPoleLoop();
+
+  // Tail: the pole groups are split into numPoleTail sets of
+  // numGroup / numPoleTail consecutive groups, each set working on one
+  // pole as the copies of a 2.5D replicated grid (see
+  // PSelInvOptions::numReplica).  The first group of the set
+  // factorizes, the selected inversion is shared by the set, and only
+  // the first group accumulates the result.  The remaining groups are
+  // idle.
+  //
+  // The merged grid and PMatrix only depend on the symbolic
+  // factorization and on numPoleTail: they are built by the first call
+  // with this tail and reused, with a value only BcastReplica, by the
+  // next ones.
+  if( isTailMerged ){
+    Int tailSize = poleNumGroup_ / numPoleTail;
+    Int tailIdx  = poleGroupIdx_ / tailSize;
+    bool isTailNew = ( poleTailNum_ != numPoleTail );
+    if( isTailNew ){
+      FreeTailPole();
+      MPI_Comm tailComm;
+      MPI_Comm_split( gridPole_->colComm, ( tailIdx < numPoleTail ) ? tailIdx : MPI_UNDEFINED,
+          poleGroupIdx_, &tailComm );
+      if( tailIdx < numPoleTail ){
+        gridTail_ = new GridType( gridSelInv_->comm, gridSelInv_->numProcRow,
+            gridSelInv_->numProcCol, tailComm );
+        if( !gridSelInv_->snodeSlot.empty() ){
+          gridTail_->SetSuperNodeMap( gridSelInv_->snodeSlot );
         }
+        selinvTailOpt_ = selinvOpt_;
+        selinvTailOpt_.numReplica = tailSize;
+        PMTailMat_ = new PMatrix<Complex>;
+        PMTailMat_->Setup( gridTail_, &superComplex_, &selinvTailOpt_, &factOpt_ );
+      }
+      if( tailComm != MPI_COMM_NULL ){
+        MPI_Comm_free( &tailComm );
+      }
+      poleTailNum_ = numPoleTail;
+    }
+    if( tailIdx < numPoleTail ){
+      Int lidx = numPoleMain + tailIdx;
+      Int l = poleIdx[lidx];
 
-        GetTime( timePostProcessingEnd );
+      GetTime( timePoleSta );
+
+      if( verbosity >= 1 ){
+        statusOFS << "Pole " << lidx << " processing on " << tailSize 
+          << " pole groups..." << std::endl;
+      }
+
+      const GridType& gridTail = *gridTail_;
+      PMatrix<Complex>& PMtail = *PMTailMat_;
+
+      AinvMat.Clear();
+
+      numPoleComputed++;
 
+      if( gridTail.replicaRank == 0 ){
+        Real timeFactorization = FactorizePole( l, verbosity );
         if( verbosity >= 1 ){
-          statusOFS << "Time for postprocessing is " <<
-            timePostProcessingEnd - timePostProcessingSta << " [s]" << std::endl;
+          statusOFS << "Time for total factorization is " << timeFactorization << " [s]" << std::endl; 
         }
+      }
+
+      Real timeTotalSelInvSta;
+      GetTime( timeTotalSelInvSta );
 
+      if( gridTail.replicaRank == 0 ){
+        ConvertPole( PMtail );
       }
+      PMtail.BcastReplica( 0, !isTailNew );
+      if( isTailNew ){
+        PMtail.ConstructCommunicationPattern();
+      }
+
+      InvertPole( PMtail, l, timeTotalSelInvSta, gridTail.replicaRank == 0 );
+
       GetTime( timePoleEnd );
 
       if( verbosity >= 1 ){
         statusOFS << "Time for pole " << lidx << " is " <<
           timePoleEnd - timePoleSta << " [s]" << std::endl << std::endl;
       }
+    }
+  }
 
-    } // if I am in charge of this pole
-
-
-  } // for(lidx)
-
-  // Reduce the density matrix across the processor rows in gridPole_
+  // Reduce the density matrix across the processor rows in gridPole_.
+  // The copies of the SelInv grid all hold the inverse of the poles of
+  // the replica set, only the first one contributes.
   {
     DblNumVec nzvalRhoMatLocal = rhoMat.nzvalLocal;
     SetValue( rhoMat.nzvalLocal, 0.0 );
+    if( gridSelInv_->replicaRank != 0 ){
+      SetValue( nzvalRhoMatLocal, 0.0 );
+    }
 
     mpi::Allreduce( nzvalRhoMatLocal.Data(), rhoMat.nzvalLocal.Data(),
         rhoMat.nnzLocal, MPI_SUM, gridPole_->colComm );
@@ -3141,6 +3585,9 @@ void PPEXSIData::CalculateFermiOperatorReal(
   {
     DblNumVec nzvalRhoDrvMuMatLocal = rhoDrvMuMat.nzvalLocal;
     SetValue( rhoDrvMuMat.nzvalLocal, 0.0 );
+    if( gridSelInv_->replicaRank != 0 ){
+      SetValue( nzvalRhoDrvMuMatLocal, 0.0 );
+    }
 
     mpi::Allreduce( nzvalRhoDrvMuMatLocal.Data(), rhoDrvMuMat.nzvalLocal.Data(),
         rhoDrvMuMat.nnzLocal, MPI_SUM, gridPole_->colComm );
@@ -3150,6 +3597,9 @@ void PPEXSIData::CalculateFermiOperatorReal(
   if( isFreeEnergyDensityMatrix ){
     DblNumVec nzvalHmzMatLocal = hmzMat.nzvalLocal;
     SetValue( hmzMat.nzvalLocal, 0.0 );
+    if( gridSelInv_->replicaRank != 0 ){
+      SetValue( nzvalHmzMatLocal, 0.0 );
+    }
 
     mpi::Allreduce( nzvalHmzMatLocal.Data(), hmzMat.nzvalLocal.Data(),
         hmzMat.nnzLocal, MPI_SUM, gridPole_->colComm );
@@ -3159,6 +3609,9 @@ void PPEXSIData::CalculateFermiOperatorReal(
   if( isEnergyDensityMatrix ){
     DblNumVec nzvalFrcMatLocal = frcMat.nzvalLocal;
     SetValue( frcMat.nzvalLocal, 0.0 );
+    if( gridSelInv_->replicaRank != 0 ){
+      SetValue( nzvalFrcMatLocal, 0.0 );
+    }
 
     mpi::Allreduce( nzvalFrcMatLocal.Data(), frcMat.nzvalLocal.Data(),
         frcMat.nnzLocal, MPI_SUM, gridPole_->colComm );
@@ -3169,6 +3622,9 @@ void PPEXSIData::CalculateFermiOperatorReal(
   if( isDerivativeTMatrix ){
     DblNumVec nzvalRhoDrvTMatLocal = rhoDrvTMat.nzvalLocal;
     SetValue( rhoDrvTMat.nzvalLocal, 0.0 );
+    if( gridSelInv_->replicaRank != 0 ){
+      SetValue( nzvalRhoDrvTMatLocal, 0.0 );
+    }
 
     mpi::Allreduce( nzvalRhoDrvTMatLocal.Data(), rhoDrvTMat.nzvalLocal.Data(),
         rhoDrvTMat.nnzLocal, MPI_SUM, gridPole_->colComm );
@@ -3300,6 +3756,10 @@ void PPEXSIData::CalculateFermiOperatorComplex(
     Int   method,
     Int   nPoints,
     Real  spin) {
+  if( gridSelInv_->numReplica > 1 ){
+    ErrorHandling( "CalculateFermiOperatorComplex does not support the 2.5D replication of the SelInv grid." );
+  }
+
 
   // These are needed in the point-pole-pexsi parallelization
   Int npPerPoint  = gridPole_->mpisize / nPoints;
@@ -3506,8 +3966,9 @@ void PPEXSIData::CalculateFermiOperatorComplex(
   Real timePoleSta, timePoleEnd;
 
   Int numPoleComputed = 0;
+  BeginPoleLoop( pointColComm, myRowPoint % numPole, gridPole_->numProcRow / nPoints );
   for(Int lidx = 0; lidx < numPole; lidx++){
-    if( myRowPoint % numPole == lidx % (gridPole_->numProcRow /nPoints)){
+    if( IsMyPole( lidx ) ){
 
       //Int l = poleIdx[lidx];
       Int l = lidx;
@@ -3775,6 +4236,7 @@ void PPEXSIData::CalculateFermiOperatorComplex(
 
 
   } // for(lidx)
+  EndPoleLoop();
 
   // Reduce the density matrix across the processor rows in gridPole_
   {
@@ -4882,6 +5344,10 @@ void PPEXSIData::CalculateFermiOperatorReal3(
     Int   method,
     Int   nPoints,
     Real  spin) {
+  if( gridSelInv_->numReplica > 1 ){
+    ErrorHandling( "CalculateFermiOperatorReal3 does not support the 2.5D replication of the SelInv grid." );
+  }
+
 
   // These are needed in the point-pole-pexsi parallelization
   Int npPerPoint  = gridPole_->mpisize / nPoints;
@@ -5075,9 +5541,10 @@ void PPEXSIData::CalculateFermiOperatorReal3(
   Real timePoleSta, timePoleEnd;
 
   Int numPoleComputed = 0;
+  BeginPoleLoop( pointColComm, myRowPoint % numPole, gridPole_->numProcRow / nPoints );
   for(Int lidx = 0; lidx < numPole; lidx++){
     // add another line here to do the 
-    if( myRowPoint % numPole == lidx % (gridPole_->numProcRow /nPoints)){
+    if( IsMyPole( lidx ) ){
       //Int l = poleIdx[lidx];
       Int l = lidx;
 
@@ -5318,6 +5785,7 @@ void PPEXSIData::CalculateFermiOperatorReal3(
 
 
   } // for(lidx)
+  EndPoleLoop();
 
   // Reduce the density matrix across the processor rows in gridPole_
   {
@@ -5440,6 +5908,10 @@ void PPEXSIData::CalculateEDMCorrectionReal(
     Int   verbosity,
     Int   nPoints, 
     Real  spin) {
+  if( gridSelInv_->numReplica > 1 ){
+    ErrorHandling( "CalculateEDMCorrectionReal does not support the 2.5D replication of the SelInv grid." );
+  }
+
 
   // add the points parallelization.
   /*
@@ -5706,6 +6178,10 @@ void PPEXSIData::CalculateEDMCorrectionComplex(
     Int   verbosity,
     Int   nPoints,
     Real  spin) {
+  if( gridSelInv_->numReplica > 1 ){
+    ErrorHandling( "CalculateEDMCorrectionComplex does not support the 2.5D replication of the SelInv grid." );
+  }
+
 
   if(solver==1){
     std::ostringstream msg;
@@ -5932,6 +6408,10 @@ void PPEXSIData::InterpolateDMReal(
     Int               & iFLAG,
     Int                 method,
     Int                 verbosity){
+  if( gridSelInv_->numReplica > 1 ){
+    ErrorHandling( "InterpolateDMReal does not support the 2.5D replication of the SelInv grid." );
+  }
+
 
   DistSparseMatrix<Real>&  SMat        = SRealMat_;
 
@@ -6273,6 +6753,10 @@ void PPEXSIData::InterpolateDMComplex(
     Int               & iFLAG,
     Int                 method,
     Int                 verbosity){
+  if( gridSelInv_->numReplica > 1 ){
+    ErrorHandling( "InterpolateDMComplex does not support the 2.5D replication of the SelInv grid." );
+  }
+
 
   DistSparseMatrix<Complex>&  SMat        = SComplexMat_;
 
@@ -124,6 +124,20 @@ void RealGridData::GridExit(  ){
 // SuperLUData class
 namespace PEXSI{
 
+/// @brief Whether the values of the L (U) blocks of LU share one
+/// allocation, Lnzval_bc_dat (Unzval_br_dat), in which case they
+/// cannot be freed one by one.  Detected from the fields rather than
+/// from SUPERLU_DIST_MAJOR_VERSION, since releases before 8 may already
+/// pool the values.
+template<typename LU, typename = void>
+struct HasLnzvalBcDat{ static const bool value = false; };
+template<typename LU>
+struct HasLnzvalBcDat<LU, decltype( (void)&LU::Lnzval_bc_dat )>{ static const bool value = true; };
+template<typename LU, typename = void>
+struct HasUnzvalBrDat{ static const bool value = false; };
+template<typename LU>
+struct HasUnzvalBrDat<LU, decltype( (void)&LU::Unzval_br_dat )>{ static const bool value = true; };
+
 class RealSuperLUData_internal{
   friend class RealSuperLUData;
 protected:
@@ -181,6 +195,15 @@ protected:
   bool                isScalePermstructAllocated;
   bool                isLUstructAllocated;
 
+  /// @brief Identifies the symbolic factorization of LUstruct, see
+  /// SuperLUPMatrixLayout::symbolicId.
+  Int                 symbolicId;
+
+  /// @brief SuperLUOptions::freeLUValues, and whether the values of
+  /// the factors are currently freed.
+  Int                 freeLUValues;
+  bool                isLUValuesFreed;
+
   Int maxDomains;
 
   RealSuperLUData_internal(const SuperLUGrid<Real>& g, const SuperLUOptions& opt);
@@ -197,7 +220,13 @@ RealSuperLUData_internal::RealSuperLUData_internal(const SuperLUGrid<Real>& g, c
   isSuperMatrixAllocated     = false;
   isScalePermstructAllocated = false;
   isLUstructAllocated        = false;
+  symbolicId                 = 0;
   numProcSymbFact            = opt.numProcSymbFact;
+  freeLUValues               = opt.freeLUValues;
+  isLUValuesFreed            = false;
+  if( freeLUValues && ( HasLnzvalBcDat<dLocalLU_t>::value || HasUnzvalBrDat<dLocalLU_t>::value ) ){
+    ErrorHandling( "freeLUValues is not supported by this SuperLU_DIST, the values of the factors share one allocation." );
+  }
 
   // Options
   set_default_options_dist(&options);
@@ -474,6 +503,10 @@ RealSuperLUData::DestroyAOnly	(  )
   return ;
 } 		// -----  end of method RealSuperLUData::DestroyAOnly  ----- 
 
+// Number of symbolic factorizations so far, gives each LUstruct its
+// symbolicId.
+static Int symbolicCount = 0;
+
 void
 RealSuperLUData::SymbolicFactorize	(  )
 {
@@ -521,6 +554,7 @@ RealSuperLUData::SymbolicFactorize	(  )
 
   ptrData->isScalePermstructAllocated = true;
   ptrData->isLUstructAllocated        = true; 
+  ptrData->symbolicId                 = ++symbolicCount;
 
 
   return ;
@@ -546,6 +580,35 @@ RealSuperLUData::Distribute	(  )
   // Apply column permutation to the original distributed A
   for(Int j = 0; j < nnzLocal; j++)
     colind[j] = perm_c[colind[j]];
+  // The values freed by LUstructToPMatrix are allocated again,
+  // pddistribute only zeros and fills them.  The PMatrix still holds
+  // the previous factors, which are refreshed in place, so from here
+  // on two copies of the factors are alive.
+  if( ptrData->isLUValuesFreed ){
+    dLocalLU_t* Llu = ptrData->LUstruct.Llu;
+    gridinfo_t* grid = ptrData->grid;
+    Int* xsup = ptrData->LUstruct.Glu_persist->xsup;
+    Int numSuper = ptrData->LUstruct.Glu_persist->supno[ptrData->A.ncol-1] + 1;
+    Int myrow = grid->iam / grid->npcol;
+    Int mycol = grid->iam % grid->npcol;
+    for( Int jb = 0; jb * grid->npcol + mycol < numSuper; jb++ ){
+      Int bnum = jb * grid->npcol + mycol;
+      const Int* index = Llu->Lrowind_bc_ptr[jb];
+      if( index && Llu->Lnzval_bc_ptr[jb] == NULL ){
+        // index[1] is the leading dimension of the block column.
+        Llu->Lnzval_bc_ptr[jb] = doubleMalloc_dist( index[1] * ( xsup[bnum+1] - xsup[bnum] ) );
+      }
+    }
+    for( Int ib = 0; ib * grid->nprow + myrow < numSuper; ib++ ){
+      const Int* index = Llu->Ufstnz_br_ptr[ib];
+      if( index && Llu->Unzval_br_ptr[ib] == NULL ){
+        // index[1] is the number of values in the block row.
+        Llu->Unzval_br_ptr[ib] = doubleMalloc_dist( index[1] );
+      }
+    }
+    ptrData->isLUValuesFreed = false;
+  }
+
   // Distribute Pc*Pr*diag(R)*A*diag(C)*Pc' into L and U storage.  
   // NOTE: the row permutation Pc*Pr is applied internally in the
   // distribution routine. 
@@ -562,6 +625,9 @@ RealSuperLUData::NumericalFactorize	(  )
   if( !ptrData->isLUstructAllocated ){
     ErrorHandling( "LUstruct has not been allocated." );
   }
+  if( ptrData->isLUValuesFreed ){
+    ErrorHandling( "The values of the factors have been freed by LUstructToPMatrix, call Distribute first." );
+  }
   // Estimate the 1-norm
   char norm[1]; *norm = '1';
   double anorm = pdlangs( norm, &ptrData->A, ptrData->grid );
@@ -716,6 +782,9 @@ void RealSuperLUData::GatherDistributedMultiVector	( NumMat<Real>& xGlobal, NumM
 void
 RealSuperLUData::SolveDistMultiVector	( NumMat<Real>& bLocal, DblNumVec& berr )
 {
+  if( ptrData->isLUValuesFreed ){
+    ErrorHandling( "The values of the factors have been freed by LUstructToPMatrix (SuperLUOptions::freeLUValues)." );
+  }
   Int nrhs = bLocal.n();
   NRformat_loc *Astore = (NRformat_loc *) ptrData->A.Store;
   Int numRowLocal = Astore->m_loc;
@@ -766,6 +835,262 @@ RealSuperLUData::CheckErrorDistMultiVector	( NumMat<Real>& xLocal, NumMat<Real>&
 } 		// -----  end of method RealSuperLUData::CheckErrorDistMultiVector  ----- 
 
 
+/// @brief Frees the values of the factors still allocated in Llu for
+/// the local blocks of PMloc, see SuperLUOptions::freeLUValues.
+static void
+FreeLUValues	( dLocalLU_t* Llu, const PMatrix<Real>& PMloc )
+{
+  const GridType* grid   = PMloc.Grid();
+  Int numSuper = PMloc.NumSuper();
+
+  for( Int jb = 0; jb < PMloc.NumLocalBlockCol(); jb++ ){
+    Int bnum = jb * grid->numProcCol + MYCOL( grid );
+    if( bnum >= numSuper ) continue;
+    if( Llu->Lnzval_bc_ptr[jb] != NULL ){
+      SUPERLU_FREE( Llu->Lnzval_bc_ptr[jb] );
+      Llu->Lnzval_bc_ptr[jb] = NULL;
+    }
+  }
+
+  for( Int ib = 0; ib < PMloc.NumLocalBlockRow(); ib++ ){
+    Int bnum = ib * grid->numProcRow + MYROW( grid );
+    if( bnum >= numSuper ) continue;
+    if( Llu->Unzval_br_ptr[ib] != NULL ){
+      SUPERLU_FREE( Llu->Unzval_br_ptr[ib] );
+      Llu->Unzval_br_ptr[ib] = NULL;
+    }
+  }
+} 		// -----  end of function FreeLUValues  ----- 
+
+
+/// @brief Copies the values of the factors in Llu into the blocks of
+/// PMloc built by an earlier LUstructToPMatrix, following layout.
+///
+/// With Lcyclic / Ucyclic the values are copied into these block
+/// columns / rows of the 2D block cyclic layout instead, see
+/// BuildCyclicBlocks.
+///
+/// Without isCopied the blocks are only checked, so that the values
+/// can be copied with isFreed afterwards: each block column / row of
+/// Llu is then freed as soon as it has been copied (see
+/// SuperLUOptions::freeLUValues).
+///
+/// @return false if the blocks of PMloc do not match the LUstruct
+/// anymore, in which case they have to be rebuilt.  Nothing else than
+/// nzval is touched.  The rows of the L blocks are compared as well,
+/// except for the cyclic blocks, which have none.
+static bool
+RefreshPMatrixValues	( dLocalLU_t* Llu, const SuperLUPMatrixLayout& layout,
+    PMatrix<Real>& PMloc, bool isCopied, bool isFreed,
+    std::vector<std::vector<LBlock<Real> > >* Lcyclic = NULL,
+    std::vector<std::vector<UBlock<Real> > >* Ucyclic = NULL )
+{
+  const GridType* grid   = PMloc.Grid();
+  const SuperNodeType* super = PMloc.SuperNode();
+  Int numSuper = PMloc.NumSuper();
+
+  // L part
+  Int cntblk  = 0;                              // Count for the L blocks in layout
+  Int cntperm = 0;                              // Count for the rows in layout
+  for( Int jb = 0; jb < PMloc.NumLocalBlockCol(); jb++ ){
+    Int bnum = jb * grid->numProcCol + MYCOL( grid );
+    if( bnum >= numSuper ) continue;
+
+    const Int* index = Llu->Lrowind_bc_ptr[jb];
+    if( index ){
+      std::vector<LBlock<Real> >& Lcol = Lcyclic ? (*Lcyclic)[jb] : PMloc.L(jb);
+      Int cnt = 0;
+      Int cntval = 0;
+      Int numBlock = index[cnt++];
+      Int lda = index[cnt++];
+      if( numBlock != Lcol.size() ) return false;
+
+      for( Int iblk = 0; iblk < numBlock; iblk++ ){
+        Int blockIdx = index[cnt++];
+        Int numRow   = index[cnt++];
+        const Int* rows = &index[cnt];
+        cnt += numRow;
+        if( cntblk >= layout.LblockPos.size() ||
+            cntperm + numRow > layout.LrowPerm.size() ) return false;
+
+        LBlock<Real> & LB = Lcol[layout.LblockPos[cntblk++]];
+        if( LB.blockIdx != blockIdx || LB.numRow != numRow ||
+            LB.nzval.m() != numRow || LB.nzval.n() != LB.numCol ) return false;
+
+        const Int* rowsPerm = &layout.LrowPerm[cntperm];
+        if( Lcyclic == NULL ){
+          if( LB.rows.m() != numRow ) return false;
+          for( Int i = 0; i < numRow; i++ ){
+            if( LB.rows[i] != rows[rowsPerm[i]] ) return false;
+          }
+        }
+        if( isCopied ){
+          const Real* pval = (Real*)(Llu->Lnzval_bc_ptr[jb]+cntval);
+          for(Int j = 0; j<LB.numCol; ++j){
+            for(Int i = 0; i<numRow; ++i){
+              LB.nzval(i,j) = pval[rowsPerm[i]+j*lda];
+            }
+          }
+        }
+        cntperm += numRow;
+        cntval  += numRow;
+      } // for(iblk)
+    } // if(index)
+
+    if( isCopied && isFreed && Llu->Lnzval_bc_ptr[jb] != NULL ){
+      SUPERLU_FREE( Llu->Lnzval_bc_ptr[jb] );
+      Llu->Lnzval_bc_ptr[jb] = NULL;
+    }
+  } // for(jb)
+
+  if( PMloc.Options() == nullptr || PMloc.Options()->symmetricStorage == 1 ){
+    return true;
+  }
+
+  // U part
+  for( Int ib = 0; ib < PMloc.NumLocalBlockRow(); ib++ ){
+    Int bnum = ib * grid->numProcRow + MYROW( grid );
+    if( bnum >= numSuper ) continue;
+
+    const Int*    index = Llu->Ufstnz_br_ptr[ib]; 
+    const Real* pval  = reinterpret_cast<const Real*>(Llu->Unzval_br_ptr[ib]);
+    if( index ){
+      std::vector<UBlock<Real> >& Urow = Ucyclic ? (*Ucyclic)[ib] : PMloc.U(ib);
+      if( index[0] != Urow.size() ) return false;
+
+      Int cnt = BR_HEADER;
+      Int cntval = 0;
+      for( Int jblk = 0; jblk < Urow.size(); jblk++ ){
+        Int blockIdx = index[cnt];
+        // PMatrixUnsym sorts U(k,:) by blockIdx after the conversion.
+        UBlock<Real>* pUB = &Urow[jblk];
+        if( pUB->blockIdx != blockIdx ){
+          pUB = NULL;
+          for( Int kblk = 0; kblk < Urow.size(); kblk++ ){
+            if( Urow[kblk].blockIdx == blockIdx ){
+              pUB = &Urow[kblk];
+              break;
+            }
+          }
+          if( pUB == NULL ) return false;
+        }
+        UBlock<Real> & UB = *pUB;
+        if( UB.nzval.m() != UB.numRow || UB.nzval.n() != UB.numCol ) return false;
+
+        cnt += UB_DESCRIPTOR;
+        if( isCopied ){
+          SetValue( UB.nzval, ZERO<Real>() );
+        }
+
+        Int cntcol = 0;
+        for( Int j = 0; 
+            j < super->superPtr[UB.blockIdx+1] - super->superPtr[UB.blockIdx]; j++ ){
+          Int firstRow = index[cnt++];
+          if( firstRow != FirstBlockCol( bnum+1, super ) ){
+            if( cntcol >= UB.numCol ) return false;
+            Int tnrow = FirstBlockCol( bnum+1, super ) - firstRow;
+            if( isCopied ){
+              lapack::Lacpy( 'A', tnrow, 1, &pval[cntval], tnrow,
+                  &UB.nzval(firstRow - FirstBlockCol(bnum, super), cntcol),
+                  UB.numRow );
+            }
+            cntcol ++;
+            cntval += tnrow;
+          }
+        } // for( j )
+        if( cntcol != UB.numCol ) return false;
+      } // for (jblk)
+    } // if( index )
+
+    if( isCopied && isFreed && Llu->Unzval_br_ptr[ib] != NULL ){
+      SUPERLU_FREE( Llu->Unzval_br_ptr[ib] );
+      Llu->Unzval_br_ptr[ib] = NULL;
+    }
+  } // for(ib)
+
+  return true;
+} 		// -----  end of function RefreshPMatrixValues  ----- 
+
+
+/// @brief Builds the blocks of the 2D block cyclic layout the LUstruct
+/// is stored in, without rows / cols and with nzval allocated only, to
+/// be filled by RefreshPMatrixValues once the blocks of PMloc have been
+/// moved to the supernode map of the grid.
+///
+/// @return false if the LUstruct does not match layout.
+static bool
+BuildCyclicBlocks	( const dLocalLU_t* Llu, const SuperLUPMatrixLayout& layout,
+    PMatrix<Real>& PMloc,
+    std::vector<std::vector<LBlock<Real> > >& Lcyclic,
+    std::vector<std::vector<UBlock<Real> > >& Ucyclic )
+{
+  const GridType* grid   = PMloc.Grid();
+  const SuperNodeType* super = PMloc.SuperNode();
+  Int numSuper = PMloc.NumSuper();
+
+  Lcyclic.clear();
+  Ucyclic.clear();
+  Lcyclic.resize( PMloc.NumLocalBlockCol() );
+  Ucyclic.resize( PMloc.NumLocalBlockRow() );
+
+  // L part
+  Int cntblk  = 0;                              // Count for the L blocks in layout
+  for( Int jb = 0; jb < PMloc.NumLocalBlockCol(); jb++ ){
+    Int bnum = jb * grid->numProcCol + MYCOL( grid );
+    if( bnum >= numSuper ) continue;
+
+    const Int* index = Llu->Lrowind_bc_ptr[jb];
+    if( index ){
+      std::vector<LBlock<Real> >& Lcol = Lcyclic[jb];
+      Int cnt = 0;
+      Lcol.resize( index[cnt++] );
+      cnt++;
+      for( Int iblk = 0; iblk < (Int)Lcol.size(); iblk++ ){
+        if( cntblk >= (Int)layout.LblockPos.size() ||
+            layout.LblockPos[cntblk] >= (Int)Lcol.size() ) return false;
+        LBlock<Real> & LB = Lcol[layout.LblockPos[cntblk++]];
+        LB.blockIdx = index[cnt++];
+        LB.numRow   = index[cnt++];
+        LB.numCol   = super->superPtr[bnum+1] - super->superPtr[bnum];
+        LB.nzval.Resize( LB.numRow, LB.numCol );
+        cnt += LB.numRow;
+      } // for(iblk)
+    } // if(index)
+  } // for(jb)
+
+  if( PMloc.Options() == nullptr || PMloc.Options()->symmetricStorage == 1 ){
+    return true;
+  }
+
+  // U part
+  for( Int ib = 0; ib < PMloc.NumLocalBlockRow(); ib++ ){
+    Int bnum = ib * grid->numProcRow + MYROW( grid );
+    if( bnum >= numSuper ) continue;
+
+    const Int* index = Llu->Ufstnz_br_ptr[ib]; 
+    if( index ){
+      std::vector<UBlock<Real> >& Urow = Ucyclic[ib];
+      Urow.resize( index[0] );
+      Int cnt = BR_HEADER;
+      for( Int jblk = 0; jblk < (Int)Urow.size(); jblk++ ){
+        UBlock<Real> & UB = Urow[jblk];
+        UB.blockIdx = index[cnt];
+        UB.numRow   = super->superPtr[bnum+1] - super->superPtr[bnum];
+        UB.numCol   = 0;
+        cnt += UB_DESCRIPTOR;
+        for( Int j = 0; 
+            j < super->superPtr[UB.blockIdx+1] - super->superPtr[UB.blockIdx]; j++ ){
+          if( index[cnt++] != FirstBlockCol( bnum+1, super ) ) UB.numCol++;
+        }
+        UB.nzval.Resize( UB.numRow, UB.numCol );
+      } // for (jblk)
+    } // if( index )
+  } // for(ib)
+
+  return true;
+} 		// -----  end of function BuildCyclicBlocks  ----- 
+
+
 void
 RealSuperLUData::LUstructToPMatrix	( PMatrix<Real>& PMloc )
 {
@@ -774,6 +1099,61 @@ RealSuperLUData::LUstructToPMatrix	( PMatrix<Real>& PMloc )
   const SuperNodeType* super = PMloc.SuperNode();
   Int numSuper = PMloc.NumSuper();
 
+  // Value-only refresh.  The blocks of PMloc, their sorted rows and
+  // ColBlockIdx / RowBlockIdx only depend on the symbolic
+  // factorization, so once PMloc has been built from this LUstruct the
+  // factors of the next shift are copied into nzval in place.  Once
+  // RedistributeSuperNodes has moved the blocks to the supernode map of
+  // the grid, the values are copied into the 2D block cyclic blocks and
+  // moved by RedistributeSuperNodeValues, and all processors have to
+  // agree on the refresh.
+  //
+  // The layout is kept in PMloc (PMatrix::FactorLayout), which drops it
+  // in Setup and deallocate, and is only used for the LUstruct of the
+  // same symbolic factorization.
+  std::shared_ptr<SuperLUPMatrixLayout> cachedLayout =
+    std::static_pointer_cast<SuperLUPMatrixLayout>( PMloc.FactorLayout() );
+  if( cachedLayout && cachedLayout->symbolicId == ptrData->symbolicId ){
+    // The blocks are checked before any value is copied, so that with
+    // freeLUValues each block column / row of the factors is freed as
+    // soon as it has been copied.
+    dLocalLU_t* LluValues = ptrData->LUstruct.Llu;
+    bool isCyclic = !grid->snodeSlot.empty();
+    std::vector<std::vector<LBlock<Real> > > Lcyclic;
+    std::vector<std::vector<UBlock<Real> > > Ucyclic;
+    std::vector<std::vector<LBlock<Real> > >* pLcyclic = isCyclic ? &Lcyclic : NULL;
+    std::vector<std::vector<UBlock<Real> > >* pUcyclic = isCyclic ? &Ucyclic : NULL;
+    int isValid = 
+      ( !isCyclic || BuildCyclicBlocks( Llu, *cachedLayout, PMloc, Lcyclic, Ucyclic ) ) &&
+      RefreshPMatrixValues( LluValues, *cachedLayout, PMloc, false, false, pLcyclic, pUcyclic );
+    if( isCyclic ){
+      int isAllValid;
+      MPI_Allreduce( &isValid, &isAllValid, 1, MPI_INT, MPI_MIN, grid->comm );
+      isValid = isAllValid;
+    }
+    if( isValid ){
+      RefreshPMatrixValues( LluValues, *cachedLayout, PMloc, true, ptrData->freeLUValues != 0,
+          pLcyclic, pUcyclic );
+      if( isCyclic ){
+        PMloc.RedistributeSuperNodeValues( Lcyclic, Ucyclic );
+      }
+#if ( _DEBUGlevel_ >= 1 )
+      statusOFS << std::endl << "LUstructToPMatrix::values refreshed" << std::endl;
+#endif
+      // Frees what is left, e.g. U which is not read with the symmetric
+      // storage.
+      if( ptrData->freeLUValues ){
+        FreeLUValues( LluValues, PMloc );
+        ptrData->isLUValuesFreed = true;
+      }
+      return;
+    }
+  }
+  PMloc.FactorLayout().reset();
+  std::shared_ptr<SuperLUPMatrixLayout> newLayout = std::make_shared<SuperLUPMatrixLayout>();
+  SuperLUPMatrixLayout& layout = *newLayout;
+  layout.symbolicId = ptrData->symbolicId;
+
   // L part   
 #if ( _DEBUGlevel_ >= 1 )
   statusOFS << std::endl << "LUstructToPMatrix::L part" << std::endl;
@@ -783,9 +1163,11 @@ RealSuperLUData::LUstructToPMatrix	( PMatrix<Real>& PMloc )
   PMloc.RowBlockIdx().clear();
   PMloc.ColBlockIdx().resize( PMloc.NumLocalBlockCol() );
   PMloc.RowBlockIdx().resize( PMloc.NumLocalBlockRow() );
+  // SuperLU_DIST stores the blocks 2D block cyclic.  They are moved to
+  // the supernode map of the grid by RedistributeSuperNodes at the end.
   //对于本地的所有column
   for( Int jb = 0; jb < PMloc.NumLocalBlockCol(); jb++ ){
-    Int bnum = GBj( jb, grid );//找到它在全局的下标
+    Int bnum = jb * grid->numProcCol + MYCOL( grid );//找到它在全局的下标
     if( bnum >= numSuper ) continue;//如果它在全局的下标大于等于所有supernode，那就错了？
 
     Int cnt = 0;                                // Count for the index in LUstruct
@@ -830,6 +1212,7 @@ RealSuperLUData::LUstructToPMatrix	( PMatrix<Real>& PMloc )
         Int blockIdx    = index[cnt++];
         //determine where to put it
         LBlock<Real> & LB     = Lcol[sortedIndices[iblk]];
+        layout.LblockPos.push_back( sortedIndices[iblk] );
         LB.blockIdx    = blockIdx;
 
         PMloc.ColBlockIdx(jb).push_back(LB.blockIdx);
@@ -847,6 +1230,7 @@ RealSuperLUData::LUstructToPMatrix	( PMatrix<Real>& PMloc )
         ULComparator cmp(LB.rows);
         //sort the row indices (so as to speedup the index lookup
         std::sort(rowsPerm.Data(),rowsPerm.Data()+rowsPerm.m(),cmp);
+        layout.LrowPerm.insert( layout.LrowPerm.end(), rowsPerm.Data(), rowsPerm.Data()+rowsPerm.m() );
 
         for(Int i = 0; i<LB.rows.m(); ++i){ 
           rowsSorted[i] = LB.rows[rowsPerm[i]];
@@ -886,6 +1270,13 @@ RealSuperLUData::LUstructToPMatrix	( PMatrix<Real>& PMloc )
       statusOFS<<std::endl;
 #endif
     }  // if(index)
+
+    // The block column has been copied, its values are not needed
+    // anymore.
+    if( ptrData->freeLUValues && Llu->Lnzval_bc_ptr[jb] != NULL ){
+      SUPERLU_FREE( ptrData->LUstruct.Llu->Lnzval_bc_ptr[jb] );
+      ptrData->LUstruct.Llu->Lnzval_bc_ptr[jb] = NULL;
+    }
   } // for(jb)
 
         if(PMloc.Options()!=nullptr){
@@ -895,7 +1286,7 @@ RealSuperLUData::LUstructToPMatrix	( PMatrix<Real>& PMloc )
   statusOFS << std::endl << "LUstructToPMatrix::U part" << std::endl;
 #endif
   for( Int ib = 0; ib < PMloc.NumLocalBlockRow(); ib++ ){
-    Int bnum = GBi( ib, grid );
+    Int bnum = ib * grid->numProcRow + MYROW( grid );
     if( bnum >= numSuper ) continue;
 
     Int cnt = 0;                                // Count for the index in LUstruct
@@ -968,10 +1359,21 @@ RealSuperLUData::LUstructToPMatrix	( PMatrix<Real>& PMloc )
 
     } // if( index )
 
+    if( ptrData->freeLUValues && Llu->Unzval_br_ptr[ib] != NULL ){
+      SUPERLU_FREE( ptrData->LUstruct.Llu->Unzval_br_ptr[ib] );
+      ptrData->LUstruct.Llu->Unzval_br_ptr[ib] = NULL;
+    }
   } // for(ib)
           }
         }
 
+  // Frees what is left, e.g. U which is not read with the symmetric
+  // storage.
+  if( ptrData->freeLUValues ){
+    FreeLUValues( ptrData->LUstruct.Llu, PMloc );
+    ptrData->isLUValuesFreed = true;
+  }
+
   for( Int ib = 0; ib < PMloc.NumLocalBlockRow(); ib++ ){
     std::vector<Int> & rowBlockIdx = PMloc.RowBlockIdx(ib);
     std::sort(rowBlockIdx.begin(),rowBlockIdx.end());
@@ -982,6 +1384,10 @@ RealSuperLUData::LUstructToPMatrix	( PMatrix<Real>& PMloc )
     std::sort(colBlockIdx.begin(),colBlockIdx.end());
   }
 
+  PMloc.RedistributeSuperNodes();
+
+  PMloc.FactorLayout() = newLayout;
+
 
   return ;
 } 		// -----  end of method RealSuperLUData::LUstructToPMatrix  ----- 